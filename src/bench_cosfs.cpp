@@ -0,0 +1,360 @@
+/*
+ * s3fs - FUSE-based file system backed by Tencentyun COS
+ *
+ * Copyright 2007-2008 Randy Rizun <rrizun@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+//
+// Benchmark of the requests(S3fsCurl) and the file cache(FdEntity) against
+// a COS server, which is usually test/mock_cos_server.py. The FUSE operations
+// are measured by test/mock-bench.sh on the mounted file system.
+//
+// Usage: bench_cosfs [-u url] [-b bucket] [-a appid] [-t threads] [-n count]
+//                    [-s size] [-o objects] [-p prefix] [-S] [-2] [-k] [-P]
+//                    [operation...]
+//
+// operation is head, get, put, list or fdread(all of them by default).
+// -S prints the statistics(as stats_socket option serves) after all.
+// -2 sends requests by HTTP/2, which is negotiated by TLS for https url, or
+//    is used with prior knowledge for http url(http2=prior_knowledge).
+// -k does not check the server certificate(no_check_certificate).
+// -P uses path style requests(use_path_request_style).
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <curl/curl.h>
+#include <string>
+#include <map>
+#include <list>
+#include <vector>
+#include <algorithm>
+
+#include "common.h"
+#include "s3fs.h"
+#include "curl.h"
+#include "fdcache.h"
+#include "s3fs_util.h"
+#include "string_util.h"
+#include "stats.h"
+
+extern std::string host;
+extern std::string bucket;
+extern std::string appid;
+
+#define BENCH_READ_SIZE         (128 * 1024)
+
+struct bench_opt
+{
+  int         threads;
+  int         count;
+  ssize_t     size;        // size of object for get/put/fdread
+  int         objects;     // count of objects which are populated
+  std::string prefix;
+};
+
+class BenchResult
+{
+  public:
+    BenchResult() : bytes(0), errors(0)
+    {
+      pthread_mutex_init(&lock, NULL);
+    }
+    ~BenchResult()
+    {
+      pthread_mutex_destroy(&lock);
+    }
+
+    void Add(double msec, size_t size, bool is_ok)
+    {
+      AutoLock auto_lock(&lock);
+      latencies.push_back(msec);
+      if(is_ok){
+        bytes += size;
+      }else{
+        errors++;
+      }
+    }
+
+    void Report(const char* name, double elapsed_msec)
+    {
+      std::sort(latencies.begin(), latencies.end());
+      size_t count = latencies.size();
+      double sec   = elapsed_msec / 1000;
+      printf("%-8s n=%-6zu err=%-4d %10.1f ops/s %9.2f MB/s  p50=%.2fms p90=%.2fms p99=%.2fms max=%.2fms\n",
+             name, count, errors, (0 < sec ? count / sec : 0), (0 < sec ? bytes / sec / (1024 * 1024) : 0),
+             Percentile(50), Percentile(90), Percentile(99), (count ? latencies.back() : 0));
+    }
+
+  private:
+    double Percentile(int percent) const
+    {
+      if(latencies.empty()){
+        return 0;
+      }
+      size_t index = (latencies.size() * percent + 99) / 100;
+      return latencies[(0 < index ? index - 1 : 0)];
+    }
+
+    pthread_mutex_t     lock;
+    std::vector<double> latencies;
+    double              bytes;
+    int                 errors;
+};
+
+typedef bool (*bench_func_t)(const bench_opt& opt, int index, int fd, size_t& bytes);
+
+struct bench_thread
+{
+  const bench_opt* opt;
+  bench_func_t     func;
+  BenchResult*     result;
+  int              start;
+  int              step;
+};
+
+static double now_msec(void)
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+}
+
+static std::string object_path(const bench_opt& opt, int index)
+{
+  return "/" + opt.prefix + str(index % opt.objects);
+}
+
+//-------------------------------------------------------------------
+// Operations
+//-------------------------------------------------------------------
+static bool bench_head(const bench_opt& opt, int index, int fd, size_t& bytes)
+{
+  S3fsCurl  s3fscurl;
+  headers_t meta;
+  return 0 == s3fscurl.HeadRequest(object_path(opt, index).c_str(), meta);
+}
+
+static bool bench_get(const bench_opt& opt, int index, int fd, size_t& bytes)
+{
+  S3fsCurl s3fscurl;
+  if(0 != s3fscurl.GetObjectRequest(object_path(opt, index).c_str(), fd, 0, opt.size)){
+    return false;
+  }
+  bytes = opt.size;
+  return true;
+}
+
+static bool bench_put(const bench_opt& opt, int index, int fd, size_t& bytes)
+{
+  S3fsCurl    s3fscurl;
+  headers_t   meta;
+  std::string path = "/" + opt.prefix + "put-" + str(index);
+  meta["Content-Type"] = "application/octet-stream";
+  if(0 != s3fscurl.PutRequest(path.c_str(), meta, fd)){
+    return false;
+  }
+  bytes = opt.size;
+  return true;
+}
+
+static bool bench_list(const bench_opt& opt, int index, int fd, size_t& bytes)
+{
+  S3fsCurl    s3fscurl;
+  std::string query = "delimiter=/&max-keys=1000&prefix=" + opt.prefix;
+  if(0 != s3fscurl.ListBucketRequest("/", query.c_str())){
+    return false;
+  }
+  BodyData* body = s3fscurl.GetBodyData();
+  bytes = (body ? body->size() : 0);
+  return true;
+}
+
+// open the file through the file cache and read it all, as s3fs_open/s3fs_read.
+static bool bench_fdread(const bench_opt& opt, int index, int fd, size_t& bytes)
+{
+  std::string path = object_path(opt, index);
+  headers_t   meta;
+  {
+    S3fsCurl s3fscurl;
+    if(0 != s3fscurl.HeadRequest(path.c_str(), meta)){
+      return false;
+    }
+  }
+  ssize_t   size = static_cast<ssize_t>(s3fs_strtoofft(meta["Content-Length"].c_str()));
+  FdEntity* ent;
+  if(NULL == (ent = FdManager::get()->Open(path.c_str(), &meta, size, -1, false, true))){
+    return false;
+  }
+
+  std::vector<char> buf(BENCH_READ_SIZE);
+  bool              result = true;
+  for(off_t pos = 0; pos < size; ){
+    ssize_t readsize = ent->Read(&buf[0], pos, BENCH_READ_SIZE);
+    if(0 >= readsize){
+      result = (0 == readsize);
+      break;
+    }
+    pos   += readsize;
+    bytes += readsize;
+  }
+  FdManager::get()->Close(ent);
+
+  return result;
+}
+
+//-------------------------------------------------------------------
+// Runner
+//-------------------------------------------------------------------
+static void* bench_worker(void* arg)
+{
+  bench_thread* thread = static_cast<bench_thread*>(arg);
+  const bench_opt& opt = *(thread->opt);
+
+  // file for body of get/put
+  FILE* file = tmpfile();
+  if(!file){
+    return NULL;
+  }
+  int fd = fileno(file);
+  if(0 < opt.size && -1 == ftruncate(fd, opt.size)){
+    fclose(file);
+    return NULL;
+  }
+
+  for(int index = thread->start; index < opt.count; index += thread->step){
+    size_t bytes = 0;
+    double start = now_msec();
+    bool   is_ok = thread->func(opt, index, fd, bytes);
+    thread->result->Add(now_msec() - start, bytes, is_ok);
+  }
+  fclose(file);
+
+  return NULL;
+}
+
+static void run_bench(const char* name, bench_func_t func, const bench_opt& opt)
+{
+  BenchResult                result;
+  std::vector<bench_thread>  threads(opt.threads);
+  std::vector<pthread_t>     tids(opt.threads);
+
+  double start = now_msec();
+  for(int cnt = 0; cnt < opt.threads; cnt++){
+    threads[cnt].opt    = &opt;
+    threads[cnt].func   = func;
+    threads[cnt].result = &result;
+    threads[cnt].start  = cnt;
+    threads[cnt].step   = opt.threads;
+    if(0 != pthread_create(&tids[cnt], NULL, bench_worker, &threads[cnt])){
+      fprintf(stderr, "could not create thread.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for(int cnt = 0; cnt < opt.threads; cnt++){
+    pthread_join(tids[cnt], NULL);
+  }
+  result.Report(name, now_msec() - start);
+}
+
+int TestMain(int argc, char* argv[])
+{
+  bench_opt   opt;
+  std::string url = "http://localhost:8080";
+  int         ch;
+  bool        is_stats = false;
+  bool        is_http2 = false;
+
+  opt.threads = 4;
+  opt.count   = 1000;
+  opt.size    = 64 * 1024;
+  opt.objects = 100;
+  opt.prefix  = "bench/";
+  bucket      = "bench";
+  appid       = "1250000000";
+
+  while(-1 != (ch = getopt(argc, argv, "u:b:a:t:n:s:o:p:S2kP"))){
+    switch(ch){
+      case 'u': url         = optarg; break;
+      case 'b': bucket      = optarg; break;
+      case 'a': appid       = optarg; break;
+      case 't': opt.threads = std::max(atoi(optarg), 1); break;
+      case 'n': opt.count   = atoi(optarg); break;
+      case 's': opt.size    = static_cast<ssize_t>(s3fs_strtoofft(optarg)); break;
+      case 'o': opt.objects = std::max(atoi(optarg), 1); break;
+      case 'p': opt.prefix  = optarg; break;
+      case 'S': is_stats    = true; break;
+      case '2': is_http2    = true; break;
+      case 'k': S3fsCurl::SetCheckCertificate(false); break;
+      case 'P': pathrequeststyle = true; break;
+      default:
+        fprintf(stderr, "Usage: %s [-u url] [-b bucket] [-a appid] [-t threads] [-n count] [-s size] [-o objects] [-p prefix] [-S] [-2] [-k] [-P] [head|get|put|list|fdread...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  host = url;
+  if(is_stats){
+    S3fsStats::Enable();
+  }
+  if(is_http2 && !S3fsCurl::SetHttp2(0 == strncasecmp(url.c_str(), "http://", 7))){
+    return EXIT_FAILURE;
+  }
+
+  if(!S3fsCurl::InitS3fsCurl("/etc/mime.types")){
+    fprintf(stderr, "could not initialize curl.\n");
+    return EXIT_FAILURE;
+  }
+  S3fsCurl::SetPublicBucket(true);
+
+  std::list<std::string> ops;
+  for(int cnt = optind; cnt < argc; cnt++){
+    ops.push_back(argv[cnt]);
+  }
+  if(ops.empty()){
+    const char* all[] = {"head", "get", "put", "list", "fdread"};
+    ops.assign(all, all + sizeof(all) / sizeof(all[0]));
+  }
+
+  printf("url=%s threads=%d count=%d size=%zd objects=%d prefix=%s\n",
+         url.c_str(), opt.threads, opt.count, opt.size, opt.objects, opt.prefix.c_str());
+  for(std::list<std::string>::iterator iter = ops.begin(); iter != ops.end(); ++iter){
+    if(*iter == "head"){
+      run_bench("head", bench_head, opt);
+    }else if(*iter == "get"){
+      run_bench("get", bench_get, opt);
+    }else if(*iter == "put"){
+      run_bench("put", bench_put, opt);
+    }else if(*iter == "list"){
+      run_bench("list", bench_list, opt);
+    }else if(*iter == "fdread"){
+      run_bench("fdread", bench_fdread, opt);
+    }else{
+      fprintf(stderr, "unknown operation: %s\n", iter->c_str());
+    }
+  }
+
+  if(is_stats){
+    printf("%s", S3fsStats::Dump().c_str());
+  }
+  S3fsCurl::DestroyS3fsCurl();
+  return EXIT_SUCCESS;
+}
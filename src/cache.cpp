@@ -19,6 +19,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -31,11 +32,13 @@
 #include <map>
 #include <algorithm>
 #include <list>
+#include <vector>
 
 #include "cache.h"
 #include "s3fs.h"
 #include "s3fs_util.h"
 #include "string_util.h"
+#include "stats.h"
 
 using namespace std;
 
@@ -43,7 +46,43 @@ using namespace std;
 // Static
 //-------------------------------------------------------------------
 StatCache       StatCache::singleton;
-pthread_mutex_t StatCache::stat_cache_lock;
+pthread_mutex_t StatCache::meta_name_lock;
+const char*     StatCache::meta_names[STAT_CACHE_META_NAME_MAX];
+unsigned short  StatCache::meta_name_hash[STAT_CACHE_META_NAME_HASH];
+size_t          StatCache::meta_name_count = 0;
+
+static StatsCounter stats_stat_cache_hits("cosfs_stat_cache_hits_total", "Lookups which are answered by the stat cache.");
+static StatsCounter stats_stat_cache_misses("cosfs_stat_cache_misses_total", "Lookups which are not found in the stat cache.");
+
+//-------------------------------------------------------------------
+// stat_cache_entry
+//-------------------------------------------------------------------
+void stat_cache_entry::SetStat(const struct stat& st)
+{
+  mode   = st.st_mode;
+  uid    = st.st_uid;
+  gid    = st.st_gid;
+  size   = st.st_size;
+  blocks = st.st_blocks;
+  mtime  = st.st_mtime;
+}
+
+void stat_cache_entry::GetStat(struct stat* pst) const
+{
+  if(!pst){
+    return;
+  }
+  // same as convert_header_to_stat
+  memset(pst, 0, sizeof(struct stat));
+  pst->st_nlink   = 1;
+  pst->st_mode    = mode;
+  pst->st_blocks  = blocks;
+  pst->st_blksize = 4096;
+  pst->st_mtime   = mtime;
+  pst->st_size    = size;
+  pst->st_uid     = uid;
+  pst->st_gid     = gid;
+}
 
 //-------------------------------------------------------------------
 // Constructor/Destructor
@@ -51,8 +90,11 @@ pthread_mutex_t StatCache::stat_cache_lock;
 StatCache::StatCache() : IsExpireTime(false), ExpireTime(0), CacheSize(1000), IsCacheNoObject(false)
 {
   if(this == StatCache::getStatCacheData()){
-    stat_cache.clear();
-    pthread_mutex_init(&(StatCache::stat_cache_lock), NULL);
+    for(int cnt = 0; cnt < STAT_CACHE_SHARD_COUNT; cnt++){
+      stat_cache[cnt].cache.clear();
+      pthread_mutex_init(&(stat_cache[cnt].lock), NULL);
+    }
+    pthread_mutex_init(&(StatCache::meta_name_lock), NULL);
   }else{
     assert(false);
   }
@@ -62,7 +104,16 @@ StatCache::~StatCache()
 {
   if(this == StatCache::getStatCacheData()){
     Clear();
-    pthread_mutex_destroy(&(StatCache::stat_cache_lock));
+    for(int cnt = 0; cnt < STAT_CACHE_SHARD_COUNT; cnt++){
+      pthread_mutex_destroy(&(stat_cache[cnt].lock));
+    }
+    pthread_mutex_destroy(&(StatCache::meta_name_lock));
+    for(size_t cnt = 0; cnt < StatCache::meta_name_count; cnt++){
+      free(const_cast<char*>(StatCache::meta_names[cnt]));
+      StatCache::meta_names[cnt] = NULL;
+    }
+    memset(StatCache::meta_name_hash, 0, sizeof(StatCache::meta_name_hash));
+    StatCache::meta_name_count = 0;
   }else{
     assert(false);
   }
@@ -111,18 +162,173 @@ bool StatCache::SetCacheNoObject(bool flag)
   return old;
 }
 
-void StatCache::Clear(void)
+stat_cache_shard& StatCache::GetShard(const char* key)
 {
-  pthread_mutex_lock(&StatCache::stat_cache_lock);
+  return stat_cache[stat_cache_key_hash()(key) % STAT_CACHE_SHARD_COUNT];
+}
+
+// [NOTE]
+// Looks up the name without lock. Returns its id, or 0 and the position
+// of the empty slot in meta_name_hash where the name should be added.
+// The slot is read with acquire ordering, so the name of the id is
+// visible when the id is.
+//
+unsigned short StatCache::FindMetaNameId(const char* name, size_t& pos)
+{
+  for(pos = stat_cache_key_hash()(name) & (STAT_CACHE_META_NAME_HASH - 1); ; pos = (pos + 1) & (STAT_CACHE_META_NAME_HASH - 1)){
+#ifdef __ATOMIC_ACQUIRE
+    unsigned short id = __atomic_load_n(&StatCache::meta_name_hash[pos], __ATOMIC_ACQUIRE);
+#else
+    unsigned short id = *static_cast<volatile unsigned short*>(&StatCache::meta_name_hash[pos]);
+    __sync_synchronize();
+#endif
+    if(0 == id || 0 == strcmp(StatCache::meta_names[id - 1], name)){
+      return id;
+    }
+  }
+}
+
+// [NOTE]
+// Returns the id of interned header name, 0 means the name is not interned
+// because of too many names, then the name is packed with the value.
+//
+unsigned short StatCache::GetMetaNameId(const string& name)
+{
+  size_t         pos;
+  unsigned short id;
+  if(0 != (id = StatCache::FindMetaNameId(name.c_str(), pos))){
+    return id;
+  }
+
+  AutoLock auto_lock(&StatCache::meta_name_lock);
+
+  // another thread may have interned it
+  if(0 != (id = StatCache::FindMetaNameId(name.c_str(), pos))){
+    return id;
+  }
+  if(STAT_CACHE_META_NAME_MAX <= StatCache::meta_name_count){
+    return 0;
+  }
+  char* pname;
+  if(NULL == (pname = strdup(name.c_str()))){
+    return 0;
+  }
+  StatCache::meta_names[StatCache::meta_name_count] = pname;
+  id = static_cast<unsigned short>(++StatCache::meta_name_count);
+
+  // publish the id after the name
+#ifdef __ATOMIC_RELEASE
+  __atomic_store_n(&StatCache::meta_name_hash[pos], id, __ATOMIC_RELEASE);
+#else
+  __sync_synchronize();
+  *static_cast<volatile unsigned short*>(&StatCache::meta_name_hash[pos]) = id;
+#endif
+  return id;
+}
+
+void StatCache::PackMeta(const headers_t& meta, string& data)
+{
+  for(headers_t::const_iterator iter = meta.begin(); iter != meta.end(); ++iter){
+    unsigned short id = StatCache::GetMetaNameId(iter->first);
+    data += static_cast<char>((id >> 8) & 0xFF);
+    data += static_cast<char>(id & 0xFF);
+    if(0 == id){
+      data += iter->first;
+      data += '\0';
+    }
+    data += iter->second;
+    data += '\0';
+  }
+}
 
-  for(stat_cache_t::iterator iter = stat_cache.begin(); iter != stat_cache.end(); stat_cache.erase(iter++)){
-    if((*iter).second){
-      delete (*iter).second;
+// [NOTE]
+// If name is specified, only the header of name is unpacked.
+//
+void StatCache::UnpackMeta(const stat_cache_entry* ent, headers_t& meta, const char* name)
+{
+  const char* pos = ent->data.c_str() + strlen(ent->data.c_str()) + 1;   // skip path
+  const char* end = ent->data.c_str() + ent->data.length();
+
+  // [NOTE]
+  // The ids in the entry were published before the entry was added under
+  // the shard lock, so the names are read without meta_name_lock.
+  while(pos + 2 <= end){
+    unsigned short id = static_cast<unsigned short>((static_cast<unsigned char>(pos[0]) << 8) | static_cast<unsigned char>(pos[1]));
+    pos += 2;
+
+    const char* pname;
+    if(0 == id){
+      pname = pos;
+      pos  += strlen(pos) + 1;
+    }else if(id <= STAT_CACHE_META_NAME_MAX && StatCache::meta_names[id - 1]){
+      pname = StatCache::meta_names[id - 1];
+    }else{
+      break;
+    }
+    if(end < pos){
+      break;
+    }
+    if(!name || 0 == strcmp(name, pname)){
+      meta[pname] = pos;
     }
+    pos += strlen(pos) + 1;
+  }
+}
+
+void StatCache::LruUnlink(stat_cache_shard& shard, stat_cache_entry* ent)
+{
+  if(ent->lru_prev){
+    ent->lru_prev->lru_next = ent->lru_next;
+  }else{
+    shard.lru_head = ent->lru_next;
+  }
+  if(ent->lru_next){
+    ent->lru_next->lru_prev = ent->lru_prev;
+  }else{
+    shard.lru_tail = ent->lru_prev;
   }
-  S3FS_MALLOCTRIM(0);
+  ent->lru_prev = NULL;
+  ent->lru_next = NULL;
+}
 
-  pthread_mutex_unlock(&StatCache::stat_cache_lock);
+void StatCache::LruPushFront(stat_cache_shard& shard, stat_cache_entry* ent)
+{
+  ent->lru_prev = NULL;
+  ent->lru_next = shard.lru_head;
+  if(shard.lru_head){
+    shard.lru_head->lru_prev = ent;
+  }else{
+    shard.lru_tail = ent;
+  }
+  shard.lru_head = ent;
+}
+
+void StatCache::EraseEntry(stat_cache_shard& shard, stat_cache_t::iterator iter)
+{
+  // [NOTE] the key is in the entry, so erase it from map before deleting.
+  stat_cache_entry* ent = (*iter).second;
+  shard.cache.erase(iter);
+  if(ent){
+    LruUnlink(shard, ent);
+    delete ent;
+  }
+}
+
+void StatCache::Clear(void)
+{
+  for(int cnt = 0; cnt < STAT_CACHE_SHARD_COUNT; cnt++){
+    AutoLock auto_lock(&(stat_cache[cnt].lock));
+
+    for(stat_cache_t::iterator iter = stat_cache[cnt].cache.begin(); iter != stat_cache[cnt].cache.end(); ++iter){
+      if((*iter).second){
+        delete (*iter).second;
+      }
+    }
+    stat_cache[cnt].cache.clear();
+    stat_cache[cnt].lru_head = NULL;
+    stat_cache[cnt].lru_tail = NULL;
+  }
+  MallocTrimmer::Request();
 }
 
 bool StatCache::GetStat(string& key, struct stat* pst, headers_t* meta, bool overcheck, const char* petag, bool* pisforce)
@@ -130,58 +336,77 @@ bool StatCache::GetStat(string& key, struct stat* pst, headers_t* meta, bool ove
   bool is_delete_cache = false;
   string strpath = key;
 
-  pthread_mutex_lock(&StatCache::stat_cache_lock);
-
-  stat_cache_t::iterator iter = stat_cache.end();
+  // [NOTE]
+  // "path/" and "path" may be in different shards, then check "path/" first.
   if(overcheck && '/' != strpath[strpath.length() - 1]){
     strpath += "/";
-    iter = stat_cache.find(strpath.c_str());
-  }
-  if(iter == stat_cache.end()){
-    strpath = key;
-    iter = stat_cache.find(strpath.c_str());
+    stat_cache_shard& shard = GetShard(strpath);
+    AutoLock auto_lock(&(shard.lock));
+    if(shard.cache.end() == shard.cache.find(strpath.c_str())){
+      strpath = key;
+    }
   }
 
-  if(iter != stat_cache.end() && (*iter).second){
+  stat_cache_shard& shard = GetShard(strpath);
+  pthread_mutex_lock(&(shard.lock));
+
+  stat_cache_t::iterator iter = shard.cache.find(strpath.c_str());
+  if(iter != shard.cache.end() && (*iter).second){
     stat_cache_entry* ent = (*iter).second;
     if(!IsExpireTime|| (ent->cache_date + ExpireTime) >= time(NULL)){
       if(ent->noobjcache){
-        pthread_mutex_unlock(&StatCache::stat_cache_lock);
+        pthread_mutex_unlock(&(shard.lock));
         if(!IsCacheNoObject){
           // need to delete this cache.
           DelStat(strpath);
+          stats_stat_cache_misses.Add();
         }else{
           // noobjcache = true means no object.
+          stats_stat_cache_hits.Add();
         }
         return false;
       }
+      if(ent->islisted && meta){
+        // made from listing, so it does not have headers which caller needs.
+        S3FS_PRN_DBG("stat cache not hit by no headers in listing[path=%s]", strpath.c_str());
+        pthread_mutex_unlock(&(shard.lock));
+        stats_stat_cache_misses.Add();
+        return false;
+      }
       // hit without checking etag
+      string stretag;
       if(petag){
-        string stretag = ent->meta["ETag"];
+        headers_t etagmeta;
+        StatCache::UnpackMeta(ent, etagmeta, "ETag");
+        stretag = etagmeta["ETag"];
         if('\0' != petag[0] && 0 != strcmp(petag, stretag.c_str())){
           is_delete_cache = true;
         }
       }
       if(is_delete_cache){
         // not hit by different ETag
-        S3FS_PRN_DBG("stat cache not hit by ETag[path=%s][time=%jd][hit count=%lu][ETag(%s)!=(%s)]",
-          strpath.c_str(), (intmax_t)(ent->cache_date), ent->hit_count, petag ? petag : "null", ent->meta["ETag"].c_str());
+        S3FS_PRN_DBG("stat cache not hit by ETag[path=%s][time=%jd][hit count=%u][ETag(%s)!=(%s)]",
+          strpath.c_str(), (intmax_t)(ent->cache_date), ent->hit_count, petag ? petag : "null", stretag.c_str());
       }else{
         // hit 
-        S3FS_PRN_DBG("stat cache hit [path=%s][time=%jd][hit count=%lu]", strpath.c_str(), (intmax_t)(ent->cache_date), ent->hit_count);
+        S3FS_PRN_DBG("stat cache hit [path=%s][time=%jd][hit count=%u]", strpath.c_str(), (intmax_t)(ent->cache_date), ent->hit_count);
 
         if(pst!= NULL){
-          *pst= ent->stbuf;
+          ent->GetStat(pst);
         }
         if(meta != NULL){
-          *meta = ent->meta;
+          meta->clear();
+          StatCache::UnpackMeta(ent, *meta);
         }
         if(pisforce != NULL){
           (*pisforce) = ent->isforce;
         }
         ent->hit_count++;
         ent->cache_date = time(NULL);
-        pthread_mutex_unlock(&StatCache::stat_cache_lock);
+        LruUnlink(shard, ent);
+        LruPushFront(shard, ent);
+        pthread_mutex_unlock(&(shard.lock));
+        stats_stat_cache_hits.Add();
         return true;
       }
 
@@ -190,7 +415,8 @@ bool StatCache::GetStat(string& key, struct stat* pst, headers_t* meta, bool ove
       is_delete_cache = true;
     }
   }
-  pthread_mutex_unlock(&StatCache::stat_cache_lock);
+  pthread_mutex_unlock(&(shard.lock));
+  stats_stat_cache_misses.Add();
 
   if(is_delete_cache){
     DelStat(strpath);
@@ -207,24 +433,27 @@ bool StatCache::IsNoObjectCache(string& key, bool overcheck)
     return false;
   }
 
-  pthread_mutex_lock(&StatCache::stat_cache_lock);
-
-  stat_cache_t::iterator iter = stat_cache.end();
   if(overcheck && '/' != strpath[strpath.length() - 1]){
     strpath += "/";
-    iter = stat_cache.find(strpath.c_str());
-  }
-  if(iter == stat_cache.end()){
-    strpath = key;
-    iter = stat_cache.find(strpath.c_str());
+    stat_cache_shard& shard = GetShard(strpath);
+    AutoLock auto_lock(&(shard.lock));
+    if(shard.cache.end() == shard.cache.find(strpath.c_str())){
+      strpath = key;
+    }
   }
 
-  if(iter != stat_cache.end() && (*iter).second) {
+  stat_cache_shard& shard = GetShard(strpath);
+  pthread_mutex_lock(&(shard.lock));
+
+  stat_cache_t::iterator iter = shard.cache.find(strpath.c_str());
+  if(iter != shard.cache.end() && (*iter).second) {
     if(!IsExpireTime|| ((*iter).second->cache_date + ExpireTime) >= time(NULL)){
       if((*iter).second->noobjcache){
         // noobjcache = true means no object.
         (*iter).second->cache_date = time(NULL);
-        pthread_mutex_unlock(&StatCache::stat_cache_lock);
+        LruUnlink(shard, (*iter).second);
+        LruPushFront(shard, (*iter).second);
+        pthread_mutex_unlock(&(shard.lock));
         return true;
       }
     }else{
@@ -232,7 +461,7 @@ bool StatCache::IsNoObjectCache(string& key, bool overcheck)
       is_delete_cache = true;
     }
   }
-  pthread_mutex_unlock(&StatCache::stat_cache_lock);
+  pthread_mutex_unlock(&(shard.lock));
 
   if(is_delete_cache){
     DelStat(strpath);
@@ -240,6 +469,26 @@ bool StatCache::IsNoObjectCache(string& key, bool overcheck)
   return false;
 }
 
+// [NOTE]
+// Adds new entry to the shard, and truncates the least recently used
+// entries of the shard if it is over the limit.
+//
+bool StatCache::AddEntry(string& key, stat_cache_entry* ent)
+{
+  stat_cache_shard& shard = GetShard(key);
+  AutoLock auto_lock(&(shard.lock));
+
+  stat_cache_t::iterator iter = shard.cache.find(key.c_str());
+  if(shard.cache.end() != iter){
+    // added by other thread
+    EraseEntry(shard, iter);
+  }
+  shard.cache.insert(stat_cache_t::value_type(ent->key(), ent));
+  LruPushFront(shard, ent);
+
+  return TruncateCache(shard);
+}
+
 bool StatCache::AddStat(std::string& key, headers_t& meta, bool forcedir)
 {
   if(CacheSize< 1){
@@ -247,74 +496,111 @@ bool StatCache::AddStat(std::string& key, headers_t& meta, bool forcedir)
   }
   S3FS_PRN_INFO3("add stat cache entry[path=%s]", key.c_str());
 
-  pthread_mutex_lock(&StatCache::stat_cache_lock);
-
-  bool found = stat_cache.end() != stat_cache.find(key);
-  bool do_truncate = stat_cache.size() > CacheSize;
-
-  pthread_mutex_unlock(&StatCache::stat_cache_lock);
-
+  bool found;
+  {
+    stat_cache_shard& shard = GetShard(key);
+    AutoLock auto_lock(&(shard.lock));
+    found = shard.cache.end() != shard.cache.find(key.c_str());
+  }
   if(found){
     DelStat(key.c_str());
-  }else{
-    if(do_truncate){
-      if(!TruncateCache()){
-        return false;
-      }
-    }
   }
 
   // make new
-  stat_cache_entry* ent = new stat_cache_entry();
-  if(!convert_header_to_stat(key.c_str(), meta, &(ent->stbuf), forcedir)){
-    delete ent;
+  struct stat st;
+  if(!convert_header_to_stat(key.c_str(), meta, &st, forcedir)){
     return false;
   }
+  stat_cache_entry* ent = new stat_cache_entry();
+  ent->SetStat(st);
   ent->hit_count  = 0;
   ent->cache_date = time(NULL); // Set time.
   ent->isforce    = forcedir;
   ent->noobjcache = false;
-  ent->meta.clear();
   //copy only some keys
+  headers_t cachemeta;
   for(headers_t::iterator iter = meta.begin(); iter != meta.end(); ++iter){
     string tag   = lower(iter->first);
     string value = iter->second;
     if(tag == "content-type"){
-      ent->meta[iter->first] = value;
+      cachemeta[iter->first] = value;
     }else if(tag == "content-length"){
-      ent->meta[iter->first] = value;
+      cachemeta[iter->first] = value;
     }else if(tag == "etag"){
-      ent->meta[iter->first] = value;
+      cachemeta[iter->first] = value;
     }else if(tag == "last-modified"){
-      ent->meta[iter->first] = value;
+      cachemeta[iter->first] = value;
     }else if(tag.substr(0, 5) == "x-cos"){
-      ent->meta[tag] = value;		// key is lower case for "x-cos"
+      cachemeta[tag] = value;		// key is lower case for "x-cos"
     }
   }
+  ent->data.assign(key.c_str(), key.length() + 1);    // with '\0'
+  StatCache::PackMeta(cachemeta, ent->data);
   // add
-  pthread_mutex_lock(&StatCache::stat_cache_lock);
-  stat_cache[key] = ent;
-  pthread_mutex_unlock(&StatCache::stat_cache_lock);
+  return AddEntry(key, ent);
+}
 
-  return true;
+//
+// Add the entry made from the listing(ListBucket) without head request.
+// The entry is used for stat only, and GetStat with meta does not hit it.
+//
+bool StatCache::AddListStat(std::string& key, off_t size, time_t mtime, const char* etag)
+{
+  if(CacheSize< 1){
+    return true;
+  }
+  S3FS_PRN_INFO3("add stat cache entry from listing[path=%s]", key.c_str());
+
+  bool found;
+  {
+    stat_cache_shard& shard = GetShard(key);
+    AutoLock auto_lock(&(shard.lock));
+    found = shard.cache.end() != shard.cache.find(key.c_str());
+  }
+  if(found){
+    DelStat(key.c_str());
+  }
+
+  // make new
+  headers_t meta;
+  meta["Content-Length"] = str(size);
+  if(etag && '\0' != etag[0]){
+    meta["ETag"] = etag;
+  }
+  struct stat st;
+  if(!convert_header_to_stat(key.c_str(), meta, &st, false)){
+    return false;
+  }
+  st.st_mtime  = mtime;
+  st.st_blocks = get_blocks(size);
+
+  stat_cache_entry* ent = new stat_cache_entry();
+  ent->SetStat(st);
+  ent->hit_count  = 0;
+  ent->cache_date = time(NULL); // Set time.
+  ent->isforce    = false;
+  ent->noobjcache = false;
+  ent->islisted   = true;
+  ent->data.assign(key.c_str(), key.length() + 1);    // with '\0'
+  StatCache::PackMeta(meta, ent->data);
+  // add
+  return AddEntry(key, ent);
 }
 
 bool StatCache::IncSize(const std::string& key, ssize_t sz)
 {
-	pthread_mutex_lock(&StatCache::stat_cache_lock);
+	stat_cache_shard& shard = GetShard(key);
+	AutoLock auto_lock(&(shard.lock));
 
-	stat_cache_t::iterator iter = stat_cache.find(key);
-	bool found = iter != stat_cache.end();
+	stat_cache_t::iterator iter = shard.cache.find(key.c_str());
+	bool found = iter != shard.cache.end();
 	if (found) {
 		stat_cache_entry* entry = iter->second;
-		entry->stbuf.st_size += sz;
+		entry->size += sz;
 		S3FS_PRN_INFO3(
 				"Update file size in stat cache. [path=%s][size=%ld][delta=%ld]", 
-				key.c_str(), entry->stbuf.st_size, sz);
+				key.c_str(), entry->size, sz);
 	}
-
-	pthread_mutex_unlock(&StatCache::stat_cache_lock);
-
 	return found;
 }
 
@@ -328,71 +614,50 @@ bool StatCache::AddNoObjectCache(string& key)
   }
   S3FS_PRN_INFO3("add no object cache entry[path=%s]", key.c_str());
 
-  pthread_mutex_lock(&StatCache::stat_cache_lock);
-
-  bool found = stat_cache.end() != stat_cache.find(key);
-  bool do_truncate = stat_cache.size() > CacheSize;
-
-  pthread_mutex_unlock(&StatCache::stat_cache_lock);
-
+  bool found;
+  {
+    stat_cache_shard& shard = GetShard(key);
+    AutoLock auto_lock(&(shard.lock));
+    found = shard.cache.end() != shard.cache.find(key.c_str());
+  }
   if(found){
     DelStat(key.c_str());
-  }else{
-    if(do_truncate){
-      if(!TruncateCache()){
-        return false;
-      }
-    }
   }
 
   // make new
   stat_cache_entry* ent = new stat_cache_entry();
-  memset(&(ent->stbuf), 0, sizeof(struct stat));
   ent->hit_count  = 0;
   ent->cache_date = time(NULL); // Set time.
   ent->isforce    = false;
   ent->noobjcache = true;
-  ent->meta.clear();
+  ent->data.assign(key.c_str(), key.length() + 1);    // with '\0'
   // add
-  pthread_mutex_lock(&StatCache::stat_cache_lock);
-  stat_cache[key] = ent;
-  pthread_mutex_unlock(&StatCache::stat_cache_lock);
-
-  return true;
+  return AddEntry(key, ent);
 }
 
-bool StatCache::TruncateCache(void)
+// [NOTE]
+// Each shard keeps CacheSize / STAT_CACHE_SHARD_COUNT entries, and the
+// least recently used entries are removed from the tail of LRU list.
+// Need to lock shard before calling.
+//
+bool StatCache::TruncateCache(stat_cache_shard& shard)
 {
-  pthread_mutex_lock(&StatCache::stat_cache_lock);
+  unsigned long shard_size = max(CacheSize / STAT_CACHE_SHARD_COUNT, 1UL);
+  bool          is_trim    = false;
 
-  if(stat_cache.empty()){
-    pthread_mutex_unlock(&StatCache::stat_cache_lock);
-    return true;
-  }
+  while(shard_size < shard.cache.size() && shard.lru_tail){
+    S3FS_PRN_DBG("truncate stat cache[path=%s]", shard.lru_tail->key());
 
-  time_t lowest_time = time(NULL) + 1;
-  stat_cache_t::iterator iter_to_delete = stat_cache.end();
-  stat_cache_t::iterator iter;
-
-  for(iter = stat_cache.begin(); iter != stat_cache.end(); ++iter) {
-    if((*iter).second){
-      if(lowest_time > (*iter).second->cache_date){
-        lowest_time    = (*iter).second->cache_date;
-        iter_to_delete = iter;
-      }
+    stat_cache_t::iterator iter = shard.cache.find(shard.lru_tail->key());
+    if(shard.cache.end() == iter){
+      break;
     }
+    EraseEntry(shard, iter);
+    is_trim = true;
   }
-  if(stat_cache.end() != iter_to_delete){
-    S3FS_PRN_DBG("truncate stat cache[path=%s]", (*iter_to_delete).first.c_str());
-    if((*iter_to_delete).second){
-      delete (*iter_to_delete).second;
-    }
-    stat_cache.erase(iter_to_delete);
-    S3FS_MALLOCTRIM(0);
+  if(is_trim){
+    MallocTrimmer::Request();
   }
-
-  pthread_mutex_unlock(&StatCache::stat_cache_lock);
-
   return true;
 }
 
@@ -403,14 +668,14 @@ bool StatCache::DelStat(const char* key)
   }
   S3FS_PRN_INFO3("delete stat cache entry[path=%s]", key);
 
-  pthread_mutex_lock(&StatCache::stat_cache_lock);
-
-  stat_cache_t::iterator iter;
-  if(stat_cache.end() != (iter = stat_cache.find(string(key)))){
-    if((*iter).second){
-      delete (*iter).second;
+  {
+    string                 strpath = key;
+    stat_cache_shard&      shard   = GetShard(strpath);
+    AutoLock               auto_lock(&(shard.lock));
+    stat_cache_t::iterator iter;
+    if(shard.cache.end() != (iter = shard.cache.find(strpath.c_str()))){
+      EraseEntry(shard, iter);
     }
-    stat_cache.erase(iter);
   }
   if(0 < strlen(key) && 0 != strcmp(key, "/")){
     string strpath = key;
@@ -421,16 +686,13 @@ bool StatCache::DelStat(const char* key)
       // If there is "path/" cache, delete it.
       strpath += "/";
     }
-    if(stat_cache.end() != (iter = stat_cache.find(strpath.c_str()))){
-      if((*iter).second){
-        delete (*iter).second;
-      }
-      stat_cache.erase(iter);
+    stat_cache_shard&      shard = GetShard(strpath);
+    AutoLock               auto_lock(&(shard.lock));
+    stat_cache_t::iterator iter;
+    if(shard.cache.end() != (iter = shard.cache.find(strpath.c_str()))){
+      EraseEntry(shard, iter);
     }
   }
-  S3FS_MALLOCTRIM(0);
-
-  pthread_mutex_unlock(&StatCache::stat_cache_lock);
 
   return true;
 }
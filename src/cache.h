@@ -20,26 +20,92 @@
 #ifndef S3FS_CACHE_H_
 #define S3FS_CACHE_H_
 
+#include <map>
+#include <vector>
+
 #include "common.h"
 
 //
 // Struct
 //
+// [NOTE]
+// The entry is compact for caching many paths. It keeps only the fields of
+// struct stat which convert_header_to_stat sets, and the path and headers
+// are packed in one string(data) as below:
+//   <path> '\0' { <name id(2 bytes)> <value> '\0' }...
+// The header names are interned in StatCache, so each header costs only
+// 3 bytes over its value. The key of stat_cache_t points to the path in
+// data, so the path is not stored twice.
+//
 struct stat_cache_entry {
-  struct stat   stbuf;
-  unsigned long hit_count;
-  time_t        cache_date;
-  headers_t     meta;
-  bool          isforce;
-  bool          noobjcache;  // Flag: cache is no object for no listing.
-
-  stat_cache_entry() : hit_count(0), cache_date(0), isforce(false), noobjcache(false) {
-    memset(&stbuf, 0, sizeof(struct stat));
-    meta.clear();
+  std::string       data;        // path and packed headers
+  stat_cache_entry* lru_prev;
+  stat_cache_entry* lru_next;
+  time_t            cache_date;
+  time_t            mtime;
+  off_t             size;
+  blkcnt_t          blocks;
+  mode_t            mode;
+  uid_t             uid;
+  gid_t             gid;
+  unsigned int      hit_count;
+  bool              isforce;
+  bool              noobjcache;  // Flag: cache is no object for no listing.
+  bool              islisted;    // Flag: made from listing, which does not have x-cos-meta headers.
+
+  stat_cache_entry() : lru_prev(NULL), lru_next(NULL), cache_date(0), mtime(0), size(0), blocks(0), mode(0), uid(0), gid(0),
+                       hit_count(0), isforce(false), noobjcache(false), islisted(false) {}
+
+  const char* key(void) const { return data.c_str(); }
+  void SetStat(const struct stat& st);
+  void GetStat(struct stat* pst) const;
+};
+
+struct stat_cache_key_hash {
+  size_t operator()(const char* key) const {
+    // FNV-1a
+    size_t hash = 2166136261U;
+    for(; key && *key; ++key){
+      hash = (hash ^ static_cast<unsigned char>(*key)) * 16777619U;
+    }
+    return hash;
   }
 };
 
-typedef std::map<std::string, stat_cache_entry*> stat_cache_t; // key=path
+struct stat_cache_key_equal {
+  bool operator()(const char* key1, const char* key2) const {
+    return (0 == strcmp(key1, key2));
+  }
+};
+
+typedef S3FS_HASH_MAP<const char*, stat_cache_entry*, stat_cache_key_hash, stat_cache_key_equal> stat_cache_t; // key=path(in entry)
+
+//
+// Stat cache is divided into shards by hash of path, and each shard has
+// own lock and LRU list(head is the most recently used), so that lookup,
+// insert and truncate are O(1) and do not lock whole cache.
+//
+#define STAT_CACHE_SHARD_COUNT  16
+
+struct stat_cache_shard {
+  pthread_mutex_t   lock;
+  stat_cache_t      cache;
+  stat_cache_entry* lru_head;
+  stat_cache_entry* lru_tail;
+
+  stat_cache_shard() : lru_head(NULL), lru_tail(NULL) {}
+};
+
+//
+// Interned header names
+//
+// The names are in the fixed size table, and each entry is never changed
+// after it is published, so the names are looked up without any lock.
+// meta_name_lock is taken only for interning a new name. The names over
+// STAT_CACHE_META_NAME_MAX are not interned(packed with the values).
+//
+#define STAT_CACHE_META_NAME_MAX    1024
+#define STAT_CACHE_META_NAME_HASH   (STAT_CACHE_META_NAME_MAX * 2)    // must be power of 2
 
 //
 // Class
@@ -48,8 +114,11 @@ class StatCache
 {
   private:
     static StatCache       singleton;
-    static pthread_mutex_t stat_cache_lock;
-    stat_cache_t  stat_cache;
+    static pthread_mutex_t meta_name_lock;
+    static const char*     meta_names[STAT_CACHE_META_NAME_MAX];      // interned header names, id is index + 1
+    static unsigned short  meta_name_hash[STAT_CACHE_META_NAME_HASH]; // ids by hash of name(open addressing), 0 is empty
+    static size_t          meta_name_count;
+    stat_cache_shard stat_cache[STAT_CACHE_SHARD_COUNT];
     bool          IsExpireTime;
     time_t        ExpireTime;
     unsigned long CacheSize;
@@ -58,8 +127,20 @@ class StatCache
   private:
     void Clear(void);
     bool GetStat(std::string& key, struct stat* pst, headers_t* meta, bool overcheck, const char* petag, bool* pisforce);
+    stat_cache_shard& GetShard(const std::string& key) { return GetShard(key.c_str()); }
+    stat_cache_shard& GetShard(const char* key);
+    // Packed headers
+    static unsigned short GetMetaNameId(const std::string& name);
+    static unsigned short FindMetaNameId(const char* name, size_t& pos);
+    static void PackMeta(const headers_t& meta, std::string& data);
+    static void UnpackMeta(const stat_cache_entry* ent, headers_t& meta, const char* name = NULL);
+    bool AddEntry(std::string& key, stat_cache_entry* ent);
+    // LRU list of shard([NOTE] need to lock shard before calling)
+    static void LruUnlink(stat_cache_shard& shard, stat_cache_entry* ent);
+    static void LruPushFront(stat_cache_shard& shard, stat_cache_entry* ent);
+    static void EraseEntry(stat_cache_shard& shard, stat_cache_t::iterator iter);
     // Truncate stat cache
-    bool TruncateCache(void);
+    bool TruncateCache(stat_cache_shard& shard);
 
   public:
     StatCache();
@@ -110,6 +191,7 @@ class StatCache
 
     // Add stat cache
     bool AddStat(std::string& key, headers_t& meta, bool forcedir = false);
+    bool AddListStat(std::string& key, off_t size, time_t mtime, const char* etag);
 
 	bool IncSize(const std::string& key, ssize_t sz);
 
@@ -26,6 +26,14 @@
 #include <sys/syscall.h>
 #include "../config.h"
 
+#if __cplusplus >= 201103L
+#include <unordered_map>
+#define S3FS_HASH_MAP   std::unordered_map
+#else
+#include <tr1/unordered_map>
+#define S3FS_HASH_MAP   std::tr1::unordered_map
+#endif
+
 //
 // Macro
 //
@@ -45,11 +53,24 @@ enum s3fs_log_level{
 //
 // Debug macros
 //
+// [NOTE]
+// The messages under S3FS_LOG_COMPILED_LEVEL(--with-log-level option of
+// configure) are stripped at compile time, then their arguments are not
+// evaluated either. The others are checked with debug_level at runtime,
+// and their arguments are evaluated only when they are printed.
+//
+#ifndef S3FS_LOG_COMPILED_LEVEL
+#define S3FS_LOG_COMPILED_LEVEL  S3FS_LOG_DBG
+#endif
+#define S3FS_LOG_IS_COMPILED(level)  (level == (level & S3FS_LOG_COMPILED_LEVEL))
+
 #define IS_S3FS_LOG_CRIT()   (S3FS_LOG_CRIT == debug_level)
-#define IS_S3FS_LOG_ERR()    (S3FS_LOG_ERR  == (debug_level & S3FS_LOG_DBG))
-#define IS_S3FS_LOG_WARN()   (S3FS_LOG_WARN == (debug_level & S3FS_LOG_DBG))
-#define IS_S3FS_LOG_INFO()   (S3FS_LOG_INFO == (debug_level & S3FS_LOG_DBG))
-#define IS_S3FS_LOG_DBG()    (S3FS_LOG_DBG  == (debug_level & S3FS_LOG_DBG))
+#define IS_S3FS_LOG_ERR()    (S3FS_LOG_IS_COMPILED(S3FS_LOG_ERR)  && S3FS_LOG_ERR  == (debug_level & S3FS_LOG_DBG))
+#define IS_S3FS_LOG_WARN()   (S3FS_LOG_IS_COMPILED(S3FS_LOG_WARN) && S3FS_LOG_WARN == (debug_level & S3FS_LOG_DBG))
+#define IS_S3FS_LOG_INFO()   (S3FS_LOG_IS_COMPILED(S3FS_LOG_INFO) && S3FS_LOG_INFO == (debug_level & S3FS_LOG_DBG))
+#define IS_S3FS_LOG_DBG()    (S3FS_LOG_IS_COMPILED(S3FS_LOG_DBG)  && S3FS_LOG_DBG  == (debug_level & S3FS_LOG_DBG))
+#define IS_S3FS_LOG_LEVEL(level) \
+       (S3FS_LOG_CRIT == level || (S3FS_LOG_IS_COMPILED(level) && S3FS_LOG_CRIT != debug_level && level == (debug_level & level)))
 
 #define S3FS_LOG_LEVEL_TO_SYSLOG(level) \
         ( S3FS_LOG_DBG  == (level & S3FS_LOG_DBG) ? LOG_DEBUG   : \
@@ -67,20 +88,20 @@ enum s3fs_log_level{
 #define S3FS_LOG_NEST(nest)  (nest < S3FS_LOG_NEST_MAX ? s3fs_log_nest[nest] : s3fs_log_nest[S3FS_LOG_NEST_MAX - 1])
 
 #define S3FS_LOW_LOGPRN(level, fmt, ...) \
-       if(S3FS_LOG_CRIT == level || (S3FS_LOG_CRIT != debug_level && level == (debug_level & level))){ \
+       if(IS_S3FS_LOG_LEVEL(level)){ \
          if(foreground){ \
            fprintf(stdout, "%s%s:%s(%d): " fmt "%s\n", S3FS_LOG_LEVEL_STRING(level), __FILE__, __func__, __LINE__, __VA_ARGS__); \
          }else{ \
-           syslog(S3FS_LOG_LEVEL_TO_SYSLOG(level), "[tid:%ld]%s:%s(%d): " fmt "%s", syscall(SYS_gettid), __FILE__, __func__, __LINE__, __VA_ARGS__); \
+           s3fs_syslog(S3FS_LOG_LEVEL_TO_SYSLOG(level), "[tid:%ld]%s:%s(%d): " fmt "%s", syscall(SYS_gettid), __FILE__, __func__, __LINE__, __VA_ARGS__); \
          } \
        }
 
 #define S3FS_LOW_LOGPRN2(level, nest, fmt, ...) \
-       if(S3FS_LOG_CRIT == level || (S3FS_LOG_CRIT != debug_level && level == (debug_level & level))){ \
+       if(IS_S3FS_LOG_LEVEL(level)){ \
          if(foreground){ \
            fprintf(stdout, "%s%s%s:%s(%d): " fmt "%s\n", S3FS_LOG_LEVEL_STRING(level), S3FS_LOG_NEST(nest), __FILE__, __func__, __LINE__, __VA_ARGS__); \
          }else{ \
-           syslog(S3FS_LOG_LEVEL_TO_SYSLOG(level), "[tid:%ld]%s%s%s:%s(%d): " fmt "%s\n", syscall(SYS_gettid), S3FS_LOG_LEVEL_STRING(level), S3FS_LOG_NEST(nest), __FILE__, __func__, __LINE__, __VA_ARGS__); \
+           s3fs_syslog(S3FS_LOG_LEVEL_TO_SYSLOG(level), "[tid:%ld]%s%s%s:%s(%d): " fmt "%s\n", syscall(SYS_gettid), S3FS_LOG_LEVEL_STRING(level), S3FS_LOG_NEST(nest), __FILE__, __func__, __LINE__, __VA_ARGS__); \
          } \
        }
 
@@ -149,6 +170,16 @@ extern s3fs_log_level debug_level;
 extern const char*    s3fs_log_nest[S3FS_LOG_NEST_MAX];
 extern mode_t gDefaultPermission;
 
+//
+// Global functions
+//
+// syslog through the ring buffer of S3fsLog(s3fs_util.cpp)
+void s3fs_syslog(int priority, const char* format, ...)
+#if defined(__GNUC__)
+  __attribute__((format(printf, 2, 3)))
+#endif
+  ;
+
 #endif // S3FS_COMMON_H_
 
 /*
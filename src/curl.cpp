@@ -50,6 +50,7 @@
 #include "s3fs_util.h"
 #include "s3fs_auth.h"
 #include "fdcache.h"
+#include "stats.h"
 
 using namespace std;
 
@@ -212,7 +213,7 @@ bool CurlHandlerPool::Init()
   }
 
   mHandlers = new CURL*[mMaxHandlers](); // this will init the array to 0
-  for (int i = 0; i < mMaxHandlers; ++i, ++mIndex) {
+  for (int i = 0; i < mMaxHandlers; ++i, ++mIndex, ++mCount) {
     mHandlers[i] = curl_easy_init();
     if (!mHandlers[i]) {
       S3FS_PRN_ERR("Init curl handlers pool failed");
@@ -228,10 +229,14 @@ bool CurlHandlerPool::Destroy()
 {
   assert(mIndex >= -1 && mIndex < mMaxHandlers);
 
+  LogStats();
+
   for (int i = 0; i <= mIndex; ++i) {
     curl_easy_cleanup(mHandlers[i]);
   }
   delete[] mHandlers;
+  mHandlers = NULL;
+  mIndex    = -1;
 
   if (0 != pthread_mutex_destroy(&mLock)) {
     S3FS_PRN_ERR("Destroy curl handlers lock failed");
@@ -247,16 +252,32 @@ CURL* CurlHandlerPool::GetHandler()
 
   assert(mIndex >= -1 && mIndex < mMaxHandlers);
 
+  bool isOverflow = false;
   pthread_mutex_lock(&mLock);
   if (mIndex >= 0) {
     S3FS_PRN_DBG("Get handler from pool: %d", mIndex);
     h = mHandlers[mIndex--];
+  } else if (mCount < mMaxHandlers) {
+    ++mCount;
+  } else {
+    isOverflow = true;
+    ++mOverflows;
   }
   pthread_mutex_unlock(&mLock);
 
   if (!h) {
-    S3FS_PRN_INFO("Pool empty: create new handler");
+    S3FS_PRN_INFO("Pool empty: create new %shandler", (isOverflow ? "overflow " : ""));
     h = curl_easy_init();
+
+    pthread_mutex_lock(&mLock);
+    if (!h) {
+      if (!isOverflow) {
+        --mCount;
+      }
+    } else if (isOverflow) {
+      mOverflowHandles.insert(h);
+    }
+    pthread_mutex_unlock(&mLock);
   }
 
   return h;
@@ -269,10 +290,14 @@ void CurlHandlerPool::ReturnHandler(CURL* h)
   assert(mIndex >= -1 && mIndex < mMaxHandlers);
 
   pthread_mutex_lock(&mLock);
-  if (mIndex < mMaxHandlers - 1) {
+  if (mOverflowHandles.end() != mOverflowHandles.find(h)) {
+    mOverflowHandles.erase(h);
+  } else if (mIndex < mMaxHandlers - 1) {
     mHandlers[++mIndex] = h;
     needCleanup = false;
     S3FS_PRN_DBG("Return handler to pool: %d", mIndex);
+  } else {
+    --mCount;
   }
   pthread_mutex_unlock(&mLock);
 
@@ -282,6 +307,532 @@ void CurlHandlerPool::ReturnHandler(CURL* h)
   }
 }
 
+//
+// Count the request which has been performed on the handle, and whether
+// its connection was reused or new(with TLS handshake).
+//
+void CurlHandlerPool::CountRequest(CURL* h, const std::string& host)
+{
+  long   connects   = 0;
+  double appconnect = 0.0;
+
+  if (CURLE_OK != curl_easy_getinfo(h, CURLINFO_NUM_CONNECTS, &connects)) {
+    return;
+  }
+  if (0 < connects && CURLE_OK != curl_easy_getinfo(h, CURLINFO_APPCONNECT_TIME, &appconnect)) {
+    appconnect = 0.0;
+  }
+
+  AutoLock lock(&mLock);
+  curl_conn_stats& stats = mStats[host];
+  ++stats.requests;
+  if (0 < connects) {
+    stats.connects += connects;
+    if (0.0 < appconnect) {
+      ++stats.handshakes;
+    }
+  } else {
+    ++stats.reused;
+  }
+}
+
+void CurlHandlerPool::LogStats()
+{
+  AutoLock lock(&mLock);
+
+  S3FS_PRN_INFO("curl handles: [max=%d][made=%d][idle=%d][overflows=%llu]", mMaxHandlers, mCount, mIndex + 1, mOverflows);
+  for (curlconnstats_t::const_iterator iter = mStats.begin(); iter != mStats.end(); ++iter) {
+    S3FS_PRN_INFO("connections to %s: [requests=%llu][reused=%llu][new=%llu][handshakes=%llu]", iter->first.c_str(),
+      iter->second.requests, iter->second.reused, iter->second.connects, iter->second.handshakes);
+  }
+}
+
+//-------------------------------------------------------------------
+// Class LatencyHistogram
+//-------------------------------------------------------------------
+LatencyHistogram::LatencyHistogram() : mCount(0)
+{
+  memset(mBuckets, 0, sizeof(mBuckets));
+}
+
+void LatencyHistogram::Add(long msec)
+{
+  int index;
+  for (index = 0; 0 < msec && index < LATENCY_BUCKETS - 1; msec >>= 1) {
+    ++index;
+  }
+  ++mBuckets[index];
+
+  if (LATENCY_DECAY_COUNT <= ++mCount) {
+    mCount = 0;
+    for (index = 0; index < LATENCY_BUCKETS; ++index) {
+      mBuckets[index] /= 2;
+      mCount         += mBuckets[index];
+    }
+  }
+}
+
+// Returns 0 if there is no sample.
+long LatencyHistogram::Percentile(int percent) const
+{
+  if (0 == mCount) {
+    return 0;
+  }
+  unsigned long long rank = (mCount * percent + 99) / 100;
+  unsigned long long sum  = 0;
+  for (int index = 0; index < LATENCY_BUCKETS; ++index) {
+    if (0 < mBuckets[index] && rank <= sum + mBuckets[index]) {
+      long low  = (0 == index ? 0 : 1L << (index - 1));
+      long high = 1L << index;
+      return low + static_cast<long>((high - low) * (rank - sum) / mBuckets[index]);
+    }
+    sum += mBuckets[index];
+  }
+  return 1L << (LATENCY_BUCKETS - 1);
+}
+
+//-------------------------------------------------------------------
+// Class CurlMultiplexer
+//-------------------------------------------------------------------
+#ifdef HAVE_CURL_MULTIPLEX
+
+bool CurlMultiplexer::Init()
+{
+  if (0 != pthread_mutex_init(&mLock, NULL)) {
+    S3FS_PRN_ERR("Init curl multiplexer lock failed");
+    return false;
+  }
+  if (0 != pthread_cond_init(&mCond, NULL)) {
+    S3FS_PRN_ERR("Init curl multiplexer condition failed");
+    pthread_mutex_destroy(&mLock);
+    return false;
+  }
+  if (NULL == (mMulti = curl_multi_init())) {
+    S3FS_PRN_ERR("Init curl multi handle failed");
+    pthread_cond_destroy(&mCond);
+    pthread_mutex_destroy(&mLock);
+    return false;
+  }
+  curl_multi_setopt(mMulti, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+  mIsExit = false;
+
+  return true;
+}
+
+bool CurlMultiplexer::Destroy()
+{
+  bool result = true;
+
+  pthread_mutex_lock(&mLock);
+  mIsExit = true;
+  pthread_mutex_unlock(&mLock);
+
+  if (mIsStarted) {
+    curl_multi_wakeup(mMulti);
+
+    int rc = pthread_join(mThread, NULL);
+    if (rc) {
+      S3FS_PRN_ERR("failed pthread_join - rc(%d)", rc);
+      result = false;
+    }
+    mIsStarted = false;
+  }
+
+  // the worker has gone, so requests which are left are aborted.
+  for (transfermap_t::iterator iter = mRunning.begin(); iter != mRunning.end(); mRunning.erase(iter++)) {
+    curl_multi_remove_handle(mMulti, iter->first);
+    Done(iter->second, CURLE_ABORTED_BY_CALLBACK);
+  }
+  for (transferlist_t::iterator iter = mPending.begin(); iter != mPending.end(); iter = mPending.erase(iter)) {
+    Done(*iter, CURLE_ABORTED_BY_CALLBACK);
+  }
+  mCancels.clear();
+
+  if (CURLM_OK != curl_multi_cleanup(mMulti)) {
+    S3FS_PRN_ERR("Destroy curl multi handle failed");
+    result = false;
+  }
+  mMulti = NULL;
+
+  if (0 != pthread_cond_destroy(&mCond)) {
+    S3FS_PRN_ERR("Destroy curl multiplexer condition failed");
+    result = false;
+  }
+  if (0 != pthread_mutex_destroy(&mLock)) {
+    S3FS_PRN_ERR("Destroy curl multiplexer lock failed");
+    result = false;
+  }
+
+  return result;
+}
+
+CURLcode CurlMultiplexer::Perform(CURL* h)
+{
+  Transfer transfer(h);
+
+  if (!Submit(&transfer)) {
+    return CURLE_FAILED_INIT;
+  }
+  Wait(&transfer, NULL, -1);
+
+  return transfer.result;
+}
+
+bool CurlMultiplexer::Submit(Transfer* transfer)
+{
+  pthread_mutex_lock(&mLock);
+  if (mIsExit || (!mIsStarted && !StartWorker())) {
+    pthread_mutex_unlock(&mLock);
+    return false;
+  }
+  mPending.push_back(transfer);
+  curl_multi_wakeup(mMulti);
+  pthread_mutex_unlock(&mLock);
+
+  return true;
+}
+
+// Waits until first or second(can be NULL) is done, or msec passes(-1 is
+// not limited). Returns the done transfer, or NULL at timeout.
+CurlMultiplexer::Transfer* CurlMultiplexer::Wait(Transfer* first, Transfer* second, long msec)
+{
+  struct timespec abstime;
+  if (0 <= msec) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    abstime.tv_sec  = now.tv_sec + msec / 1000;
+    abstime.tv_nsec = now.tv_usec * 1000 + (msec % 1000) * 1000 * 1000;
+    if (1000 * 1000 * 1000 <= abstime.tv_nsec) {
+      abstime.tv_sec  += 1;
+      abstime.tv_nsec -= 1000 * 1000 * 1000;
+    }
+  }
+
+  pthread_mutex_lock(&mLock);
+  while (!first->is_done && !(second && second->is_done)) {
+    if (0 > msec) {
+      pthread_cond_wait(&mCond, &mLock);
+    } else if (ETIMEDOUT == pthread_cond_timedwait(&mCond, &mLock, &abstime)) {
+      break;
+    }
+  }
+  Transfer* done = (first->is_done ? first : ((second && second->is_done) ? second : NULL));
+  pthread_mutex_unlock(&mLock);
+
+  return done;
+}
+
+// Aborts the transfer, and returns after the worker has removed it.
+void CurlMultiplexer::Cancel(Transfer* transfer)
+{
+  pthread_mutex_lock(&mLock);
+  if (!transfer->is_done) {
+    transferlist_t::iterator iter = std::find(mPending.begin(), mPending.end(), transfer);
+    if (iter != mPending.end()) {
+      mPending.erase(iter);
+      transfer->result  = CURLE_ABORTED_BY_CALLBACK;
+      transfer->is_done = true;
+    } else {
+      mCancels.push_back(transfer);
+      curl_multi_wakeup(mMulti);
+      while (!transfer->is_done) {
+        pthread_cond_wait(&mCond, &mLock);
+      }
+    }
+  }
+  pthread_mutex_unlock(&mLock);
+}
+
+// [NOTE] must be called with mLock held.
+bool CurlMultiplexer::StartWorker()
+{
+  int rc;
+  if (0 != (rc = pthread_create(&mThread, NULL, CurlMultiplexer::Worker, static_cast<void*>(this)))) {
+    S3FS_PRN_ERR("failed pthread_create - rc(%d)", rc);
+    return false;
+  }
+  mIsStarted = true;
+
+  return true;
+}
+
+void CurlMultiplexer::Done(Transfer* transfer, CURLcode result)
+{
+  pthread_mutex_lock(&mLock);
+  mCancels.remove(transfer);        // the caller may return soon
+  transfer->result  = result;
+  transfer->is_done = true;
+  pthread_cond_broadcast(&mCond);
+  pthread_mutex_unlock(&mLock);
+}
+
+void* CurlMultiplexer::Worker(void* arg)
+{
+  CurlMultiplexer* mux = static_cast<CurlMultiplexer*>(arg);
+
+  while (true) {
+    // add new requests to multi handle
+    transferlist_t pending;
+    transferlist_t cancels;
+    pthread_mutex_lock(&mux->mLock);
+    if (mux->mIsExit) {
+      pthread_mutex_unlock(&mux->mLock);
+      break;
+    }
+    pending.swap(mux->mPending);
+    cancels.swap(mux->mCancels);
+    pthread_mutex_unlock(&mux->mLock);
+
+    for (transferlist_t::iterator iter = pending.begin(); iter != pending.end(); ++iter) {
+      CURLMcode code = curl_multi_add_handle(mux->mMulti, (*iter)->hCurl);
+      if (CURLM_OK != code) {
+        S3FS_PRN_ERR("curl_multi_add_handle code: %d msg: %s", code, curl_multi_strerror(code));
+        mux->Done(*iter, CURLE_FAILED_INIT);
+        continue;
+      }
+      mux->mRunning[(*iter)->hCurl] = *iter;
+    }
+
+    // remove canceled requests, which are not done yet
+    for (transferlist_t::iterator iter = cancels.begin(); iter != cancels.end(); ++iter) {
+      transfermap_t::iterator riter = mux->mRunning.find((*iter)->hCurl);
+      if (riter != mux->mRunning.end() && riter->second == *iter) {
+        curl_multi_remove_handle(mux->mMulti, riter->first);
+        mux->mRunning.erase(riter);
+        mux->Done(*iter, CURLE_ABORTED_BY_CALLBACK);
+      }
+    }
+
+    // perform and check done requests
+    int running = 0;
+    CURLMcode code = curl_multi_perform(mux->mMulti, &running);
+    if (CURLM_OK != code) {
+      S3FS_PRN_ERR("curl_multi_perform code: %d msg: %s", code, curl_multi_strerror(code));
+    }
+
+    CURLMsg* msg;
+    int      remaining_msgs;
+    while (NULL != (msg = curl_multi_info_read(mux->mMulti, &remaining_msgs))) {
+      if (CURLMSG_DONE != msg->msg) {
+        continue;
+      }
+      CURL*    hCurl  = msg->easy_handle;
+      CURLcode result = msg->data.result;
+      curl_multi_remove_handle(mux->mMulti, hCurl);
+
+      transfermap_t::iterator iter = mux->mRunning.find(hCurl);
+      if (iter != mux->mRunning.end()) {
+        Transfer* transfer = iter->second;
+        mux->mRunning.erase(iter);
+        mux->Done(transfer, result);
+      }
+    }
+
+    // wait for events on sockets, or new requests
+    if (CURLM_OK != (code = curl_multi_poll(mux->mMulti, NULL, 0, 1000, NULL))) {
+      S3FS_PRN_ERR("curl_multi_poll code: %d msg: %s", code, curl_multi_strerror(code));
+    }
+  }
+
+  return NULL;
+}
+
+#else // HAVE_CURL_MULTIPLEX
+
+bool CurlMultiplexer::Init()
+{
+  S3FS_PRN_ERR("libcurl is too old for multiplexing requests.");
+  return false;
+}
+
+bool CurlMultiplexer::Destroy()
+{
+  return true;
+}
+
+CURLcode CurlMultiplexer::Perform(CURL* h)
+{
+  return curl_easy_perform(h);
+}
+
+bool CurlMultiplexer::Submit(Transfer* transfer)
+{
+  return false;
+}
+
+CurlMultiplexer::Transfer* CurlMultiplexer::Wait(Transfer* first, Transfer* second, long msec)
+{
+  return NULL;
+}
+
+void CurlMultiplexer::Cancel(Transfer* transfer)
+{
+}
+
+#endif // HAVE_CURL_MULTIPLEX
+
+//-------------------------------------------------------------------
+// Class CurlThreadPool
+//-------------------------------------------------------------------
+
+bool CurlThreadPool::Init()
+{
+  if (0 != pthread_mutex_init(&mLock, NULL)) {
+    S3FS_PRN_ERR("Init curl thread pool lock failed");
+    return false;
+  }
+  if (0 != pthread_cond_init(&mCond, NULL)) {
+    S3FS_PRN_ERR("Init curl thread pool condition failed");
+    pthread_mutex_destroy(&mLock);
+    return false;
+  }
+  mIsExit = false;
+
+  return true;
+}
+
+bool CurlThreadPool::Destroy()
+{
+  bool result = true;
+
+  pthread_mutex_lock(&mLock);
+  mIsExit = true;
+  pthread_cond_broadcast(&mCond);
+  pthread_mutex_unlock(&mLock);
+
+  for (std::vector<pthread_t>::iterator iter = mThreads.begin(); iter != mThreads.end(); ++iter) {
+    int rc = pthread_join(*iter, NULL);
+    if (rc) {
+      S3FS_PRN_ERR("failed pthread_join - rc(%d)", rc);
+      result = false;
+    }
+  }
+  mThreads.clear();
+
+  // requests which were never started or are waiting to retry are reported as failed.
+  for (std::list<Job>::iterator iter = mJobs.begin(); iter != mJobs.end(); iter = mJobs.erase(iter)) {
+    iter->owner->RequestDone(iter->s3fscurl, -EIO);
+  }
+  for (delayjobs_t::iterator iter = mDelayJobs.begin(); iter != mDelayJobs.end(); mDelayJobs.erase(iter++)) {
+    iter->second.owner->RequestDone(iter->second.s3fscurl, -EIO);
+  }
+
+  if (0 != pthread_cond_destroy(&mCond)) {
+    S3FS_PRN_ERR("Destroy curl thread pool condition failed");
+    result = false;
+  }
+  if (0 != pthread_mutex_destroy(&mLock)) {
+    S3FS_PRN_ERR("Destroy curl thread pool lock failed");
+    result = false;
+  }
+
+  return result;
+}
+
+// [NOTE] must be called with mLock held.
+bool CurlThreadPool::StartWorkers()
+{
+  while (static_cast<int>(mThreads.size()) < mMaxThreads) {
+    pthread_t thread;
+    int       rc;
+
+    if (0 != (rc = pthread_create(&thread, NULL, CurlThreadPool::Worker, static_cast<void*>(this)))) {
+      S3FS_PRN_ERR("failed pthread_create - rc(%d)", rc);
+      break;
+    }
+    mThreads.push_back(thread);
+  }
+  S3FS_PRN_INFO3("curl thread pool has %zu workers", mThreads.size());
+
+  return !mThreads.empty();
+}
+
+bool CurlThreadPool::Submit(S3fsCurl* s3fscurl, S3fsMultiCurl* owner)
+{
+  bool result = true;
+
+  assert(s3fscurl && owner);
+
+  pthread_mutex_lock(&mLock);
+  if (mIsExit) {
+    result = false;
+  } else if (static_cast<int>(mThreads.size()) < mMaxThreads && !StartWorkers()) {
+    result = false;
+  } else {
+    mJobs.push_back(Job(s3fscurl, owner));
+    pthread_cond_signal(&mCond);
+  }
+  pthread_mutex_unlock(&mLock);
+
+  return result;
+}
+
+long long CurlThreadPool::GetNowMsec()
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return static_cast<long long>(now.tv_sec) * 1000 + now.tv_usec / 1000;
+}
+
+void* CurlThreadPool::Worker(void* arg)
+{
+  CurlThreadPool* pool = static_cast<CurlThreadPool*>(arg);
+
+  while (true) {
+    pthread_mutex_lock(&pool->mLock);
+    while (!pool->mIsExit) {
+      // move delayed jobs which reached the retry time
+      long long now = GetNowMsec();
+      while (!pool->mDelayJobs.empty() && pool->mDelayJobs.begin()->first <= now) {
+        pool->mJobs.push_back(pool->mDelayJobs.begin()->second);
+        pool->mDelayJobs.erase(pool->mDelayJobs.begin());
+      }
+      if (!pool->mJobs.empty()) {
+        break;
+      }
+      if (pool->mDelayJobs.empty()) {
+        pthread_cond_wait(&pool->mCond, &pool->mLock);
+      } else {
+        long long       next = pool->mDelayJobs.begin()->first;
+        struct timespec abstime;
+        abstime.tv_sec  = static_cast<time_t>(next / 1000);
+        abstime.tv_nsec = static_cast<long>(next % 1000) * 1000 * 1000;
+        pthread_cond_timedwait(&pool->mCond, &pool->mLock, &abstime);
+      }
+    }
+    if (pool->mIsExit) {
+      pthread_mutex_unlock(&pool->mLock);
+      break;
+    }
+    Job job = pool->mJobs.front();
+    pool->mJobs.pop_front();
+    pthread_mutex_unlock(&pool->mLock);
+
+    if (!job.started) {
+      job.s3fscurl->BeginRequest();
+      job.started = true;
+    }
+    long wait_msec = 0;
+    int  result    = job.s3fscurl->PerformAttempt(wait_msec);
+    if (S3FSCURL_RETRY != result) {
+      job.owner->RequestDone(job.s3fscurl, result);
+      continue;
+    }
+
+    pthread_mutex_lock(&pool->mLock);
+    if (pool->mIsExit) {
+      pthread_mutex_unlock(&pool->mLock);
+      job.owner->RequestDone(job.s3fscurl, -EIO);
+      break;
+    }
+    pool->mDelayJobs.insert(std::make_pair(GetNowMsec() + wait_msec, job));
+    pthread_cond_signal(&pool->mCond);
+    pthread_mutex_unlock(&pool->mLock);
+  }
+
+  return NULL;
+}
+
 //-------------------------------------------------------------------
 // Class S3fsCurl
 //-------------------------------------------------------------------
@@ -296,6 +847,79 @@ void CurlHandlerPool::ReturnHandler(CURL* h)
 #define RAMCRED_EXPIRATION          "Expiration"
 #define RAMCRED_KEYCOUNT            4
 
+//
+// Retry of request
+//
+// The wait before retrying is decorrelated jitter(random between
+// RETRY_BASE_MSEC and 3 times of last wait, up to RETRY_MAX_MSEC), so that
+// the requests which failed at the same time do not retry at the same time.
+// Retries are limited by the count(retries option), the time from the first
+// attempt(retry_deadline option), and the retry budget which is shared by
+// all requests: each retry takes RETRY_BUDGET_COST from it, and each
+// successful request gives back RETRY_BUDGET_REFUND. While the service
+// is throttling, the budget runs out and requests fail without retrying.
+//
+#define RETRY_BASE_MSEC         500
+#define RETRY_MAX_MSEC          10000
+#define RETRY_BUDGET_MAX        1000
+#define RETRY_BUDGET_COST       10
+#define RETRY_BUDGET_REFUND     1
+
+//
+// Hedged request
+//
+// A head request or a small get request which is not answered within the
+// hedge_percentile of latency of its type is sent again on another handle,
+// and the one answered first is taken. The latency is measured for each
+// type, and hedging starts after HEDGE_MIN_SAMPLES requests are measured.
+//
+#define HEDGE_MAX_SIZE          (1024 * 1024)     // 1MB
+#define HEDGE_MIN_SAMPLES       100
+#define HEDGE_MIN_MSEC          10
+
+//
+// Statistics of requests
+//
+// Each attempt is counted, so the count includes retries. The table is
+// indexed by REQTYPE.
+//
+#define REQUEST_STATS(type)     static OpStats stats_request_##type("cosfs_request", "Latency of requests to COS.", #type)
+
+REQUEST_STATS(delete);
+REQUEST_STATS(head);
+REQUEST_STATS(puthead);
+REQUEST_STATS(put);
+REQUEST_STATS(get);
+REQUEST_STATS(chkbucket);
+REQUEST_STATS(listbucket);
+REQUEST_STATS(premultipost);
+REQUEST_STATS(completemultipost);
+REQUEST_STATS(uploadmultipost);
+REQUEST_STATS(copymultipost);
+REQUEST_STATS(multilist);
+REQUEST_STATS(ramcred);
+REQUEST_STATS(abortmultiupload);
+
+static OpStats* const stats_requests[] = {
+  &stats_request_delete,
+  &stats_request_head,
+  &stats_request_puthead,
+  &stats_request_put,
+  &stats_request_get,
+  &stats_request_chkbucket,
+  &stats_request_listbucket,
+  &stats_request_premultipost,
+  &stats_request_completemultipost,
+  &stats_request_uploadmultipost,
+  &stats_request_copymultipost,
+  &stats_request_multilist,
+  &stats_request_ramcred,
+  &stats_request_abortmultiupload,
+};
+
+static StatsCounter stats_hedge_sent("cosfs_hedge_sent_total", "Hedges which are sent for slow requests.");
+static StatsCounter stats_hedge_won("cosfs_hedge_won_total", "Hedges which are answered before the original requests.");
+
 // [NOTICE]
 // This symbol is for libcurl under 7.23.0
 #ifndef CURLSHE_NOT_BUILT_IN
@@ -306,7 +930,9 @@ pthread_mutex_t  S3fsCurl::curl_handles_lock;
 pthread_mutex_t  S3fsCurl::curl_share_lock[SHARE_MUTEX_MAX];
 bool             S3fsCurl::is_initglobal_done  = false;
 CurlHandlerPool* S3fsCurl::sCurlPool           = NULL;
-int              S3fsCurl::sCurlPoolSize       = 32;
+int              S3fsCurl::sCurlPoolSize       = 64;
+CurlMultiplexer* S3fsCurl::sCurlMux            = NULL;
+long             S3fsCurl::http_version        = CURL_HTTP_VERSION_NONE;
 CURLSH*          S3fsCurl::hCurlShare          = NULL;
 bool             S3fsCurl::is_cert_check       = true; // default
 bool             S3fsCurl::is_dns_cache        = true; // default
@@ -329,6 +955,21 @@ string           S3fsCurl::COSAccessToken;
 time_t           S3fsCurl::COSAccessTokenExpire= 0;
 string           S3fsCurl::CAM_role;
 string           S3fsCurl::CAM_role_url        = RAM_CRED_URL;
+pthread_mutex_t  S3fsCurl::sign_key_lock;
+string           S3fsCurl::sign_key_ak;
+string           S3fsCurl::sign_key_sk;
+string           S3fsCurl::sign_key_time;
+string           S3fsCurl::sign_key;
+time_t           S3fsCurl::sign_key_start      = 0;
+time_t           S3fsCurl::sign_key_end        = 0;
+time_t           S3fsCurl::retry_deadline      = 0;              // not limited
+pthread_mutex_t  S3fsCurl::retry_budget_lock;
+long             S3fsCurl::retry_budget        = RETRY_BUDGET_MAX;
+int              S3fsCurl::hedge_percentile    = 0;              // disabled
+off_t            S3fsCurl::hedge_max_size      = HEDGE_MAX_SIZE;
+pthread_mutex_t  S3fsCurl::hedge_lock;
+LatencyHistogram S3fsCurl::hedge_latency_head;
+LatencyHistogram S3fsCurl::hedge_latency_get;
 long             S3fsCurl::ssl_verify_hostname = 1;    // default(original code...)
 curltime_t       S3fsCurl::curl_times;
 curlprogress_t   S3fsCurl::curl_progress;
@@ -364,6 +1005,17 @@ bool S3fsCurl::InitS3fsCurl(const char* MimeFile)
   if (!sCurlPool->Init()) {
     return false;
   }
+  if(CURL_HTTP_VERSION_NONE != S3fsCurl::http_version || 0 < S3fsCurl::hedge_percentile){
+    sCurlMux = new CurlMultiplexer();
+    if(!sCurlMux->Init()){
+      delete sCurlMux;
+      sCurlMux = NULL;
+      return false;
+    }
+  }
+  if(!S3fsMultiCurl::InitThreadPool()){
+    return false;
+  }
   if(!S3fsCurl::InitShareCurl()){
     return false;
   }
@@ -373,6 +1025,15 @@ bool S3fsCurl::InitS3fsCurl(const char* MimeFile)
   if(0 != pthread_mutex_init(&S3fsCurl::token_lock, NULL)){
     return false;
   }
+  if(0 != pthread_mutex_init(&S3fsCurl::sign_key_lock, NULL)){
+    return false;
+  }
+  if(0 != pthread_mutex_init(&S3fsCurl::retry_budget_lock, NULL)){
+    return false;
+  }
+  if(0 != pthread_mutex_init(&S3fsCurl::hedge_lock, NULL)){
+    return false;
+  }
   return true;
 }
 
@@ -380,10 +1041,21 @@ bool S3fsCurl::DestroyS3fsCurl(void)
 {
   int result = true;
 
+  // easy handles must be removed from multi handle before destroying them.
+  if(sCurlMux){
+    if(!sCurlMux->Destroy()){
+      result = false;
+    }
+    delete sCurlMux;
+    sCurlMux = NULL;
+  }
   if(!S3fsCurl::DestroyCryptMutex()){
     result = false;
   }
-  if(!S3fsCurl::DestroyShareCurl()){
+  if(!S3fsCurl::DestroyShareCurl()){
+    result = false;
+  }
+  if(!S3fsMultiCurl::DestroyThreadPool()){
     result = false;
   }
   if (!sCurlPool->Destroy()) {
@@ -401,6 +1073,15 @@ bool S3fsCurl::DestroyS3fsCurl(void)
   if(0 != pthread_mutex_destroy(&S3fsCurl::curl_handles_lock)){
     result = false;
   }
+  if(0 != pthread_mutex_destroy(&S3fsCurl::sign_key_lock)){
+    result = false;
+  }
+  if(0 != pthread_mutex_destroy(&S3fsCurl::retry_budget_lock)){
+    result = false;
+  }
+  if(0 != pthread_mutex_destroy(&S3fsCurl::hedge_lock)){
+    result = false;
+  }
   return result;
 }
 
@@ -732,6 +1413,25 @@ size_t S3fsCurl::WriteMemoryCallback(void* ptr, size_t blockSize, size_t numBloc
   return (blockSize * numBlocks);
 }
 
+//
+// Body of success response is passed to BodyCallback while it is received,
+// and error response is kept in bodydata for logging.
+//
+size_t S3fsCurl::StreamBodyCallback(void* ptr, size_t blockSize, size_t numBlocks, void* data)
+{
+  S3fsCurl* s3fscurl     = reinterpret_cast<S3fsCurl*>(data);
+  long      responseCode = -1;
+
+  if(!s3fscurl->BodyCallback || CURLE_OK != curl_easy_getinfo(s3fscurl->hCurl, CURLINFO_RESPONSE_CODE, &responseCode) || 300 <= responseCode){
+    return WriteMemoryCallback(ptr, blockSize, numBlocks, s3fscurl->bodydata);
+  }
+  if(!s3fscurl->BodyCallback(static_cast<const char*>(ptr), blockSize * numBlocks, s3fscurl->pBodyParam)){
+    S3FS_PRN_ERR("BodyCallback returned false(%s).", s3fscurl->url.c_str());
+    return 0;   // abort this request(CURLE_WRITE_ERROR)
+  }
+  return (blockSize * numBlocks);
+}
+
 size_t S3fsCurl::ReadCallback(void* ptr, size_t size, size_t nmemb, void* userp)
 {
   S3fsCurl* pCurl = reinterpret_cast<S3fsCurl*>(userp);
@@ -814,6 +1514,14 @@ size_t S3fsCurl::DownloadWriteCallback(void* ptr, size_t size, size_t nmemb, voi
   if(-1 == pCurl->partdata.fd || 0 >= pCurl->partdata.size){
     return 0;
   }
+  // only one of the request and its hedge writes to the file
+  if(pCurl->hedge_owner){
+    if(!*pCurl->hedge_owner){
+      *pCurl->hedge_owner = pCurl;
+    }else if(*pCurl->hedge_owner != pCurl){
+      return 0;
+    }
+  }
 
   // write size
   ssize_t copysize = (size * nmemb) < (size_t)pCurl->partdata.size ? (size * nmemb) : (size_t)pCurl->partdata.size;
@@ -879,6 +1587,13 @@ int S3fsCurl::SetRetries(int count)
   return old;
 }
 
+time_t S3fsCurl::SetRetryDeadline(time_t sec)
+{
+  time_t old = S3fsCurl::retry_deadline;
+  S3fsCurl::retry_deadline = sec;
+  return old;
+}
+
 bool S3fsCurl::SetPublicBucket(bool flag)
 {
   bool old = S3fsCurl::is_public_bucket;
@@ -1203,6 +1918,97 @@ int S3fsCurl::SetMaxParallelCount(int value)
   return old;
 }
 
+//
+// Use HTTP/2 for requests, and multiplex them over a few connections.
+// If prior_knowledge is true, HTTP/2 is used without upgrade from HTTP/1.1
+// (for h2c servers over http), otherwise HTTP/2 is negotiated by TLS.
+//
+bool S3fsCurl::SetHttp2(bool prior_knowledge)
+{
+#ifdef HAVE_CURL_MULTIPLEX
+  curl_version_info_data* info = curl_version_info(CURLVERSION_NOW);
+  if(!info || !(info->features & CURL_VERSION_HTTP2)){
+    S3FS_PRN_ERR("libcurl is not built with HTTP/2 support.");
+    return false;
+  }
+  if(prior_knowledge && 0x075800 <= info->version_num && info->version_num < 0x075900){
+    S3FS_PRN_WARN("libcurl %s fails the requests on a reused HTTP/2 connection with prior knowledge, use http2 over https.", info->version);
+  }
+  S3fsCurl::http_version = (prior_knowledge ? CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE : CURL_HTTP_VERSION_2TLS);
+  return true;
+#else
+  S3FS_PRN_ERR("libcurl(%s) is too old for HTTP/2 multiplexing, 7.68.0 or later is needed.", LIBCURL_VERSION);
+  return false;
+#endif
+}
+
+bool S3fsCurl::SetHedgePercentile(int percent)
+{
+  if(percent < 0 || 100 <= percent){
+    return false;
+  }
+#ifndef HAVE_CURL_MULTIPLEX
+  if(0 < percent){
+    S3FS_PRN_ERR("libcurl(%s) is too old for hedged requests, 7.68.0 or later is needed.", LIBCURL_VERSION);
+    return false;
+  }
+#endif
+  S3fsCurl::hedge_percentile = percent;
+  return true;
+}
+
+off_t S3fsCurl::SetHedgeMaxSize(off_t size)
+{
+  off_t old = S3fsCurl::hedge_max_size;
+  S3fsCurl::hedge_max_size = size;
+  return old;
+}
+
+int S3fsCurl::SetMaxCurlHandles(int value)
+{
+  int old = S3fsCurl::sCurlPoolSize;
+  S3fsCurl::sCurlPoolSize = (0 < value ? value : 1);
+  return old;
+}
+
+//
+// Make connections of pooled handles by head requests to the bucket in
+// parallel, then the following requests do not need to wait for making
+// connections(and TLS handshakes).
+// Returns the count of requests which are succeeded.
+//
+int S3fsCurl::WarmupConnections(int count)
+{
+  S3fsMultiCurl curlmulti;
+
+  count = std::min(count, S3fsCurl::sCurlPoolSize);
+  if(count <= 0){
+    return 0;
+  }
+  S3FS_PRN_INFO("warm up %d connections.", count);
+
+  for(int cnt = 0; cnt < count; cnt++){
+    S3fsCurl* s3fscurl = new S3fsCurl();
+    if(!s3fscurl->PreHeadRequest("/")){
+      S3FS_PRN_WARN("Could not make curl object for warming up connection.");
+      delete s3fscurl;
+      break;
+    }
+    if(!curlmulti.SetS3fsCurlObject(s3fscurl)){
+      S3FS_PRN_WARN("Could not make curl object into multi curl for warming up connection.");
+      delete s3fscurl;
+      break;
+    }
+  }
+  curlmulti.SetMaxInFlight(count);
+
+  int result;
+  if(0 != (result = curlmulti.Request())){
+    S3FS_PRN_WARN("failed to warm up connections(%d), but continue.", result);
+  }
+  return result;
+}
+
 bool S3fsCurl::UploadMultipartPostCallback(S3fsCurl* s3fscurl)
 {
   if(!s3fscurl){
@@ -1273,6 +2079,45 @@ S3fsCurl* S3fsCurl::UploadMultipartPostRetryCallback(S3fsCurl* s3fscurl)
   return newcurl;
 }
 
+S3fsCurl* S3fsCurl::UploadMultipartPostNextCallback(void* param)
+{
+  parallelpart* ppart = static_cast<parallelpart*>(param);
+  int           result;
+
+  if(!ppart || !ppart->etaglist || 0 != ppart->result || 0 >= ppart->remaining){
+    return NULL;
+  }
+
+  // chunk size
+  off_t chunk = ppart->remaining > S3fsCurl::multipart_size ? S3fsCurl::multipart_size : ppart->remaining;
+
+  // s3fscurl sub object
+  S3fsCurl* s3fscurl_para            = new S3fsCurl(true);
+  s3fscurl_para->partdata.fd         = ppart->fd;
+  s3fscurl_para->partdata.startpos   = ppart->startpos;
+  s3fscurl_para->partdata.size       = chunk;
+  s3fscurl_para->b_partdata_startpos = s3fscurl_para->partdata.startpos;
+  s3fscurl_para->b_partdata_size     = s3fscurl_para->partdata.size;
+  s3fscurl_para->partdata.add_etag_list(ppart->etaglist);
+
+  // initiate upload part for parallel
+  //
+  // [NOTE]
+  // parts are made in order, so that the position in etaglist is
+  // the part number even if parts finish out of order.
+  //
+  if(0 != (result = s3fscurl_para->UploadMultipartPostSetup(ppart->path, ppart->etaglist->size(), ppart->upload_id))){
+    S3FS_PRN_ERR("failed uploading part setup(%d)", result);
+    ppart->result = result;
+    delete s3fscurl_para;
+    return NULL;
+  }
+  ppart->startpos  += chunk;
+  ppart->remaining -= chunk;
+
+  return s3fscurl_para;
+}
+
 int S3fsCurl::ParallelMultipartUploadRequest(const char* tpath, headers_t& meta, int fd)
 {
   int            result;
@@ -1280,7 +2125,6 @@ int S3fsCurl::ParallelMultipartUploadRequest(const char* tpath, headers_t& meta,
   struct stat    st;
   int            fd2;
   etaglist_t     list;
-  off_t          remaining_bytes;
   S3fsCurl       s3fscurl(true);
 
   S3FS_PRN_INFO3("[tpath=%s][fd=%d]", SAFESTRPTR(tpath), fd);
@@ -1306,57 +2150,35 @@ int S3fsCurl::ParallelMultipartUploadRequest(const char* tpath, headers_t& meta,
   s3fscurl.DestroyCurlHandle();
 
   // cycle through open fd, pulling off 10MB chunks at a time
-  for(remaining_bytes = st.st_size; 0 < remaining_bytes; ){
+  //
+  // Parts are made one by one, so that max_parallel_cnt parts are
+  // always uploading until the last part is sent.
+  //
+  {
+    parallelpart  part(tpath, fd2, 0, st.st_size);
     S3fsMultiCurl curlmulti;
-    int           para_cnt;
-    off_t         chunk;
+
+    part.upload_id = upload_id;
+    part.etaglist  = &list;
 
     // Initialize S3fsMultiCurl
     curlmulti.SetSuccessCallback(S3fsCurl::UploadMultipartPostCallback);
     curlmulti.SetRetryCallback(S3fsCurl::UploadMultipartPostRetryCallback);
-
-    // Loop for setup parallel upload(multipart) request.
-    for(para_cnt = 0; para_cnt < S3fsCurl::max_parallel_cnt && 0 < remaining_bytes; para_cnt++, remaining_bytes -= chunk){
-      // chunk size
-      chunk = remaining_bytes > S3fsCurl::multipart_size ? S3fsCurl::multipart_size : remaining_bytes;
-
-      // s3fscurl sub object
-      S3fsCurl* s3fscurl_para            = new S3fsCurl(true);
-      s3fscurl_para->partdata.fd         = fd2;
-      s3fscurl_para->partdata.startpos   = st.st_size - remaining_bytes;
-      s3fscurl_para->partdata.size       = chunk;
-      s3fscurl_para->b_partdata_startpos = s3fscurl_para->partdata.startpos;
-      s3fscurl_para->b_partdata_size     = s3fscurl_para->partdata.size;
-      s3fscurl_para->partdata.add_etag_list(&list);
-
-      // initiate upload part for parallel
-      if(0 != (result = s3fscurl_para->UploadMultipartPostSetup(tpath, list.size(), upload_id))){
-        S3FS_PRN_ERR("failed uploading part setup(%d)", result);
-        close(fd2);
-        delete s3fscurl_para;
-        return result;
-      }
-
-      // set into parallel object
-      if(!curlmulti.SetS3fsCurlObject(s3fscurl_para)){
-        S3FS_PRN_ERR("Could not make curl object into multi curl(%s).", tpath);
-        close(fd2);
-        delete s3fscurl_para;
-        return -1;
-      }
-    }
+    curlmulti.SetNextCallback(S3fsCurl::UploadMultipartPostNextCallback, &part);
+    curlmulti.SetMaxInFlight(S3fsCurl::max_parallel_cnt);
 
     // Multi request
     if(0 != (result = curlmulti.Request())){
       S3FS_PRN_ERR("error occuered in multi request(errno=%d).", result);
-      break;
+    }else if(0 != (result = part.result)){
+      S3FS_PRN_ERR("error occuered in setting up part request(errno=%d).", result);
     }
-
-    // reinit for loop.
-    curlmulti.Clear();
   }
   close(fd2);
 
+  if(0 != result){
+    return result;
+  }
   if(0 != (result = s3fscurl.CompleteMultipartPostRequest(tpath, upload_id, list))){
     return result;
   }
@@ -1393,57 +2215,56 @@ S3fsCurl* S3fsCurl::ParallelGetObjectRetryCallback(S3fsCurl* s3fscurl)
   return newcurl;
 }
 
-int S3fsCurl::ParallelGetObjectRequest(const char* tpath, int fd, off_t start, ssize_t size)
+S3fsCurl* S3fsCurl::ParallelGetObjectNextCallback(void* param)
 {
-  S3FS_PRN_INFO3("[tpath=%s][fd=%d]", SAFESTRPTR(tpath), fd);
+  parallelpart* ppart = static_cast<parallelpart*>(param);
 
-  sse_type_t ssetype;
+  if(!ppart || 0 != ppart->result || 0 >= ppart->remaining){
+    return NULL;
+  }
+  sse_type_t ssetype = SSE_DISABLE;
   string     ssevalue;
 
-  int        result = 0;
-  ssize_t    remaining_bytes;
+  // chunk size
+  off_t chunk = ppart->remaining > S3fsCurl::multipart_size ? S3fsCurl::multipart_size : ppart->remaining;
 
-  // cycle through open fd, pulling off 10MB chunks at a time
-  for(remaining_bytes = size; 0 < remaining_bytes; ){
-    S3fsMultiCurl curlmulti;
-    int           para_cnt;
-    off_t         chunk;
+  // s3fscurl sub object
+  S3fsCurl* s3fscurl_para = new S3fsCurl();
+  if(0 != (ppart->result = s3fscurl_para->PreGetObjectRequest(ppart->path, ppart->fd, ppart->startpos, chunk, ssetype, ssevalue))){
+    S3FS_PRN_ERR("failed downloading part setup(%d)", ppart->result);
+    delete s3fscurl_para;
+    return NULL;
+  }
+  ppart->startpos  += chunk;
+  ppart->remaining -= chunk;
 
-    // Initialize S3fsMultiCurl
-    //curlmulti.SetSuccessCallback(NULL);   // not need to set success callback
-    curlmulti.SetRetryCallback(S3fsCurl::ParallelGetObjectRetryCallback);
-
-    // Loop for setup parallel upload(multipart) request.
-    for(para_cnt = 0; para_cnt < S3fsCurl::max_parallel_cnt && 0 < remaining_bytes; para_cnt++, remaining_bytes -= chunk){
-      // chunk size
-      chunk = remaining_bytes > S3fsCurl::multipart_size ? S3fsCurl::multipart_size : remaining_bytes;
-
-      // s3fscurl sub object
-      S3fsCurl* s3fscurl_para = new S3fsCurl();
-      if(0 != (result = s3fscurl_para->PreGetObjectRequest(tpath, fd, (start + size - remaining_bytes), chunk, ssetype, ssevalue))){
-        S3FS_PRN_ERR("failed downloading part setup(%d)", result);
-        delete s3fscurl_para;
-        return result;
-      }
+  return s3fscurl_para;
+}
 
-      // set into parallel object
-      if(!curlmulti.SetS3fsCurlObject(s3fscurl_para)){
-        S3FS_PRN_ERR("Could not make curl object into multi curl(%s).", tpath);
-        delete s3fscurl_para;
-        return -1;
-      }
-    }
+int S3fsCurl::ParallelGetObjectRequest(const char* tpath, int fd, off_t start, ssize_t size)
+{
+  S3FS_PRN_INFO3("[tpath=%s][fd=%d]", SAFESTRPTR(tpath), fd);
 
-    // Multi request
-    if(0 != (result = curlmulti.Request())){
-      S3FS_PRN_ERR("error occuered in multi request(errno=%d).", result);
-      break;
-    }
+  int           result;
+  parallelpart  part(tpath, fd, start, size);
+  S3fsMultiCurl curlmulti;
 
-    // reinit for loop.
-    curlmulti.Clear();
+  // Initialize S3fsMultiCurl
+  //
+  // Ranged requests are made one by one, so that the next range
+  // is requested as soon as any of max_parallel_cnt requests finishes.
+  //
+  //curlmulti.SetSuccessCallback(NULL);   // not need to set success callback
+  curlmulti.SetRetryCallback(S3fsCurl::ParallelGetObjectRetryCallback);
+  curlmulti.SetNextCallback(S3fsCurl::ParallelGetObjectNextCallback, &part);
+  curlmulti.SetMaxInFlight(S3fsCurl::max_parallel_cnt);
+
+  // Multi request
+  if(0 != (result = curlmulti.Request())){
+    S3FS_PRN_ERR("error occuered in multi request(errno=%d).", result);
+    return result;
   }
-  return result;
+  return part.result;
 }
 
 bool S3fsCurl::ParseRAMCredentialResponse(const char* response, ramcredmap_t& keyval)
@@ -1573,9 +2394,9 @@ int S3fsCurl::CurlDebugFunc(CURL* hcurl, curl_infotype type, char* data, size_t
 //-------------------------------------------------------------------
 S3fsCurl::S3fsCurl(bool ahbe) :
     hCurl(NULL), path(""), base_path(""), saved_path(""), url(""), requestHeaders(NULL),
-    bodydata(NULL), headdata(NULL), LastResponseCode(-1), postdata(NULL), postdata_remaining(0), is_use_ahbe(ahbe),
+    bodydata(NULL), headdata(NULL), BodyCallback(NULL), pBodyParam(NULL), LastResponseCode(-1), postdata(NULL), postdata_remaining(0), is_use_ahbe(ahbe),
     retry_count(0), b_infile(NULL), b_postdata(NULL), b_postdata_remaining(0), b_partdata_startpos(0), b_partdata_size(0),
-    b_ssekey_pos(-1), b_ssevalue(""), b_ssetype(SSE_DISABLE)
+    b_ssekey_pos(-1), b_ssevalue(""), b_ssetype(SSE_DISABLE), attempt_count(0), attempt_start(0), retry_wait_msec(0), hedge_owner(NULL)
 {
   type = REQTYPE_UNSET;
 }
@@ -1595,6 +2416,11 @@ bool S3fsCurl::ResetHandle(void)
   curl_easy_setopt(hCurl, CURLOPT_PROGRESSFUNCTION, S3fsCurl::CurlProgress);
   curl_easy_setopt(hCurl, CURLOPT_PROGRESSDATA, hCurl);
   // curl_easy_setopt(hCurl, CURLOPT_FORBID_REUSE, 1);
+  if(CURL_HTTP_VERSION_NONE != S3fsCurl::http_version){
+    curl_easy_setopt(hCurl, CURLOPT_HTTP_VERSION, S3fsCurl::http_version);
+    // wait for the connection which can be multiplexed, rather than make new one
+    curl_easy_setopt(hCurl, CURLOPT_PIPEWAIT, 1L);
+  }
 
   if((S3fsCurl::is_dns_cache || S3fsCurl::is_ssl_session_cache) && S3fsCurl::hCurlShare){
     curl_easy_setopt(hCurl, CURLOPT_SHARE, S3fsCurl::hCurlShare);
@@ -1611,16 +2437,21 @@ bool S3fsCurl::ResetHandle(void)
     }
   }
 
+  pthread_mutex_lock(&S3fsCurl::curl_handles_lock);
   S3fsCurl::curl_times[hCurl]    = time(0);
   S3fsCurl::curl_progress[hCurl] = progress_t(-1, -1);
+  pthread_mutex_unlock(&S3fsCurl::curl_handles_lock);
 
   return true;
 }
 
+//
+// GetHandler and ReturnHandler of the pool have their own lock, and
+// are called without curl_handles_lock, which protects only curl_times
+// and curl_progress.
+//
 bool S3fsCurl::CreateCurlHandle(bool force)
 {
-  pthread_mutex_lock(&S3fsCurl::curl_handles_lock);
-
   if(hCurl){
     if(!force){
       S3FS_PRN_WARN("already create handle.");
@@ -1640,8 +2471,6 @@ bool S3fsCurl::CreateCurlHandle(bool force)
   type = REQTYPE_UNSET;
   ResetHandle();
 
-  pthread_mutex_unlock(&S3fsCurl::curl_handles_lock);
-
   return true;
 }
 
@@ -1651,14 +2480,14 @@ bool S3fsCurl::DestroyCurlHandle(void)
     return false;
   }
   pthread_mutex_lock(&S3fsCurl::curl_handles_lock);
-
   S3fsCurl::curl_times.erase(hCurl);
   S3fsCurl::curl_progress.erase(hCurl);
+  pthread_mutex_unlock(&S3fsCurl::curl_handles_lock);
+
   sCurlPool->ReturnHandler(hCurl);
   hCurl = NULL;
   ClearInternalData();
 
-  pthread_mutex_unlock(&S3fsCurl::curl_handles_lock);
   return true;
 }
 
@@ -1685,6 +2514,8 @@ bool S3fsCurl::ClearInternalData(void)
     delete headdata;
     headdata = NULL;
   }
+  BodyCallback         = NULL;
+  pBodyParam           = NULL;
   LastResponseCode     = -1;
   postdata             = NULL;
   postdata_remaining   = 0;
@@ -1696,8 +2527,6 @@ bool S3fsCurl::ClearInternalData(void)
   b_partdata_size      = 0;
   partdata.clear();
 
-  S3FS_MALLOCTRIM(0);
-
   return true;
 }
 
@@ -1823,8 +2652,18 @@ bool S3fsCurl::RemakeHandle(void)
 
     case REQTYPE_LISTBUCKET:
       curl_easy_setopt(hCurl, CURLOPT_URL, url.c_str());
-      curl_easy_setopt(hCurl, CURLOPT_WRITEDATA, (void*)bodydata);
-      curl_easy_setopt(hCurl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+      if(BodyCallback){
+        // reset the receiver of body
+        if(!BodyCallback(NULL, 0, pBodyParam)){
+          S3FS_PRN_ERR("Could not reset BodyCallback.");
+          return false;
+        }
+        curl_easy_setopt(hCurl, CURLOPT_WRITEDATA, (void*)this);
+        curl_easy_setopt(hCurl, CURLOPT_WRITEFUNCTION, StreamBodyCallback);
+      }else{
+        curl_easy_setopt(hCurl, CURLOPT_WRITEDATA, (void*)bodydata);
+        curl_easy_setopt(hCurl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+      }
       curl_easy_setopt(hCurl, CURLOPT_HTTPHEADER, requestHeaders);
       break;
 
@@ -1891,212 +2730,476 @@ bool S3fsCurl::RemakeHandle(void)
       curl_easy_setopt(hCurl, CURLOPT_HTTPHEADER, requestHeaders);
       break;
 
-    default:
-      S3FS_PRN_ERR("request type is unknown(%d)", type);
-      return false;
+    default:
+      S3FS_PRN_ERR("request type is unknown(%d)", type);
+      return false;
+  }
+  return true;
+}
+
+//
+// returns curl return code
+//
+
+long S3fsCurl::GetRetryWait(void)
+{
+  long upper = std::min(static_cast<long>(RETRY_MAX_MSEC), std::max(static_cast<long>(RETRY_BASE_MSEC), retry_wait_msec * 3));
+  retry_wait_msec = RETRY_BASE_MSEC + (upper > RETRY_BASE_MSEC ? random() % (upper - RETRY_BASE_MSEC + 1) : 0);
+  return retry_wait_msec;
+}
+
+bool S3fsCurl::TakeRetryBudget(void)
+{
+  AutoLock lock(&S3fsCurl::retry_budget_lock);
+  if(S3fsCurl::retry_budget < RETRY_BUDGET_COST){
+    return false;
+  }
+  S3fsCurl::retry_budget -= RETRY_BUDGET_COST;
+  return true;
+}
+
+void S3fsCurl::ReturnRetryBudget(void)
+{
+  AutoLock lock(&S3fsCurl::retry_budget_lock);
+  S3fsCurl::retry_budget = std::min(S3fsCurl::retry_budget + RETRY_BUDGET_REFUND, static_cast<long>(RETRY_BUDGET_MAX));
+}
+
+//
+// Start new request, and reset the state of retrying.
+//
+void S3fsCurl::BeginRequest(void)
+{
+  // Add the user-agent info
+  requestHeaders = curl_slist_sort_insert(requestHeaders, "User-Agent", skUserAgent.c_str());
+  if(IS_S3FS_LOG_DBG()){
+    char* ptr_url = NULL;
+    curl_easy_getinfo(hCurl, CURLINFO_EFFECTIVE_URL , &ptr_url);
+    S3FS_PRN_DBG("connecting to URL %s", SAFESTRPTR(ptr_url));
+  }
+  attempt_count   = 0;
+  attempt_start   = time(NULL);
+  retry_wait_msec = 0;
+
+#ifdef TEST_COSFS
+  test_request_count = 0;
+#endif
+}
+
+//
+// Performs one attempt of the request.
+//
+// Returns 0 or -errno when the request is done, or S3FSCURL_RETRY when it
+// should be retried after wait_msec(the handle is already remade for it).
+// The caller waits by itself, so that a worker thread can perform other
+// requests while waiting.
+//
+int S3fsCurl::PerformAttempt(long& wait_msec)
+{
+  wait_msec = 0;
+  attempt_count++;
+
+#ifdef TEST_COSFS
+  test_request_count++;
+#endif
+  // Requests
+  long long start_usec = (S3fsStats::IsEnabled() ? S3fsStats::GetUsec() : 0);
+  CURLcode  curlCode   = PerformHandle();
+  sCurlPool->CountRequest(hCurl, get_url_host(url));
+  AddRequestStats(curlCode, start_usec);
+
+  // Check result
+  switch(curlCode){
+    case CURLE_OK:
+      // Need to look at the HTTP response code
+      if(0 != curl_easy_getinfo(hCurl, CURLINFO_RESPONSE_CODE, &LastResponseCode)){
+        S3FS_PRN_ERR("curl_easy_getinfo failed while trying to retrieve HTTP response code");
+        return -EIO;
+      }
+      if(400 > LastResponseCode){
+        S3FS_PRN_INFO3("HTTP response code %ld", LastResponseCode);
+        S3fsCurl::ReturnRetryBudget();
+        return 0;
+      }
+      if(500 <= LastResponseCode){
+        S3FS_PRN_INFO3("HTTP response code %ld", LastResponseCode);
+        wait_msec = GetRetryWait();
+        break;
+      }
+
+      // Service response codes which are >= 400 && < 500
+      switch(LastResponseCode){
+        case 400:
+          S3FS_PRN_INFO3("HTTP response code 400 was returned, returing EIO.");
+          S3FS_PRN_DBG("Body Text: %s", (bodydata ? bodydata->str() : ""));
+          return -EIO;
+
+        case 403:
+          S3FS_PRN_INFO3("HTTP response code 403 was returned, returning EPERM");
+          S3FS_PRN_DBG("Body Text: %s", (bodydata ? bodydata->str() : ""));
+          return -EPERM;
+
+        case 404:
+          S3FS_PRN_INFO3("HTTP response code 404 was returned, returning ENOENT");
+          S3FS_PRN_DBG("Body Text: %s", (bodydata ? bodydata->str() : ""));
+          return -ENOENT;
+
+        case 409:
+          S3FS_PRN_INFO3("HTTP response code 409 was returned, retry after waiting");
+          S3FS_PRN_DBG("Body Text: %s", (bodydata ? bodydata->str() : ""));
+          wait_msec = 100;
+          break;
+
+        default:
+          S3FS_PRN_INFO3("HTTP response code = %ld, returning EIO", LastResponseCode);
+          S3FS_PRN_DBG("Body Text: %s", (bodydata ? bodydata->str() : ""));
+          return -EIO;
+      }
+      break;
+
+    case CURLE_WRITE_ERROR:
+      S3FS_PRN_ERR("### CURLE_WRITE_ERROR");
+      wait_msec = GetRetryWait();
+      break;
+
+    case CURLE_OPERATION_TIMEDOUT:
+      S3FS_PRN_ERR("### CURLE_OPERATION_TIMEDOUT");
+      wait_msec = GetRetryWait();
+      break;
+
+    case CURLE_COULDNT_RESOLVE_HOST:
+      S3FS_PRN_ERR("### CURLE_COULDNT_RESOLVE_HOST");
+      wait_msec = GetRetryWait();
+      break;
+
+    case CURLE_COULDNT_CONNECT:
+      S3FS_PRN_ERR("### CURLE_COULDNT_CONNECT");
+      wait_msec = GetRetryWait();
+      break;
+
+    case CURLE_GOT_NOTHING:
+      S3FS_PRN_ERR("### CURLE_GOT_NOTHING");
+      wait_msec = GetRetryWait();
+      break;
+
+    case CURLE_ABORTED_BY_CALLBACK:
+      S3FS_PRN_ERR("### CURLE_ABORTED_BY_CALLBACK");
+      pthread_mutex_lock(&S3fsCurl::curl_handles_lock);
+      S3fsCurl::curl_times[hCurl] = time(0);
+      pthread_mutex_unlock(&S3fsCurl::curl_handles_lock);
+      break;
+
+    case CURLE_PARTIAL_FILE:
+      S3FS_PRN_ERR("### CURLE_PARTIAL_FILE");
+      wait_msec = GetRetryWait();
+      break;
+
+    case CURLE_SEND_ERROR:
+      S3FS_PRN_ERR("### CURLE_SEND_ERROR");
+      wait_msec = GetRetryWait();
+      break;
+
+    case CURLE_RECV_ERROR:
+      S3FS_PRN_ERR("### CURLE_RECV_ERROR");
+      wait_msec = GetRetryWait();
+      break;
+
+    case CURLE_SSL_CONNECT_ERROR:
+      S3FS_PRN_ERR("### CURLE_SSL_CONNECT_ERROR");
+      wait_msec = GetRetryWait();
+      break;
+
+    case CURLE_SSL_CACERT:
+      S3FS_PRN_ERR("### CURLE_SSL_CACERT");
+
+      // try to locate cert, if successful, then set the
+      // option and continue
+      if(0 == S3fsCurl::curl_ca_bundle.size()){
+        if(!S3fsCurl::LocateBundle()){
+          S3FS_PRN_CRIT("could not get CURL_CA_BUNDLE.");
+          return -EIO;
+        }
+        break; // retry with CAINFO
+      }
+      S3FS_PRN_CRIT("curlCode: %d  msg: %s", curlCode, curl_easy_strerror(curlCode));
+      return -EIO;
+
+#ifdef CURLE_PEER_FAILED_VERIFICATION
+    case CURLE_PEER_FAILED_VERIFICATION:
+      S3FS_PRN_ERR("### CURLE_PEER_FAILED_VERIFICATION");
+
+      first_pos = bucket.find_first_of(".");
+      if(first_pos != string::npos){
+        S3FS_PRN_INFO("curl returned a CURL_PEER_FAILED_VERIFICATION error");
+        S3FS_PRN_INFO("security issue found: buckets with periods in their name are incompatible with http");
+        S3FS_PRN_INFO("This check can be over-ridden by using the -o ssl_verify_hostname=0");
+        S3FS_PRN_INFO("The certificate will still be checked but the hostname will not be verified.");
+        S3FS_PRN_INFO("A more secure method would be to use a bucket name without periods.");
+      }else{
+        S3FS_PRN_INFO("my_curl_easy_perform: curlCode: %d -- %s", curlCode, curl_easy_strerror(curlCode));
+      }
+      return -EIO;
+#endif
+
+    // This should be invalid since curl option HTTP FAILONERROR is now off
+    case CURLE_HTTP_RETURNED_ERROR:
+      S3FS_PRN_ERR("### CURLE_HTTP_RETURNED_ERROR");
+
+      if(0 != curl_easy_getinfo(hCurl, CURLINFO_RESPONSE_CODE, &LastResponseCode)){
+        return -EIO;
+      }
+      S3FS_PRN_INFO3("HTTP response code =%ld", LastResponseCode);
+
+      // Let's try to retrieve the
+      if(404 == LastResponseCode){
+        return -ENOENT;
+      }
+      if(500 > LastResponseCode){
+        return -EIO;
+      }
+      break;
+
+    // Unknown CURL return code
+    default:
+      S3FS_PRN_CRIT("###curlCode: %d  msg: %s", curlCode, curl_easy_strerror(curlCode));
+      return -EIO;
+  }
+
+  // 1 attempt + retries...
+  if(S3fsCurl::retries <= attempt_count){
+    S3FS_PRN_ERR("### giving up");
+    return -EIO;
+  }
+  if(0 < S3fsCurl::retry_deadline && attempt_start + S3fsCurl::retry_deadline <= time(NULL) + wait_msec / 1000){
+    S3FS_PRN_ERR("### giving up, because retry deadline(%jd sec) is over", (intmax_t)S3fsCurl::retry_deadline);
+    return -EIO;
+  }
+  if(!S3fsCurl::TakeRetryBudget()){
+    S3FS_PRN_ERR("### giving up, because retry budget is used up");
+    return -EIO;
+  }
+  S3FS_PRN_INFO("### retrying after %ld msec...", wait_msec);
+  if(REQTYPE_UNSET != type){
+    stats_requests[type]->AddRetry();
+  }
+
+  if(!RemakeHandle()){
+    S3FS_PRN_INFO("Failed to reset handle and internal data for retrying.");
+    return -EIO;
   }
-  return true;
+  return S3FSCURL_RETRY;
 }
 
-//
-// returns curl return code
-//
-int S3fsCurl::RequestPerform(void)
+// Adds the attempt to the statistics of its type. The attempt which is
+// failed by curl or answered with error status is counted as an error.
+void S3fsCurl::AddRequestStats(CURLcode curlCode, long long start_usec)
 {
-  static const int max_retry_time_in_s = 10;
-  // Add the user-agent info
-  requestHeaders = curl_slist_sort_insert(requestHeaders, "User-Agent", skUserAgent.c_str());
-  if(IS_S3FS_LOG_DBG()){
-    char* ptr_url = NULL;
-    curl_easy_getinfo(hCurl, CURLINFO_EFFECTIVE_URL , &ptr_url);
-    S3FS_PRN_DBG("connecting to URL %s", SAFESTRPTR(ptr_url));
+  if(!S3fsStats::IsEnabled() || REQTYPE_UNSET == type){
+    return;
   }
-
-#ifdef TEST_COSFS
-  test_request_count = 0;
-#endif
-  // 1 attempt + retries...
-  for(int retrycnt = S3fsCurl::retries; 0 < retrycnt; retrycnt--){
-
-#ifdef TEST_COSFS
-	test_request_count++;
+  long code   = 0;
+  off_t bytes = 0;
+  if(CURLE_OK == curlCode){
+    curl_easy_getinfo(hCurl, CURLINFO_RESPONSE_CODE, &code);
+  }
+#if LIBCURL_VERSION_NUM >= 0x073700
+  curl_off_t download = 0;
+  curl_off_t upload   = 0;
+  curl_easy_getinfo(hCurl, CURLINFO_SIZE_DOWNLOAD_T, &download);
+  curl_easy_getinfo(hCurl, CURLINFO_SIZE_UPLOAD_T, &upload);
+  bytes = static_cast<off_t>(download + upload);
 #endif
-    // Requests
-	// XXX
-	//curl_easy_setopt(hCurl, CURLOPT_HEADERDATA, (void*)&responseHeaders);
-	//curl_easy_setopt(hCurl, CURLOPT_HEADERFUNCTION, HeaderCallback);
-    CURLcode curlCode = curl_easy_perform(hCurl);
-
-	// exponential backoff until max_retry_time_in_s
-	int retry_sleep_time_in_s = 2 * (retries - retrycnt + 1);
-	if (retry_sleep_time_in_s > max_retry_time_in_s) {
-		retry_sleep_time_in_s = max_retry_time_in_s;
-	}
-
-    // Check result
-    switch(curlCode){
-      case CURLE_OK:
-        // Need to look at the HTTP response code
-        if(0 != curl_easy_getinfo(hCurl, CURLINFO_RESPONSE_CODE, &LastResponseCode)){
-          S3FS_PRN_ERR("curl_easy_getinfo failed while trying to retrieve HTTP response code");
-          return -EIO;
-        }
-        if(400 > LastResponseCode){
-          S3FS_PRN_INFO3("HTTP response code %ld", LastResponseCode);
-          return 0;
-        }
-        if(500 <= LastResponseCode){
-          S3FS_PRN_INFO3("HTTP response code %ld", LastResponseCode);
-          sleep(retry_sleep_time_in_s);
-          break;
-        }
+  stats_requests[type]->Add(S3fsStats::GetUsec() - start_usec, (CURLE_OK != curlCode || 400 <= code), bytes);
+}
 
-        // Service response codes which are >= 400 && < 500
-        switch(LastResponseCode){
-          case 400:
-            S3FS_PRN_INFO3("HTTP response code 400 was returned, returing EIO.");
-            S3FS_PRN_DBG("Body Text: %s", (bodydata ? bodydata->str() : ""));
-            return -EIO;
-
-          case 403:
-            S3FS_PRN_INFO3("HTTP response code 403 was returned, returning EPERM");
-            S3FS_PRN_DBG("Body Text: %s", (bodydata ? bodydata->str() : ""));
-            return -EPERM;
-
-          case 404:
-            S3FS_PRN_INFO3("HTTP response code 404 was returned, returning ENOENT");
-            S3FS_PRN_DBG("Body Text: %s", (bodydata ? bodydata->str() : ""));
-            return -ENOENT;
-
-          case 409:
-            S3FS_PRN_INFO3("HTTP response code 409 was returned, retry after sleep");
-            S3FS_PRN_DBG("Body Text: %s", (bodydata ? bodydata->str() : ""));
-            usleep(100000);
-            break;
+// Returns the latency of the type of this request, if it should be hedged.
+LatencyHistogram* S3fsCurl::GetHedgeLatency(void)
+{
+  if(0 == S3fsCurl::hedge_percentile || !sCurlMux){
+    return NULL;
+  }
+  if(REQTYPE_HEAD == type){
+    return &S3fsCurl::hedge_latency_head;
+  }
+  if(REQTYPE_GET == type && 0 < b_partdata_size && b_partdata_size <= S3fsCurl::hedge_max_size){
+    return &S3fsCurl::hedge_latency_get;
+  }
+  return NULL;
+}
 
-          default:
-            S3FS_PRN_INFO3("HTTP response code = %ld, returning EIO", LastResponseCode);
-            S3FS_PRN_DBG("Body Text: %s", (bodydata ? bodydata->str() : ""));
-            return -EIO;
-        }
-        break;
+// Makes the hedge which sends the same request on another handle.
+// The hedge borrows requestHeaders, so the caller must clear it before
+// the hedge is destroyed.
+bool S3fsCurl::MakeHedge(S3fsCurl& hedge)
+{
+  if(!hedge.CreateCurlHandle(true)){
+    return false;
+  }
+  hedge.type                = type;
+  hedge.path                = path;
+  hedge.url                 = url;
+  hedge.requestHeaders      = requestHeaders;
+  hedge.partdata.fd         = partdata.fd;
+  hedge.b_partdata_startpos = b_partdata_startpos;
+  hedge.b_partdata_size     = b_partdata_size;
+  hedge.hedge_owner         = hedge_owner;
 
-      case CURLE_WRITE_ERROR:
-        S3FS_PRN_ERR("### CURLE_WRITE_ERROR");
-        sleep(retry_sleep_time_in_s);
-        break;
+  if(!hedge.RemakeHandle()){
+    return false;
+  }
+  if(CURL_HTTP_VERSION_NONE != S3fsCurl::http_version){
+    // a stream on the same HTTP/2 connection would be stuck with the request.
+    curl_easy_setopt(hedge.hCurl, CURLOPT_FRESH_CONNECT, 1L);
+  }
+  return true;
+}
 
-      case CURLE_OPERATION_TIMEDOUT:
-        S3FS_PRN_ERR("### CURLE_OPERATION_TIMEDOUT");
-        sleep(retry_sleep_time_in_s);
-        break;
+// Performs the request once. When the request should be hedged and it is
+// not answered within the percentile of latency of its type, the hedge is
+// sent, and the one which is answered first is taken.
+// Only HTTP/2 and hedged requests go through the multiplexer, the others
+// are performed on this thread by curl_easy_perform.
+CURLcode S3fsCurl::PerformHandle(void)
+{
+  bool              is_mux  = (sCurlMux && CURL_HTTP_VERSION_NONE != S3fsCurl::http_version);
+  LatencyHistogram* latency = GetHedgeLatency();
+  if(!latency){
+    return (is_mux ? sCurlMux->Perform(hCurl) : curl_easy_perform(hCurl));
+  }
 
-      case CURLE_COULDNT_RESOLVE_HOST:
-        S3FS_PRN_ERR("### CURLE_COULDNT_RESOLVE_HOST");
-        sleep(retry_sleep_time_in_s);
-        break;
+  long hedge_msec = 0;
+  pthread_mutex_lock(&S3fsCurl::hedge_lock);
+  if(HEDGE_MIN_SAMPLES <= latency->Count()){
+    hedge_msec = std::max(latency->Percentile(S3fsCurl::hedge_percentile), static_cast<long>(HEDGE_MIN_MSEC));
+  }
+  pthread_mutex_unlock(&S3fsCurl::hedge_lock);
 
-      case CURLE_COULDNT_CONNECT:
-        S3FS_PRN_ERR("### CURLE_COULDNT_CONNECT");
-        sleep(retry_sleep_time_in_s);
-        break;
+  struct timeval start;
+  gettimeofday(&start, NULL);
 
-      case CURLE_GOT_NOTHING:
-        S3FS_PRN_ERR("### CURLE_GOT_NOTHING");
-        sleep(retry_sleep_time_in_s);
-        break;
+  S3fsCurl*                 owner = NULL;
+  CurlMultiplexer::Transfer first(hCurl);
+  CURLcode                  result;
 
-      case CURLE_ABORTED_BY_CALLBACK:
-        S3FS_PRN_ERR("### CURLE_ABORTED_BY_CALLBACK");
-        // sleep(retry_sleep_time_in_s);
-        S3fsCurl::curl_times[hCurl] = time(0);
-        break;
+  hedge_owner = &owner;
+  if(0 == hedge_msec){
+    // not enough samples yet, only measures the latency.
+    result = (is_mux ? sCurlMux->Perform(hCurl) : curl_easy_perform(hCurl));
 
-      case CURLE_PARTIAL_FILE:
-        S3FS_PRN_ERR("### CURLE_PARTIAL_FILE");
-        sleep(retry_sleep_time_in_s);
-        break;
+  }else if(!sCurlMux->Submit(&first)){
+    result = CURLE_FAILED_INIT;
 
-      case CURLE_SEND_ERROR:
-        S3FS_PRN_ERR("### CURLE_SEND_ERROR");
-        sleep(retry_sleep_time_in_s);
-        break;
+  }else if(sCurlMux->Wait(&first, NULL, hedge_msec)){
+    sCurlMux->Wait(&first, NULL, -1);
+    result = first.result;
 
-      case CURLE_RECV_ERROR:
-        S3FS_PRN_ERR("### CURLE_RECV_ERROR");
-        sleep(retry_sleep_time_in_s);
-        break;
+  }else{
+    S3fsCurl                   hedge;
+    bool                       is_hedged = MakeHedge(hedge);
+    CurlMultiplexer::Transfer  second(hedge.hCurl);
+    CurlMultiplexer::Transfer* winner = &first;
+
+    if(is_hedged && sCurlMux->Submit(&second)){
+      S3FS_PRN_INFO3("send hedge after %ld msec [path=%s]", hedge_msec, path.c_str());
+      stats_hedge_sent.Add();
+
+      CurlMultiplexer::Transfer* done  = sCurlMux->Wait(&first, &second, -1);
+      CurlMultiplexer::Transfer* other = (done == &first ? &second : &first);
+      if(CURLE_OK == done->result){
+        sCurlMux->Cancel(other);
+        winner = done;
+      }else{
+        // the other may still be answered
+        sCurlMux->Wait(other, NULL, -1);
+        winner = (CURLE_OK == other->result ? other : &first);
+      }
+    }else{
+      sCurlMux->Wait(&first, NULL, -1);
+    }
+    if(winner == &second){
+      S3FS_PRN_INFO3("hedge is answered first [path=%s]", path.c_str());
+      stats_hedge_won.Add();
+      std::swap(hCurl, hedge.hCurl);
+      responseHeaders.swap(hedge.responseHeaders);
+    }
+    hedge.requestHeaders = NULL;
+    result = winner->result;
+  }
+  hedge_owner = NULL;
 
-      case CURLE_SSL_CONNECT_ERROR:
-        S3FS_PRN_ERR("### CURLE_SSL_CONNECT_ERROR");
-        sleep(retry_sleep_time_in_s);
-        break;
+  if(CURLE_OK == result){
+    struct timeval end;
+    gettimeofday(&end, NULL);
+    long msec = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
 
-      case CURLE_SSL_CACERT:
-        S3FS_PRN_ERR("### CURLE_SSL_CACERT");
+    pthread_mutex_lock(&S3fsCurl::hedge_lock);
+    latency->Add(msec);
+    pthread_mutex_unlock(&S3fsCurl::hedge_lock);
+  }
+  return result;
+}
 
-        // try to locate cert, if successful, then set the
-        // option and continue
-        if(0 == S3fsCurl::curl_ca_bundle.size()){
-          if(!S3fsCurl::LocateBundle()){
-            S3FS_PRN_CRIT("could not get CURL_CA_BUNDLE.");
-            return -EIO;
-          }
-          break; // retry with CAINFO
-        }
-        S3FS_PRN_CRIT("curlCode: %d  msg: %s", curlCode, curl_easy_strerror(curlCode));
-        return -EIO;
+int S3fsCurl::RequestPerform(void)
+{
+  BeginRequest();
 
-#ifdef CURLE_PEER_FAILED_VERIFICATION
-      case CURLE_PEER_FAILED_VERIFICATION:
-        S3FS_PRN_ERR("### CURLE_PEER_FAILED_VERIFICATION");
-
-        first_pos = bucket.find_first_of(".");
-        if(first_pos != string::npos){
-          S3FS_PRN_INFO("curl returned a CURL_PEER_FAILED_VERIFICATION error");
-          S3FS_PRN_INFO("security issue found: buckets with periods in their name are incompatible with http");
-          S3FS_PRN_INFO("This check can be over-ridden by using the -o ssl_verify_hostname=0");
-          S3FS_PRN_INFO("The certificate will still be checked but the hostname will not be verified.");
-          S3FS_PRN_INFO("A more secure method would be to use a bucket name without periods.");
-        }else{
-          S3FS_PRN_INFO("my_curl_easy_perform: curlCode: %d -- %s", curlCode, curl_easy_strerror(curlCode));
-        }
-        return -EIO;
-#endif
+  int  result;
+  long wait_msec = 0;
+  while(S3FSCURL_RETRY == (result = PerformAttempt(wait_msec))){
+    if(0 < wait_msec){
+      struct timespec sleeptime;
+      sleeptime.tv_sec  = wait_msec / 1000;
+      sleeptime.tv_nsec = (wait_msec % 1000) * 1000 * 1000;
+      nanosleep(&sleeptime, NULL);
+    }
+  }
+  return result;
+}
 
-      // This should be invalid since curl option HTTP FAILONERROR is now off
-      case CURLE_HTTP_RETURNED_ERROR:
-        S3FS_PRN_ERR("### CURLE_HTTP_RETURNED_ERROR");
+//
+// Returns the sign key and its q-key-time for the keys.
+//
+// The sign key is HMAC of q-key-time(valid for 1 hour) with the secret key,
+// so it is cached and reused for requests until the rest of its time gets
+// shorter than SIGN_KEY_MIN_REST_TIME.
+//
+#define SIGN_KEY_VALID_TIME     3700    // 1 hour + 100 sec(q-key-time starts 10 sec before)
+#define SIGN_KEY_MIN_REST_TIME  1800
 
-        if(0 != curl_easy_getinfo(hCurl, CURLINFO_RESPONSE_CODE, &LastResponseCode)){
-          return -EIO;
-        }
-        S3FS_PRN_INFO3("HTTP response code =%ld", LastResponseCode);
+bool S3fsCurl::GetSignKey(const string& accessKey, const string& secretKey, string& key_time, string& key)
+{
+  time_t   now = time(NULL);
+  AutoLock auto_lock(&S3fsCurl::sign_key_lock);
 
-        // Let's try to retrieve the
-        if(404 == LastResponseCode){
-          return -ENOENT;
-        }
-        if(500 > LastResponseCode){
-          return -EIO;
-        }
-        break;
+  if(S3fsCurl::sign_key_start <= now && now + SIGN_KEY_MIN_REST_TIME <= S3fsCurl::sign_key_end &&
+     accessKey == S3fsCurl::sign_key_ak && secretKey == S3fsCurl::sign_key_sk)
+  {
+    key_time = S3fsCurl::sign_key_time;
+    key      = S3fsCurl::sign_key;
+    return true;
+  }
 
-      // Unknown CURL return code
-      default:
-        S3FS_PRN_CRIT("###curlCode: %d  msg: %s", curlCode, curl_easy_strerror(curlCode));
-        return -EIO;
-    }
-    S3FS_PRN_INFO("### retrying...");
+  // make new sign key
+  time_t key_t_s = now - 10;
+  time_t key_t_e = key_t_s + SIGN_KEY_VALID_TIME;
+  string q_key_time = str(key_t_s) + ";" + str(key_t_e);
 
-    if(!RemakeHandle()){
-      S3FS_PRN_INFO("Failed to reset handle and internal data for retrying.");
-      return -EIO;
-    }
+  unsigned char* sign_key_raw = NULL;
+  unsigned int   sign_key_len = 0;
+  if(!s3fs_HMAC(secretKey.data(), secretKey.size(), reinterpret_cast<const unsigned char*>(q_key_time.data()), q_key_time.size(), &sign_key_raw, &sign_key_len)){
+    S3FS_PRN_ERR("could not make sign key.");
+    return false;
   }
-  S3FS_PRN_ERR("### giving up");
+  S3fsCurl::sign_key_ak    = accessKey;
+  S3fsCurl::sign_key_sk    = secretKey;
+  S3fsCurl::sign_key_time  = q_key_time;
+  S3fsCurl::sign_key       = s3fs_hex(sign_key_raw, sign_key_len);
+  S3fsCurl::sign_key_start = key_t_s;
+  S3fsCurl::sign_key_end   = key_t_e;
+  free(sign_key_raw);
 
-  return -EIO;
+  key_time = S3fsCurl::sign_key_time;
+  key      = S3fsCurl::sign_key;
+  return true;
 }
 
 //
@@ -2107,7 +3210,7 @@ int S3fsCurl::RequestPerform(void)
 // @param date e.g., get_date_rfc850()
 // @param resource e.g., "/pub"
 //
-string S3fsCurl::CalcSignature(string method, string strMD5, string content_type, string date, string resource, string query)
+string S3fsCurl::CalcSignature(const string& method, const string& strMD5, const string& content_type, const string& date, const string& resource, const string& query)
 {
   string Signature;
   string accessKey, secretKey, accessToken;
@@ -2130,28 +3233,28 @@ string S3fsCurl::CalcSignature(string method, string strMD5, string content_type
     S3fsCurl::GetAccessKey(accessKey, secretKey);
   }
 
-  const void* key            = secretKey.data();
-  int key_len                = secretKey.size();
-
   // first, get sign key
-  time_t key_t_s = time(NULL) - 10;
-  time_t key_t_e = key_t_s + 3700; // expired after 1 hour
-  ostringstream q_key_time_tmp;
-  q_key_time_tmp << key_t_s << ";" << key_t_e;
-  string q_key_time = q_key_time_tmp.str();
-  const unsigned char* kdata = reinterpret_cast<const unsigned char*>(q_key_time.data());
+  string q_key_time;
+  string sign_key;
+  if(!S3fsCurl::GetSignKey(accessKey, secretKey, q_key_time, sign_key)){
+    return Signature;
+  }
 
-  unsigned char* sign_key_raw = NULL;
-  unsigned int sign_key_len = 0;
-  s3fs_HMAC(key, key_len, kdata, q_key_time.size(), &sign_key_raw, &sign_key_len);
-  std::string sign_key = s3fs_hex(sign_key_raw, sign_key_len);
+  string canonical_params;
+  string param_keys;
+  string canonical_headers;
+  string header_keys;
+  get_canonical_params(query, canonical_params, param_keys);
+  get_canonical_headers(requestHeaders, canonical_headers, header_keys);
 
-  map<string, string> requestParams = get_params_from_query_string(query);
   string FormatString;
-  FormatString += lower(method) + "\n";
-  FormatString += resource + "\n";
-  FormatString += get_canonical_params(requestParams); // \n has been append
-  FormatString += get_canonical_headers(requestHeaders); // \n has been append
+  FormatString.reserve(method.size() + resource.size() + canonical_params.size() + canonical_headers.size() + 2);
+  FormatString += lower(method);
+  FormatString += '\n';
+  FormatString += resource;
+  FormatString += '\n';
+  FormatString += canonical_params;   // \n has been append
+  FormatString += canonical_headers;  // \n has been append
 
   const unsigned char* sdata = reinterpret_cast<const unsigned char*>(FormatString.data());
   int sdata_len              = FormatString.size();
@@ -2160,23 +3263,32 @@ string S3fsCurl::CalcSignature(string method, string strMD5, string content_type
 
   string format_string_sha1 = s3fs_sha1_hex(sdata, sdata_len, &md, &md_len);
   string StringToSign;
-  StringToSign += string("sha1\n");
-  StringToSign += q_key_time + "\n";
-  StringToSign += format_string_sha1 + "\n";
+  StringToSign.reserve(q_key_time.size() + format_string_sha1.size() + 7);
+  StringToSign += "sha1\n";
+  StringToSign += q_key_time;
+  StringToSign += '\n';
+  StringToSign += format_string_sha1;
+  StringToSign += '\n';
 
   unsigned char* sign_data     = NULL;
   unsigned int sign_len        = 0;
   s3fs_HMAC(sign_key.data(), sign_key.size(), reinterpret_cast<const unsigned char*>(StringToSign.data()), StringToSign.size(), &sign_data, &sign_len);
   string sign_data_hex = s3fs_hex(sign_data, sign_len);
 
-  Signature += "q-sign-algorithm=sha1&";
-  Signature += string("q-ak=") + accessKey + "&";
-  Signature += string("q-sign-time=") + q_key_time + "&";
-  Signature += string("q-key-time=") + q_key_time + "&q-url-param-list=" + get_canonical_param_keys(requestParams) + "&";
-  Signature += string("q-header-list=") + get_canonical_header_keys(requestHeaders) + "&";
-  Signature += string("q-signature=") + sign_data_hex;
+  Signature.reserve(128 + accessKey.size() + q_key_time.size() * 2 + param_keys.size() + header_keys.size() + sign_data_hex.size());
+  Signature += "q-sign-algorithm=sha1&q-ak=";
+  Signature += accessKey;
+  Signature += "&q-sign-time=";
+  Signature += q_key_time;
+  Signature += "&q-key-time=";
+  Signature += q_key_time;
+  Signature += "&q-url-param-list=";
+  Signature += param_keys;
+  Signature += "&q-header-list=";
+  Signature += header_keys;
+  Signature += "&q-signature=";
+  Signature += sign_data_hex;
 
-  free(sign_key_raw);
   free(md);
   free(sign_data);
   return Signature;
@@ -2748,7 +3860,11 @@ int S3fsCurl::CheckBucket(void)
   return result;
 }
 
-int S3fsCurl::ListBucketRequest(const char* tpath, const char* query)
+//
+// If callback is specified, the body of response is passed to it while it
+// is received, and it is not kept in bodydata.
+//
+int S3fsCurl::ListBucketRequest(const char* tpath, const char* query, S3fsCurlBodyCallback callback, void* param)
 {
   S3FS_PRN_INFO3("[tpath=%s]", SAFESTRPTR(tpath));
 
@@ -2786,8 +3902,15 @@ int S3fsCurl::ListBucketRequest(const char* tpath, const char* query)
 
   // setopt
   curl_easy_setopt(hCurl, CURLOPT_URL, url.c_str());
-  curl_easy_setopt(hCurl, CURLOPT_WRITEDATA, (void*)bodydata);
-  curl_easy_setopt(hCurl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+  BodyCallback = callback;
+  pBodyParam   = param;
+  if(BodyCallback){
+    curl_easy_setopt(hCurl, CURLOPT_WRITEDATA, (void*)this);
+    curl_easy_setopt(hCurl, CURLOPT_WRITEFUNCTION, StreamBodyCallback);
+  }else{
+    curl_easy_setopt(hCurl, CURLOPT_WRITEDATA, (void*)bodydata);
+    curl_easy_setopt(hCurl, CURLOPT_WRITEFUNCTION, WriteMemoryCallback);
+  }
   curl_easy_setopt(hCurl, CURLOPT_HTTPHEADER, requestHeaders);
 
   type = REQTYPE_LISTBUCKET;
@@ -3414,7 +4537,22 @@ int S3fsCurl::MultipartUploadRequest(const char* tpath, headers_t& meta, int fd,
 
 int S3fsCurl::MultipartUploadRequest(string upload_id, const char* tpath, int fd, off_t offset, size_t size, etaglist_t& list)
 {
-  S3FS_PRN_INFO3("[upload_id=%s][tpath=%s][fd=%d][offset=%jd][size=%jd]", upload_id.c_str(), SAFESTRPTR(tpath), fd, (intmax_t)offset, (intmax_t)size);
+  string etag;
+  int    result;
+  if(0 != (result = MultipartUploadRequest(upload_id, tpath, fd, offset, size, static_cast<int>(list.size() + 1), etag))){
+    return result;
+  }
+  list.push_back(etag);
+  return 0;
+}
+
+//
+// Upload one part by specified part number, so that parts can be
+// uploaded by multiple threads in any order.
+//
+int S3fsCurl::MultipartUploadRequest(const string& upload_id, const char* tpath, int fd, off_t offset, size_t size, int part_num, string& etag)
+{
+  S3FS_PRN_INFO3("[upload_id=%s][tpath=%s][fd=%d][offset=%jd][size=%jd][part=%d]", upload_id.c_str(), SAFESTRPTR(tpath), fd, (intmax_t)offset, (intmax_t)size, part_num);
 
   // duplicate fd
   int fd2;
@@ -3434,13 +4572,14 @@ int S3fsCurl::MultipartUploadRequest(string upload_id, const char* tpath, int fd
   b_partdata_size     = partdata.size;
 
   // upload part
-  int   result;
-  if(0 != (result = UploadMultipartPostRequest(tpath, (list.size() + 1), upload_id))){
+  int    result;
+  string tmp_upload_id(upload_id);
+  if(0 != (result = UploadMultipartPostRequest(tpath, part_num, tmp_upload_id))){
     S3FS_PRN_ERR("failed uploading part(%d)", result);
     close(fd2);
     return result;
   }
-  list.push_back(partdata.etag);
+  etag = partdata.etag;
   DestroyCurlHandle();
   close(fd2);
 
@@ -3522,7 +4661,36 @@ std::string S3fsCurl::GetClientInfo(std::string pid)
 //-------------------------------------------------------------------
 // Class method for S3fsMultiCurl
 //-------------------------------------------------------------------
-int S3fsMultiCurl::max_multireq = MAX_MULTI_HEADREQ;
+int             S3fsMultiCurl::max_multireq = MAX_MULTI_HEADREQ;
+CurlThreadPool* S3fsMultiCurl::sThreadPool  = NULL;
+
+bool S3fsMultiCurl::InitThreadPool(void)
+{
+  if(S3fsMultiCurl::sThreadPool){
+    return false;
+  }
+  // workers are shared by all multi requests, so that the pool is
+  // sized for the largest of readdir and parallel transfer fan-out.
+  int maxthreads = std::max(S3fsMultiCurl::max_multireq, S3fsCurl::GetMaxParallelCount());
+  S3fsMultiCurl::sThreadPool = new CurlThreadPool(std::max(maxthreads, 1));
+  if(!S3fsMultiCurl::sThreadPool->Init()){
+    delete S3fsMultiCurl::sThreadPool;
+    S3fsMultiCurl::sThreadPool = NULL;
+    return false;
+  }
+  return true;
+}
+
+bool S3fsMultiCurl::DestroyThreadPool(void)
+{
+  if(!S3fsMultiCurl::sThreadPool){
+    return false;
+  }
+  bool result = S3fsMultiCurl::sThreadPool->Destroy();
+  delete S3fsMultiCurl::sThreadPool;
+  S3fsMultiCurl::sThreadPool = NULL;
+  return result;
+}
 
 int S3fsMultiCurl::SetMaxMultiRequest(int max)
 {
@@ -3534,20 +4702,24 @@ int S3fsMultiCurl::SetMaxMultiRequest(int max)
 //-------------------------------------------------------------------
 // method for S3fsMultiCurl
 //-------------------------------------------------------------------
-S3fsMultiCurl::S3fsMultiCurl() : SuccessCallback(NULL), RetryCallback(NULL)
+S3fsMultiCurl::S3fsMultiCurl() : SuccessCallback(NULL), RetryCallback(NULL), NextCallback(NULL), pNextParam(NULL),
+    max_inflight(S3fsMultiCurl::max_multireq)
 {
+  pthread_mutex_init(&done_lock, NULL);
+  pthread_cond_init(&done_cond, NULL);
 }
 
 S3fsMultiCurl::~S3fsMultiCurl()
 {
   Clear();
+  pthread_cond_destroy(&done_cond);
+  pthread_mutex_destroy(&done_lock);
 }
 
 bool S3fsMultiCurl::ClearEx(bool is_all)
 {
-  s3fscurlmap_t::iterator iter;
-  for(iter = cMap_req.begin(); iter != cMap_req.end(); cMap_req.erase(iter++)){
-    S3fsCurl* s3fscurl = (*iter).second;
+  for(s3fscurlset_t::iterator iter = cSet_req.begin(); iter != cSet_req.end(); cSet_req.erase(iter++)){
+    S3fsCurl* s3fscurl = *iter;
     if(s3fscurl){
       s3fscurl->DestroyCurlHandle();
       delete s3fscurl;  // with destroy curl handle.
@@ -3555,13 +4727,13 @@ bool S3fsMultiCurl::ClearEx(bool is_all)
   }
 
   if(is_all){
+    s3fscurlmap_t::iterator iter;
     for(iter = cMap_all.begin(); iter != cMap_all.end(); cMap_all.erase(iter++)){
       S3fsCurl* s3fscurl = (*iter).second;
       s3fscurl->DestroyCurlHandle();
       delete s3fscurl;
     }
   }
-  S3FS_MALLOCTRIM(0);
 
   return true;
 }
@@ -3580,6 +4752,21 @@ S3fsMultiRetryCallback S3fsMultiCurl::SetRetryCallback(S3fsMultiRetryCallback fu
   return old;
 }
 
+S3fsMultiNextCallback S3fsMultiCurl::SetNextCallback(S3fsMultiNextCallback function, void* param)
+{
+  S3fsMultiNextCallback old = NextCallback;
+  NextCallback = function;
+  pNextParam   = param;
+  return old;
+}
+
+int S3fsMultiCurl::SetMaxInFlight(int count)
+{
+  int old = max_inflight;
+  max_inflight = (0 < count ? count : 1);
+  return old;
+}
+
 bool S3fsMultiCurl::SetS3fsCurlObject(S3fsCurl* s3fscurl)
 {
   if(!s3fscurl){
@@ -3592,152 +4779,161 @@ bool S3fsMultiCurl::SetS3fsCurlObject(S3fsCurl* s3fscurl)
   return true;
 }
 
+//
+// Hand requests over to the worker threads until max_inflight
+// requests are in flight. When all registered requests are sent,
+// the next ones are made by NextCallback.
+//
 int S3fsMultiCurl::MultiPerform(void)
 {
-  std::vector<pthread_t>   threads;
-  bool                     success = true;
-
-  for(s3fscurlmap_t::iterator iter = cMap_req.begin(); iter != cMap_req.end(); ++iter) {
-    pthread_t   thread;
-    S3fsCurl*   s3fscurl = (*iter).second;
-    int         rc;
-
-    rc = pthread_create(&thread, NULL, S3fsMultiCurl::RequestPerformWrapper, static_cast<void*>(s3fscurl));
-    if (rc != 0) {
-      success = false;
-      S3FS_PRN_ERR("failed pthread_create - rc(%d)", rc);
-      break;
+  while(static_cast<int>(cSet_req.size()) < max_inflight){
+    if(cMap_all.empty()){
+      S3fsCurl* nextcurl;
+      if(!NextCallback || NULL == (nextcurl = NextCallback(pNextParam))){
+        break;
+      }
+      cMap_all[nextcurl->hCurl] = nextcurl;
     }
+    s3fscurlmap_t::iterator iter     = cMap_all.begin();
+    S3fsCurl*               s3fscurl = (*iter).second;
 
-    threads.push_back(thread);
-  }
-
-  for (std::vector<pthread_t>::iterator iter = threads.begin(); iter != threads.end(); ++iter) {
-    void*   retval;
-    int     rc;
-
-    rc = pthread_join(*iter, &retval);
-    if (rc) {
-      success = false;
-      S3FS_PRN_ERR("failed pthread_join - rc(%d)", rc);
-    } else {
-      int int_retval = (int)(intptr_t)(retval);
-      if (int_retval) {
-        S3FS_PRN_ERR("thread failed - rc(%d)", int_retval);
-        success = false;
-      }
+    cMap_all.erase(iter);
+    if(!S3fsMultiCurl::sThreadPool || !S3fsMultiCurl::sThreadPool->Submit(s3fscurl, this)){
+      S3FS_PRN_ERR("could not submit request to thread pool(%s).", s3fscurl->url.c_str());
+      s3fscurl->DestroyCurlHandle();
+      delete s3fscurl;
+      return -EIO;
     }
+    cSet_req.insert(s3fscurl);
   }
-
-  return success ? 0 : -EIO;
+  return 0;
 }
 
-int S3fsMultiCurl::MultiRead(void)
+int S3fsMultiCurl::MultiRead(S3fsCurl* s3fscurl)
 {
-  for(s3fscurlmap_t::iterator iter = cMap_req.begin(); iter != cMap_req.end(); cMap_req.erase(iter++)) {
-    S3fsCurl* s3fscurl = (*iter).second;
+  bool isRetry = false;
 
-    bool isRetry = false;
-
-    long responseCode = -1;
-    if(s3fscurl->GetResponseCode(responseCode)){
-      if(400 > responseCode){
-        // add into stat cache
-        if(SuccessCallback && !SuccessCallback(s3fscurl)){
-          S3FS_PRN_WARN("error from callback function(%s).", s3fscurl->url.c_str());
-        }
-      }else if(400 == responseCode){
-        // as possibly in multipart
-        S3FS_PRN_WARN("failed a request(%ld: %s)", responseCode, s3fscurl->url.c_str());
-        isRetry = true;
-      }else if(404 == responseCode){
-        // not found
-        S3FS_PRN_WARN("failed a request(%ld: %s)", responseCode, s3fscurl->url.c_str());
-      }else if(500 == responseCode){
-        // case of all other result, do retry.(11/13/2013)
-        // because it was found that s3fs got 500 error from S3, but could success
-        // to retry it.
-        S3FS_PRN_WARN("failed a request(%ld: %s)", responseCode, s3fscurl->url.c_str());
-        isRetry = true;
-      }else{
-        // Retry in other case.
-        S3FS_PRN_WARN("failed a request(%ld: %s)", responseCode, s3fscurl->url.c_str());
-        isRetry = true;
+  long responseCode = -1;
+  if(s3fscurl->GetResponseCode(responseCode)){
+    if(400 > responseCode){
+      // add into stat cache
+      if(SuccessCallback && !SuccessCallback(s3fscurl)){
+        S3FS_PRN_WARN("error from callback function(%s).", s3fscurl->url.c_str());
       }
+    }else if(400 == responseCode){
+      // as possibly in multipart
+      S3FS_PRN_WARN("failed a request(%ld: %s)", responseCode, s3fscurl->url.c_str());
+      isRetry = true;
+    }else if(404 == responseCode){
+      // not found
+      S3FS_PRN_WARN("failed a request(%ld: %s)", responseCode, s3fscurl->url.c_str());
+    }else if(500 == responseCode){
+      // case of all other result, do retry.(11/13/2013)
+      // because it was found that s3fs got 500 error from S3, but could success
+      // to retry it.
+      S3FS_PRN_WARN("failed a request(%ld: %s)", responseCode, s3fscurl->url.c_str());
+      isRetry = true;
     }else{
-      S3FS_PRN_ERR("failed a request(Unknown response code: %s)", s3fscurl->url.c_str());
+      // Retry in other case.
+      S3FS_PRN_WARN("failed a request(%ld: %s)", responseCode, s3fscurl->url.c_str());
+      isRetry = true;
     }
+  }else{
+    S3FS_PRN_ERR("failed a request(Unknown response code: %s)", s3fscurl->url.c_str());
+  }
 
+  if(isRetry){
+    S3fsCurl* retrycurl = NULL;
 
-    if(!isRetry){
-      s3fscurl->DestroyCurlHandle();
-      delete s3fscurl;
-
-    }else{
-      S3fsCurl* retrycurl = NULL;
-
-      // For retry
-      if(RetryCallback){
-        retrycurl = RetryCallback(s3fscurl);
-        if(NULL != retrycurl){
-          cMap_all[retrycurl->hCurl] = retrycurl;
-        }else{
-          // Could not set up callback.
-          return -EIO;
-        }
-      }
-      if(s3fscurl != retrycurl){
+    // For retry
+    if(RetryCallback){
+      retrycurl = RetryCallback(s3fscurl);
+      if(NULL != retrycurl){
+        cMap_all[retrycurl->hCurl] = retrycurl;
+      }else{
+        // Could not set up callback.
         s3fscurl->DestroyCurlHandle();
         delete s3fscurl;
+        return -EIO;
       }
     }
+    if(s3fscurl == retrycurl){
+      return 0;
+    }
   }
+  s3fscurl->DestroyCurlHandle();
+  delete s3fscurl;
+
   return 0;
 }
 
+// called by worker threads
+void S3fsMultiCurl::RequestDone(S3fsCurl* s3fscurl, int result)
+{
+  pthread_mutex_lock(&done_lock);
+  cList_done.push_back(std::make_pair(s3fscurl, result));
+  pthread_cond_signal(&done_cond);
+  pthread_mutex_unlock(&done_lock);
+}
+
+S3fsCurl* S3fsMultiCurl::WaitRequestDone(int& result)
+{
+  pthread_mutex_lock(&done_lock);
+  while(cList_done.empty()){
+    pthread_cond_wait(&done_cond, &done_lock);
+  }
+  S3fsCurl* s3fscurl = cList_done.front().first;
+  result             = cList_done.front().second;
+  cList_done.pop_front();
+  pthread_mutex_unlock(&done_lock);
+
+  return s3fscurl;
+}
+
 int S3fsMultiCurl::Request(void)
 {
-  int result;
+  int result = 0;
 
   S3FS_PRN_INFO3("[count=%zu]", cMap_all.size());
 
-  // Make request list.
   //
   // Send multi request loop( with retry )
-  // (When many request is sends, sometimes gets "Couldn't connect to server")
   //
-  while(!cMap_all.empty()){
-    // set curl handle to multi handle
-    int                     cnt;
-    s3fscurlmap_t::iterator iter;
-    for(cnt = 0, iter = cMap_all.begin(); cnt < S3fsMultiCurl::max_multireq && iter != cMap_all.end(); cMap_all.erase(iter++), cnt++){
-      CURL*     hCurl    = (*iter).first;
-      S3fsCurl* s3fscurl = (*iter).second;
-
-      cMap_req[hCurl] = s3fscurl;
+  // Requests are kept in flight up to max_inflight, and each finished
+  // request is read as soon as it completes, so that one slow request
+  // does not hold back the others.
+  //
+  while(true){
+    // Send multi request.(stop sending after an error)
+    if(0 == result){
+      result = MultiPerform();
+    }
+    if(cSet_req.empty()){
+      break;
     }
 
-    // Send multi request.
-    if(0 != (result = MultiPerform())){
-      Clear();
-      return result;
+    // Wait for one of the requests
+    int       perform_result;
+    S3fsCurl* s3fscurl = WaitRequestDone(perform_result);
+    cSet_req.erase(s3fscurl);
+
+    if(0 != perform_result){
+      S3FS_PRN_ERR("thread failed - rc(%d)", perform_result);
+      s3fscurl->DestroyCurlHandle();
+      delete s3fscurl;
+      result = -EIO;
+      continue;
     }
 
     // Read the result
-    if(0 != (result = MultiRead())){
-      Clear();
-      return result;
+    if(0 != MultiRead(s3fscurl)){
+      result = -EIO;
     }
-
-    // Cleanup curl handle in multi handle
-    ClearEx(false);
   }
-  return 0;
-}
-
-// thread function for performing an S3fsCurl request
-void* S3fsMultiCurl::RequestPerformWrapper(void* arg) {
-  return (void*)(intptr_t)(static_cast<S3fsCurl*>(arg)->RequestPerform());
+  if(0 != result){
+    Clear();
+  }
+  return result;
 }
 
 //-------------------------------------------------------------------
@@ -3890,7 +5086,6 @@ struct curl_slist* AdditionalHeader::AddHeader(struct curl_slist* list, const ch
     list = curl_slist_sort_insert(list, iter->first.c_str(), iter->second.c_str());
   }
   meta.clear();
-  S3FS_MALLOCTRIM(0);
   return list;
 }
 
@@ -4106,6 +5301,63 @@ string get_canonical_headers(const struct curl_slist* list)
   return canonical_headers;
 }
 
+//
+// Make canonical headers and header keys at once for signature, the results
+// are same as get_canonical_headers and get_canonical_header_keys.
+//
+void get_canonical_headers(const struct curl_slist* list, string& headers, string& keys)
+{
+  headers.erase();
+  keys.erase();
+
+  for( ; list; list = list->next){
+    const char* data  = list->data;
+    const char* colon = strchr(data, ':');
+    const char* kbeg  = data;
+    const char* kend  = colon ? colon : data + strlen(data);
+
+    // trim and lower key
+    while(kbeg < kend && strchr(SPACES, *kbeg)){
+      ++kbeg;
+    }
+    while(kbeg < kend && strchr(SPACES, *(kend - 1))){
+      --kend;
+    }
+    string strkey(kbeg, kend - kbeg);
+    for(string::iterator iter = strkey.begin(); iter != strkey.end(); ++iter){
+      *iter = tolower(*iter);
+    }
+    if(!is_signed_header(strkey)){
+      continue;
+    }
+    if(colon){
+      // trim value
+      const char* vbeg = colon + 1;
+      const char* vend = colon + strlen(colon);
+      while(vbeg < vend && strchr(SPACES, *vbeg)){
+        ++vbeg;
+      }
+      while(vbeg < vend && strchr(SPACES, *(vend - 1))){
+        --vend;
+      }
+      if(vbeg == vend){
+        continue;
+      }
+      if(!headers.empty()){
+        headers += '&';
+      }
+      headers += strkey;
+      headers += '=';
+      headers += urlEncodeForSign(string(vbeg, vend - vbeg));
+    }
+    if(!keys.empty()){
+      keys += ';';
+    }
+    keys += strkey;
+  }
+  headers += '\n';
+}
+
 string get_canonical_header_keys(const struct curl_slist* list)
 {
   string canonical_headers;
@@ -4141,6 +5393,15 @@ string get_canonical_header_keys(const struct curl_slist* list)
 }
 
 
+// returns host(and port) part of url
+string get_url_host(const string& url)
+{
+  string::size_type start = url.find("://");
+  start = (string::npos == start ? 0 : start + 3);
+  string::size_type end = url.find('/', start);
+  return url.substr(start, (string::npos == end ? string::npos : end - start));
+}
+
 // function for using global values
 bool MakeUrlResource(const char* realpath, string& resourcepath, string& url)
 {
@@ -4211,7 +5472,7 @@ bool is_signed_header(const string &key) {
     key == "range") {
     return true;
   }
-  if (key.substr(0, 5) == "x-cos") {
+  if (0 == key.compare(0, 5, "x-cos")) {
     return true;
   }
   return false;
@@ -4221,20 +5482,20 @@ map<string, string> get_params_from_query_string(const string &query)
 {
   map<string, string> params;
 
-  stringstream ss(query);
-  string subquery;
-  while (getline(ss, subquery, '&')) {
-    if (!subquery.empty()) {
-      size_t pos;
-      string key, val;
-      if (string::npos != (pos = subquery.find('=', 0))) {
-        key = subquery.substr(0, pos);
-        val = urlDecode(subquery.substr(pos + 1));
+  for (string::size_type start = 0; start < query.size(); ) {
+    string::size_type end = query.find('&', start);
+    if (string::npos == end) {
+      end = query.size();
+    }
+    if (start < end) {
+      string::size_type pos = query.find('=', start);
+      if (string::npos != pos && pos < end) {
+        params[query.substr(start, pos - start)] = urlDecode(query.substr(pos + 1, end - pos - 1));
       } else {
-        key = subquery;
+        params[query.substr(start, end - start)] = "";
       }
-      params[key] = val;
     }
+    start = end + 1;
   }
   return params;
 }
@@ -4256,6 +5517,33 @@ string get_canonical_params(const map<string, string> &requestParams)
   return canonical_params;
 }
 
+//
+// Make canonical params and param keys at once for signature, the results
+// are same as get_canonical_params and get_canonical_param_keys.
+//
+void get_canonical_params(const string& query, string& params, string& keys)
+{
+  params.erase();
+  keys.erase();
+
+  if(!query.empty()){
+    map<string, string> requestParams = get_params_from_query_string(query);
+    for(map<string, string>::const_iterator iter = requestParams.begin(); iter != requestParams.end(); ++iter){
+      string strkey = lower(urlEncodeForSign(iter->first));
+      if(!params.empty()){
+        params += '&';
+        keys   += ';';
+      }
+      // value has been encoded
+      params += strkey;
+      params += '=';
+      params += urlEncodeForSign(iter->second);
+      keys   += strkey;
+    }
+  }
+  params += '\n';
+}
+
 string get_canonical_param_keys(const map<string, string> &requestParams)
 {
   string canonical_params;
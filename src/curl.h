@@ -21,12 +21,16 @@
 #define S3FS_CURL_H_
 
 #include <cassert>
+#include <set>
 
 //----------------------------------------------
 // Symbols
 //----------------------------------------------
 #define MIN_MULTIPART_SIZE          1048576           // 5MB
 
+// S3fsCurl::PerformAttempt() returns this when the request should be retried
+#define S3FSCURL_RETRY              1
+
 //----------------------------------------------
 // class BodyData
 //----------------------------------------------
@@ -108,6 +112,21 @@ struct filepart
   }
 };
 
+// Range information for making part requests one by one in parallel transfer
+struct parallelpart
+{
+  const char* path;         // target object path
+  int         fd;           // base file descriptor
+  off_t       startpos;     // start position of next part
+  off_t       remaining;    // remaining bytes which are not requested yet
+  int         result;       // result of setting up part request
+  std::string upload_id;    // use only parallel upload
+  etaglist_t* etaglist;     // use only parallel upload
+
+  parallelpart(const char* tpath, int tfd, off_t start, off_t size)
+    : path(tpath), fd(tfd), startpos(start), remaining(size), result(0), etaglist(NULL) {}
+};
+
 // for progress
 struct case_insensitive_compare_func
 {
@@ -120,11 +139,34 @@ typedef std::pair<double, double>   progress_t;
 typedef std::map<CURL*, time_t>     curltime_t;
 typedef std::map<CURL*, progress_t> curlprogress_t;
 
+class S3fsCurl;
 class S3fsMultiCurl;
 
+// callback for receiving body of response in stream(data is NULL when retrying, then the callback resets itself)
+typedef bool (*S3fsCurlBodyCallback)(const char* data, size_t size, void* param);
+
 //----------------------------------------------
 // class CurlHandlerPool
 //----------------------------------------------
+// Idle curl handles keep their connections alive, so that
+// a handle from the pool can send a request without new
+// connection(and TLS handshake). The pool keeps up to
+// maxHandlers handles. When all of them are used, GetHandler
+// does not wait, because callers may hold some handles, and
+// makes an overflow handle, which is destroyed when returned.
+//
+
+// statistics of requests and connections for each host
+struct curl_conn_stats
+{
+  unsigned long long requests;      // performed requests
+  unsigned long long reused;        // requests on reused connection
+  unsigned long long connects;      // new connections
+  unsigned long long handshakes;    // new connections with TLS handshake
+
+  curl_conn_stats() : requests(0), reused(0), connects(0), handshakes(0) {}
+};
+typedef std::map<std::string, curl_conn_stats> curlconnstats_t;   // key is host
 
 class CurlHandlerPool
 {
@@ -133,6 +175,8 @@ public:
     : mMaxHandlers(maxHandlers)
     , mHandlers(NULL)
     , mIndex(-1)
+    , mCount(0)
+    , mOverflows(0)
   {
     assert(maxHandlers > 0);
   }
@@ -143,12 +187,163 @@ public:
   CURL* GetHandler();
   void ReturnHandler(CURL* h);
 
+  void CountRequest(CURL* h, const std::string& host);
+  void LogStats();
+
 private:
   int mMaxHandlers;
 
   pthread_mutex_t mLock;
   CURL** mHandlers;
   int mIndex;
+  int mCount;                       // pooled handles which are made(in pool or used)
+  std::set<CURL*> mOverflowHandles; // used handles which are not pooled
+  unsigned long long mOverflows;    // count of overflow handles
+  curlconnstats_t mStats;
+};
+
+//----------------------------------------------
+// class LatencyHistogram
+//----------------------------------------------
+// Latencies of requests in buckets of powers of 2 msec,
+// bucket i has [2^(i-1), 2^i) msec(bucket 0 has < 1msec).
+// Percentile is interpolated linearly in the bucket.
+// All counts are halved at LATENCY_DECAY_COUNT samples,
+// so that old samples fade out.
+// [NOTE] the caller must lock it.
+//
+#define LATENCY_BUCKETS         24
+#define LATENCY_DECAY_COUNT     10000
+
+class LatencyHistogram
+{
+public:
+  LatencyHistogram();
+
+  void Add(long msec);
+  long Percentile(int percent) const;
+  unsigned long long Count() const { return mCount; }
+
+private:
+  unsigned long long mBuckets[LATENCY_BUCKETS];
+  unsigned long long mCount;
+};
+
+//----------------------------------------------
+// class CurlMultiplexer
+//----------------------------------------------
+// Performs the requests of easy handles on one shared multi
+// handle, so that the concurrent requests are multiplexed
+// over a few HTTP/2 connections. The caller of Perform()
+// blocks until its request is done, as curl_easy_perform().
+// The worker thread is started at the first Perform().
+// Submit()/Wait()/Cancel() are for the caller which runs
+// two transfers at once, such as a hedged request.
+//
+// [NOTE]
+// curl_multi_poll/curl_multi_wakeup need libcurl 7.68.0.
+//
+#if LIBCURL_VERSION_NUM >= 0x074400
+#define HAVE_CURL_MULTIPLEX     1
+#endif
+
+class CurlMultiplexer
+{
+public:
+  CurlMultiplexer()
+    : mMulti(NULL)
+    , mIsStarted(false)
+    , mIsExit(false)
+  {
+  }
+
+  struct Transfer
+  {
+    CURL*    hCurl;
+    CURLcode result;
+    bool     is_done;
+
+    explicit Transfer(CURL* h) : hCurl(h), result(CURLE_OK), is_done(false) {}
+  };
+
+  bool Init();
+  bool Destroy();
+
+  CURLcode Perform(CURL* h);
+
+  bool Submit(Transfer* transfer);
+  Transfer* Wait(Transfer* first, Transfer* second, long msec);
+  void Cancel(Transfer* transfer);
+
+private:
+  typedef std::list<Transfer*>        transferlist_t;
+  typedef std::map<CURL*, Transfer*>  transfermap_t;
+
+  bool StartWorker();
+  void Done(Transfer* transfer, CURLcode result);
+  static void* Worker(void* arg);
+
+  CURLM* mMulti;
+
+  pthread_mutex_t mLock;
+  pthread_cond_t mCond;
+  transferlist_t mPending;          // not added to multi handle yet
+  transferlist_t mCancels;          // to be removed from multi handle
+  transfermap_t mRunning;           // only accessed by worker
+  pthread_t mThread;
+  bool mIsStarted;
+  bool mIsExit;
+};
+
+//----------------------------------------------
+// class CurlThreadPool
+//----------------------------------------------
+// Long-lived worker threads which perform the requests
+// of S3fsMultiCurl. Workers are started at the first
+// Submit(), so that they are created after fuse has
+// daemonized the process.
+// A request which needs to be retried is put back to the
+// delayed jobs until its retry time instead of sleeping,
+// so the worker can perform other requests meanwhile.
+//
+class CurlThreadPool
+{
+public:
+  explicit CurlThreadPool(int maxThreads)
+    : mMaxThreads(maxThreads)
+    , mIsExit(false)
+  {
+    assert(maxThreads > 0);
+  }
+
+  bool Init();
+  bool Destroy();
+
+  bool Submit(S3fsCurl* s3fscurl, S3fsMultiCurl* owner);
+
+private:
+  struct Job
+  {
+    S3fsCurl*      s3fscurl;
+    S3fsMultiCurl* owner;
+    bool           started;
+
+    Job(S3fsCurl* curl, S3fsMultiCurl* multi) : s3fscurl(curl), owner(multi), started(false) {}
+  };
+  typedef std::multimap<long long, Job> delayjobs_t;    // key is the time(msec) to retry
+
+  bool StartWorkers();
+  static long long GetNowMsec();
+  static void* Worker(void* arg);
+
+  int mMaxThreads;
+
+  pthread_mutex_t mLock;
+  pthread_cond_t mCond;
+  std::list<Job> mJobs;
+  delayjobs_t mDelayJobs;
+  std::vector<pthread_t> mThreads;
+  bool mIsExit;
 };
 
 //----------------------------------------------
@@ -209,6 +404,8 @@ class S3fsCurl
     static bool             is_initglobal_done;
     static CurlHandlerPool* sCurlPool;
     static int              sCurlPoolSize;
+    static CurlMultiplexer* sCurlMux;
+    static long             http_version;            // CURL_HTTP_VERSION_*
     static CURLSH*          hCurlShare;
     static bool             is_cert_check;
     static bool             is_dns_cache;
@@ -231,6 +428,21 @@ class S3fsCurl
     static time_t           COSAccessTokenExpire;
     static std::string      CAM_role;
     static std::string      CAM_role_url;
+    static pthread_mutex_t  sign_key_lock;
+    static std::string      sign_key_ak;             // access key of cached sign key
+    static std::string      sign_key_sk;             // secret key of cached sign key
+    static std::string      sign_key_time;           // q-key-time of cached sign key
+    static std::string      sign_key;                // cached sign key
+    static time_t           sign_key_start;
+    static time_t           sign_key_end;
+    static time_t           retry_deadline;          // limit time for retrying a request(0 is not limited)
+    static pthread_mutex_t  retry_budget_lock;
+    static long             retry_budget;            // shared by all requests
+    static int              hedge_percentile;        // latency percentile for hedging(0 is disabled)
+    static off_t            hedge_max_size;          // max size of get request for hedging
+    static pthread_mutex_t  hedge_lock;
+    static LatencyHistogram hedge_latency_head;
+    static LatencyHistogram hedge_latency_get;
     static long             ssl_verify_hostname;
     static curltime_t       curl_times;
     static curlprogress_t   curl_progress;
@@ -253,6 +465,8 @@ class S3fsCurl
     headers_t            responseHeaders;      // header data by HeaderCallback
     BodyData*            bodydata;             // body data by WriteMemoryCallback
     BodyData*            headdata;             // header data by WriteMemoryCallback
+    S3fsCurlBodyCallback BodyCallback;         // callback for body in stream instead of bodydata(only success response)
+    void*                pBodyParam;           // parameter for BodyCallback
     long                 LastResponseCode;
     const unsigned char* postdata;             // use by post method and read callback function.
     int                  postdata_remaining;   // use by post method and read callback function.
@@ -268,6 +482,10 @@ class S3fsCurl
     std::string          b_ssevalue;           // backup for retrying
     sse_type_t           b_ssetype;            // backup for retrying
     int                  test_request_count;   // request count for test
+    int                  attempt_count;        // attempts of current request
+    time_t               attempt_start;        // time of the first attempt
+    long                 retry_wait_msec;      // last wait for retrying
+    S3fsCurl**           hedge_owner;          // request which writes body, shared with hedge
   public:
     // constructor/destructor
     explicit S3fsCurl(bool ahbe = false);
@@ -289,27 +507,38 @@ class S3fsCurl
     static bool LocateBundle(void);
     static size_t HeaderCallback(void *data, size_t blockSize, size_t numBlocks, void *userPtr);
     static size_t WriteMemoryCallback(void *ptr, size_t blockSize, size_t numBlocks, void *data);
+    static size_t StreamBodyCallback(void *ptr, size_t blockSize, size_t numBlocks, void *data);
     static size_t ReadCallback(void *ptr, size_t size, size_t nmemb, void *userp);
     static size_t UploadReadCallback(void *ptr, size_t size, size_t nmemb, void *userp);
     static size_t DownloadWriteCallback(void* ptr, size_t size, size_t nmemb, void* userp);
 
     static bool UploadMultipartPostCallback(S3fsCurl* s3fscurl);
     static S3fsCurl* UploadMultipartPostRetryCallback(S3fsCurl* s3fscurl);
+    static S3fsCurl* UploadMultipartPostNextCallback(void* param);
     static S3fsCurl* ParallelGetObjectRetryCallback(S3fsCurl* s3fscurl);
+    static S3fsCurl* ParallelGetObjectNextCallback(void* param);
 
     static bool ParseRAMCredentialResponse(const char* response, ramcredmap_t& keyval);
     static bool SetRAMCredentials(const char* response);
     static bool LoadEnvSseCKeys(void);
     static bool LoadEnvSseKmsid(void);
     static bool PushbackSseKeys(std::string& onekey);
+    static bool GetSignKey(const std::string& accessKey, const std::string& secretKey, std::string& key_time, std::string& key);
+    static bool TakeRetryBudget(void);
+    static void ReturnRetryBudget(void);
 
     static int CurlDebugFunc(CURL* hcurl, curl_infotype type, char* data, size_t size, void* userptr);
 
     // methods
     bool ResetHandle(void);
     bool RemakeHandle(void);
+    long GetRetryWait(void);
+    LatencyHistogram* GetHedgeLatency(void);
+    bool MakeHedge(S3fsCurl& hedge);
+    CURLcode PerformHandle(void);
+    void AddRequestStats(CURLcode curlCode, long long start_usec);
     bool ClearInternalData(void);
-    std::string CalcSignature(std::string method, std::string strMD5, std::string content_type, std::string date, std::string resource, std::string query);
+    std::string CalcSignature(const std::string& method, const std::string& strMD5, const std::string& content_type, const std::string& date, const std::string& resource, const std::string& query);
     bool GetUploadId(std::string& upload_id);
     int GetRAMCredentials(void);
 
@@ -334,6 +563,7 @@ class S3fsCurl
     static time_t SetReadwriteTimeout(time_t timeout);
     static time_t GetReadwriteTimeout(void) { return S3fsCurl::readwrite_timeout; }
     static int SetRetries(int count);
+    static time_t SetRetryDeadline(time_t sec);
     static bool SetPublicBucket(bool flag);
     static bool IsPublicBucket(void) { return S3fsCurl::is_public_bucket; }
     static std::string SetDefaultAcl(const char* acl);
@@ -369,6 +599,12 @@ class S3fsCurl
     static long SetSslVerifyHostname(long value);
     static long GetSslVerifyHostname(void) { return S3fsCurl::ssl_verify_hostname; }
     static int SetMaxParallelCount(int value);
+    static int SetMaxCurlHandles(int value);
+    static int WarmupConnections(int count);
+    static bool SetHttp2(bool prior_knowledge);
+    static long GetHttpVersion(void) { return S3fsCurl::http_version; }
+    static bool SetHedgePercentile(int percent);
+    static off_t SetHedgeMaxSize(off_t size);
     static int GetMaxParallelCount(void) { return S3fsCurl::max_parallel_cnt; }
     static std::string SetCAMRole(const char* role);
     static const char* GetRAMRole(void) { return S3fsCurl::CAM_role.c_str(); }
@@ -388,6 +624,8 @@ class S3fsCurl
     bool AddSseRequestHead(sse_type_t ssetype, std::string& ssevalue, bool is_only_c, bool is_copy);
     bool GetResponseCode(long& responseCode);
     int RequestPerform(void);
+    void BeginRequest(void);
+    int PerformAttempt(long& wait_msec);
     int DeleteRequest(const char* tpath, int pid);
     bool PreHeadRequest(const char* tpath, const char* bpath = NULL, const char* savedpath = NULL, int ssekey_pos = -1);
     bool PreHeadRequest(std::string& tpath, std::string& bpath, std::string& savedpath, int ssekey_pos = -1) {
@@ -399,7 +637,7 @@ class S3fsCurl
     int PreGetObjectRequest(const char* tpath, int fd, off_t start, ssize_t size, sse_type_t ssetype, std::string& ssevalue);
     int GetObjectRequest(const char* tpath, int fd, off_t start = -1, ssize_t size = -1);
     int CheckBucket(void);
-    int ListBucketRequest(const char* tpath, const char* query);
+    int ListBucketRequest(const char* tpath, const char* query, S3fsCurlBodyCallback callback = NULL, void* param = NULL);
     int PreMultipartPostRequest(const char* tpath, headers_t& meta, std::string& upload_id, bool is_copy);
     int CompleteMultipartPostRequest(const char* tpath, std::string& upload_id, etaglist_t& parts);
     int UploadMultipartPostRequest(const char* tpath, int part_num, std::string& upload_id);
@@ -408,6 +646,7 @@ class S3fsCurl
     int MultipartHeadRequest(const char* tpath, off_t size, headers_t& meta, bool is_copy);
     int MultipartUploadRequest(const char* tpath, headers_t& meta, int fd, bool is_copy);
     int MultipartUploadRequest(std::string upload_id, const char* tpath, int fd, off_t offset, size_t size, etaglist_t& list);
+    int MultipartUploadRequest(const std::string& upload_id, const char* tpath, int fd, off_t offset, size_t size, int part_num, std::string& etag);
     int MultipartRenameRequest(const char* from, const char* to, headers_t& meta, off_t size);
 
     // methods(valiables)
@@ -437,36 +676,55 @@ class S3fsCurl
 // Class for lapping multi curl
 //
 typedef std::map<CURL*, S3fsCurl*> s3fscurlmap_t;
+typedef std::set<S3fsCurl*> s3fscurlset_t;     // keyed by object, because hedged request swaps its handle
 typedef bool (*S3fsMultiSuccessCallback)(S3fsCurl* s3fscurl);    // callback for succeed multi request
 typedef S3fsCurl* (*S3fsMultiRetryCallback)(S3fsCurl* s3fscurl); // callback for failure and retrying
+typedef S3fsCurl* (*S3fsMultiNextCallback)(void* param);         // callback for making next request(NULL means no more request)
+
+typedef std::list<std::pair<S3fsCurl*, int> > s3fscurldone_t; // finished request and its result
 
 class S3fsMultiCurl
 {
+    friend class CurlThreadPool;
+
   private:
-    static int    max_multireq;
+    static int             max_multireq;
+    static CurlThreadPool* sThreadPool;
 
     CURLM*        hMulti;
     s3fscurlmap_t cMap_all;  // all of curl requests
-    s3fscurlmap_t cMap_req;  // curl requests are sent
+    s3fscurlset_t cSet_req;  // curl requests are sent
+
+    pthread_mutex_t done_lock;
+    pthread_cond_t  done_cond;
+    s3fscurldone_t  cList_done; // requests finished by worker threads
 
     S3fsMultiSuccessCallback SuccessCallback;
     S3fsMultiRetryCallback   RetryCallback;
+    S3fsMultiNextCallback    NextCallback;
+    void*                    pNextParam;
+    int                      max_inflight;  // max request count in flight for this object
 
   private:
     bool ClearEx(bool is_all);
     int MultiPerform(void);
-    int MultiRead(void);
-    static void* RequestPerformWrapper(void* arg);
+    int MultiRead(S3fsCurl* s3fscurl);
+    void RequestDone(S3fsCurl* s3fscurl, int result);
+    S3fsCurl* WaitRequestDone(int& result);
 
   public:
     S3fsMultiCurl();
     ~S3fsMultiCurl();
 
+    static bool InitThreadPool(void);
+    static bool DestroyThreadPool(void);
     static int SetMaxMultiRequest(int max);
     static int GetMaxMultiRequest(void) { return S3fsMultiCurl::max_multireq; }
 
     S3fsMultiSuccessCallback SetSuccessCallback(S3fsMultiSuccessCallback function);
     S3fsMultiRetryCallback SetRetryCallback(S3fsMultiRetryCallback function);
+    S3fsMultiNextCallback SetNextCallback(S3fsMultiNextCallback function, void* param);
+    int SetMaxInFlight(int count);
     bool Clear(void) { return ClearEx(true); }
     bool SetS3fsCurlObject(S3fsCurl* s3fscurl);
     int Request(void);
@@ -513,11 +771,14 @@ struct curl_slist* curl_slist_sort_insert(struct curl_slist* list, const char* k
 std::string get_sorted_header_keys(const struct curl_slist* list);
 std::string get_canonical_headers(const struct curl_slist* list);
 std::string get_canonical_header_keys(const struct curl_slist* list);
+void get_canonical_headers(const struct curl_slist* list, std::string& headers, std::string& keys);
 bool is_signed_header(const std::string &key);
 std::map<std::string, std::string> get_params_from_query_string(const std::string &query);
 std::string get_canonical_params(const std::map<std::string, std::string> &requestParams);
 std::string get_canonical_param_keys(const std::map<std::string, std::string> &requestParams);
+void get_canonical_params(const std::string& query, std::string& params, std::string& keys);
 
+std::string get_url_host(const std::string& url);
 bool MakeUrlResource(const char* realpath, std::string& resourcepath, std::string& url);
 std::string prepare_url(const char* url, std::string &host);
 bool get_object_sse_type(const char* path, sse_type_t& ssetype, std::string& ssevalue);   // implement in s3fs.cpp
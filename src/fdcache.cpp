@@ -24,6 +24,8 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <dirent.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <pthread.h>
@@ -38,6 +40,7 @@
 #include <map>
 #include <list>
 #include <vector>
+#include <algorithm>
 
 #include "common.h"
 #include "fdcache.h"
@@ -46,6 +49,7 @@
 #include "string_util.h"
 #include "cache.h"
 #include "curl.h"
+#include "stats.h"
 
 using namespace std;
 
@@ -55,6 +59,16 @@ using namespace std;
 #define MAX_MULTIPART_CNT   10000                   // OSS multipart max count
 
 size_t FdEntity::max_prefetch_bytes = 100 * 1024 * 1024;
+bool   FdEntity::stream_upload      = false;
+
+//------------------------------------------------
+// Statistics
+//------------------------------------------------
+static StatsCounter stats_fd_cache_hits("cosfs_fd_cache_hits_total", "Reads which are served from the cache file without loading.");
+static StatsCounter stats_fd_cache_misses("cosfs_fd_cache_misses_total", "Reads which need to load the area from COS.");
+static StatsCounter stats_fd_cache_miss_bytes("cosfs_fd_cache_miss_bytes_total", "Bytes which are not loaded in the cache file at reading.");
+static OpStats      stats_disk_read("cosfs_disk_io", "Latency of reading and writing the cache file.", "read");
+static OpStats      stats_disk_write("cosfs_disk_io", "Latency of reading and writing the cache file.", "write");
 
 //------------------------------------------------
 // CacheFileStat class methods
@@ -267,6 +281,16 @@ void PageList::FreeList(fdpage_list_t& list)
   list.clear();
 }
 
+static bool fdpage_end_less(const fdpage& page, off_t pos)
+{
+  return page.end() < pos;
+}
+
+static bool fdpage_next_less_equal(const fdpage& page, off_t pos)
+{
+  return page.next() <= pos;
+}
+
 PageList::PageList(size_t size, bool is_loaded)
 {
   Init(size, is_loaded);
@@ -279,14 +303,13 @@ PageList::~PageList()
 
 void PageList::Clear(void)
 {
-  PageList::FreeList(pages);
+  pages.clear();
 }
 
 bool PageList::Init(size_t size, bool is_loaded)
 {
   Clear();
-  fdpage* page = new fdpage(0, size, is_loaded);
-  pages.push_back(page);
+  pages.push_back(fdpage(0, size, is_loaded));
   return true;
 }
 
@@ -295,50 +318,76 @@ size_t PageList::Size(void) const
   if(pages.empty()){
     return 0;
   }
-  fdpage_list_t::const_reverse_iterator riter = pages.rbegin();
-  return static_cast<size_t>((*riter)->next());
+  return static_cast<size_t>(pages.back().next());
+}
+
+// returns the first page whose end is not before start.
+fdpage_array_t::const_iterator PageList::FindPage(off_t start) const
+{
+  return std::lower_bound(pages.begin(), pages.end(), start, fdpage_end_less);
+}
+
+// returns the first page whose next is after start.
+fdpage_array_t::const_iterator PageList::FindNextPage(off_t start) const
+{
+  return std::lower_bound(pages.begin(), pages.end(), start, fdpage_next_less_equal);
 }
 
 bool PageList::Compress(void)
 {
-  bool is_first       = true;
-  bool is_last_loaded = false;
-  for(fdpage_list_t::iterator iter = pages.begin(); iter != pages.end(); ){
-    if(is_first){
-      is_first       = false;
-      is_last_loaded = (*iter)->loaded;
-      ++iter;
+  if(pages.empty()){
+    return true;
+  }
+  fdpage_array_t::iterator last = pages.begin();
+  for(fdpage_array_t::iterator iter = last + 1; iter != pages.end(); ++iter){
+    if(last->loaded == iter->loaded){
+      last->bytes += iter->bytes;
     }else{
-      if(is_last_loaded == (*iter)->loaded){
-        fdpage_list_t::iterator biter = iter;
-        --biter;
-        (*biter)->bytes += (*iter)->bytes;
-        delete *iter;
-        iter = pages.erase(iter);
-      }else{
-        is_last_loaded = (*iter)->loaded;
-        ++iter;
-      }
+      *(++last) = *iter;
     }
   }
+  pages.erase(last + 1, pages.end());
   return true;
 }
 
-bool PageList::Parse(off_t new_pos)
+//
+// Merge the page at pos with adjoining pages which have same loaded status.
+//
+void PageList::Merge(size_t pos)
 {
-  for(fdpage_list_t::iterator iter = pages.begin(); iter != pages.end(); ++iter){
-    if(new_pos == (*iter)->offset){
-      // nothing to do
-      return true;
-    }else if((*iter)->offset < new_pos && new_pos < (*iter)->next()){
-      fdpage* page    = new fdpage((*iter)->offset, static_cast<size_t>(new_pos - (*iter)->offset), (*iter)->loaded);
-      (*iter)->bytes -= (new_pos - (*iter)->offset);
-      (*iter)->offset = new_pos;
-      pages.insert(iter, page);
-      return true;
-    }
+  if(pages.size() <= pos){
+    return;
   }
-  return false;
+  size_t first = pos;
+  size_t last  = pos;
+  while(0 < first && pages[first - 1].loaded == pages[pos].loaded){
+    --first;
+  }
+  while(last + 1 < pages.size() && pages[last + 1].loaded == pages[pos].loaded){
+    ++last;
+  }
+  if(first == last){
+    return;
+  }
+  pages[first].bytes = static_cast<size_t>(pages[last].next() - pages[first].offset);
+  pages.erase(pages.begin() + first + 1, pages.begin() + last + 1);
+}
+
+//
+// Split the page which has new_pos, and returns the index of the page
+// starting at new_pos(or the count of pages if new_pos is not in pages).
+//
+size_t PageList::Split(off_t new_pos)
+{
+  fdpage_array_t::const_iterator citer = FindNextPage(new_pos);
+  size_t                         pos   = static_cast<size_t>(citer - pages.begin());
+  if(pages.size() <= pos || new_pos == pages[pos].offset){
+    return pos;
+  }
+  fdpage page(new_pos, static_cast<size_t>(pages[pos].next() - new_pos), pages[pos].loaded);
+  pages[pos].bytes = static_cast<size_t>(new_pos - pages[pos].offset);
+  pages.insert(pages.begin() + pos + 1, page);
+  return pos + 1;
 }
 
 bool PageList::Resize(size_t size, bool is_loaded)
@@ -350,40 +399,30 @@ bool PageList::Resize(size_t size, bool is_loaded)
 
   }else if(total < size){
     // add new area
-    fdpage* page = new fdpage(static_cast<off_t>(total), (size - total), is_loaded);
-    pages.push_back(page);
+    pages.push_back(fdpage(static_cast<off_t>(total), (size - total), is_loaded));
 
   }else if(size < total){
     // cut area
-    for(fdpage_list_t::iterator iter = pages.begin(); iter != pages.end(); ){
-      if(static_cast<size_t>((*iter)->next()) <= size){
-        ++iter;
-      }else{
-        if(size <= static_cast<size_t>((*iter)->offset)){
-          delete *iter;
-          iter = pages.erase(iter);
-        }else{
-          (*iter)->bytes = size - static_cast<size_t>((*iter)->offset);
-        }
-      }
-    }
+    size_t pos = Split(static_cast<off_t>(size));
+    pages.erase(pages.begin() + pos, pages.end());
+
   }else{    // total == size
     // nothing to do
   }
   // compress area
-  return Compress();
+  if(!pages.empty()){
+    Merge(pages.size() - 1);
+  }
+  return true;
 }
 
 bool PageList::IsPageLoaded(off_t start, size_t size) const
 {
-  for(fdpage_list_t::const_iterator iter = pages.begin(); iter != pages.end(); ++iter){
-    if((*iter)->end() < start){
-      continue;
-    }
-    if(!(*iter)->loaded){
+  for(fdpage_array_t::const_iterator iter = FindPage(start); iter != pages.end(); ++iter){
+    if(!iter->loaded){
       return false;
     }
-    if(0 != size && static_cast<size_t>(start + size) <= static_cast<size_t>((*iter)->next())){
+    if(0 != size && static_cast<size_t>(start + size) <= static_cast<size_t>(iter->next())){
       break;
     }
   }
@@ -409,34 +448,28 @@ bool PageList::SetPageLoadedStatus(off_t start, size_t size, bool is_loaded, boo
 
   }else{
     // start-size are inner pages area
-    // parse "start", and "start + size" position
-    Parse(start);
-    Parse(start + size);
-
-    // set loaded flag
-    for(fdpage_list_t::iterator iter = pages.begin(); iter != pages.end(); ++iter){
-      if((*iter)->end() < start){
-        continue;
-      }else if(static_cast<off_t>(start + size) <= (*iter)->offset){
-        break;
-      }else{
-        (*iter)->loaded = is_loaded;
+    // parse "start", and "start + size" position, and replace pages
+    // between them with one page.
+    size_t first = Split(start);
+    size_t last  = Split(static_cast<off_t>(start + size));
+    if(first < last){
+      pages[first] = fdpage(start, size, is_loaded);
+      pages.erase(pages.begin() + first + 1, pages.begin() + last);
+      if(is_compress){
+        Merge(first);
       }
     }
   }
-  // compress area
-  return (is_compress ? Compress() : true);
+  return true;
 }
 
 bool PageList::FindUnloadedPage(off_t start, off_t& resstart, size_t& ressize) const
 {
-  for(fdpage_list_t::const_iterator iter = pages.begin(); iter != pages.end(); ++iter){
-    if(start <= (*iter)->end()){
-      if(!(*iter)->loaded){
-        resstart = (*iter)->offset;
-        ressize  = (*iter)->bytes;
-        return true;
-      }
+  for(fdpage_array_t::const_iterator iter = FindPage(start); iter != pages.end(); ++iter){
+    if(!iter->loaded){
+      resstart = iter->offset;
+      ressize  = iter->bytes;
+      return true;
     }
   }
   return false;
@@ -451,31 +484,14 @@ size_t PageList::GetTotalUnloadedPageSize(off_t start, size_t size) const
   }
   size_t restsize = 0;
   off_t  next     = static_cast<off_t>(start + size);
-  for(fdpage_list_t::const_iterator iter = pages.begin(); iter != pages.end(); ++iter){
-    if((*iter)->next() <= start){
-      continue;
-    }
-    if(next <= (*iter)->offset){
+  for(fdpage_array_t::const_iterator iter = FindNextPage(start); iter != pages.end(); ++iter){
+    if(next <= iter->offset){
       break;
     }
-    if((*iter)->loaded){
+    if(iter->loaded){
       continue;
     }
-    size_t tmpsize;
-    if((*iter)->offset <= start){
-      if((*iter)->next() <= next){
-        tmpsize = static_cast<size_t>((*iter)->next() - start);
-      }else{
-        tmpsize = static_cast<size_t>(next - start);                         // = size
-      }
-    }else{
-      if((*iter)->next() <= next){
-        tmpsize = static_cast<size_t>((*iter)->next() - (*iter)->offset);   // = (*iter)->bytes
-      }else{
-        tmpsize = static_cast<size_t>(next - (*iter)->offset);
-      }
-    }
-    restsize += tmpsize;
+    restsize += static_cast<size_t>(min(iter->next(), next) - max(iter->offset, start));
   }
   return restsize;
 }
@@ -490,20 +506,17 @@ int PageList::GetUnloadedPages(fdpage_list_t& unloaded_list, off_t start, size_t
   }
   off_t next = static_cast<off_t>(start + size);
 
-  for(fdpage_list_t::const_iterator iter = pages.begin(); iter != pages.end(); ++iter){
-    if((*iter)->next() <= start){
-      continue;
-    }
-    if(next <= (*iter)->offset){
+  for(fdpage_array_t::const_iterator iter = FindNextPage(start); iter != pages.end(); ++iter){
+    if(next <= iter->offset){
       break;
     }
-    if((*iter)->loaded){
+    if(iter->loaded){
       continue; // already loaded
     }
 
     // page area
-    off_t  page_start = max((*iter)->offset, start);
-    off_t  page_next  = min((*iter)->next(), next);
+    off_t  page_start = max(iter->offset, start);
+    off_t  page_next  = min(iter->next(), next);
     size_t page_size  = static_cast<size_t>(page_next - page_start);
 
     // add list
@@ -519,6 +532,52 @@ int PageList::GetUnloadedPages(fdpage_list_t& unloaded_list, off_t start, size_t
   return unloaded_list.size();
 }
 
+//
+// Cache stat file format
+//
+// [binary]
+//   cache_stat_header, and cache_stat_extent for each page.
+//   The checksum(64bit FNV-1a) covers the header(the checksum is 0) and
+//   extents, so the file which is broken by crash is not used.
+//   The values are host byte order, because the file is only for local.
+//
+// [text(old format)]
+//   "<total size>\n<offset>:<bytes>:<loaded(1 or 0)>\n..."
+//   This is only loaded, the binary format is always written.
+//
+#define CACHE_STAT_MAGIC        "COSFSCS"         // with '\0', 8 bytes
+#define CACHE_STAT_VERSION      1
+
+struct cache_stat_header
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t size;          // total size
+  uint64_t count;         // extent count
+  uint64_t checksum;
+};
+
+struct cache_stat_extent
+{
+  uint64_t offset;
+  uint64_t bytes;
+  uint32_t loaded;
+  uint32_t reserved;
+};
+
+#define CACHE_STAT_FNV_OFFSET   14695981039346656037ULL
+#define CACHE_STAT_FNV_PRIME    1099511628211ULL
+
+static uint64_t cache_stat_checksum(const unsigned char* data, size_t length, uint64_t hash = CACHE_STAT_FNV_OFFSET)
+{
+  for(size_t pos = 0; pos < length; ++pos){
+    hash ^= data[pos];
+    hash *= CACHE_STAT_FNV_PRIME;
+  }
+  return hash;
+}
+
 bool PageList::Serialize(CacheFileStat& file, bool is_output)
 {
   if(!file.Open()){
@@ -528,18 +587,50 @@ bool PageList::Serialize(CacheFileStat& file, bool is_output)
     //
     // put to file
     //
-    stringstream ssall;
-    ssall << Size();
+    size_t        length = sizeof(cache_stat_header) + sizeof(cache_stat_extent) * pages.size();
+    unsigned char* pbuff = static_cast<unsigned char*>(calloc(length, 1));
+    if(!pbuff){
+      S3FS_PRN_CRIT("could not allocate memory.");
+      S3FS_FUSE_EXIT();
+      return false;
+    }
+    cache_stat_header* pheader  = reinterpret_cast<cache_stat_header*>(pbuff);
+    cache_stat_extent* pextents = reinterpret_cast<cache_stat_extent*>(pbuff + sizeof(cache_stat_header));
+    memcpy(pheader->magic, CACHE_STAT_MAGIC, sizeof(pheader->magic));
+    pheader->version = CACHE_STAT_VERSION;
+    pheader->size    = static_cast<uint64_t>(Size());
+    pheader->count   = static_cast<uint64_t>(pages.size());
+    for(size_t cnt = 0; cnt < pages.size(); ++cnt){
+      pextents[cnt].offset = static_cast<uint64_t>(pages[cnt].offset);
+      pextents[cnt].bytes  = static_cast<uint64_t>(pages[cnt].bytes);
+      pextents[cnt].loaded = (pages[cnt].loaded ? 1 : 0);
+    }
+    pheader->checksum = cache_stat_checksum(pbuff, length);
 
-    for(fdpage_list_t::iterator iter = pages.begin(); iter != pages.end(); ++iter){
-      ssall << "\n" << (*iter)->offset << ":" << (*iter)->bytes << ":" << ((*iter)->loaded ? "1" : "0");
+    // [NOTE]
+    // If the file already has same stats(ex. only reading loaded area),
+    // it is not rewritten.
+    //
+    cache_stat_header oldheader;
+    struct stat       st;
+    if(0 == fstat(file.GetFd(), &st) && static_cast<size_t>(st.st_size) == length &&
+       static_cast<ssize_t>(sizeof(oldheader)) == pread(file.GetFd(), &oldheader, sizeof(oldheader), 0) &&
+       0 == memcmp(&oldheader, pheader, sizeof(oldheader)))
+    {
+      free(pbuff);
+      return true;
     }
 
-    string strall = ssall.str();
-    if(0 >= pwrite(file.GetFd(), strall.c_str(), strall.length(), 0)){
+    bool result = true;
+    if(static_cast<ssize_t>(length) != pwrite(file.GetFd(), pbuff, length, 0)){
       S3FS_PRN_ERR("failed to write stats(%d)", errno);
-      return false;
+      result = false;
+    }else if(-1 == ftruncate(file.GetFd(), static_cast<off_t>(length))){
+      S3FS_PRN_ERR("failed to truncate stats(%d)", errno);
+      result = false;
     }
+    free(pbuff);
+    return result;
 
   }else{
     //
@@ -556,71 +647,120 @@ bool PageList::Serialize(CacheFileStat& file, bool is_output)
       Init(0, false);
       return true;
     }
-    char* ptmp;
-    if(NULL == (ptmp = (char*)calloc(st.st_size + 1, sizeof(char)))){
-      S3FS_PRN_CRIT("could not allocate memory.");
-      S3FS_FUSE_EXIT();
+    void* pmap;
+    if(MAP_FAILED == (pmap = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, file.GetFd(), 0))){
+      S3FS_PRN_ERR("failed to map stats(%d)", errno);
       return false;
     }
-    // read from file
-    if(0 >= pread(file.GetFd(), ptmp, st.st_size, 0)){
-      S3FS_PRN_ERR("failed to read stats(%d)", errno);
-      free(ptmp);
+    bool result;
+    if(sizeof(cache_stat_header) <= static_cast<size_t>(st.st_size) && 0 == memcmp(pmap, CACHE_STAT_MAGIC, sizeof(CACHE_STAT_MAGIC))){
+      result = LoadBinaryStats(static_cast<const unsigned char*>(pmap), static_cast<size_t>(st.st_size));
+    }else{
+      result = LoadTextStats(static_cast<const char*>(pmap), static_cast<size_t>(st.st_size));
+    }
+    munmap(pmap, static_cast<size_t>(st.st_size));
+
+    if(!result){
+      Clear();
       return false;
     }
-    string       oneline;
-    stringstream ssall(ptmp);
+  }
+  return true;
+}
 
-    // loaded
-    Clear();
+bool PageList::LoadBinaryStats(const unsigned char* data, size_t length)
+{
+  cache_stat_header header;
+  memcpy(&header, data, sizeof(header));
 
-    // load(size)
-    if(!getline(ssall, oneline, '\n')){
-      S3FS_PRN_ERR("failed to parse stats.");
-      free(ptmp);
+  if(CACHE_STAT_VERSION != header.version){
+    S3FS_PRN_ERR("unknown version(%u) of stats.", header.version);
+    return false;
+  }
+  if((length - sizeof(header)) / sizeof(cache_stat_extent) != header.count || (length - sizeof(header)) % sizeof(cache_stat_extent)){
+    S3FS_PRN_ERR("stats is broken(length=%zu, count=%ju).", length, (uintmax_t)header.count);
+    return false;
+  }
+  uint64_t checksum = header.checksum;
+  header.checksum   = 0;
+  uint64_t hash     = cache_stat_checksum(reinterpret_cast<const unsigned char*>(&header), sizeof(header));
+  hash              = cache_stat_checksum(data + sizeof(header), length - sizeof(header), hash);
+  if(hash != checksum){
+    S3FS_PRN_ERR("stats is broken(checksum).");
+    return false;
+  }
+
+  Clear();
+  pages.reserve(static_cast<size_t>(header.count));
+  off_t next = 0;
+  for(size_t pos = sizeof(header); pos < length; pos += sizeof(cache_stat_extent)){
+    cache_stat_extent extent;
+    memcpy(&extent, data + pos, sizeof(extent));
+    if(static_cast<off_t>(extent.offset) != next){
+      S3FS_PRN_ERR("stats is broken(offset=%ju).", (uintmax_t)extent.offset);
       return false;
     }
-    size_t total = s3fs_strtoofft(oneline.c_str());
+    pages.push_back(fdpage(static_cast<off_t>(extent.offset), static_cast<size_t>(extent.bytes), (0 != extent.loaded)));
+    next = pages.back().next();
+  }
+  if(pages.empty()){
+    Init(0, false);
+  }
+  Compress();
 
-    // load each part
-    bool is_err = false;
-    while(getline(ssall, oneline, '\n')){
-      string       part;
-      stringstream ssparts(oneline);
-      // offset
-      if(!getline(ssparts, part, ':')){
-        is_err = true;
-        break;
-      }
-      off_t offset = s3fs_strtoofft(part.c_str());
-      // size
-      if(!getline(ssparts, part, ':')){
-        is_err = true;
-        break;
-      }
-      off_t size = s3fs_strtoofft(part.c_str());
-      // loaded
-      if(!getline(ssparts, part, ':')){
-        is_err = true;
-        break;
-      }
-      bool is_loaded = (1 == s3fs_strtoofft(part.c_str()) ? true : false);
-      // add new area
-      SetPageLoadedStatus(offset, size, is_loaded);
+  // check size
+  if(header.size != static_cast<uint64_t>(Size())){
+    S3FS_PRN_ERR("different size(%jd - %jd).", (intmax_t)header.size, (intmax_t)Size());
+    return false;
+  }
+  return true;
+}
+
+bool PageList::LoadTextStats(const char* data, size_t length)
+{
+  string       oneline;
+  stringstream ssall(string(data, length));
+
+  // loaded
+  Clear();
+
+  // load(size)
+  if(!getline(ssall, oneline, '\n')){
+    S3FS_PRN_ERR("failed to parse stats.");
+    return false;
+  }
+  size_t total = s3fs_strtoofft(oneline.c_str());
+
+  // load each part
+  while(getline(ssall, oneline, '\n')){
+    string       part;
+    stringstream ssparts(oneline);
+    // offset
+    if(!getline(ssparts, part, ':')){
+      S3FS_PRN_ERR("failed to parse stats.");
+      return false;
     }
-    free(ptmp);
-    if(is_err){
+    off_t offset = s3fs_strtoofft(part.c_str());
+    // size
+    if(!getline(ssparts, part, ':')){
       S3FS_PRN_ERR("failed to parse stats.");
-      Clear();
       return false;
     }
-
-    // check size
-    if(total != Size()){
-      S3FS_PRN_ERR("different size(%jd - %jd).", (intmax_t)total, (intmax_t)Size());
-      Clear();
+    off_t size = s3fs_strtoofft(part.c_str());
+    // loaded
+    if(!getline(ssparts, part, ':')){
+      S3FS_PRN_ERR("failed to parse stats.");
       return false;
     }
+    bool is_loaded = (1 == s3fs_strtoofft(part.c_str()) ? true : false);
+    // add new area
+    SetPageLoadedStatus(offset, size, is_loaded);
+  }
+
+  // check size
+  if(total != Size()){
+    S3FS_PRN_ERR("different size(%jd - %jd).", (intmax_t)total, (intmax_t)Size());
+    return false;
   }
   return true;
 }
@@ -630,8 +770,8 @@ void PageList::Dump(void)
   int cnt = 0;
 
   S3FS_PRN_DBG("pages = {");
-  for(fdpage_list_t::iterator iter = pages.begin(); iter != pages.end(); ++iter, ++cnt){
-    S3FS_PRN_DBG("  [%08d] -> {%014jd - %014zu : %s}", cnt, (intmax_t)((*iter)->offset), (*iter)->bytes, (*iter)->loaded ? "true" : "false");
+  for(fdpage_array_t::const_iterator iter = pages.begin(); iter != pages.end(); ++iter, ++cnt){
+    S3FS_PRN_DBG("  [%08d] -> {%014jd - %014zu : %s}", cnt, (intmax_t)(iter->offset), iter->bytes, iter->loaded ? "true" : "false");
   }
   S3FS_PRN_DBG("}");
 }
@@ -659,13 +799,19 @@ int FdEntity::FillFile(int fd, unsigned char byte, size_t size, off_t start)
 FdEntity::FdEntity(const char* tpath, const char* cpath)
         : is_lock_init(false), refcnt(0), path(SAFESTRPTR(tpath)), cachepath(SAFESTRPTR(cpath)),
           open_pid(-1), fd(-1), pfile(NULL), is_modify(false), size_orgmeta(0), upload_id(""), mp_start(0), mp_size(0),
-          is_meta_pending(false), is_no_disk_space_flushed(false)
+          is_meta_pending(false), is_no_disk_space_flushed(false),
+          readahead_next(0), readahead_pos(0), readahead_size(0),
+          stream_upload_id(""), stream_pos(0), stream_uploading(0), stream_result(0), is_stream_invalid(false)
 {
   try{
     pthread_mutexattr_t attr;
     pthread_mutexattr_init(&attr);
     pthread_mutexattr_settype(&attr, S3FS_MUTEX_RECURSIVE);   // recursive mutex
     pthread_mutex_init(&fdent_lock, &attr);
+    pthread_mutex_init(&loading_lock, NULL);
+    pthread_cond_init(&loading_cond, NULL);
+    pthread_mutex_init(&stream_lock, NULL);
+    pthread_cond_init(&stream_cond, NULL);
     is_lock_init = true;
   }catch(exception& e){
     S3FS_PRN_CRIT("failed to init mutex");
@@ -679,17 +825,26 @@ FdEntity::~FdEntity()
   if(is_lock_init){
     try{
       pthread_mutex_destroy(&fdent_lock);
+      pthread_mutex_destroy(&loading_lock);
+      pthread_cond_destroy(&loading_cond);
+      pthread_mutex_destroy(&stream_lock);
+      pthread_cond_destroy(&stream_cond);
     }catch(exception& e){
       S3FS_PRN_CRIT("failed to destroy mutex");
     }
     is_lock_init = false;
   }
+  PageList::FreeList(loading_pages);
 }
 
 void FdEntity::Clear(void)
 {
   AutoLock auto_lock(&fdent_lock);
 
+  WaitLoadingPages();
+  MergeLoadedPages();
+  AbortStreamUpload();
+
   if(pfile){
     if(0 != cachepath.size()){
       CacheFileStat cfstat(path.c_str());
@@ -720,6 +875,7 @@ void FdEntity::Close(void)
       refcnt--;
     }
     if(0 == refcnt){
+      MergeLoadedPages();
       if(0 != cachepath.size()){
         CacheFileStat cfstat(path.c_str());
         if(!pagelist.Serialize(cfstat, true)){
@@ -955,6 +1111,7 @@ bool FdEntity::OpenAndLoadAll(headers_t* pmeta, size_t* size, bool force_load, i
   AutoLock auto_lock(&fdent_lock);
 
   if(force_load){
+    WaitLoadingPages();
     SetAllStatusUnloaded();
   }
   //
@@ -1129,6 +1286,10 @@ int FdEntity::Load(off_t start, size_t size)
   }
   AutoLock auto_lock(&fdent_lock);
 
+  // the area may be downloading by other readers now
+  WaitLoadingPages(start, size);
+  MergeLoadedPages();
+
   int result = 0;
 
   // check loaded area & load
@@ -1139,47 +1300,11 @@ int FdEntity::Load(off_t start, size_t size)
         // reached end
         break;
       }
-      // check loading size
-      size_t need_load_size = 0;
-      if(static_cast<size_t>((*iter)->offset) < size_orgmeta){
-        // original file size(on S3) is smaller than request.
-        need_load_size = (static_cast<size_t>((*iter)->next()) <= size_orgmeta ? (*iter)->bytes : (size_orgmeta - (*iter)->offset));
-      }
-      size_t over_size = (*iter)->bytes - need_load_size;
-
-      // download
-      if(static_cast<size_t>(2 * S3fsCurl::GetMultipartSize()) < need_load_size && !nomultipart){ // default 20MB
-        // parallel request
-        // Additional time is needed for large files
-        time_t backup = 0;
-        if(120 > S3fsCurl::GetReadwriteTimeout()){
-          backup = S3fsCurl::SetReadwriteTimeout(120);
-        }
-        result = S3fsCurl::ParallelGetObjectRequest(path.c_str(), fd, (*iter)->offset, need_load_size);
-        if(0 != backup){
-          S3fsCurl::SetReadwriteTimeout(backup);
-        }
-      }else{
-        // single request
-        S3fsCurl s3fscurl;
-        if(0 < need_load_size){
-          S3fsCurl s3fscurl;
-          result = s3fscurl.GetObjectRequest(path.c_str(), fd, (*iter)->offset, need_load_size);
-        }else{
-          result = 0;
-        }
-      }
-      if(0 != result){
+      if(0 != (result = LoadPage(path, (*iter)->offset, (*iter)->bytes, size_orgmeta))){
         break;
       }
-
-      // initialize for the area of over original size
-      if(0 < over_size){
-        if(0 != (result = FdEntity::FillFile(fd, 0, over_size, (*iter)->offset + need_load_size))){
-          S3FS_PRN_ERR("failed to fill rest bytes for fd(%d). errno(%d)", fd, result);
-          break;
-        }
-        // set modify flag
+      if(size_orgmeta < static_cast<size_t>((*iter)->next())){
+        // initialized the area of over original size
         is_modify = false;
       }
 
@@ -1191,6 +1316,133 @@ int FdEntity::Load(off_t start, size_t size)
   return result;
 }
 
+// [NOTE]
+// Download one area to fd, and fill the area over original size by zero.
+// This method does not touch pagelist, so it can be called without
+// fdent_lock for the area which is reserved in loading_pages.
+//
+int FdEntity::LoadPage(const string& tpath, off_t offset, size_t bytes, size_t orgsize)
+{
+  int result = 0;
+
+  // check loading size
+  size_t need_load_size = 0;
+  if(static_cast<size_t>(offset) < orgsize){
+    // original file size(on S3) is smaller than request.
+    need_load_size = (static_cast<size_t>(offset + bytes) <= orgsize ? bytes : (orgsize - offset));
+  }
+  size_t over_size = bytes - need_load_size;
+
+  // download
+  if(static_cast<size_t>(2 * S3fsCurl::GetMultipartSize()) < need_load_size && !nomultipart){ // default 20MB
+    // parallel request
+    // Additional time is needed for large files
+    time_t backup = 0;
+    if(120 > S3fsCurl::GetReadwriteTimeout()){
+      backup = S3fsCurl::SetReadwriteTimeout(120);
+    }
+    result = S3fsCurl::ParallelGetObjectRequest(tpath.c_str(), fd, offset, need_load_size);
+    if(0 != backup){
+      S3fsCurl::SetReadwriteTimeout(backup);
+    }
+  }else if(0 < need_load_size){
+    // single request
+    S3fsCurl s3fscurl;
+    result = s3fscurl.GetObjectRequest(tpath.c_str(), fd, offset, need_load_size);
+  }
+  if(0 != result){
+    return result;
+  }
+
+  // initialize for the area of over original size
+  if(0 < over_size){
+    if(0 != (result = FdEntity::FillFile(fd, 0, over_size, offset + need_load_size))){
+      S3FS_PRN_ERR("failed to fill rest bytes for fd(%d). errno(%d)", fd, result);
+    }
+  }
+  return result;
+}
+
+// [NOTE]
+// Removes the areas which are already loading by others from unloaded_list,
+// and registers the rest areas to loading_pages. The pages in unloaded_list
+// are shared with loading_pages, so the caller must pass each of them to
+// FinishLoadingPage() and must not free them.
+//
+void FdEntity::ReserveLoadingPages(fdpage_list_t& unloaded_list)
+{
+  AutoLock auto_lock(&loading_lock);
+
+  for(fdpage_list_t::const_iterator liter = loading_pages.begin(); liter != loading_pages.end(); ++liter){
+    for(fdpage_list_t::iterator iter = unloaded_list.begin(); iter != unloaded_list.end(); ){
+      fdpage* page = *iter;
+      if((*liter)->next() <= page->offset || page->next() <= (*liter)->offset){
+        ++iter;
+        continue;
+      }
+      if(page->offset < (*liter)->offset){
+        // head area is not loading
+        unloaded_list.insert(iter, new fdpage(page->offset, static_cast<size_t>((*liter)->offset - page->offset), false));
+      }
+      if((*liter)->next() < page->next()){
+        // tail area is not loading
+        page->bytes  = static_cast<size_t>(page->next() - (*liter)->next());
+        page->offset = (*liter)->next();
+        ++iter;
+      }else{
+        delete page;
+        iter = unloaded_list.erase(iter);
+      }
+    }
+  }
+  loading_pages.insert(loading_pages.end(), unloaded_list.begin(), unloaded_list.end());
+}
+
+void FdEntity::FinishLoadingPage(fdpage* page, bool is_loaded)
+{
+  AutoLock auto_lock(&loading_lock);
+
+  if(is_loaded){
+    // merged to pagelist by MergeLoadedPages()
+    page->loaded = true;
+  }else{
+    loading_pages.remove(page);
+    delete page;
+  }
+  pthread_cond_broadcast(&loading_cond);
+}
+
+void FdEntity::WaitLoadingPages(off_t start, size_t size)
+{
+  off_t next = (0 == size ? -1 : static_cast<off_t>(start + size));
+
+  AutoLock auto_lock(&loading_lock);
+
+  for(fdpage_list_t::const_iterator iter = loading_pages.begin(); iter != loading_pages.end(); ){
+    if(!(*iter)->loaded && start < (*iter)->next() && (-1 == next || (*iter)->offset < next)){
+      pthread_cond_wait(&loading_cond, &loading_lock);
+      iter = loading_pages.begin();
+    }else{
+      ++iter;
+    }
+  }
+}
+
+void FdEntity::MergeLoadedPages(void)
+{
+  AutoLock auto_lock(&loading_lock);
+
+  for(fdpage_list_t::iterator iter = loading_pages.begin(); iter != loading_pages.end(); ){
+    if((*iter)->loaded){
+      pagelist.SetPageLoadedStatus((*iter)->offset, (*iter)->bytes, true);
+      delete *iter;
+      iter = loading_pages.erase(iter);
+    }else{
+      ++iter;
+    }
+  }
+}
+
 // [NOTE]
 // At no disk space for caching object.
 // This method is downloading by dividing an object of the specified range
@@ -1234,18 +1486,21 @@ int FdEntity::NoCacheLoadAndPost(off_t start, size_t size)
   }
 
   // loop uploading by multipart
-  for(fdpage_list_t::iterator iter = pagelist.pages.begin(); iter != pagelist.pages.end(); ++iter){
-    if((*iter)->end() < start){
+  // [NOTE]
+  // pages are copied, because loaded status of pagelist is changed in loop.
+  fdpage_array_t pages = pagelist.pages;
+  for(fdpage_array_t::const_iterator iter = pages.begin(); iter != pages.end(); ++iter){
+    if(iter->end() < start){
       continue;
     }
-    if(0 != size && static_cast<size_t>(start + size) <= static_cast<size_t>((*iter)->offset)){
+    if(0 != size && static_cast<size_t>(start + size) <= static_cast<size_t>(iter->offset)){
       break;
     }
     // download earch multipart size(default 10MB) in unit
-    for(size_t oneread = 0, totalread = ((*iter)->offset < start ? start : 0); totalread < (*iter)->bytes; totalread += oneread){
+    for(size_t oneread = 0, totalread = (iter->offset < start ? start : 0); totalread < iter->bytes; totalread += oneread){
       int   upload_fd = fd;
-      off_t offset    = (*iter)->offset + totalread;
-      oneread         = min(((*iter)->bytes - totalread), static_cast<size_t>(S3fsCurl::GetMultipartSize()));
+      off_t offset    = iter->offset + totalread;
+      oneread         = min((iter->bytes - totalread), static_cast<size_t>(S3fsCurl::GetMultipartSize()));
 
       // check rest size is over minimum part size
       //
@@ -1255,15 +1510,15 @@ int FdEntity::NoCacheLoadAndPost(off_t start, size_t size)
       // we incorporate the final part to the previous part. If the previous part
       // is over 5GB, we want to even out the last part and the previous part.
       //
-      if(((*iter)->bytes - totalread - oneread) < MIN_MULTIPART_SIZE){
-        if(FIVE_GB < ((*iter)->bytes - totalread)){
-          oneread = ((*iter)->bytes - totalread) / 2;
+      if((iter->bytes - totalread - oneread) < MIN_MULTIPART_SIZE){
+        if(FIVE_GB < (iter->bytes - totalread)){
+          oneread = (iter->bytes - totalread) / 2;
         }else{
-          oneread = ((*iter)->bytes - totalread);
+          oneread = (iter->bytes - totalread);
         }
       }
 
-      if(!(*iter)->loaded){
+      if(!iter->loaded){
         //
         // loading or initializing
         //
@@ -1327,21 +1582,10 @@ int FdEntity::NoCacheLoadAndPost(off_t start, size_t size)
     }
 
     // set loaded flag
-    if(!(*iter)->loaded){
-      if((*iter)->offset < start){
-        fdpage* page    = new fdpage((*iter)->offset, static_cast<size_t>(start - (*iter)->offset), (*iter)->loaded);
-        (*iter)->bytes -= (start - (*iter)->offset);
-        (*iter)->offset = start;
-        pagelist.pages.insert(iter, page);
-      }
-      if(0 != size && static_cast<size_t>(start + size) < static_cast<size_t>((*iter)->next())){
-        fdpage* page    = new fdpage((*iter)->offset, static_cast<size_t>((start + size) - (*iter)->offset), true);
-        (*iter)->bytes -= static_cast<size_t>((start + size) - (*iter)->offset);
-        (*iter)->offset = start + size;
-        pagelist.pages.insert(iter, page);
-      }else{
-        (*iter)->loaded = true;
-      }
+    if(!iter->loaded){
+      off_t page_start = max(iter->offset, start);
+      off_t page_next  = (0 != size ? min(iter->next(), static_cast<off_t>(start + size)) : iter->next());
+      pagelist.SetPageLoadedStatus(page_start, static_cast<size_t>(page_next - page_start), true, false);
     }
   }
   if(0 == result){
@@ -1436,6 +1680,18 @@ int FdEntity::RowFlush(const char* tpath, bool force_sync)
     return 0;
   }
 
+  WaitLoadingPages();
+  MergeLoadedPages();
+
+  // finish uploading parts while writing, or upload all by the normal way.
+  if(!stream_upload_id.empty()){
+    if(0 == StreamUploadFlush(tpath)){
+      is_modify = false;
+      return 0;
+    }
+    S3FS_PRN_WARN("could not finish stream upload, then upload all of file(%s).", path.c_str());
+  }
+
   // If there is no loading all of the area, loading all area.
   size_t restsize = pagelist.GetTotalUnloadedPageSize();
   if(0 < restsize){
@@ -1562,66 +1818,446 @@ size_t FdEntity::GetPretchSize() {
   return min(static_cast<size_t>(S3fsCurl::GetMultipartSize() * S3fsCurl::GetMaxParallelCount()), max_prefetch_bytes);
 }
 
-ssize_t FdEntity::Read(char* bytes, off_t start, size_t size, bool force_load)
+// [NOTE]
+// Stream upload(streamupload option) uploads the parts which are filled by
+// sequential writing in background, then flushing only uploads the rest
+// and completes multipart uploading.
+// next is the end of the written area. If is_last is true, the rest area
+// is uploaded including the last part which is smaller than multipart size.
+// Writing or truncating the area which is already uploaded makes the stream
+// invalid, then flushing aborts it and uploads all of file as before.
+//
+int FdEntity::StreamUploadParts(off_t next, bool is_last)
 {
-  S3FS_PRN_DBG("[path=%s][fd=%d][offset=%jd][size=%zu]", path.c_str(), fd, (intmax_t)start, size);
-
-  if(-1 == fd){
-    return -EBADF;
-  }
-  AutoLock auto_lock(&fdent_lock);
-
-  if(force_load){
-    pagelist.SetPageLoadedStatus(start, size, false);
+  if(is_stream_invalid || 0 < upload_id.length()){
+    return 0;
   }
+  off_t partsize = S3fsCurl::GetMultipartSize();
+  int   result   = 0;
 
-  int     result;
-  ssize_t rsize;
-
-  // check disk space
-  if(0 < pagelist.GetTotalUnloadedPageSize(start, size)){
-    if(!FdManager::IsSafeDiskSpace(NULL, size)){
-      // [NOTE]
-      // If the area of this entity fd used can be released, try to do it.
-      // But If file data is updated, we can not even release of fd.
-      // Fundamentally, this method will fail as long as the disk capacity
-      // is not ensured.
-      //
-      if(!is_modify){
-        // try to clear all cache for this fd.
-        pagelist.Init(pagelist.Size(), false);
-        if(-1 == ftruncate(fd, 0) || -1 == ftruncate(fd, pagelist.Size())){
-          S3FS_PRN_ERR("failed to truncate temporary file(%d).", fd);
-          return -ENOSPC;
-        }
-      }
+  if(stream_upload_id.empty()){
+    if(is_last || next < 2 * partsize || nomultipart){
+      // small file is uploaded by the normal way.
+      return 0;
+    }
+    if(!pagelist.IsPageLoaded(0, static_cast<size_t>(partsize))){
+      return 0;
+    }
+    S3fsCurl s3fscurl(true);
+    if(0 != (result = s3fscurl.PreMultipartPostRequest(path.c_str(), orgmeta, stream_upload_id, false))){
+      stream_upload_id.erase();
+      is_stream_invalid = true;
+      return result;
     }
+    s3fscurl.DestroyCurlHandle();
 
-    // load size(for prefetch)
-    size_t load_size = size;
-    if(static_cast<size_t>(start + size) < pagelist.Size()){
-      size_t prefetch_max_size = max(size, FdEntity::GetPretchSize());
+    stream_path      = path;
+    stream_meta      = orgmeta;
+    stream_pos       = 0;
+    stream_result    = 0;
+    stream_etaglist.clear();
+  }
 
-      if(static_cast<size_t>(start + prefetch_max_size) < pagelist.Size()){
-        load_size = prefetch_max_size;
-      }else{
-        load_size = static_cast<size_t>(pagelist.Size() - start);
-      }
+  while(stream_pos < next){
+    size_t bytes = static_cast<size_t>(min(partsize, next - stream_pos));
+    if(!is_last && static_cast<off_t>(bytes) < partsize){
+      break;
     }
-    // Loading
-    if(0 < size && 0 != (result = Load(start, load_size))){
-      S3FS_PRN_ERR("could not download. start(%jd), size(%zu), errno(%d)", (intmax_t)start, size, result);
-      return -EIO;
+    if(MAX_MULTIPART_CNT <= stream_etaglist.size() || !pagelist.IsPageLoaded(stream_pos, bytes)){
+      is_stream_invalid = true;
+      break;
     }
+    {
+      AutoLock auto_lock(&stream_lock);
+      stream_etaglist.push_back(string(""));
+      stream_uploading++;
+    }
+    // reference for the job is released after uploading
+    Dup();
+    if(!FdManager::UploadPart(this, stream_pos, bytes)){
+      refcnt--;
+      result = StreamUploadPart(stream_pos, bytes);
+    }
+    stream_pos += bytes;
+  }
+  return result;
+}
+
+int FdEntity::StreamUploadPart(off_t start, size_t size)
+{
+  string tmp_upload_id;
+  string tpath;
+  {
+    AutoLock auto_lock(&stream_lock);
+    tmp_upload_id = stream_upload_id;
+    tpath         = stream_path;
+  }
+  int    part_num = static_cast<int>(start / S3fsCurl::GetMultipartSize()) + 1;
+  string etag;
+  int    result;
+  {
+    S3fsCurl s3fscurl(true);
+    result = s3fscurl.MultipartUploadRequest(tmp_upload_id, tpath.c_str(), fd, start, size, part_num, etag);
+  }
+  if(0 != result){
+    S3FS_PRN_ERR("failed to upload part(%d) of file(%s) by errno(%d).", part_num, tpath.c_str(), result);
+  }
+
+  AutoLock auto_lock(&stream_lock);
+  if(0 == result && static_cast<size_t>(part_num) <= stream_etaglist.size()){
+    stream_etaglist[part_num - 1] = etag;
+  }else if(0 == stream_result){
+    stream_result = (0 != result ? result : -EIO);
+  }
+  stream_uploading--;
+  pthread_cond_broadcast(&stream_cond);
+
+  return result;
+}
+
+int FdEntity::WaitStreamUploadParts(void)
+{
+  AutoLock auto_lock(&stream_lock);
+
+  while(0 < stream_uploading){
+    pthread_cond_wait(&stream_cond, &stream_lock);
+  }
+  return stream_result;
+}
+
+void FdEntity::AbortStreamUpload(void)
+{
+  if(stream_upload_id.empty()){
+    return;
+  }
+  WaitStreamUploadParts();
+
+  S3fsCurl s3fscurl(true);
+  if(0 != s3fscurl.AbortMultipartUpload(stream_path.c_str(), stream_upload_id)){
+    S3FS_PRN_WARN("failed to abort multipart upload for file(%s), but continue...", stream_path.c_str());
+  }
+  stream_upload_id.erase();
+  stream_etaglist.clear();
+  stream_pos        = 0;
+  stream_result     = 0;
+  is_stream_invalid = false;
+}
+
+int FdEntity::StreamUploadFlush(const char* tpath)
+{
+  int result = 0;
+
+  if(is_stream_invalid || 0 < upload_id.length() || path != stream_path || (tpath && stream_path != tpath)){
+    result = -EIO;
+  }else{
+    // load all area for the rest parts
+    size_t restsize = pagelist.GetTotalUnloadedPageSize();
+    if(0 < restsize){
+      if(!FdManager::IsSafeDiskSpace(NULL, restsize)){
+        result = -ENOSPC;
+      }else{
+        result = Load();
+      }
+    }
+    if(0 == result){
+      result = StreamUploadParts(static_cast<off_t>(pagelist.Size()), true);
+    }
+    if(0 == result){
+      result = WaitStreamUploadParts();
+    }
+    if(0 == result && is_stream_invalid){
+      result = -EIO;
+    }
+    if(0 == result){
+      S3fsCurl s3fscurl(true);
+      result = s3fscurl.CompleteMultipartPostRequest(stream_path.c_str(), stream_upload_id, stream_etaglist);
+    }
+  }
+  if(0 != result){
+    AbortStreamUpload();
+    return result;
+  }
+
+  // headers are changed after starting
+  if(stream_meta != orgmeta){
+    is_meta_pending = true;
+  }
+  stream_upload_id.erase();
+  stream_etaglist.clear();
+  stream_pos    = 0;
+  stream_result = 0;
+
+  return UploadPendingMeta();
+}
+
+int FdEntity::LoadReservedPages(fdpage_list_t& reserved_list, const string& tpath, size_t orgsize)
+{
+  int result = 0;
+  for(fdpage_list_t::iterator iter = reserved_list.begin(); iter != reserved_list.end(); ++iter){
+    if(0 == result){
+      result = LoadPage(tpath, (*iter)->offset, (*iter)->bytes, orgsize);
+    }
+    FinishLoadingPage(*iter, (0 == result));
+  }
+  reserved_list.clear();
+  return result;
+}
+
+// [NOTE]
+// Detects sequential reading, and returns the area which should be loaded
+// ahead. The read ahead window starts from multipart size, and it is doubled
+// at each request up to the prefetch size. The next area is requested when
+// the reader comes within the half of the window from the end of the area
+// already requested. Random reading resets the window.
+// Returns false if the reading is not sequential or read ahead is disabled,
+// then the caller prefetches synchronously as before.
+//
+bool FdEntity::CheckReadAhead(off_t start, size_t size, off_t& ahead_start, size_t& ahead_size)
+{
+  ahead_start = 0;
+  ahead_size  = 0;
+
+  bool is_sequential = (start == readahead_next);
+  readahead_next     = start + size;
+
+  if(!FdManager::IsReadAhead() || 0 < upload_id.length()){
+    return false;
+  }
+  if(!is_sequential || 0 == readahead_size){
+    readahead_pos  = 0;
+    readahead_size = static_cast<size_t>(S3fsCurl::GetMultipartSize());
+    if(!is_sequential){
+      return false;
+    }
+  }
+
+  off_t next    = start + size;
+  off_t fsize   = static_cast<off_t>(pagelist.Size());
+  off_t lastpos = max(readahead_pos, next);
+  if(fsize <= lastpos || static_cast<off_t>(next + readahead_size / 2) < lastpos){
+    // already requested enough
+    return true;
+  }
+  ahead_start    = lastpos;
+  ahead_size     = static_cast<size_t>(min(static_cast<off_t>(next + readahead_size), fsize) - lastpos);
+  readahead_pos  = ahead_start + ahead_size;
+  readahead_size = min(readahead_size * 2, max(static_cast<size_t>(S3fsCurl::GetMultipartSize()), FdEntity::GetPretchSize()));
+
+  return true;
+}
+
+// [NOTE]
+// Called from read ahead threads. The areas which are not loaded yet
+// are reserved and loaded as same as Read, then readers of those areas
+// wait for this loading instead of requesting again.
+//
+int FdEntity::ReadAhead(off_t start, size_t size)
+{
+  S3FS_PRN_DBG("[path=%s][fd=%d][offset=%jd][size=%zu]", path.c_str(), fd, (intmax_t)start, size);
+
+  if(-1 == fd){
+    return -EBADF;
+  }
+
+  fdpage_list_t reserved_list;
+  string        tpath;
+  size_t        orgsize;
+  {
+    AutoLock auto_lock(&fdent_lock);
+
+    MergeLoadedPages();
+
+    if(0 == pagelist.GetTotalUnloadedPageSize(start, size)){
+      return 0;
+    }
+    if(0 < upload_id.length() || !FdManager::IsSafeDiskSpace(NULL, size)){
+      // not loading ahead without enough disk space
+      return 0;
+    }
+    pagelist.GetUnloadedPages(reserved_list, start, size);
+    ReserveLoadingPages(reserved_list);
+    tpath   = path;
+    orgsize = size_orgmeta;
+  }
+
+  int result;
+  if(0 != (result = LoadReservedPages(reserved_list, tpath, orgsize))){
+    S3FS_PRN_WARN("could not read ahead. start(%jd), size(%zu), errno(%d)", (intmax_t)start, size, result);
+  }
+  return result;
+}
+
+// [NOTE]
+// Read does not hold fdent_lock while downloading. The unloaded areas are
+// reserved in loading_pages and downloaded without the lock, so that other
+// readers of loaded areas are served from the cache file immediately, and
+// readers which need the same area wait for the reserved download.
+//
+ssize_t FdEntity::Read(char* bytes, off_t start, size_t size, bool force_load)
+{
+  S3FS_PRN_DBG("[path=%s][fd=%d][offset=%jd][size=%zu]", path.c_str(), fd, (intmax_t)start, size);
+
+  if(-1 == fd){
+    return -EBADF;
+  }
+
+  int result;
+  if(0 != (result = PrepareRead(start, size, force_load))){
+    return result;
   }
+
   // Reading
+  StatsTimer stats_timer(stats_disk_read);
+  ssize_t    rsize;
   if(-1 == (rsize = pread(fd, bytes, size, start))){
     S3FS_PRN_ERR("pread failed. errno(%d)", errno);
     return -errno;
   }
+  stats_timer.SetSize(rsize);
   return rsize;
 }
 
+//
+// Load the area for reading, and returns the fd of cache file and the size
+// which can be read from start, so that the caller reads the cache file
+// directly(ex. FUSE splices it) without copying to buffer.
+//
+// [NOTE]
+// The fd is valid while the caller has this entity opened.
+//
+ssize_t FdEntity::ReadFd(off_t start, size_t size, int& readfd)
+{
+  S3FS_PRN_DBG("[path=%s][fd=%d][offset=%jd][size=%zu]", path.c_str(), fd, (intmax_t)start, size);
+
+  if(-1 == fd){
+    return -EBADF;
+  }
+
+  int result;
+  if(0 != (result = PrepareRead(start, size, false))){
+    return result;
+  }
+
+  AutoLock auto_lock(&fdent_lock);
+  size_t   total = pagelist.Size();
+  readfd = fd;
+  if(total <= static_cast<size_t>(start)){
+    return 0;
+  }
+  return static_cast<ssize_t>(min(size, total - static_cast<size_t>(start)));
+}
+
+//
+// Load the area which is not loaded yet for reading.
+//
+int FdEntity::PrepareRead(off_t start, size_t size, bool force_load)
+{
+  int           result = 0;
+  fdpage_list_t reserved_list;
+  string        tpath;
+  size_t        orgsize    = 0;
+  off_t         ahead_start = 0;
+  size_t        ahead_size  = 0;
+  {
+    AutoLock auto_lock(&fdent_lock);
+
+    MergeLoadedPages();
+
+    if(force_load){
+      WaitLoadingPages(start, size);
+      MergeLoadedPages();
+      pagelist.SetPageLoadedStatus(start, size, false);
+    }
+
+    // sequential reading is loaded ahead by background threads
+    bool is_readahead = CheckReadAhead(start, size, ahead_start, ahead_size);
+    if(0 < ahead_size){
+      tpath = path;
+    }
+
+    size_t unloaded = (0 < size ? pagelist.GetTotalUnloadedPageSize(start, size) : 0);
+    if(0 < size){
+      if(0 == unloaded){
+        stats_fd_cache_hits.Add();
+      }else{
+        stats_fd_cache_misses.Add();
+        stats_fd_cache_miss_bytes.Add(unloaded);
+      }
+    }
+
+    // check disk space
+    if(0 < unloaded){
+      if(!FdManager::IsSafeDiskSpace(NULL, size)){
+        // remove cold cache files for next time
+        FdManager::WakeupCacheEvictor();
+
+        // [NOTE]
+        // If the area of this entity fd used can be released, try to do it.
+        // But If file data is updated, we can not even release of fd.
+        // Fundamentally, this method will fail as long as the disk capacity
+        // is not ensured.
+        //
+        if(!is_modify){
+          // try to clear all cache for this fd.
+          WaitLoadingPages();
+          MergeLoadedPages();
+          pagelist.Init(pagelist.Size(), false);
+          if(-1 == ftruncate(fd, 0) || -1 == ftruncate(fd, pagelist.Size())){
+            S3FS_PRN_ERR("failed to truncate temporary file(%d).", fd);
+            return -ENOSPC;
+          }
+        }
+      }
+
+      // load size(for prefetch)
+      size_t load_size = size;
+      if(!is_readahead && static_cast<size_t>(start + size) < pagelist.Size()){
+        size_t prefetch_max_size = max(size, FdEntity::GetPretchSize());
+
+        if(static_cast<size_t>(start + prefetch_max_size) < pagelist.Size()){
+          load_size = prefetch_max_size;
+        }else{
+          load_size = static_cast<size_t>(pagelist.Size() - start);
+        }
+      }
+      // reserve areas which are not loading by others
+      pagelist.GetUnloadedPages(reserved_list, start, load_size);
+      ReserveLoadingPages(reserved_list);
+      tpath   = path;
+      orgsize = size_orgmeta;
+    }
+  }
+
+  // request to read ahead before loading, so that it overlaps with this loading
+  if(0 < ahead_size){
+    if(-1 == Dup() || !FdManager::ReadAhead(this, ahead_start, ahead_size)){
+      S3FS_PRN_WARN("failed to request read ahead(start=%jd, size=%zu) for file(%s).", (intmax_t)ahead_start, ahead_size, tpath.c_str());
+      FdManager::get()->Close(this);
+    }
+  }
+
+  // Loading reserved areas without fdent_lock
+  if(0 != (result = LoadReservedPages(reserved_list, tpath, orgsize))){
+    S3FS_PRN_ERR("could not download. start(%jd), size(%zu), errno(%d)", (intmax_t)start, size, result);
+    return -EIO;
+  }
+
+  if(0 < size){
+    // wait for the areas which are loading by others
+    WaitLoadingPages(start, size);
+
+    AutoLock auto_lock(&fdent_lock);
+    MergeLoadedPages();
+
+    // the loading by others might be failed, then load it here.
+    if(0 < pagelist.GetTotalUnloadedPageSize(start, size) && 0 != (result = Load(start, size))){
+      S3FS_PRN_ERR("could not download. start(%jd), size(%zu), errno(%d)", (intmax_t)start, size, result);
+      return -EIO;
+    }
+  }
+  return 0;
+}
+
 ssize_t FdEntity::Write(const char* bytes, off_t start, size_t size)
 {
   S3FS_PRN_DBG("[path=%s][fd=%d][offset=%jd][size=%zu]", path.c_str(), fd, (intmax_t)start, size);
@@ -1631,6 +2267,10 @@ ssize_t FdEntity::Write(const char* bytes, off_t start, size_t size)
   }
   AutoLock auto_lock(&fdent_lock);
 
+  // do not write while other readers are downloading
+  WaitLoadingPages();
+  MergeLoadedPages();
+
   int     result;
   ssize_t wsize;
 
@@ -1647,6 +2287,11 @@ ssize_t FdEntity::Write(const char* bytes, off_t start, size_t size)
       }
     }else{
       // no enough disk space
+      if(!stream_upload_id.empty()){
+        // cache file is truncated after this, so stop uploading parts.
+        is_stream_invalid = true;
+        WaitStreamUploadParts();
+      }
       if(0 != (result = NoCachePreMultipartPost())){
         S3FS_PRN_ERR("failed to switch multipart uploading with no cache(errno=%d)", result);
         return static_cast<ssize_t>(result);
@@ -1664,8 +2309,18 @@ ssize_t FdEntity::Write(const char* bytes, off_t start, size_t size)
 
   }
 
+  // the area already uploaded as parts is changed
+  if(start < stream_pos){
+    is_stream_invalid = true;
+  }
+
   // Writing
-  if(-1 == (wsize = pwrite(fd, bytes, size, start))){
+  {
+    StatsTimer stats_timer(stats_disk_write);
+    wsize = pwrite(fd, bytes, size, start);
+    stats_timer.SetSize(wsize);
+  }
+  if(-1 == wsize){
     S3FS_PRN_ERR("pwrite failed. errno(%d)", errno);
     return -errno;
   }
@@ -1676,6 +2331,13 @@ ssize_t FdEntity::Write(const char* bytes, off_t start, size_t size)
     pagelist.SetPageLoadedStatus(start, static_cast<size_t>(wsize), true);
   }
 
+  // upload parts which are filled by sequential writing
+  if(0 == upload_id.length() && FdEntity::stream_upload && 0 < wsize){
+    if(0 != (result = StreamUploadParts(start + wsize, false))){
+      S3FS_PRN_WARN("failed to upload parts while writing(errno=%d), then upload at flushing.", result);
+    }
+  }
+
   // check multipart uploading
   if(0 < upload_id.length()){
     // sequence write mode check offset
@@ -1734,6 +2396,14 @@ int FdEntity::Ftruncate(ssize_t size) {
       S3FS_PRN_ERR("failed to truncate file %s, because not enough space.", path.c_str());
       return -ENOSPC;
     }
+    WaitLoadingPages();
+    MergeLoadedPages();
+
+    if(size < stream_pos){
+      // the area already uploaded as parts is changed
+      is_stream_invalid = true;
+    }
+
     // truncate temporary file size
     if(-1 == ftruncate(fd, size) || -1 == fsync(fd)){
       S3FS_PRN_ERR("failed to truncate temporary file %s by errno(%d).",  path.c_str(), errno);
@@ -1806,6 +2476,355 @@ int FdEntity::UploadPendingMeta()
     return result;
 }
 
+//------------------------------------------------
+// FdThreadPool methods
+//------------------------------------------------
+FdThreadPool::FdThreadPool(int count) : is_lock_init(false), is_exit(false), max_threads(count)
+{
+  try{
+    pthread_mutex_init(&pool_lock, NULL);
+    pthread_cond_init(&pool_cond, NULL);
+    is_lock_init = true;
+  }catch(exception& e){
+    S3FS_PRN_CRIT("failed to init mutex");
+  }
+}
+
+FdThreadPool::~FdThreadPool()
+{
+  if(is_lock_init){
+    try{
+      pthread_mutex_destroy(&pool_lock);
+      pthread_cond_destroy(&pool_cond);
+    }catch(exception& e){
+      S3FS_PRN_CRIT("failed to destroy mutex");
+    }
+    is_lock_init = false;
+  }
+}
+
+int FdThreadPool::SetMaxThreads(int count)
+{
+  int old     = max_threads;
+  max_threads = (0 < count ? count : 0);
+  return old;
+}
+
+// [NOTE] must be called with pool_lock held.
+bool FdThreadPool::StartWorkers(void)
+{
+  while(static_cast<int>(threads.size()) < max_threads){
+    pthread_t thread;
+    int       rc;
+    if(0 != (rc = pthread_create(&thread, NULL, FdThreadPool::Worker, static_cast<void*>(this)))){
+      S3FS_PRN_ERR("failed pthread_create - rc(%d)", rc);
+      break;
+    }
+    threads.push_back(thread);
+  }
+  return !threads.empty();
+}
+
+bool FdThreadPool::Submit(FdEntity* ent, job_type type, off_t start, size_t size)
+{
+  if(!ent || !is_lock_init){
+    return false;
+  }
+  AutoLock auto_lock(&pool_lock);
+
+  if(is_exit || 0 == max_threads){
+    return false;
+  }
+  if(static_cast<int>(threads.size()) < max_threads && !StartWorkers()){
+    return false;
+  }
+  jobs.push_back(fdjob(ent, type, start, size));
+  pthread_cond_signal(&pool_cond);
+
+  return true;
+}
+
+bool FdThreadPool::Destroy(void)
+{
+  if(!is_lock_init){
+    return true;
+  }
+  fdjob_list_t rest_jobs;
+  {
+    AutoLock auto_lock(&pool_lock);
+    is_exit = true;
+    pthread_cond_broadcast(&pool_cond);
+    rest_jobs.swap(jobs);
+  }
+
+  bool result = true;
+  for(std::vector<pthread_t>::iterator iter = threads.begin(); iter != threads.end(); ++iter){
+    int rc;
+    if(0 != (rc = pthread_join(*iter, NULL))){
+      S3FS_PRN_ERR("failed pthread_join - rc(%d)", rc);
+      result = false;
+    }
+  }
+  threads.clear();
+
+  // jobs which were never started.
+  for(fdjob_list_t::iterator iter = rest_jobs.begin(); iter != rest_jobs.end(); ++iter){
+    if(JOB_UPLOADPART == iter->type){
+      // the writer waits for this part, so upload it here.
+      iter->ent->StreamUploadPart(iter->start, iter->size);
+    }
+    FdManager::get()->Close(iter->ent);
+  }
+  return result;
+}
+
+void* FdThreadPool::Worker(void* arg)
+{
+  FdThreadPool* pool = static_cast<FdThreadPool*>(arg);
+
+  while(true){
+    fdjob job(NULL, JOB_READAHEAD, 0, 0);
+    {
+      AutoLock auto_lock(&pool->pool_lock);
+      while(!pool->is_exit && pool->jobs.empty()){
+        pthread_cond_wait(&pool->pool_cond, &pool->pool_lock);
+      }
+      if(pool->is_exit){
+        break;
+      }
+      job = pool->jobs.front();
+      pool->jobs.pop_front();
+    }
+    if(JOB_UPLOADPART == job.type){
+      job.ent->StreamUploadPart(job.start, job.size);
+    }else{
+      job.ent->ReadAhead(job.start, job.size);
+    }
+    FdManager::get()->Close(job.ent);
+  }
+  return NULL;
+}
+
+//------------------------------------------------
+// FdCacheEvictor methods
+//------------------------------------------------
+FdCacheEvictor::FdCacheEvictor() : is_lock_init(false), is_exit(false), is_started(false), is_wakeup(false), max_size(0), total_size(0)
+{
+  try{
+    pthread_mutex_init(&evict_lock, NULL);
+    pthread_cond_init(&evict_cond, NULL);
+    is_lock_init = true;
+  }catch(exception& e){
+    S3FS_PRN_CRIT("failed to init mutex");
+  }
+}
+
+FdCacheEvictor::~FdCacheEvictor()
+{
+  if(is_lock_init){
+    try{
+      pthread_mutex_destroy(&evict_lock);
+      pthread_cond_destroy(&evict_cond);
+    }catch(exception& e){
+      S3FS_PRN_CRIT("failed to destroy mutex");
+    }
+    is_lock_init = false;
+  }
+}
+
+size_t FdCacheEvictor::SetMaxSize(size_t size)
+{
+  size_t old = max_size;
+  max_size   = size;
+  return old;
+}
+
+bool FdCacheEvictor::Start(void)
+{
+  if(!is_lock_init){
+    return false;
+  }
+  AutoLock auto_lock(&evict_lock);
+
+  if(is_started){
+    return true;
+  }
+  int rc;
+  if(0 != (rc = pthread_create(&thread, NULL, FdCacheEvictor::Worker, static_cast<void*>(this)))){
+    S3FS_PRN_ERR("failed pthread_create - rc(%d)", rc);
+    return false;
+  }
+  is_started = true;
+  return true;
+}
+
+bool FdCacheEvictor::Destroy(void)
+{
+  if(!is_lock_init){
+    return true;
+  }
+  {
+    AutoLock auto_lock(&evict_lock);
+    if(!is_started){
+      return true;
+    }
+    is_exit = true;
+    pthread_cond_broadcast(&evict_cond);
+  }
+  int rc;
+  if(0 != (rc = pthread_join(thread, NULL))){
+    S3FS_PRN_ERR("failed pthread_join - rc(%d)", rc);
+    return false;
+  }
+  is_started = false;
+  return true;
+}
+
+void FdCacheEvictor::Add(const string& path, size_t size)
+{
+  AutoLock auto_lock(&evict_lock);
+
+  RemoveEntry(path);
+  lrulist.push_front(make_pair(path, size));
+  lrumap[path] = lrulist.begin();
+  total_size  += size;
+
+  if(is_started && NeedEvict()){
+    is_wakeup = true;
+    pthread_cond_signal(&evict_cond);
+  }
+}
+
+void FdCacheEvictor::Remove(const string& path)
+{
+  AutoLock auto_lock(&evict_lock);
+  RemoveEntry(path);
+}
+
+void FdCacheEvictor::Wakeup(void)
+{
+  AutoLock auto_lock(&evict_lock);
+  if(is_started){
+    is_wakeup = true;
+    pthread_cond_signal(&evict_cond);
+  }
+}
+
+void FdCacheEvictor::RemoveEntry(const string& path)
+{
+  cachefile_map_t::iterator iter = lrumap.find(path);
+  if(lrumap.end() == iter){
+    return;
+  }
+  total_size -= min(total_size, iter->second->second);
+  lrulist.erase(iter->second);
+  lrumap.erase(iter);
+}
+
+//
+// Evicting starts when the total size is over max size, and continues
+// until it is under the low-water mark(90% of max size), so that a little
+// growth after evicting does not start it again soon.
+//
+bool FdCacheEvictor::NeedEvict(bool is_evicting) const
+{
+  if(lrulist.empty()){
+    return false;
+  }
+  size_t limit = (is_evicting ? max_size - max_size / 10 : max_size);
+  if(0 < max_size && limit < total_size){
+    return true;
+  }
+  return !FdManager::IsSafeDiskSpace(NULL, 0);
+}
+
+void FdCacheEvictor::Evict(void)
+{
+  {
+    AutoLock auto_lock(&evict_lock);
+    if(!NeedEvict()){
+      return;
+    }
+  }
+  while(true){
+    string path;
+    {
+      AutoLock auto_lock(&evict_lock);
+      if(is_exit || !NeedEvict(true)){
+        break;
+      }
+      path = lrulist.back().first;
+      RemoveEntry(path);
+    }
+    if(!FdManager::get()->EvictCacheFile(path.c_str())){
+      S3FS_PRN_DBG("skip evicting cache file(%s).", path.c_str());
+    }
+  }
+}
+
+bool FdCacheEvictor::ScanCacheDir(const string& topdir, const string& path, std::multimap<time_t, std::pair<string, size_t> >& files)
+{
+  string dir = topdir + path;
+  DIR*   dp;
+  if(NULL == (dp = opendir(dir.c_str()))){
+    S3FS_PRN_ERR("could not open dir(%s) - errno(%d)", dir.c_str(), errno);
+    return false;
+  }
+  for(struct dirent* dent = readdir(dp); dent; dent = readdir(dp)){
+    if(0 == strcmp(dent->d_name, "..") || 0 == strcmp(dent->d_name, ".")){
+      continue;
+    }
+    string      objpath = path + "/" + dent->d_name;
+    struct stat st;
+    if(0 != lstat((topdir + objpath).c_str(), &st)){
+      continue;
+    }
+    if(S_ISDIR(st.st_mode)){
+      ScanCacheDir(topdir, objpath, files);
+    }else if(S_ISREG(st.st_mode)){
+      files.insert(make_pair(max(st.st_atime, st.st_mtime), make_pair(objpath, static_cast<size_t>(st.st_blocks) * 512)));
+    }
+  }
+  closedir(dp);
+  return true;
+}
+
+void* FdCacheEvictor::Worker(void* arg)
+{
+  FdCacheEvictor* evictor = static_cast<FdCacheEvictor*>(arg);
+
+  // load files which are left in cache directory, older files are colder.
+  string topdir;
+  if(FdManager::MakeCachePath(NULL, topdir, false) && !topdir.empty()){
+    std::multimap<time_t, std::pair<string, size_t> > files;
+    ScanCacheDir(topdir, "", files);
+
+    AutoLock auto_lock(&evictor->evict_lock);
+    for(std::multimap<time_t, std::pair<string, size_t> >::reverse_iterator iter = files.rbegin(); iter != files.rend(); ++iter){
+      if(evictor->lrumap.end() == evictor->lrumap.find(iter->second.first)){
+        evictor->lrulist.push_back(iter->second);
+        evictor->lrumap[iter->second.first] = --evictor->lrulist.end();
+        evictor->total_size += iter->second.second;
+      }
+    }
+    S3FS_PRN_INFO("cache directory has %zu files(%zu bytes).", evictor->lrulist.size(), evictor->total_size);
+  }
+
+  while(true){
+    evictor->Evict();
+
+    AutoLock auto_lock(&evictor->evict_lock);
+    while(!evictor->is_exit && !evictor->is_wakeup){
+      pthread_cond_wait(&evictor->evict_cond, &evictor->evict_lock);
+    }
+    if(evictor->is_exit){
+      break;
+    }
+    evictor->is_wakeup = false;
+  }
+  return NULL;
+}
+
 //------------------------------------------------
 // FdManager symbol
 //------------------------------------------------
@@ -1833,6 +2852,11 @@ bool            FdManager::is_lock_init(false);
 string          FdManager::cache_dir("");
 size_t          FdManager::free_disk_space = 0;
 std::string     FdManager::tmp_dir = "/tmp";
+#define DEFAULT_READAHEAD_THREADS   4
+
+FdThreadPool    FdManager::readahead_pool(DEFAULT_READAHEAD_THREADS);
+FdThreadPool    FdManager::upload_pool;
+FdCacheEvictor  FdManager::cache_evictor;
 
 //------------------------------------------------
 // FdManager class methods
@@ -1873,6 +2897,8 @@ int FdManager::DeleteCacheFile(const char* path)
   if(!FdManager::MakeCachePath(path, cache_path, false)){
     return 0;
   }
+  FdManager::cache_evictor.Remove(path);
+
   int result = 0;
   if(0 != unlink(cache_path.c_str())){
     if(ENOENT == errno){
@@ -2030,6 +3056,14 @@ bool FdManager::IsSafeDiskSpace(const char* path, size_t size)
   return ((size + FdManager::GetEnsureFreeDiskSpace()) <= fsize);
 }
 
+bool FdManager::InitCacheEvictor(void)
+{
+  if(!FdManager::IsCacheDir() || 0 == cache_evictor.GetMaxSize()){
+    return true;
+  }
+  return cache_evictor.Start();
+}
+
 //------------------------------------------------
 // FdManager methods
 //------------------------------------------------
@@ -2056,6 +3090,8 @@ FdManager::~FdManager()
       delete ent;
     }
     fent.clear();
+    fentkeys.clear();
+    fentpaths.clear();
 
     if(FdManager::is_lock_init){
       try{
@@ -2070,6 +3106,72 @@ FdManager::~FdManager()
   }
 }
 
+//
+// Add the entity to fent with key, and to its indexes.
+//
+void FdManager::AddEntity(const string& key, FdEntity* ent)
+{
+  fdent_map_t::iterator iter = fent.find(key);
+  if(fent.end() != iter && iter->second != ent){
+    // [NOTE]
+    // another entity has the same key(ex. renamed to opened file path), it is
+    // not managed any more as before.
+    S3FS_PRN_WARN("entity for %s is replaced by new one.", key.c_str());
+    RemoveEntity(iter->second);
+  }
+  RemoveEntity(ent);
+
+  fent[key]      = ent;
+  fentkeys[ent]  = fdent_key_t(key, SAFESTRPTR(ent->GetPath()));
+  fentpaths[fentkeys[ent].second].push_back(ent);
+}
+
+//
+// Remove the entity from fent and its indexes, the entity is not deleted.
+//
+bool FdManager::RemoveEntity(FdEntity* ent)
+{
+  fdent_key_map_t::iterator kiter = fentkeys.find(ent);
+  if(fentkeys.end() == kiter){
+    return false;
+  }
+  fent.erase(kiter->second.first);
+
+  fdent_path_map_t::iterator piter = fentpaths.find(kiter->second.second);
+  if(fentpaths.end() != piter){
+    fdent_list_t& ents = piter->second;
+    for(fdent_list_t::iterator iter = ents.begin(); iter != ents.end(); ++iter){
+      if(*iter == ent){
+        ents.erase(iter);
+        break;
+      }
+    }
+    if(ents.empty()){
+      fentpaths.erase(piter);
+    }
+  }
+  fentkeys.erase(kiter);
+  return true;
+}
+
+//
+// Find the entity for path from the path index. If fd is not -1, the
+// entity must have it.
+//
+FdEntity* FdManager::FindEntity(const char* path, int fd, bool is_opened) const
+{
+  fdent_path_map_t::const_iterator piter = fentpaths.find(string(path));
+  if(fentpaths.end() == piter){
+    return NULL;
+  }
+  for(fdent_list_t::const_iterator iter = piter->second.begin(); iter != piter->second.end(); ++iter){
+    if((!is_opened || (*iter)->IsOpen()) && (-1 == fd || (*iter)->GetFd() == fd) && 0 == strcmp((*iter)->GetPath(), path)){
+      return *iter;
+    }
+  }
+  return NULL;
+}
+
 FdEntity* FdManager::GetFdEntity(const char* path, int existfd)
 {
   S3FS_PRN_INFO3("[path=%s][fd=%d]", SAFESTRPTR(path), existfd);
@@ -2085,17 +3187,10 @@ FdEntity* FdManager::GetFdEntity(const char* path, int existfd)
   }
 
   if(-1 != existfd){
-    for(iter = fent.begin(); iter != fent.end(); ++iter){
-      if((*iter).second && (*iter).second->GetFd() == existfd){
-        // found opend fd in map
-        if(0 == strcmp((*iter).second->GetPath(), path)){
-          return (*iter).second;
-        }
-        // found fd, but it is used another file(file descriptor is recycled)
-        // so returns NULL.
-        break;
-      }
-    }
+    // [NOTE]
+    // If the fd is used by another file(file descriptor is recycled), it is
+    // not found in the entities for path, so returns NULL.
+    return FindEntity(path, existfd, false);
   }
   return NULL;
 }
@@ -2110,26 +3205,24 @@ FdEntity* FdManager::Open(const char* path, headers_t* pmeta, ssize_t size, time
   AutoLock auto_lock(&FdManager::fd_manager_lock);
 
   fdent_map_t::iterator iter = fent.find(string(path));
-  FdEntity*             ent;
+  FdEntity*             ent  = (fent.end() != iter ? iter->second : NULL);
 
-  if(fent.end() == iter && !force_tmpfile && !FdManager::IsCacheDir()){
+  if(!ent && !force_tmpfile && !FdManager::IsCacheDir()){
     // If the cache directory is not specified, s3fs opens a temporary file
     // when the file is opened.
     // Then if it could not find a entity in map for the file, s3fs should
     // search a entity in all which opened the temporary file.
     //
-    for(iter = fent.begin(); iter != fent.end(); ++iter){
-      if((*iter).second && (*iter).second->IsOpen() && 0 == strcmp((*iter).second->GetPath(), path)){
-        break;      // found opened fd in mapping
-      }
-    }
+    ent = FindEntity(path, -1, true);
   }
 
-  if(fent.end() != iter){
+  if(ent){
     // found
-    ent = (*iter).second;
 
   }else if(is_create){
+    // opened cache file is not evicted
+    FdManager::cache_evictor.Remove(path);
+
     // not found
     string cache_path = "";
     if(!force_tmpfile && !FdManager::MakeCachePath(path, cache_path, true)){
@@ -2141,7 +3234,7 @@ FdEntity* FdManager::Open(const char* path, headers_t* pmeta, ssize_t size, time
 
     if(0 < cache_path.size()){
       // using cache
-      fent[string(path)] = ent;
+      AddEntity(string(path), ent);
     }else{
       // not using cache, so the key of fdentity is set not really existsing path.
       // (but not strictly unexisting path.)
@@ -2152,7 +3245,7 @@ FdEntity* FdManager::Open(const char* path, headers_t* pmeta, ssize_t size, time
       //
       string tmppath("");
       FdManager::MakeRandomTempPath(path, tmppath);
-      fent[tmppath] = ent;
+      AddEntity(tmppath, ent);
     }
   }else{
     return NULL;
@@ -2176,18 +3269,11 @@ FdEntity* FdManager::ExistOpen(const char* path, int existfd, bool ignore_existf
     // search from all fdentity because of not using cache.
     AutoLock auto_lock(&FdManager::fd_manager_lock);
 
-    for(fdent_map_t::iterator iter = fent.begin(); iter != fent.end(); ++iter){
-      if((*iter).second && (*iter).second->IsOpen() && (ignore_existfd || ((*iter).second->GetFd() == existfd))){
-        // found opend fd in map
-        if(0 == strcmp((*iter).second->GetPath(), path)){
-          ent = (*iter).second;
-          ent->Dup();
-          break;
-        }else{
-          // found fd, but it is used another file(file descriptor is recycled)
-          // so returns NULL.
-        }
-      }
+    // [NOTE]
+    // If the fd is used by another file(file descriptor is recycled), it is
+    // not found in the entities for path, so returns NULL.
+    if(NULL != (ent = FindEntity(path, (ignore_existfd ? -1 : existfd), true))){
+      ent->Dup();
     }
   }
   return ent;
@@ -2197,23 +3283,19 @@ bool FdManager::Rename(const std::string &from, const std::string &to)
 {
   AutoLock auto_lock(&FdManager::fd_manager_lock);
   fdent_map_t::iterator iter = fent.find(from);
-  if(fent.end() == iter && !FdManager::IsCacheDir()){
+  FdEntity*             ent  = (fent.end() != iter ? iter->second : NULL);
+  if(!ent && !FdManager::IsCacheDir()){
     // If the cache directory is not specified, s3fs opens a temporary file
     // when the file is opened.
     // Then if it could not find a entity in map for the file, s3fs should
     // search a entity in all which opened the temporary file.
     //
-    for(iter = fent.begin(); iter != fent.end(); ++iter){
-      if((*iter).second && (*iter).second->IsOpen() && 0 == strcmp((*iter).second->GetPath(), from.c_str())){
-        break;              // found opened fd in mapping
-      }
-    }
+    ent = FindEntity(from.c_str(), -1, true);
   }
-  if(fent.end() != iter){
+  if(ent){
     // found
     S3FS_PRN_DBG("[from=%s][to=%s]", from.c_str(), to.c_str());
-    FdEntity* ent = (*iter).second;
-    fent.erase(iter);
+    RemoveEntity(ent);
     // rename path and caches in fd entity
     string fentmapkey;
     if(!ent->RenamePath(to, fentmapkey)){
@@ -2226,7 +3308,7 @@ bool FdManager::Rename(const std::string &from, const std::string &to)
     }
 
     // set new fd entity to map
-    fent[fentmapkey] = ent;
+    AddEntity(fentmapkey, ent);
   }
   return true;
 }
@@ -2237,19 +3319,44 @@ bool FdManager::Close(FdEntity* ent)
 
   AutoLock auto_lock(&FdManager::fd_manager_lock);
 
-  for(fdent_map_t::iterator iter = fent.begin(); iter != fent.end(); ++iter){
-    if((*iter).second == ent){
-      ent->Close();
-      if(!ent->IsOpen()){
-        delete (*iter).second;
-        fent.erase(iter);
-        return true;
+  fdent_key_map_t::iterator iter = fentkeys.find(ent);
+  if(fentkeys.end() == iter){
+    return false;
+  }
+  ent->Close();
+  if(!ent->IsOpen()){
+    // closed cache file is able to be evicted
+    string key = iter->second.first;
+    string cache_path;
+    if(FdManager::IsCacheDir() && key == ent->GetPath() && FdManager::MakeCachePath(ent->GetPath(), cache_path, false)){
+      struct stat st;
+      if(0 == stat(cache_path.c_str(), &st)){
+        FdManager::cache_evictor.Add(key, static_cast<size_t>(st.st_blocks) * 512);
       }
     }
+    RemoveEntity(ent);
+    delete ent;
+    return true;
   }
   return false;
 }
 
+// [NOTE]
+// Called from cache evictor thread. The cache file is removed only if it
+// is not opened, and this is checked under fd_manager_lock so that it is
+// not opened while removing.
+//
+bool FdManager::EvictCacheFile(const char* path)
+{
+  AutoLock auto_lock(&FdManager::fd_manager_lock);
+
+  if(fent.end() != fent.find(string(path))){
+    return false;
+  }
+  S3FS_PRN_INFO("evict cache file(%s)", path);
+  return (0 == FdManager::DeleteCacheFile(path));
+}
+
 bool FdManager::SetTmpDir(const char *dir)
 {
     if(!dir || '\0' == dir[0]){
@@ -2264,16 +3371,10 @@ bool FdManager::ChangeEntityToTempPath(FdEntity* ent, const char* path)
 {
   AutoLock auto_lock(&FdManager::fd_manager_lock);
 
-  for(fdent_map_t::iterator iter = fent.begin(); iter != fent.end(); ){
-    if((*iter).second == ent){
-      fent.erase(iter++);
-
-      string tmppath("");
-      FdManager::MakeRandomTempPath(path, tmppath);
-      fent[tmppath] = ent;
-    }else{
-      ++iter;
-    }
+  if(fentkeys.end() != fentkeys.find(ent)){
+    string tmppath("");
+    FdManager::MakeRandomTempPath(path, tmppath);
+    AddEntity(tmppath, ent);
   }
   return false;
 }
@@ -66,23 +66,33 @@ struct fdpage
   off_t end(void) const { return (0 < bytes ? offset + bytes - 1 : 0); }
 };
 typedef std::list<struct fdpage*> fdpage_list_t;
+typedef std::vector<struct fdpage> fdpage_array_t;
 
 class FdEntity;
 
 //
 // Management of loading area/modifying
 //
+// Pages are kept in a vector sorted by offset, they are contiguous from
+// 0 and adjoining pages have different loaded status(after compressing),
+// so a page is found by binary search without walking the list.
+//
 class PageList
 {
   friend class FdEntity;    // only one method access directly pages.
 
   private:
-    fdpage_list_t pages;
+    fdpage_array_t pages;
 
   private:
     void Clear(void);
     bool Compress(void);
-    bool Parse(off_t new_pos);
+    size_t Split(off_t pos);
+    void Merge(size_t pos);
+    fdpage_array_t::const_iterator FindPage(off_t start) const;
+    fdpage_array_t::const_iterator FindNextPage(off_t start) const;
+    bool LoadBinaryStats(const unsigned char* data, size_t length);
+    bool LoadTextStats(const char* data, size_t length);
 
   public:
     static void FreeList(fdpage_list_t& list);
@@ -129,8 +139,29 @@ class FdEntity
     size_t          mp_size;        // size for no cached multipart(write method only)
     bool            is_meta_pending;
     bool            is_no_disk_space_flushed;
+
+    pthread_mutex_t loading_lock;   // lock for loading_pages
+    pthread_cond_t  loading_cond;   // signaled when a loading page is finished
+    fdpage_list_t   loading_pages;  // areas which are downloading without fdent_lock
+                                    // (loaded=true means finished but not merged to pagelist yet)
+
+    off_t           readahead_next; // start position of next sequential read
+    off_t           readahead_pos;  // end position of the area requested to read ahead
+    size_t          readahead_size; // current read ahead window size
+
+    pthread_mutex_t stream_lock;    // lock for stream_etaglist, stream_uploading and stream_result
+    pthread_cond_t  stream_cond;    // signaled when a streaming part is finished
+    std::string     stream_upload_id;  // for uploading parts while sequential writing(streamupload)
+    std::string     stream_path;    // object path at starting stream upload
+    headers_t       stream_meta;    // headers at starting stream upload
+    etaglist_t      stream_etaglist;
+    off_t           stream_pos;     // end position of the area requested to upload as parts
+    int             stream_uploading;  // count of parts which are uploading now
+    int             stream_result;  // first error of uploading parts
+    bool            is_stream_invalid; // uploaded parts were changed after uploading
   private:
     static size_t max_prefetch_bytes;
+    static bool   stream_upload;
   private:
     static int FillFile(int fd, unsigned char byte, size_t size, off_t start);
 
@@ -139,6 +170,18 @@ class FdEntity
     //bool SetAllStatusLoaded(void) { return SetAllStatus(true); }
     bool SetAllStatusUnloaded(void) { return SetAllStatus(false); }
     int UploadPendingMeta(void);
+    int LoadPage(const std::string& tpath, off_t offset, size_t bytes, size_t orgsize);   // [NOTE] not locking
+    void ReserveLoadingPages(fdpage_list_t& unloaded_list);
+    void FinishLoadingPage(fdpage* page, bool is_loaded);
+    void WaitLoadingPages(off_t start = 0, size_t size = 0);   // size=0 means waiting to end
+    void MergeLoadedPages(void);                                // [NOTE] need to lock fdent_lock before calling
+    int LoadReservedPages(fdpage_list_t& reserved_list, const std::string& tpath, size_t orgsize);
+    int PrepareRead(off_t start, size_t size, bool force_load);
+    bool CheckReadAhead(off_t start, size_t size, off_t& ahead_start, size_t& ahead_size);   // [NOTE] need to lock fdent_lock before calling
+    int StreamUploadParts(off_t next, bool is_last);           // [NOTE] need to lock fdent_lock before calling
+    int WaitStreamUploadParts(void);
+    void AbortStreamUpload(void);                               // [NOTE] need to lock fdent_lock before calling
+    int StreamUploadFlush(const char* tpath);                   // [NOTE] need to lock fdent_lock before calling
 
 
   public:
@@ -146,6 +189,8 @@ class FdEntity
     ~FdEntity();
     static void SetMaxPrefetchBytes(size_t size) { max_prefetch_bytes = size; }
     static size_t GetPretchSize();   
+    static bool SetStreamUpload(bool is_stream) { bool old = stream_upload; stream_upload = is_stream; return old; }
+    static bool IsStreamUpload(void) { return stream_upload; }
   
     void Close(void);
     bool IsOpen(void) const { return (-1 != fd); }
@@ -180,11 +225,120 @@ class FdEntity
     int Flush(bool force_sync = false) { return RowFlush(NULL, force_sync); }
 
     ssize_t Read(char* bytes, off_t start, size_t size, bool force_load = false);
+    ssize_t ReadFd(off_t start, size_t size, int& readfd);
+    int ReadAhead(off_t start, size_t size);
+    int StreamUploadPart(off_t start, size_t size);
     ssize_t Write(const char* bytes, off_t start, size_t size);
     int GetRefCount();
     int Ftruncate(ssize_t size);
 };
-typedef std::map<std::string, class FdEntity*> fdent_map_t;   // key=path, value=FdEntity*
+typedef S3FS_HASH_MAP<std::string, class FdEntity*> fdent_map_t;   // key=path, value=FdEntity*
+
+// indexes of fdent_map_t
+typedef std::pair<std::string, std::string> fdent_key_t;              // key in fdent_map_t and object path
+typedef S3FS_HASH_MAP<class FdEntity*, fdent_key_t> fdent_key_map_t;  // key=FdEntity*
+typedef std::vector<class FdEntity*> fdent_list_t;
+typedef S3FS_HASH_MAP<std::string, fdent_list_t> fdent_path_map_t;    // key=object path, value=FdEntities for it
+
+//------------------------------------------------
+// class FdThreadPool
+//------------------------------------------------
+// Worker threads which load the areas ahead of sequential readers, or
+// upload parts of sequential writers in background.
+// Each job holds a reference of FdEntity(by FdEntity::Dup), and it is
+// released by FdManager::Close after the job. Workers are started at
+// the first Submit(), so that they are created after fuse has
+// daemonized the process.
+//
+class FdThreadPool
+{
+  public:
+    enum job_type {
+      JOB_READAHEAD = 0,            // FdEntity::ReadAhead
+      JOB_UPLOADPART                // FdEntity::StreamUploadPart
+    };
+
+  private:
+    struct fdjob
+    {
+      FdEntity* ent;
+      job_type  type;
+      off_t     start;
+      size_t    size;
+
+      fdjob(FdEntity* pent, job_type jtype, off_t pos, size_t bytes) : ent(pent), type(jtype), start(pos), size(bytes) {}
+    };
+    typedef std::list<fdjob> fdjob_list_t;
+
+    pthread_mutex_t        pool_lock;
+    pthread_cond_t         pool_cond;
+    bool                   is_lock_init;
+    bool                   is_exit;
+    int                    max_threads;
+    fdjob_list_t           jobs;
+    std::vector<pthread_t> threads;
+
+  private:
+    bool StartWorkers(void);
+    static void* Worker(void* arg);
+
+  public:
+    explicit FdThreadPool(int count = 0);
+    ~FdThreadPool();
+
+    int SetMaxThreads(int count);
+    int GetMaxThreads(void) const { return max_threads; }
+    bool Submit(FdEntity* ent, job_type type, off_t start, size_t size);
+    bool Destroy(void);
+};
+
+//------------------------------------------------
+// class FdCacheEvictor
+//------------------------------------------------
+// Keeps closed cache files in LRU order, and removes the coldest files
+// in background when the total size is over max_cache_size(until it is
+// under low-water mark) or the free disk space is not enough.
+// Opened files are not in the list, so they are never removed.
+// The list is built by scanning the cache directory at starting, and
+// updated by FdManager at opening/closing/deleting cache files.
+//
+class FdCacheEvictor
+{
+  private:
+    typedef std::list<std::pair<std::string, size_t> > cachefile_list_t;            // path and size, front is the most recently used
+    typedef std::map<std::string, cachefile_list_t::iterator> cachefile_map_t;
+
+    pthread_mutex_t  evict_lock;
+    pthread_cond_t   evict_cond;
+    bool             is_lock_init;
+    bool             is_exit;
+    bool             is_started;
+    bool             is_wakeup;
+    pthread_t        thread;
+    size_t           max_size;          // 0 means not limited
+    size_t           total_size;        // total size of files in lrulist
+    cachefile_list_t lrulist;
+    cachefile_map_t  lrumap;
+
+  private:
+    static void* Worker(void* arg);
+    static bool ScanCacheDir(const std::string& topdir, const std::string& path, std::multimap<time_t, std::pair<std::string, size_t> >& files);
+    bool NeedEvict(bool is_evicting = false) const;   // [NOTE] need to lock evict_lock before calling
+    void Evict(void);
+    void RemoveEntry(const std::string& path);  // [NOTE] need to lock evict_lock before calling
+
+  public:
+    FdCacheEvictor();
+    ~FdCacheEvictor();
+
+    size_t SetMaxSize(size_t size);
+    size_t GetMaxSize(void) const { return max_size; }
+    bool Start(void);
+    bool Destroy(void);
+    void Add(const std::string& path, size_t size);
+    void Remove(const std::string& path);
+    void Wakeup(void);
+};
 
 //------------------------------------------------
 // class FdManager
@@ -199,12 +353,22 @@ class FdManager
     static size_t          free_disk_space; // limit free disk space
 
     fdent_map_t            fent;
+    fdent_key_map_t        fentkeys;    // FdEntity -> key in fent(and path at adding)
+    fdent_path_map_t       fentpaths;   // object path -> FdEntities(keys in fent are tmp path without cache)
     static std::string     tmp_dir;
+    static FdThreadPool    readahead_pool;
+    static FdThreadPool    upload_pool;
+    static FdCacheEvictor  cache_evictor;
 
   private:
     static fsblkcnt_t GetFreeDiskSpace(const char* path);
     static bool IsDir(const std::string* dir);
 
+    // [NOTE] need to lock fd_manager_lock before calling
+    void AddEntity(const std::string& key, FdEntity* ent);
+    bool RemoveEntity(FdEntity* ent);
+    FdEntity* FindEntity(const char* path, int fd, bool is_opened) const;
+
   public:
     FdManager();
     ~FdManager();
@@ -235,6 +399,19 @@ class FdManager
     static bool SetTmpDir(const char* dir);
     static bool CheckTmpDirExist();
     static FILE* MakeTempFile();
+
+    static int SetReadAheadThreads(int count) { return readahead_pool.SetMaxThreads(count); }
+    static bool IsReadAhead(void) { return (0 < readahead_pool.GetMaxThreads()); }
+    static bool ReadAhead(FdEntity* ent, off_t start, size_t size) { return readahead_pool.Submit(ent, FdThreadPool::JOB_READAHEAD, start, size); }
+    static bool DestroyReadAhead(void) { return readahead_pool.Destroy(); }
+    static int SetUploadThreads(int count) { return upload_pool.SetMaxThreads(count); }
+    static bool UploadPart(FdEntity* ent, off_t start, size_t size) { return upload_pool.Submit(ent, FdThreadPool::JOB_UPLOADPART, start, size); }
+    static bool DestroyUploadPart(void) { return upload_pool.Destroy(); }
+    static size_t SetMaxCacheSize(size_t size) { return cache_evictor.SetMaxSize(size); }
+    static bool InitCacheEvictor(void);
+    static bool DestroyCacheEvictor(void) { return cache_evictor.Destroy(); }
+    static void WakeupCacheEvictor(void) { cache_evictor.Wakeup(); }
+    bool EvictCacheFile(const char* path);
 };
 
 #endif // FD_CACHE_H_
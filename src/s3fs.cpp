@@ -30,6 +30,7 @@
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
 #include <libxml/tree.h>
+#include <libxml/parser.h>
 #include <curl/curl.h>
 #include <pwd.h>
 #include <grp.h>
@@ -52,6 +53,7 @@
 #include "s3fs_util.h"
 #include "fdcache.h"
 #include "s3fs_auth.h"
+#include "stats.h"
 
 using namespace std;
 
@@ -82,6 +84,53 @@ typedef struct uncomplete_multipart_info{
 
 typedef std::list<UNCOMP_MP_INFO> uncomp_mp_list_t;
 
+//
+// For pipelined readdir
+//
+// A worker thread lists the objects page by page, and readdir sends
+// head requests for each page while the next page is being listed.
+//
+#define READDIR_MAX_PAGES   2         // max pages listed ahead of head requests
+
+typedef std::list<S3ObjList*> s3objlist_pages_t;
+
+typedef struct readdir_pipeline{
+  pthread_mutex_t   lock;
+  pthread_cond_t    cond;
+  string            path;
+  s3objlist_pages_t pages;      // listed pages which are not sent head requests yet
+  size_t            max_pages;  // 0 means no limit
+  bool              is_done;    // listing is finished
+  bool              is_abort;   // readdir stops, so stop listing
+  int               result;     // result of listing
+}READDIR_PIPELINE;
+
+typedef bool (*list_bucket_page_callback)(S3ObjList& page, void* param);
+
+//
+// For parsing ListBucket response
+//
+// The response is parsed by SAX parser while it is received, and the
+// objects are added into S3ObjList directly without building the DOM.
+//
+typedef struct list_bucket_parser{
+  xmlParserCtxtPtr ctxt;
+  string           path;          // used as prefix if the response does not have <Prefix>
+  S3ObjList*       head;
+  int              depth;         // depth of current element
+  bool             in_contents;   // in <Contents>
+  bool             in_cprefix;    // in <CommonPrefixes>
+  string           text;          // text of current element
+  string           prefix;        // <Prefix>
+  string           key;           // <Key> in <Contents> or <Prefix> in <CommonPrefixes>
+  string           etag;
+  string           size;
+  string           lastmodified;
+  bool             is_truncated;  // <IsTruncated>
+  string           next_marker;   // <NextMarker>
+  bool             is_error;
+}LIST_BUCKET_PARSER;
+
 //-------------------------------------------------------------------
 // Global valiables
 //-------------------------------------------------------------------
@@ -126,6 +175,43 @@ static bool is_remove_cache       = false;
 static bool create_bucket         = false;
 static int64_t singlepart_copy_limit = FIVE_GB;
 static bool noflush_in_other_proc = false;
+static bool stat_from_list        = false;
+static int  warmup_connections    = 0;
+
+//-------------------------------------------------------------------
+// Statistics of fuse interface functions
+//-------------------------------------------------------------------
+#define FUSE_OP_STATS(op)   static OpStats stats_fuse_##op("cosfs_fuse_op", "Latency of FUSE operations.", #op)
+
+FUSE_OP_STATS(getattr);
+FUSE_OP_STATS(readlink);
+FUSE_OP_STATS(mknod);
+FUSE_OP_STATS(mkdir);
+FUSE_OP_STATS(unlink);
+FUSE_OP_STATS(rmdir);
+FUSE_OP_STATS(symlink);
+FUSE_OP_STATS(rename);
+FUSE_OP_STATS(link);
+FUSE_OP_STATS(chmod);
+FUSE_OP_STATS(chown);
+FUSE_OP_STATS(utimens);
+FUSE_OP_STATS(truncate);
+FUSE_OP_STATS(create);
+FUSE_OP_STATS(open);
+FUSE_OP_STATS(read);
+FUSE_OP_STATS(read_buf);
+FUSE_OP_STATS(write);
+FUSE_OP_STATS(statfs);
+FUSE_OP_STATS(flush);
+FUSE_OP_STATS(fsync);
+FUSE_OP_STATS(release);
+FUSE_OP_STATS(opendir);
+FUSE_OP_STATS(readdir);
+FUSE_OP_STATS(access);
+FUSE_OP_STATS(setxattr);
+FUSE_OP_STATS(getxattr);
+FUSE_OP_STATS(listxattr);
+FUSE_OP_STATS(removexattr);
 
 //-------------------------------------------------------------------
 // Static functions : prototype
@@ -144,17 +230,24 @@ static FdEntity* get_local_fent(const char* path, bool is_load = false, int pid
 static bool multi_head_callback(S3fsCurl* s3fscurl);
 static S3fsCurl* multi_head_retry_callback(S3fsCurl* s3fscurl);
 static int readdir_multi_head(const char* path, S3ObjList& head, void* buf, fuse_fill_dir_t filler);
-static int list_bucket(const char* path, S3ObjList& head, const char* delimiter, bool check_content_only = false);
+static int list_bucket(const char* path, S3ObjList& head, const char* delimiter, bool check_content_only = false,
+                       list_bucket_page_callback callback = NULL, void* param = NULL);
+static bool readdir_list_page_callback(S3ObjList& page, void* param);
+static void* readdir_list_worker(void* arg);
+static int readdir_pages(const char* path, void* buf, fuse_fill_dir_t filler);
 static int directory_empty(const char* path);
-static bool is_truncated(xmlDocPtr doc);;
-static int append_objects_from_xml_ex(const char* path, xmlDocPtr doc, xmlXPathContextPtr ctx,
-              const char* ex_contents, const char* ex_key, const char* ex_etag, int isCPrefix, S3ObjList& head);
-static int append_objects_from_xml(const char* path, xmlDocPtr doc, S3ObjList& head);
+static bool list_bucket_parser_init(LIST_BUCKET_PARSER* parser);
+static void list_bucket_parser_destroy(LIST_BUCKET_PARSER* parser);
+static bool list_bucket_parser_feed(const char* data, size_t size, void* param);
+static bool list_bucket_parser_finish(LIST_BUCKET_PARSER* parser);
+static bool list_bucket_parser_add(LIST_BUCKET_PARSER* parser, bool is_cprefix);
+static void list_bucket_sax_start(void* ctx, const xmlChar* localname, const xmlChar* prefix, const xmlChar* URI,
+              int nb_namespaces, const xmlChar** namespaces, int nb_attributes, int nb_defaulted, const xmlChar** attributes);
+static void list_bucket_sax_end(void* ctx, const xmlChar* localname, const xmlChar* prefix, const xmlChar* URI);
+static void list_bucket_sax_characters(void* ctx, const xmlChar* ch, int len);
+static void list_bucket_sax_error(void* ctx, const char* msg, ...);
 static bool GetXmlNsUrl(xmlDocPtr doc, string& nsurl);
-static xmlChar* get_base_exp(xmlDocPtr doc, const char* exp);
-static xmlChar* get_prefix(xmlDocPtr doc);
-static xmlChar* get_next_marker(xmlDocPtr doc);
-static char* get_object_name(xmlDocPtr doc, xmlNodePtr node, const char* path);
+static char* get_object_name(const char* fullpath, const char* path);
 int put_headers(const char* path, headers_t& meta, bool is_copy, bool update_mtime = true);
 static int rename_large_object(const char* from, const char* to, int pid);
 static int create_file_object(const char* path, mode_t mode, uid_t uid, gid_t gid);
@@ -202,6 +295,9 @@ static int s3fs_create(const char* path, mode_t mode, struct fuse_file_info* fi)
 static int s3fs_open(const char* path, struct fuse_file_info* fi);
 static int s3fs_read(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi);
 static int s3fs_write(const char* path, const char* buf, size_t size, off_t offset, struct fuse_file_info* fi);
+#if FUSE_HAS_READ_BUF
+static int s3fs_read_buf(const char* path, struct fuse_bufvec** bufp, size_t size, off_t offset, struct fuse_file_info* fi);
+#endif
 static int s3fs_statfs(const char* path, struct statvfs* stbuf);
 static int s3fs_flush(const char* path, struct fuse_file_info* fi);
 static int s3fs_fsync(const char* path, int datasync, struct fuse_file_info* fi);
@@ -289,7 +385,6 @@ static bool is_special_name_folder_object(const char* path)
     return false;
   }
   header.clear();
-  S3FS_MALLOCTRIM(0);
   return true;
 }
 
@@ -428,7 +523,10 @@ static int get_object_attribute(const char* path, struct stat* pstbuf, headers_t
   if(pisforce){
     (*pisforce) = false;
   }
-  if(StatCache::getStatCacheData()->GetStat(strpath, pstat, pheader, overcheck, pisforce)){
+  // [NOTE]
+  // Pass pmeta as it is, because the entry made from listing does not hit
+  // when the caller needs headers.
+  if(StatCache::getStatCacheData()->GetStat(strpath, pstat, pmeta, overcheck, pisforce)){
     return 0;
   }
   if(StatCache::getStatCacheData()->IsNoObjectCache(strpath)){
@@ -800,6 +898,8 @@ int put_headers(const char* path, headers_t& meta, bool is_copy, bool update_mti
 
 static int s3fs_getattr(const char* path, struct stat* stbuf)
 {
+  StatsTimer stats_timer(stats_fuse_getattr);
+
   int result;
 
   S3FS_PRN_INFO("[path=%s]", path);
@@ -831,13 +931,14 @@ static int s3fs_getattr(const char* path, struct stat* stbuf)
     stbuf->st_blocks  = get_blocks(stbuf->st_size);
   }
   S3FS_PRN_DBG("[path=%s] uid=%u, gid=%u, mode=%04o", path, (unsigned int)(stbuf->st_uid), (unsigned int)(stbuf->st_gid), stbuf->st_mode);
-  S3FS_MALLOCTRIM(0);
 
   return result;
 }
 
 static int s3fs_readlink(const char* path, char* buf, size_t size)
 {
+  StatsTimer stats_timer(stats_fuse_readlink);
+
   if(!path || !buf || 0 >= size){
     return 0;
   }
@@ -873,7 +974,6 @@ static int s3fs_readlink(const char* path, char* buf, size_t size)
   buf[ressize] = '\0';
 
   FdManager::get()->Close(ent);
-  S3FS_MALLOCTRIM(0);
 
   return 0;
 }
@@ -918,6 +1018,8 @@ static int create_file_object(const char* path, mode_t mode, uid_t uid, gid_t gi
 
 static int s3fs_mknod(const char *path, mode_t mode, dev_t rdev)
 {
+  StatsTimer stats_timer(stats_fuse_mknod);
+
   int       result;
   struct fuse_context* pcxt;
 
@@ -933,13 +1035,14 @@ static int s3fs_mknod(const char *path, mode_t mode, dev_t rdev)
     return result;
   }
   StatCache::getStatCacheData()->DelStat(path);
-  S3FS_MALLOCTRIM(0);
 
   return result;
 }
 
 static int s3fs_create(const char* path, mode_t mode, struct fuse_file_info* fi)
 {
+  StatsTimer stats_timer(stats_fuse_create);
+
   int result;
   struct fuse_context* pcxt;
 
@@ -976,7 +1079,6 @@ static int s3fs_create(const char* path, mode_t mode, struct fuse_file_info* fi)
     return -EIO;
   }
   fi->fh = ent->GetFd();
-  S3FS_MALLOCTRIM(0);
 
   return 0;
 }
@@ -1006,6 +1108,8 @@ static int create_directory_object(const char* path, mode_t mode, time_t time, u
 
 static int s3fs_mkdir(const char* path, mode_t mode)
 {
+  StatsTimer stats_timer(stats_fuse_mkdir);
+
   int result;
   struct fuse_context* pcxt;
 
@@ -1029,13 +1133,14 @@ static int s3fs_mkdir(const char* path, mode_t mode)
 
   result = create_directory_object(path, mode, time(NULL), pcxt->uid, pcxt->gid);
   StatCache::getStatCacheData()->DelStat(path);
-  S3FS_MALLOCTRIM(0);
 
   return result;
 }
 
 static int s3fs_unlink(const char* path)
 {
+  StatsTimer stats_timer(stats_fuse_unlink);
+
   int result;
 
   S3FS_PRN_INFO("[path=%s]", path);
@@ -1054,7 +1159,6 @@ static int s3fs_unlink(const char* path)
   result = s3fscurl.DeleteRequest(path, pid);
   FdManager::DeleteCacheFile(path);
   StatCache::getStatCacheData()->DelStat(path);
-  S3FS_MALLOCTRIM(0);
 
   return result;
 }
@@ -1076,6 +1180,8 @@ static int directory_empty(const char* path)
 
 static int s3fs_rmdir(const char* path)
 {
+  StatsTimer stats_timer(stats_fuse_rmdir);
+
   int result;
   string strpath;
   struct stat stbuf;
@@ -1132,13 +1238,14 @@ static int s3fs_rmdir(const char* path)
     strpath += "_$folder$";
     result   = s3fscurl.DeleteRequest(strpath.c_str(), pid);
   }
-  S3FS_MALLOCTRIM(0);
 
   return result;
 }
 
 static int s3fs_symlink(const char* from, const char* to)
 {
+  StatsTimer stats_timer(stats_fuse_symlink);
+
   int result;
   struct fuse_context* pcxt;
 
@@ -1186,7 +1293,6 @@ static int s3fs_symlink(const char* from, const char* to)
   FdManager::get()->Close(ent);
 
   StatCache::getStatCacheData()->DelStat(to);
-  S3FS_MALLOCTRIM(0);
 
   return result;
 }
@@ -1524,6 +1630,8 @@ static int rename_directory(const char* from, const char* to, int pid)
 
 static int s3fs_rename(const char* from, const char* to)
 {
+  StatsTimer stats_timer(stats_fuse_rename);
+
   struct stat buf;
   int result;
 
@@ -1569,19 +1677,22 @@ static int s3fs_rename(const char* from, const char* to)
       result = rename_object_nocopy(from, to, pid);
     }
   }
-  S3FS_MALLOCTRIM(0);
 
   return result;
 }
 
 static int s3fs_link(const char* from, const char* to)
 {
+  StatsTimer stats_timer(stats_fuse_link);
+
   S3FS_PRN_INFO("[from=%s][to=%s]", from, to);
   return -EPERM;
 }
 
 static int s3fs_chmod(const char* path, mode_t mode)
 {
+  StatsTimer stats_timer(stats_fuse_chmod);
+
   int result;
   string strpath;
   string newpath;
@@ -1677,13 +1788,14 @@ static int s3fs_chmod(const char* path, mode_t mode)
     StatCache::getStatCacheData()->DelStat(nowcache);
     }
   }
-  S3FS_MALLOCTRIM(0);
 
   return 0;
 }
 
 static int s3fs_chmod_nocopy(const char* path, mode_t mode)
 {
+  StatsTimer stats_timer(stats_fuse_chmod);
+
   int         result;
   string      strpath;
   string      newpath;
@@ -1763,13 +1875,14 @@ static int s3fs_chmod_nocopy(const char* path, mode_t mode)
 
     StatCache::getStatCacheData()->DelStat(nowcache);
   }
-  S3FS_MALLOCTRIM(0);
 
   return result;
 }
 
 static int s3fs_chown(const char* path, uid_t uid, gid_t gid)
 {
+  StatsTimer stats_timer(stats_fuse_chown);
+
   int result;
   string strpath;
   string newpath;
@@ -1881,13 +1994,14 @@ static int s3fs_chown(const char* path, uid_t uid, gid_t gid)
         StatCache::getStatCacheData()->DelStat(nowcache);
     }
   }
-  S3FS_MALLOCTRIM(0);
 
   return 0;
 }
 
 static int s3fs_chown_nocopy(const char* path, uid_t uid, gid_t gid)
 {
+  StatsTimer stats_timer(stats_fuse_chown);
+
   int         result;
   string      strpath;
   string      newpath;
@@ -1976,13 +2090,14 @@ static int s3fs_chown_nocopy(const char* path, uid_t uid, gid_t gid)
 
     StatCache::getStatCacheData()->DelStat(nowcache);
   }
-  S3FS_MALLOCTRIM(0);
 
   return result;
 }
 
 static int s3fs_utimens(const char* path, const struct timespec ts[2])
 {
+  StatsTimer stats_timer(stats_fuse_utimens);
+
   int result;
   string strpath;
   string newpath;
@@ -2077,13 +2192,14 @@ static int s3fs_utimens(const char* path, const struct timespec ts[2])
         StatCache::getStatCacheData()->DelStat(nowcache);
     }
   }
-  S3FS_MALLOCTRIM(0);
 
   return 0;
 }
 
 static int s3fs_utimens_nocopy(const char* path, const struct timespec ts[2])
 {
+  StatsTimer stats_timer(stats_fuse_utimens);
+
   int         result;
   string      strpath;
   string      newpath;
@@ -2168,13 +2284,14 @@ static int s3fs_utimens_nocopy(const char* path, const struct timespec ts[2])
 
     StatCache::getStatCacheData()->DelStat(nowcache);
   }
-  S3FS_MALLOCTRIM(0);
 
   return result;
 }
 
 static int s3fs_truncate(const char* path, off_t size)
 {
+  StatsTimer stats_timer(stats_fuse_truncate);
+
   int result;
   headers_t meta;
   FdEntity* ent = NULL;
@@ -2249,13 +2366,14 @@ static int s3fs_truncate(const char* path, off_t size)
   FdManager::get()->Close(ent);
 
   StatCache::getStatCacheData()->DelStat(path);
-  S3FS_MALLOCTRIM(0);
 
   return result;
 }
 
 static int s3fs_open(const char* path, struct fuse_file_info* fi)
 {
+  StatsTimer stats_timer(stats_fuse_open);
+
   int result;
   struct stat st;
   bool needs_flush = false;
@@ -2313,13 +2431,14 @@ static int s3fs_open(const char* path, struct fuse_file_info* fi)
   }
 
   fi->fh = ent->GetFd();
-  S3FS_MALLOCTRIM(0);
 
   return 0;
 }
 
 static int s3fs_read(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi)
 {
+  StatsTimer stats_timer(stats_fuse_read);
+
   ssize_t res;
 
   S3FS_PRN_DBG("[path=%s][size=%zu][offset=%jd][fd=%llu]", path, size, (intmax_t)offset, (unsigned long long)(fi->fh));
@@ -2351,12 +2470,94 @@ static int s3fs_read(const char* path, char* buf, size_t size, off_t offset, str
     S3FS_PRN_WARN("failed to read file(%s). result=%zd", path, res);
   }
   FdManager::get()->Close(ent);
+  stats_timer.SetResult(static_cast<int>(res));
 
   return static_cast<int>(res);
 }
 
+#if FUSE_HAS_READ_BUF
+//
+// Same as s3fs_read, but passes the area of cache file to libfuse instead of
+// copying it to buffer, then libfuse splices it to the kernel(or reads it
+// into its own buffer when splice is not available).
+//
+static int s3fs_read_buf(const char* path, struct fuse_bufvec** bufp, size_t size, off_t offset, struct fuse_file_info* fi)
+{
+  StatsTimer stats_timer(stats_fuse_read_buf);
+
+  ssize_t res;
+
+  S3FS_PRN_DBG("[path=%s][size=%zu][offset=%jd][fd=%llu]", path, size, (intmax_t)offset, (unsigned long long)(fi->fh));
+  int pid = -1;
+  struct fuse_context* pcxt;
+  if(NULL != (pcxt = fuse_get_context())){
+    pid = pcxt->pid;
+    S3FS_PRN_INFO("%s, uid=[%d], gid=[%d], pid=[%d]", __FUNCTION__, pcxt->uid, pcxt->gid, pcxt->pid);
+  }
+
+  struct fuse_bufvec* bufvec;
+  if(NULL == (bufvec = static_cast<struct fuse_bufvec*>(malloc(sizeof(struct fuse_bufvec))))){
+    S3FS_PRN_CRIT("could not allocate memory.");
+    return -ENOMEM;
+  }
+  // empty buffer
+  bufvec->count         = 1;
+  bufvec->idx           = 0;
+  bufvec->off           = 0;
+  bufvec->buf[0].size   = 0;
+  bufvec->buf[0].flags  = static_cast<enum fuse_buf_flags>(0);
+  bufvec->buf[0].mem    = NULL;
+  bufvec->buf[0].fd     = -1;
+  bufvec->buf[0].pos    = 0;
+
+  FdEntity* ent;
+  if(NULL == (ent = FdManager::get()->ExistOpen(path, static_cast<int>(fi->fh), pid))){
+    S3FS_PRN_ERR("could not find opened fd(%s)", path);
+    free(bufvec);
+    return -EIO;
+  }
+  if(ent->GetFd() != static_cast<int>(fi->fh)){
+    S3FS_PRN_WARN("different fd(%d - %llu)", ent->GetFd(), (unsigned long long)(fi->fh));
+  }
+
+  // check real file size
+  size_t realsize = 0;
+  if(!ent->GetSize(realsize) || realsize <= 0){
+    S3FS_PRN_ERR("file size is 0, so break to read.");
+    FdManager::get()->Close(ent);
+    *bufp = bufvec;
+    return 0;
+  }
+
+  int readfd = -1;
+  if(0 > (res = ent->ReadFd(offset, size, readfd))){
+    S3FS_PRN_WARN("failed to read file(%s). result=%zd", path, res);
+    FdManager::get()->Close(ent);
+    free(bufvec);
+    stats_timer.SetResult(static_cast<int>(res));
+    return static_cast<int>(res);
+  }
+  stats_timer.SetSize(res);
+  if(0 < res){
+    bufvec->buf[0].size  = static_cast<size_t>(res);
+    bufvec->buf[0].flags = static_cast<enum fuse_buf_flags>(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+    bufvec->buf[0].fd    = readfd;
+    bufvec->buf[0].pos   = offset;
+  }
+  // [NOTE]
+  // The fd is read by libfuse after returning, it is still opened because
+  // the file handle(fi) is opened until this request is done.
+  FdManager::get()->Close(ent);
+
+  *bufp = bufvec;
+  return 0;
+}
+#endif
+
 static int s3fs_write(const char* path, const char* buf, size_t size, off_t offset, struct fuse_file_info* fi)
 {
+  StatsTimer stats_timer(stats_fuse_write);
+
   ssize_t res;
 
   S3FS_PRN_DBG("[path=%s][size=%zu][offset=%jd][fd=%llu]", path, size, (intmax_t)offset, (unsigned long long)(fi->fh));
@@ -2379,12 +2580,15 @@ static int s3fs_write(const char* path, const char* buf, size_t size, off_t offs
     S3FS_PRN_WARN("failed to write file(%s). result=%zd", path, res);
   }
   FdManager::get()->Close(ent);
+  stats_timer.SetResult(static_cast<int>(res));
 
   return static_cast<int>(res);
 }
 
 static int s3fs_statfs(const char* path, struct statvfs* stbuf)
 {
+  StatsTimer stats_timer(stats_fuse_statfs);
+
   // 256T
   stbuf->f_bsize  = 0X1000000;
   stbuf->f_blocks = 0X1000000;
@@ -2396,6 +2600,8 @@ static int s3fs_statfs(const char* path, struct statvfs* stbuf)
 
 static int s3fs_flush(const char* path, struct fuse_file_info* fi)
 {
+  StatsTimer stats_timer(stats_fuse_flush);
+
   int result;
 
   S3FS_PRN_INFO("[path=%s][fd=%llu]", path, (unsigned long long)(fi->fh));
@@ -2430,7 +2636,6 @@ static int s3fs_flush(const char* path, struct fuse_file_info* fi)
     result = ent->Flush(false);
     FdManager::get()->Close(ent);
   }
-  S3FS_MALLOCTRIM(0);
 
   return result;
 }
@@ -2440,6 +2645,8 @@ static int s3fs_flush(const char* path, struct fuse_file_info* fi)
 //
 static int s3fs_fsync(const char* path, int datasync, struct fuse_file_info* fi)
 {
+  StatsTimer stats_timer(stats_fuse_fsync);
+
   int result = 0;
 
   S3FS_PRN_INFO("[path=%s][fd=%llu]", path, (unsigned long long)(fi->fh));
@@ -2458,7 +2665,6 @@ static int s3fs_fsync(const char* path, int datasync, struct fuse_file_info* fi)
     result = ent->Flush(false);
     FdManager::get()->Close(ent);
   }
-  S3FS_MALLOCTRIM(0);
 
   // Delete stat cache entry because st_size may have changed.
   StatCache::getStatCacheData()->DelStat(path);
@@ -2468,6 +2674,8 @@ static int s3fs_fsync(const char* path, int datasync, struct fuse_file_info* fi)
 
 static int s3fs_release(const char* path, struct fuse_file_info* fi)
 {
+  StatsTimer stats_timer(stats_fuse_release);
+
   S3FS_PRN_INFO("[path=%s][fd=%llu]", path, (unsigned long long)(fi->fh));
 
   struct fuse_context* pcxt;
@@ -2500,13 +2708,14 @@ static int s3fs_release(const char* path, struct fuse_file_info* fi)
       S3FS_PRN_WARN("file(%s),fd(%d) is still opened.", path, ent->GetFd());
     }
   }
-  S3FS_MALLOCTRIM(0);
 
   return 0;
 }
 
 static int s3fs_opendir(const char* path, struct fuse_file_info* fi)
 {
+  StatsTimer stats_timer(stats_fuse_opendir);
+
   struct fuse_context* pcxt;
   if(NULL != (pcxt = fuse_get_context())){
     S3FS_PRN_INFO("%s, uid=[%d], gid=[%d], pid=[%d]", __FUNCTION__, pcxt->uid, pcxt->gid, pcxt->pid);
@@ -2520,7 +2729,6 @@ static int s3fs_opendir(const char* path, struct fuse_file_info* fi)
   if(0 == (result = check_object_access(path, mask, NULL))){
     result = check_parent_object_access(path, mask);
   }
-  S3FS_MALLOCTRIM(0);
 
   return result;
 }
@@ -2610,6 +2818,15 @@ static int readdir_multi_head(const char* path, S3ObjList& head, void* buf, fuse
         continue;
       }
 
+      // make stat cache from listing without head request.
+      off_t  size;
+      time_t mtime;
+      if(stat_from_list && head.GetListStat((*iter).c_str(), size, mtime)){
+        if(StatCache::getStatCacheData()->AddListStat(disppath, size, mtime, etag.c_str())){
+          continue;
+        }
+      }
+
       // First check for directory, start checking "not SSE-C".
       // If checking failed, retry to check with "SSE-C" by retry callback func when SSE-C mode.
       S3fsCurl* s3fscurl = new S3fsCurl();
@@ -2661,10 +2878,148 @@ static int readdir_multi_head(const char* path, S3ObjList& head, void* buf, fuse
   return result;
 }
 
-static int s3fs_readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info* fi)
+// called by list_bucket in readdir_list_worker thread for each page
+static bool readdir_list_page_callback(S3ObjList& page, void* param)
+{
+  READDIR_PIPELINE* pipeline = reinterpret_cast<READDIR_PIPELINE*>(param);
+  if(!pipeline){
+    return false;
+  }
+  S3ObjList* newpage = new S3ObjList();
+  newpage->swap(page);
+
+  pthread_mutex_lock(&(pipeline->lock));
+  while(!pipeline->is_abort && 0 < pipeline->max_pages && pipeline->max_pages <= pipeline->pages.size()){
+    pthread_cond_wait(&(pipeline->cond), &(pipeline->lock));
+  }
+  if(pipeline->is_abort){
+    pthread_mutex_unlock(&(pipeline->lock));
+    delete newpage;
+    return false;
+  }
+  pipeline->pages.push_back(newpage);
+  pthread_cond_broadcast(&(pipeline->cond));
+  pthread_mutex_unlock(&(pipeline->lock));
+
+  return true;
+}
+
+static void* readdir_list_worker(void* arg)
 {
+  READDIR_PIPELINE* pipeline = reinterpret_cast<READDIR_PIPELINE*>(arg);
+  if(!pipeline){
+    return NULL;
+  }
   S3ObjList head;
-  int result;
+  int       result = list_bucket(pipeline->path.c_str(), head, "/", false, readdir_list_page_callback, pipeline);
+
+  pthread_mutex_lock(&(pipeline->lock));
+  pipeline->result  = result;
+  pipeline->is_done = true;
+  pthread_cond_broadcast(&(pipeline->cond));
+  pthread_mutex_unlock(&(pipeline->lock));
+
+  return NULL;
+}
+
+//
+// List objects in path page by page, and send head requests and fill
+// them for each page while listing next page.
+//
+static int readdir_pages(const char* path, void* buf, fuse_fill_dir_t filler)
+{
+  READDIR_PIPELINE pipeline;
+  pthread_t        thread;
+  bool             is_thread;
+  int              result = 0;
+
+  // get a list of all the objects by worker thread, page by page
+  pthread_mutex_init(&(pipeline.lock), NULL);
+  pthread_cond_init(&(pipeline.cond), NULL);
+  pipeline.path      = path;
+  pipeline.max_pages = READDIR_MAX_PAGES;
+  pipeline.is_done   = false;
+  pipeline.is_abort  = false;
+  pipeline.result    = 0;
+
+  if(0 == pthread_create(&thread, NULL, readdir_list_worker, &pipeline)){
+    is_thread = true;
+  }else{
+    // list all pages at first, and send head requests after that.
+    S3FS_PRN_WARN("could not create thread for listing, so list all objects before head requests.");
+    is_thread          = false;
+    pipeline.max_pages = 0;
+    readdir_list_worker(&pipeline);
+  }
+
+  // Send multi head request for stats caching.
+  string    strpath = path;
+  S3ObjList trailing;   // objects which may be merged with next page
+  if(strcmp(path, "/") != 0){
+    strpath += "/";
+  }
+  while(true){
+    S3ObjList* page = NULL;
+
+    pthread_mutex_lock(&(pipeline.lock));
+    while(pipeline.pages.empty() && !pipeline.is_done){
+      pthread_cond_wait(&(pipeline.cond), &(pipeline.lock));
+    }
+    if(!pipeline.pages.empty()){
+      page = pipeline.pages.front();
+      pipeline.pages.pop_front();
+      pthread_cond_broadcast(&(pipeline.cond));
+    }else if(0 != (result = pipeline.result)){
+      S3FS_PRN_ERR("list_bucket returns error(%d).", result);
+    }
+    pthread_mutex_unlock(&(pipeline.lock));
+
+    if(!page){
+      if(0 == result && !trailing.IsEmpty()){
+        if(0 != (result = readdir_multi_head(strpath.c_str(), trailing, buf, filler))){
+          S3FS_PRN_ERR("readdir_multi_head returns error(%d).", result);
+        }
+      }
+      break;
+    }
+    if(!page->IsEmpty()){
+      // "dir", "dir/" and "dir_$folder$" are one directory, but they
+      // may be listed in different pages. So the objects which may be
+      // merged with next page are held back until next page.
+      trailing.MoveTo(*page);
+      page->MoveMergeableTo(trailing);
+    }
+    if(!page->IsEmpty()){
+      result = readdir_multi_head(strpath.c_str(), *page, buf, filler);
+    }
+    delete page;
+    if(0 != result){
+      S3FS_PRN_ERR("readdir_multi_head returns error(%d).", result);
+      break;
+    }
+  }
+
+  // stop listing and cleanup
+  pthread_mutex_lock(&(pipeline.lock));
+  pipeline.is_abort = true;
+  pthread_cond_broadcast(&(pipeline.cond));
+  pthread_mutex_unlock(&(pipeline.lock));
+  if(is_thread){
+    pthread_join(thread, NULL);
+  }
+  for(s3objlist_pages_t::iterator iter = pipeline.pages.begin(); iter != pipeline.pages.end(); iter = pipeline.pages.erase(iter)){
+    delete *iter;
+  }
+  pthread_cond_destroy(&(pipeline.cond));
+  pthread_mutex_destroy(&(pipeline.lock));
+
+  return result;
+}
+
+static int s3fs_readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info* fi)
+{
+  StatsTimer stats_timer(stats_fuse_readdir);
+  int        result;
 
   S3FS_PRN_INFO("[path=%s]", path);
   struct fuse_context* pcxt;
@@ -2676,33 +3031,27 @@ static int s3fs_readdir(const char* path, void* buf, fuse_fill_dir_t filler, off
     return result;
   }
 
-  // get a list of all the objects
-  if((result = list_bucket(path, head, "/")) != 0){
-    S3FS_PRN_ERR("list_bucket returns error(%d).", result);
-    return result;
-  }
-
   // force to add "." and ".." name.
   filler(buf, ".", 0, 0);
   filler(buf, "..", 0, 0);
-  if(head.IsEmpty()){
-    return 0;
-  }
 
-  // Send multi head request for stats caching.
-  string strpath = path;
-  if(strcmp(path, "/") != 0){
-    strpath += "/";
-  }
-  if(0 != (result = readdir_multi_head(strpath.c_str(), head, buf, filler))){
-    S3FS_PRN_ERR("readdir_multi_head returns error(%d).", result);
-  }
-  S3FS_MALLOCTRIM(0);
+  return readdir_pages(path, buf, filler);
+}
 
-  return result;
+#ifdef TEST_COSFS
+int test_readdir_pages(const char* path, void* buf, fuse_fill_dir_t filler)
+{
+  return readdir_pages(path, buf, filler);
 }
+#endif
 
-static int list_bucket(const char* path, S3ObjList& head, const char* delimiter, bool check_content_only)
+//
+// If callback is specified, it is called with the objects of each page,
+// and head has only the objects of the page when it is called. Listing
+// stops when callback returns false.
+//
+static int list_bucket(const char* path, S3ObjList& head, const char* delimiter, bool check_content_only,
+                       list_bucket_page_callback callback, void* param)
 {
   int       result;
   string    s3_realpath;
@@ -2712,11 +3061,14 @@ static int list_bucket(const char* path, S3ObjList& head, const char* delimiter,
   string    next_marker = "";
   bool      truncated = true;
   S3fsCurl  s3fscurl;
-  xmlDocPtr doc;
-  BodyData* body;
+  LIST_BUCKET_PARSER parser;
 
   S3FS_PRN_INFO1("[path=%s]", path);
 
+  parser.ctxt = NULL;
+  parser.path = path;
+  parser.head = &head;
+
   if(delimiter && 0 < strlen(delimiter)){
     query_delimiter += "delimiter=";
     query_delimiter += delimiter;
@@ -2746,28 +3098,23 @@ static int list_bucket(const char* path, S3ObjList& head, const char* delimiter,
     each_query += query_maxkey;
     each_query += query_prefix;
 
-    // request
-    if(0 != (result = s3fscurl.ListBucketRequest(path, each_query.c_str()))){
+    // request(the response is parsed while it is received)
+    if(!list_bucket_parser_init(&parser)){
+      return -1;
+    }
+    if(0 != (result = s3fscurl.ListBucketRequest(path, each_query.c_str(), list_bucket_parser_feed, &parser))){
       S3FS_PRN_ERR("ListBucketRequest returns with error.");
+      list_bucket_parser_destroy(&parser);
       return result;
     }
-    body = s3fscurl.GetBodyData();
-
-    // xmlDocPtr
-    if(NULL == (doc = xmlReadMemory(body->str(), static_cast<int>(body->size()), "", NULL, 0))){
-      S3FS_PRN_ERR("xmlReadMemory returns with error.");
-      return -1;
-    }
-    if(0 != append_objects_from_xml(path, doc, head)){
-      S3FS_PRN_ERR("append_objects_from_xml returns with error.");
-      xmlFreeDoc(doc);
+    if(!list_bucket_parser_finish(&parser)){
+      S3FS_PRN_ERR("could not parse ListBucket response.");
+      list_bucket_parser_destroy(&parser);
       return -1;
     }
-    if(true == (truncated = is_truncated(doc))){
-      xmlChar*	tmpch = get_next_marker(doc);
-      if(tmpch){
-        next_marker = (char*)tmpch;
-        xmlFree(tmpch);
+    if(true == (truncated = parser.is_truncated)){
+      if(!parser.next_marker.empty()){
+        next_marker = parser.next_marker;
       }else{
         // If did not specify "delimiter", s3 did not return "NextMarker".
         // On this case, can use lastest name for next marker.
@@ -2785,255 +3132,269 @@ static int list_bucket(const char* path, S3ObjList& head, const char* delimiter,
         }
       }
     }
-    S3FS_XMLFREEDOC(doc);
 
     // reset(initialize) curl object
     s3fscurl.DestroyCurlHandle();
 
     if (check_content_only)
       break;
+
+    // hand the page over to callback
+    if(callback){
+      if(!callback(head, param)){
+        S3FS_PRN_INFO1("listing is stopped by callback[path=%s]", path);
+        break;
+      }
+      S3ObjList().swap(head);
+    }
   }
-  S3FS_MALLOCTRIM(0);
+  list_bucket_parser_destroy(&parser);
 
   return 0;
 }
 
 const char* c_strErrorObjectName = "FILE or SUBDIR in DIR";
 
-static int append_objects_from_xml_ex(const char* path, xmlDocPtr doc, xmlXPathContextPtr ctx,
-       const char* ex_contents, const char* ex_key, const char* ex_etag, int isCPrefix, S3ObjList& head)
+//
+// (Re)initialize parser for new response, the objects which have already
+// been added into head are kept.
+//
+static bool list_bucket_parser_init(LIST_BUCKET_PARSER* parser)
 {
-  xmlXPathObjectPtr contents_xp;
-  xmlNodeSetPtr content_nodes;
-
-  if(NULL == (contents_xp = xmlXPathEvalExpression((xmlChar*)ex_contents, ctx))){
-    S3FS_PRN_ERR("xmlXPathEvalExpression returns null.");
-    return -1;
-  }
-  if(xmlXPathNodeSetIsEmpty(contents_xp->nodesetval)){
-    S3FS_PRN_WARN("contents_xp->nodesetval is empty.");
-    S3FS_XMLXPATHFREEOBJECT(contents_xp);
-    return 0;
+  list_bucket_parser_destroy(parser);
+
+  xmlSAXHandler handler;
+  memset(&handler, 0, sizeof(xmlSAXHandler));
+  handler.initialized    = XML_SAX2_MAGIC;
+  handler.startElementNs = list_bucket_sax_start;
+  handler.endElementNs   = list_bucket_sax_end;
+  handler.characters     = list_bucket_sax_characters;
+  handler.warning        = list_bucket_sax_error;
+  handler.error          = list_bucket_sax_error;
+
+  if(NULL == (parser->ctxt = xmlCreatePushParserCtxt(&handler, parser, NULL, 0, NULL))){
+    S3FS_PRN_ERR("xmlCreatePushParserCtxt returns with error.");
+    return false;
   }
-  content_nodes = contents_xp->nodesetval;
+  parser->depth        = 0;
+  parser->in_contents  = false;
+  parser->in_cprefix   = false;
+  parser->is_truncated = false;
+  parser->is_error     = false;
+  parser->text.erase();
+  parser->prefix.erase();
+  parser->key.erase();
+  parser->etag.erase();
+  parser->size.erase();
+  parser->lastmodified.erase();
+  parser->next_marker.erase();
 
-  bool   is_dir;
-  string stretag;
-  int    i;
-  for(i = 0; i < content_nodes->nodeNr; i++){
-    ctx->node = content_nodes->nodeTab[i];
+  return true;
+}
 
-    // object name
-    xmlXPathObjectPtr key;
-    if(NULL == (key = xmlXPathEvalExpression((xmlChar*)ex_key, ctx))){
-      S3FS_PRN_WARN("key is null. but continue.");
-      continue;
-    }
-    if(xmlXPathNodeSetIsEmpty(key->nodesetval)){
-      S3FS_PRN_WARN("node is empty. but continue.");
-      xmlXPathFreeObject(key);
-      continue;
-    }
-    xmlNodeSetPtr key_nodes = key->nodesetval;
-    char* name = get_object_name(doc, key_nodes->nodeTab[0]->xmlChildrenNode, path);
-
-    if(!name){
-      S3FS_PRN_WARN("name is something wrong. but continue.");
-
-    }else if((const char*)name != c_strErrorObjectName){
-      is_dir  = isCPrefix ? true : false;
-      stretag = "";
-
-      if(!isCPrefix && ex_etag){
-        // Get ETag
-        xmlXPathObjectPtr ETag;
-        if(NULL != (ETag = xmlXPathEvalExpression((xmlChar*)ex_etag, ctx))){
-          if(xmlXPathNodeSetIsEmpty(ETag->nodesetval)){
-            S3FS_PRN_INFO("ETag->nodesetval is empty.");
-          }else{
-            xmlNodeSetPtr etag_nodes = ETag->nodesetval;
-            xmlChar* petag = xmlNodeListGetString(doc, etag_nodes->nodeTab[0]->xmlChildrenNode, 1);
-            if(petag){
-              stretag = (char*)petag;
-              xmlFree(petag);
-            }
-          }
-          xmlXPathFreeObject(ETag);
-        }
-      }
-      if(!head.insert(name, (0 < stretag.length() ? stretag.c_str() : NULL), is_dir)){
-        S3FS_PRN_ERR("insert_object returns with error.");
-        xmlXPathFreeObject(key);
-        xmlXPathFreeObject(contents_xp);
-        free(name);
-        S3FS_MALLOCTRIM(0);
-        return -1;
-      }
-      free(name);
-    }else{
-      S3FS_PRN_WARN("name is file or subdir in dir. but continue.");
-    }
-    xmlXPathFreeObject(key);
+static void list_bucket_parser_destroy(LIST_BUCKET_PARSER* parser)
+{
+  if(parser->ctxt){
+    xmlFreeParserCtxt(parser->ctxt);
+    parser->ctxt = NULL;
   }
-  S3FS_XMLXPATHFREEOBJECT(contents_xp);
-
-  return 0;
 }
 
-static bool GetXmlNsUrl(xmlDocPtr doc, string& nsurl)
+// called by S3fsCurl as S3fsCurlBodyCallback
+static bool list_bucket_parser_feed(const char* data, size_t size, void* param)
 {
-  static time_t tmLast = 0;  // cache for 60 sec.
-  static string strNs("");
-  bool result = false;
-
-  if(!doc){
-    return result;
+  LIST_BUCKET_PARSER* parser = reinterpret_cast<LIST_BUCKET_PARSER*>(param);
+  if(!parser){
+    return false;
   }
-  if((tmLast + 60) < time(NULL)){
-    // refresh
-    tmLast = time(NULL);
-    strNs  = "";
-    xmlNodePtr pRootNode = xmlDocGetRootElement(doc);
-    if(pRootNode){
-      xmlNsPtr* nslist = xmlGetNsList(doc, pRootNode);
-      if(nslist){
-        if(nslist[0] && nslist[0]->href){
-          strNs  = (const char*)(nslist[0]->href);
-        }
-        S3FS_XMLFREE(nslist);
-      }
-    }
+  if(!data){
+    // retrying request
+    return list_bucket_parser_init(parser);
   }
-  if(0 < strNs.size()){
-    nsurl  = strNs;
-    result = true;
+  if(!parser->ctxt || parser->is_error){
+    return false;
   }
-  return result;
+  if(0 != xmlParseChunk(parser->ctxt, data, static_cast<int>(size), 0) || parser->is_error){
+    S3FS_PRN_ERR("xmlParseChunk returns with error.");
+    return false;
+  }
+  return true;
 }
 
-static int append_objects_from_xml(const char* path, xmlDocPtr doc, S3ObjList& head)
+static bool list_bucket_parser_finish(LIST_BUCKET_PARSER* parser)
 {
-  string xmlnsurl;
-  string ex_contents = "//";
-  string ex_key      = "";
-  string ex_cprefix  = "//";
-  string ex_prefix   = "";
-  string ex_etag     = "";
-
-  if(!doc){
-    return -1;
+  if(!parser->ctxt || parser->is_error){
+    return false;
+  }
+  if(0 != xmlParseChunk(parser->ctxt, NULL, 0, 1) || parser->is_error || !parser->ctxt->wellFormed){
+    S3FS_PRN_ERR("xmlParseChunk returns with error at end of response.");
+    return false;
   }
+  return true;
+}
 
+static bool list_bucket_parser_add(LIST_BUCKET_PARSER* parser, bool is_cprefix)
+{
+  if(parser->key.empty()){
+    S3FS_PRN_WARN("node is empty. but continue.");
+    return true;
+  }
   // If there is not <Prefix>, use path instead of it.
-  xmlChar* pprefix = get_prefix(doc);
-  string   prefix  = (pprefix ? (char*)pprefix : path ? path : "");
-  if(pprefix){
-    xmlFree(pprefix);
+  const char* basepath = parser->prefix.empty() ? parser->path.c_str() : parser->prefix.c_str();
+  char*       name     = get_object_name(parser->key.c_str(), basepath);
+
+  if(!name){
+    S3FS_PRN_WARN("name is something wrong. but continue.");
+    return true;
+  }
+  if((const char*)name == c_strErrorObjectName){
+    S3FS_PRN_WARN("name is file or subdir in dir. but continue.");
+    return true;
   }
 
-  xmlXPathContextPtr ctx = xmlXPathNewContext(doc);
+  off_t  size  = -1;
+  time_t mtime = 0;
+  if(!is_cprefix && stat_from_list && !parser->size.empty() && !parser->lastmodified.empty()){
+    size  = get_size(parser->size.c_str());
+    mtime = cvtCAMExpireStringToTime(parser->lastmodified.c_str());    // ex. "2017-01-01T00:00:00.000Z"
+  }
+  const char* etag = (!is_cprefix && !parser->etag.empty()) ? parser->etag.c_str() : NULL;
 
-  if(!noxmlns && GetXmlNsUrl(doc, xmlnsurl)){
-    xmlXPathRegisterNs(ctx, (xmlChar*)"s3", (xmlChar*)xmlnsurl.c_str());
-    ex_contents+= "s3:";
-    ex_key     += "s3:";
-    ex_cprefix += "s3:";
-    ex_prefix  += "s3:";
-    ex_etag    += "s3:";
-  }
-  ex_contents+= "Contents";
-  ex_key     += "Key";
-  ex_cprefix += "CommonPrefixes";
-  ex_prefix  += "Prefix";
-  ex_etag    += "ETag";
-
-  if(-1 == append_objects_from_xml_ex(prefix.c_str(), doc, ctx, ex_contents.c_str(), ex_key.c_str(), ex_etag.c_str(), 0, head) ||
-     -1 == append_objects_from_xml_ex(prefix.c_str(), doc, ctx, ex_cprefix.c_str(), ex_prefix.c_str(), NULL, 1, head) )
-  {
-    S3FS_PRN_ERR("append_objects_from_xml_ex returns with error.");
-    S3FS_XMLXPATHFREECONTEXT(ctx);
-    return -1;
+  if(!parser->head->insert(name, etag, is_cprefix, size, mtime)){
+    S3FS_PRN_ERR("insert_object returns with error.");
+    free(name);
+    return false;
   }
-  S3FS_XMLXPATHFREECONTEXT(ctx);
+  free(name);
 
-  return 0;
+  return true;
 }
 
-static xmlChar* get_base_exp(xmlDocPtr doc, const char* exp)
+static void list_bucket_sax_start(void* ctx, const xmlChar* localname, const xmlChar* prefix, const xmlChar* URI,
+              int nb_namespaces, const xmlChar** namespaces, int nb_attributes, int nb_defaulted, const xmlChar** attributes)
 {
-  xmlXPathObjectPtr  marker_xp;
-  string xmlnsurl;
-  string exp_string = "//";
+  LIST_BUCKET_PARSER* parser = reinterpret_cast<LIST_BUCKET_PARSER*>(ctx);
 
-  if(!doc){
-    return NULL;
-  }
-  xmlXPathContextPtr ctx = xmlXPathNewContext(doc);
+  parser->depth++;
+  parser->text.erase();
 
-  if(!noxmlns && GetXmlNsUrl(doc, xmlnsurl)){
-    xmlXPathRegisterNs(ctx, (xmlChar*)"s3", (xmlChar*)xmlnsurl.c_str());
-    exp_string += "s3:";
+  // <ListBucketResult><Contents>...</Contents><CommonPrefixes>...</CommonPrefixes></ListBucketResult>
+  if(2 == parser->depth){
+    if(0 == strcmp((const char*)localname, "Contents")){
+      parser->in_contents = true;
+      parser->key.erase();
+      parser->etag.erase();
+      parser->size.erase();
+      parser->lastmodified.erase();
+    }else if(0 == strcmp((const char*)localname, "CommonPrefixes")){
+      parser->in_cprefix = true;
+      parser->key.erase();
+    }
   }
-  exp_string += exp;
+}
 
-  if(NULL == (marker_xp = xmlXPathEvalExpression((xmlChar *)exp_string.c_str(), ctx))){
-    xmlXPathFreeContext(ctx);
-    return NULL;
-  }
-  if(xmlXPathNodeSetIsEmpty(marker_xp->nodesetval)){
-    S3FS_PRN_ERR("marker_xp->nodesetval is empty.");
-    xmlXPathFreeObject(marker_xp);
-    xmlXPathFreeContext(ctx);
-    return NULL;
+static void list_bucket_sax_end(void* ctx, const xmlChar* localname, const xmlChar* prefix, const xmlChar* URI)
+{
+  LIST_BUCKET_PARSER* parser = reinterpret_cast<LIST_BUCKET_PARSER*>(ctx);
+  const char*         name   = (const char*)localname;
+
+  if(2 == parser->depth){
+    if(parser->in_contents){
+      parser->in_contents = false;
+      if(!list_bucket_parser_add(parser, false)){
+        parser->is_error = true;
+        xmlStopParser(parser->ctxt);
+      }
+    }else if(parser->in_cprefix){
+      parser->in_cprefix = false;
+      if(!list_bucket_parser_add(parser, true)){
+        parser->is_error = true;
+        xmlStopParser(parser->ctxt);
+      }
+    }else if(0 == strcmp(name, "Prefix")){
+      parser->prefix = parser->text;
+    }else if(0 == strcmp(name, "IsTruncated")){
+      parser->is_truncated = (0 == strcasecmp(parser->text.c_str(), "true"));
+    }else if(0 == strcmp(name, "NextMarker")){
+      parser->next_marker = parser->text;
+    }
+  }else if(3 == parser->depth){
+    if(parser->in_contents){
+      if(0 == strcmp(name, "Key")){
+        parser->key = parser->text;
+      }else if(0 == strcmp(name, "ETag")){
+        parser->etag = parser->text;
+      }else if(0 == strcmp(name, "Size")){
+        parser->size = parser->text;
+      }else if(0 == strcmp(name, "LastModified")){
+        parser->lastmodified = parser->text;
+      }
+    }else if(parser->in_cprefix){
+      if(0 == strcmp(name, "Prefix")){
+        parser->key = parser->text;
+      }
+    }
   }
-  xmlNodeSetPtr nodes  = marker_xp->nodesetval;
-  xmlChar*      result = xmlNodeListGetString(doc, nodes->nodeTab[0]->xmlChildrenNode, 1);
-
-  xmlXPathFreeObject(marker_xp);
-  xmlXPathFreeContext(ctx);
-
-  return result;
+  parser->text.erase();
+  parser->depth--;
 }
 
-static xmlChar* get_prefix(xmlDocPtr doc)
+static void list_bucket_sax_characters(void* ctx, const xmlChar* ch, int len)
 {
-  return get_base_exp(doc, "Prefix");
+  LIST_BUCKET_PARSER* parser = reinterpret_cast<LIST_BUCKET_PARSER*>(ctx);
+
+  if(2 <= parser->depth && parser->depth <= 3){
+    parser->text.append((const char*)ch, len);
+  }
 }
 
-static xmlChar* get_next_marker(xmlDocPtr doc)
+static void list_bucket_sax_error(void* ctx, const char* msg, ...)
 {
-  return get_base_exp(doc, "NextMarker");
+  S3FS_PRN_WARN("error or warning from xml parser for ListBucket response.");
 }
 
-static bool is_truncated(xmlDocPtr doc)
+static bool GetXmlNsUrl(xmlDocPtr doc, string& nsurl)
 {
+  static time_t tmLast = 0;  // cache for 60 sec.
+  static string strNs("");
   bool result = false;
 
-  xmlChar* strTruncate = get_base_exp(doc, "IsTruncated");
-  if(!strTruncate){
+  if(!doc){
     return result;
   }
-  if(0 == strcasecmp((const char*)strTruncate, "true")){
+  if((tmLast + 60) < time(NULL)){
+    // refresh
+    tmLast = time(NULL);
+    strNs  = "";
+    xmlNodePtr pRootNode = xmlDocGetRootElement(doc);
+    if(pRootNode){
+      xmlNsPtr* nslist = xmlGetNsList(doc, pRootNode);
+      if(nslist){
+        if(nslist[0] && nslist[0]->href){
+          strNs  = (const char*)(nslist[0]->href);
+        }
+        S3FS_XMLFREE(nslist);
+      }
+    }
+  }
+  if(0 < strNs.size()){
+    nsurl  = strNs;
     result = true;
   }
-  xmlFree(strTruncate);
   return result;
 }
 
 // return: the pointer to object name on allocated memory.
 //         the pointer to "c_strErrorObjectName".(not allocated)
 //         NULL(a case of something error occurred)
-static char* get_object_name(xmlDocPtr doc, xmlNodePtr node, const char* path)
+static char* get_object_name(const char* fullpath, const char* path)
 {
-  // Get full path
-  xmlChar* fullpath = xmlNodeListGetString(doc, node, 1);
   if(!fullpath){
     S3FS_PRN_ERR("could not get object full path name..");
     return NULL;
   }
   // basepath(path) is as same as fullpath.
-  if(0 == strcmp((char*)fullpath, path)){
-    xmlFree(fullpath);
+  if(0 == strcmp(fullpath, path)){
     return (char*)c_strErrorObjectName;
   }
 
@@ -3043,7 +3404,6 @@ static char* get_object_name(xmlDocPtr doc, xmlNodePtr node, const char* path)
   const char* dirpath = strdirpath.c_str();
   const char* mybname = strmybpath.c_str();
   const char* basepath= (!path || '\0' == path[0] || '/' != path[0] ? path : &path[1]);
-  xmlFree(fullpath);
 
   if(!mybname || '\0' == mybname[0]){
     return NULL;
@@ -3262,6 +3622,8 @@ static int s3fs_setxattr(const char* path, const char* name, const char* value,
 static int s3fs_setxattr(const char* path, const char* name, const char* value, size_t size, int flags)
 #endif
 {
+  StatsTimer stats_timer(stats_fuse_setxattr);
+
   if (noxattr) {
     S3FS_PRN_WARN("XATTR DISABLED: [path=%s][name=%s][value=%p][size=%zu][flags=%d]", path, name, value, size, flags);
     return 0;
@@ -3413,6 +3775,8 @@ static int s3fs_getxattr(const char* path, const char* name, char* value, size_t
 static int s3fs_getxattr(const char* path, const char* name, char* value, size_t size)
 #endif
 {
+  StatsTimer stats_timer(stats_fuse_getxattr);
+
   if (noxattr) {
     S3FS_PRN_WARN("XATTR DISABLED: [path=%s][name=%s][value=%p][size=%zu]", path, name, value, size);
     return -ENOATTR;
@@ -3489,6 +3853,8 @@ static int s3fs_getxattr(const char* path, const char* name, char* value, size_t
 
 static int s3fs_listxattr(const char* path, char* list, size_t size)
 {
+  StatsTimer stats_timer(stats_fuse_listxattr);
+
   S3FS_PRN_INFO("[path=%s][list=%p][size=%zu]", path, list, size);
   struct fuse_context* pcxt;
   if(NULL != (pcxt = fuse_get_context())){
@@ -3561,6 +3927,8 @@ static int s3fs_listxattr(const char* path, char* list, size_t size)
 
 static int s3fs_removexattr(const char* path, const char* name)
 {
+  StatsTimer stats_timer(stats_fuse_removexattr);
+
   S3FS_PRN_INFO("[path=%s][name=%s]", path, name);
   int pid = -1;
   struct fuse_context* pcxt;
@@ -3715,6 +4083,11 @@ static int s3fs_removexattr(const char* path, const char* name)
 
 static void* s3fs_init(struct fuse_conn_info* conn)
 {
+  // write syslog in background, after daemonizing
+  if(!S3fsLog::Start()){
+    S3FS_PRN_WARN("Could not start logging thread, syslog is written directly.");
+  }
+
   // check bucket
   {
        int result;
@@ -3723,12 +4096,34 @@ static void* s3fs_init(struct fuse_conn_info* conn)
            return NULL;
        }
   }
+  // make connections for the following requests
+  if(0 < warmup_connections){
+    S3fsCurl::WarmupConnections(warmup_connections);
+  }
   // Investigate system capabilities
   #ifndef __APPLE__
   if((unsigned int)conn->capable & FUSE_CAP_ATOMIC_O_TRUNC){
      conn->want |= FUSE_CAP_ATOMIC_O_TRUNC;
   }
   #endif
+  #if FUSE_HAS_READ_BUF
+  if((unsigned int)conn->capable & FUSE_CAP_SPLICE_READ){
+     conn->want |= FUSE_CAP_SPLICE_READ;
+  }
+  #endif
+
+  // start removing cold cache files
+  if(!FdManager::InitCacheEvictor()){
+    S3FS_PRN_WARN("Could not start cache evictor, cache directory size is not limited.");
+  }
+  // start giving freed memory back
+  if(!MallocTrimmer::Start()){
+    S3FS_PRN_WARN("Could not start malloc trimmer.");
+  }
+  // start serving statistics
+  if(!S3fsStats::Start()){
+    S3FS_PRN_WARN("Could not start statistics socket.");
+  }
 
   return NULL;
 }
@@ -3737,6 +4132,23 @@ static void s3fs_destroy(void*)
 {
   S3FS_PRN_INFO("destroy");
 
+  if(!FdManager::DestroyCacheEvictor()){
+    S3FS_PRN_WARN("Could not stop cache evictor.");
+  }
+  if(!MallocTrimmer::Destroy()){
+    S3FS_PRN_WARN("Could not stop malloc trimmer.");
+  }
+  if(!S3fsStats::Destroy()){
+    S3FS_PRN_WARN("Could not stop statistics socket.");
+  }
+
+  // Stop read ahead and part uploading threads before curl
+  if(!FdManager::DestroyReadAhead()){
+    S3FS_PRN_WARN("Could not stop read ahead threads.");
+  }
+  if(!FdManager::DestroyUploadPart()){
+    S3FS_PRN_WARN("Could not stop part uploading threads.");
+  }
   // Destroy curl
   if(!S3fsCurl::DestroyS3fsCurl()){
     S3FS_PRN_WARN("Could not release curl library.");
@@ -3747,10 +4159,17 @@ static void s3fs_destroy(void*)
   }
   // ssl
   s3fs_destroy_global_ssl();
+
+  // flush log messages
+  if(!S3fsLog::Destroy()){
+    S3FS_PRN_WARN("Could not stop logging thread.");
+  }
 }
 
 static int s3fs_access(const char* path, int mask)
 {
+  StatsTimer stats_timer(stats_fuse_access);
+
   struct fuse_context* pcxt;
   if(NULL != (pcxt = fuse_get_context())){
     S3FS_PRN_INFO("%s, uid=[%d], gid=[%d], pid=[%d]", __FUNCTION__, pcxt->uid, pcxt->gid, pcxt->pid);
@@ -3763,7 +4182,6 @@ static int s3fs_access(const char* path, int mask)
           (mask == F_OK) ? "F_OK" : "");
 
   int result = check_object_access(path, mask, NULL);
-  S3FS_MALLOCTRIM(0);
   return result;
 }
 
@@ -4700,6 +5118,10 @@ static int my_fuse_opt_proc(void* data, const char* arg, int key, struct fuse_ar
       S3fsCurl::SetRetries(static_cast<int>(s3fs_strtoofft(strchr(arg, '=') + sizeof(char))));
       return 0;
     }
+    if(0 == STR2NCMP(arg, "retry_deadline=")){
+      S3fsCurl::SetRetryDeadline(static_cast<time_t>(s3fs_strtoofft(strchr(arg, '=') + sizeof(char))));
+      return 0;
+    }
     if(0 == STR2NCMP(arg, "tmpdir=")){
       FdManager::SetTmpDir(strchr(arg, '=') + sizeof(char));
       return 0;
@@ -4716,6 +5138,49 @@ static int my_fuse_opt_proc(void* data, const char* arg, int key, struct fuse_ar
       is_remove_cache = true;
       return 0;
     }
+    if(0 == STR2NCMP(arg, "max_curl_handles=")){
+      int handles = static_cast<int>(s3fs_strtoofft(strchr(arg, '=') + sizeof(char)));
+      if(handles <= 0){
+        S3FS_PRN_EXIT("max_curl_handles option must be over 0.");
+        return -1;
+      }
+      S3fsCurl::SetMaxCurlHandles(handles);
+      return 0;
+    }
+    if(0 == STR2NCMP(arg, "malloc_trim_interval=")){
+      MallocTrimmer::SetInterval(static_cast<time_t>(s3fs_strtoofft(strchr(arg, '=') + sizeof(char))));
+      return 0;
+    }
+    if(0 == STR2NCMP(arg, "stats_socket=")){
+      if(!S3fsStats::SetSocketPath(strchr(arg, '=') + sizeof(char))){
+        S3FS_PRN_EXIT("stats_socket option needs the path of unix socket.");
+        return -1;
+      }
+      return 0;
+    }
+    if(0 == STR2NCMP(arg, "warmup_connections=")){
+      warmup_connections = static_cast<int>(s3fs_strtoofft(strchr(arg, '=') + sizeof(char)));
+      return 0;
+    }
+    if(0 == strcmp(arg, "http2") || 0 == strcmp(arg, "http2=prior_knowledge")){
+      if(!S3fsCurl::SetHttp2(0 == strcmp(arg, "http2=prior_knowledge"))){
+        S3FS_PRN_EXIT("http2 option is not supported by libcurl.");
+        return -1;
+      }
+      return 0;
+    }
+    if(0 == STR2NCMP(arg, "hedge_percentile=")){
+      int percent = static_cast<int>(s3fs_strtoofft(strchr(arg, '=') + sizeof(char)));
+      if(!S3fsCurl::SetHedgePercentile(percent)){
+        S3FS_PRN_EXIT("hedge_percentile option must be 0 to 99 and needs libcurl 7.68.0 or later.");
+        return -1;
+      }
+      return 0;
+    }
+    if(0 == STR2NCMP(arg, "hedge_max_size=")){
+      S3fsCurl::SetHedgeMaxSize(s3fs_strtoofft(strchr(arg, '=') + sizeof(char)));
+      return 0;
+    }
     if(0 == STR2NCMP(arg, "multireq_max=")){
       long maxreq = static_cast<long>(s3fs_strtoofft(strchr(arg, '=') + sizeof(char)));
       S3fsMultiCurl::SetMaxMultiRequest(maxreq);
@@ -4727,6 +5192,15 @@ static int my_fuse_opt_proc(void* data, const char* arg, int key, struct fuse_ar
       S3FS_PRN_CRIT("max_prefetch_bytes:%zu", max_prefetch_bytes);
       return 0;
     }
+    if(0 == strcmp(arg, "streamupload")){
+      FdEntity::SetStreamUpload(true);
+      return 0;
+    }
+    if(0 == STR2NCMP(arg, "readahead_threads=")){
+      int threads = static_cast<int>(s3fs_strtoofft(strchr(arg, '=') + sizeof(char)));
+      FdManager::SetReadAheadThreads(threads);
+      return 0;
+    }
     if(0 == strcmp(arg, "nonempty")){
       nonempty = true;
       return 1; // need to continue for fuse.
@@ -4953,6 +5427,10 @@ static int my_fuse_opt_proc(void* data, const char* arg, int key, struct fuse_ar
       StatCache::getStatCacheData()->SetExpireTime(expr_time);
       return 0;
     }
+    if(0 == strcmp(arg, "stat_from_list")){
+      stat_from_list = true;
+      return 0;
+    }
     if(0 == strcmp(arg, "enable_noobj_cache")){
       StatCache::getStatCacheData()->EnableCacheNoObject();
       return 0;
@@ -4965,6 +5443,10 @@ static int my_fuse_opt_proc(void* data, const char* arg, int key, struct fuse_ar
       S3fsCurl::SetSslSessionCache(false);
       return 0;
     }
+    if(0 == strcmp(arg, "noasynclog")){
+      S3fsLog::SetAsync(false);
+      return 0;
+    }
     if(0 == STR2NCMP(arg, "parallel_count=") || 0 == STR2NCMP(arg, "parallel_upload=")){
       int maxpara = static_cast<int>(s3fs_strtoofft(strchr(arg, '=') + sizeof(char)));
       if(0 >= maxpara){
@@ -4988,6 +5470,11 @@ static int my_fuse_opt_proc(void* data, const char* arg, int key, struct fuse_ar
       FdManager::InitEnsureFreeDiskSpace();
       return 0;
     }
+    if(0 == STR2NCMP(arg, "max_cache_size=")){
+      size_t maxsize = static_cast<size_t>(s3fs_strtoofft(strchr(arg, '=') + sizeof(char))) * 1024 * 1024;
+      FdManager::SetMaxCacheSize(maxsize);
+      return 0;
+    }
     if(0 == STR2NCMP(arg, "ensure_diskfree=")){
       size_t dfsize = static_cast<size_t>(s3fs_strtoofft(strchr(arg, '=') + sizeof(char))) * 1024 * 1024;
       if(dfsize < static_cast<size_t>(S3fsCurl::GetMultipartSize())){
@@ -5172,8 +5659,8 @@ static void s3fs_exit_fuseloop(int exit_status) {
 int main(int argc, char* argv[])
 {
 #ifdef TEST_COSFS
-  extern int TestMain();
-  return TestMain();
+  extern int TestMain(int argc, char* argv[]);
+  return TestMain(argc, argv);
 #endif
   int ch;
   int fuse_res;
@@ -5253,6 +5740,12 @@ int main(int argc, char* argv[])
     S3FS_PRN_EXIT("use_sse option could not be specified with storage class reduced_redundancy.");
     exit(EXIT_FAILURE);
   }
+#ifdef HAVE_CURL_MULTIPLEX
+  // libcurl negotiates HTTP/2 only by TLS, so requests over http are sent by HTTP/1.1.
+  if(CURL_HTTP_VERSION_2TLS == S3fsCurl::GetHttpVersion() && 0 == strncasecmp(host.c_str(), "http://", 7)){
+    S3FS_PRN_WARN("http2 option does not use HTTP/2 for %s, specify http2=prior_knowledge for HTTP/2 over http.", host.c_str());
+  }
+#endif
 
   // The first plain argument is the bucket
   if(bucket.empty() || appid.empty()){
@@ -5347,6 +5840,11 @@ int main(int argc, char* argv[])
     exit(s3fs_utility_mode());
   }
 
+  // parts of stream upload are sent by parallel_count threads
+  if(FdEntity::IsStreamUpload()){
+    FdManager::SetUploadThreads(S3fsCurl::GetMaxParallelCount());
+  }
+
   // check free disk space
   FdManager::InitEnsureFreeDiskSpace();
   if(!FdManager::IsSafeDiskSpace(NULL, S3fsCurl::GetMultipartSize())){
@@ -5393,6 +5891,9 @@ int main(int argc, char* argv[])
   s3fs_oper.truncate  = s3fs_truncate;
   s3fs_oper.open      = s3fs_open;
   s3fs_oper.read      = s3fs_read;
+#if FUSE_HAS_READ_BUF
+  s3fs_oper.read_buf  = s3fs_read_buf;
+#endif
   s3fs_oper.write     = s3fs_write;
   s3fs_oper.statfs    = s3fs_statfs;
   s3fs_oper.flush     = s3fs_flush;
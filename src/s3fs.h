@@ -25,6 +25,13 @@
 
 #include <fuse.h>
 
+// read_buf(and fuse_bufvec) is supported from libfuse 2.9
+#if FUSE_MAJOR_VERSION > 2 || (FUSE_MAJOR_VERSION == 2 && FUSE_MINOR_VERSION >= 9)
+#define FUSE_HAS_READ_BUF     1
+#else
+#define FUSE_HAS_READ_BUF     0
+#endif
+
 #define S3FS_FUSE_EXIT() { \
   struct fuse_context* pcxt = fuse_get_context(); \
   if(pcxt){ \
@@ -41,6 +48,11 @@
 // memory back. Following macros is prepared for that
 // your system does not have it.
 //
+// malloc_trim walks all arenas with locking them, so it is
+// not called in each operation. MallocTrimmer(s3fs_util.h)
+// calls it in background, and S3FS_MALLOCTRIM is only used
+// at starting and exiting.
+//
 // Address of gratitude, this workaround quotes a document
 // of libxml2.
 // http://xmlsoft.org/xmlmem.html
@@ -51,39 +63,20 @@
 
 #define DISPWARN_MALLOCTRIM(str)
 #define S3FS_MALLOCTRIM(pad)          malloc_trim(pad)
-#define S3FS_XMLFREEDOC(doc) \
-        { \
-          xmlFreeDoc(doc); \
-          S3FS_MALLOCTRIM(0); \
-        }
-#define S3FS_XMLFREE(ptr) \
-        { \
-          xmlFree(ptr); \
-          S3FS_MALLOCTRIM(0); \
-        }
-#define S3FS_XMLXPATHFREECONTEXT(ctx) \
-        { \
-          xmlXPathFreeContext(ctx); \
-          S3FS_MALLOCTRIM(0); \
-        }
-#define S3FS_XMLXPATHFREEOBJECT(obj) \
-        { \
-          xmlXPathFreeObject(obj); \
-          S3FS_MALLOCTRIM(0); \
-        }
 
 #else // HAVE_MALLOC_TRIM
 
 #define DISPWARN_MALLOCTRIM(str) \
         fprintf(stderr, "Warning: %s without malloc_trim is possibility of the use memory increase.\n", program_name.c_str())
 #define S3FS_MALLOCTRIM(pad)
+
+#endif // HAVE_MALLOC_TRIM
+
 #define S3FS_XMLFREEDOC(doc)          xmlFreeDoc(doc)
 #define S3FS_XMLFREE(ptr)             xmlFree(ptr)
 #define S3FS_XMLXPATHFREECONTEXT(ctx) xmlXPathFreeContext(ctx)
 #define S3FS_XMLXPATHFREEOBJECT(obj)  xmlXPathFreeObject(obj)
 
-#endif // HAVE_MALLOC_TRIM
-
 #endif // S3FS_S3_H_
 
 /*
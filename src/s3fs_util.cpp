@@ -28,6 +28,7 @@
 #include <pwd.h>
 #include <grp.h>
 #include <syslog.h>
+#include <stdarg.h>
 #include <pthread.h>
 #include <sys/types.h>
 #include <dirent.h>
@@ -36,12 +37,15 @@
 #include <sstream>
 #include <map>
 #include <list>
+#include <algorithm>
+#include <new>
 
 #include "common.h"
 #include "s3fs_util.h"
 #include "string_util.h"
 #include "s3fs.h"
 #include "s3fs_auth.h"
+#include "stats.h"
 
 using namespace std;
 
@@ -70,8 +74,9 @@ string get_realpath(const char *path) {
 // If name is terminated by "/", it is forced dir type.
 // If name is terminated by "_$folder$", it is forced dir type.
 // If is_dir is true and name is not terminated by "/", the name is added "/".
+// If size is not -1, size and mtime in listing are kept for file object.
 //
-bool S3ObjList::insert(const char* name, const char* etag, bool is_dir)
+bool S3ObjList::insert(const char* name, const char* etag, bool is_dir, off_t size, time_t mtime)
 {
   if(!name || '\0' == name[0]){
     return false;
@@ -124,6 +129,8 @@ bool S3ObjList::insert(const char* name, const char* etag, bool is_dir)
     if(etag){
       (*iter).second.etag = string(etag);  // over write
     }
+    (*iter).second.size  = is_dir ? -1 : size;
+    (*iter).second.mtime = mtime;
   }else{
     // add new object
     s3obj_entry newobject;
@@ -132,6 +139,8 @@ bool S3ObjList::insert(const char* name, const char* etag, bool is_dir)
     if(etag){
       newobject.etag = etag;
     }
+    newobject.size    = is_dir ? -1 : size;
+    newobject.mtime   = mtime;
     objects[newname] = newobject;
   }
 
@@ -230,6 +239,21 @@ bool S3ObjList::IsDir(const char* name) const
   return ps3obj->is_dir;
 }
 
+bool S3ObjList::GetListStat(const char* name, off_t& size, time_t& mtime) const
+{
+  const s3obj_entry* ps3obj;
+
+  if(NULL == (ps3obj = GetS3Obj(name))){
+    return false;
+  }
+  if(ps3obj->is_dir || 0 > ps3obj->size){
+    return false;
+  }
+  size  = ps3obj->size;
+  mtime = ps3obj->mtime;
+  return true;
+}
+
 bool S3ObjList::GetLastName(std::string& lastname) const
 {
   bool result = false;
@@ -250,6 +274,75 @@ bool S3ObjList::GetLastName(std::string& lastname) const
   return result;
 }
 
+//
+// Moves all objects to other, and merges them with the objects in other.
+//
+bool S3ObjList::MoveTo(S3ObjList& other)
+{
+  for(s3obj_t::const_iterator iter = objects.begin(); iter != objects.end(); ++iter){
+    if(0 != (*iter).second.normalname.length()){
+      // normalized name is made again by inserting the object.
+      continue;
+    }
+    const s3obj_entry& obj  = (*iter).second;
+    string             name = obj.orgname.length() ? obj.orgname : (*iter).first;
+    other.insert(name.c_str(), (obj.etag.length() ? obj.etag.c_str() : NULL), obj.is_dir, obj.size, obj.mtime);
+  }
+  objects.clear();
+  return true;
+}
+
+//
+// Moves the objects which may be merged with the objects listed after
+// this to other.
+// Objects are listed in order of their names, so "dir/" or "dir_$folder$"
+// can be listed after this list only when "dir" is a prefix of the last
+// name in this list.
+//
+bool S3ObjList::MoveMergeableTo(S3ObjList& other)
+{
+  s3obj_t::iterator iter;
+  string            lastname;
+
+  for(iter = objects.begin(); iter != objects.end(); ++iter){
+    if(0 > strcmp(lastname.c_str(), (*iter).first.c_str())){
+      lastname = (*iter).first;
+    }
+    if(0 > strcmp(lastname.c_str(), (*iter).second.orgname.c_str())){
+      lastname = (*iter).second.orgname;
+    }
+  }
+
+  s3obj_list_t names;
+  for(iter = objects.begin(); iter != objects.end(); ++iter){
+    if(0 != (*iter).second.normalname.length()){
+      continue;
+    }
+    string basename = (*iter).first;
+    if(1 < basename.length() && '/' == basename[basename.length() - 1]){
+      basename = basename.substr(0, basename.length() - 1);
+    }
+    if(0 != lastname.compare(0, basename.length(), basename)){
+      continue;
+    }
+    const s3obj_entry& obj  = (*iter).second;
+    string             name = obj.orgname.length() ? obj.orgname : (*iter).first;
+    other.insert(name.c_str(), (obj.etag.length() ? obj.etag.c_str() : NULL), obj.is_dir, obj.size, obj.mtime);
+    names.push_back((*iter).first);
+  }
+
+  // remove moved objects with their normalized names
+  for(iter = objects.begin(); iter != objects.end(); ){
+    const string& name = (*iter).second.normalname.length() ? (*iter).second.normalname : (*iter).first;
+    if(names.end() != find(names.begin(), names.end(), name)){
+      objects.erase(iter++);
+    }else{
+      ++iter;
+    }
+  }
+  return true;
+}
+
 bool S3ObjList::GetNameList(s3obj_list_t& list, bool OnlyNormalized, bool CutSlash) const
 {
   s3obj_t::const_iterator iter;
@@ -441,7 +534,14 @@ AutoLock::AutoLock(pthread_mutex_t* pmutex, Type type) : auto_mutex(pmutex)
             abort();
         }
     } else {
-        int res = pthread_mutex_lock(auto_mutex);
+        int res;
+        if(!S3fsStats::IsEnabled()){
+            res = pthread_mutex_lock(auto_mutex);
+        }else if(EBUSY == (res = pthread_mutex_trylock(auto_mutex))){
+            // only the contended locking is measured
+            StatsTimer stats_timer(stats_lock_wait);
+            res = pthread_mutex_lock(auto_mutex);
+        }
         if(res == 0){
             is_lock_acquired = true;
         }else{
@@ -462,6 +562,292 @@ AutoLock::~AutoLock()
     }
 }
 
+//-------------------------------------------------------------------
+// Class MallocTrimmer
+//-------------------------------------------------------------------
+pthread_mutex_t MallocTrimmer::trim_lock    = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t  MallocTrimmer::trim_cond    = PTHREAD_COND_INITIALIZER;
+pthread_t       MallocTrimmer::thread;
+bool            MallocTrimmer::is_started   = false;
+bool            MallocTrimmer::is_exit      = false;
+bool            MallocTrimmer::is_requested = false;
+time_t          MallocTrimmer::interval     = MALLOC_TRIM_INTERVAL;
+
+time_t MallocTrimmer::SetInterval(time_t sec)
+{
+  time_t old = MallocTrimmer::interval;
+  MallocTrimmer::interval = sec;
+  return old;
+}
+
+bool MallocTrimmer::Start(void)
+{
+#ifdef HAVE_MALLOC_TRIM
+  AutoLock auto_lock(&MallocTrimmer::trim_lock);
+
+  if(MallocTrimmer::is_started || 0 >= MallocTrimmer::interval){
+    return true;
+  }
+  MallocTrimmer::is_exit = false;
+
+  int rc;
+  if(0 != (rc = pthread_create(&MallocTrimmer::thread, NULL, MallocTrimmer::Worker, NULL))){
+    S3FS_PRN_ERR("failed pthread_create - rc(%d)", rc);
+    return false;
+  }
+  MallocTrimmer::is_started = true;
+#endif
+  return true;
+}
+
+bool MallocTrimmer::Destroy(void)
+{
+  {
+    AutoLock auto_lock(&MallocTrimmer::trim_lock);
+    if(!MallocTrimmer::is_started){
+      return true;
+    }
+    MallocTrimmer::is_exit = true;
+    pthread_cond_broadcast(&MallocTrimmer::trim_cond);
+  }
+  int rc;
+  if(0 != (rc = pthread_join(MallocTrimmer::thread, NULL))){
+    S3FS_PRN_ERR("failed pthread_join - rc(%d)", rc);
+    return false;
+  }
+  MallocTrimmer::is_started = false;
+  return true;
+}
+
+// [NOTE]
+// Only sets the flag, the trimmer checks it at next checking time.
+//
+void MallocTrimmer::Request(void)
+{
+  AutoLock auto_lock(&MallocTrimmer::trim_lock);
+  MallocTrimmer::is_requested = true;
+}
+
+// returns resident size of this process, or 0 if it is unknown.
+size_t MallocTrimmer::GetRss(void)
+{
+  size_t pages    = 0;
+  size_t resident = 0;
+  FILE*  fp;
+  if(NULL == (fp = fopen("/proc/self/statm", "r"))){
+    return 0;
+  }
+  if(2 != fscanf(fp, "%zu %zu", &pages, &resident)){
+    resident = 0;
+  }
+  fclose(fp);
+  return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+void* MallocTrimmer::Worker(void* arg)
+{
+  size_t last_rss  = MallocTrimmer::GetRss();
+  time_t last_trim = time(NULL);
+
+  AutoLock auto_lock(&MallocTrimmer::trim_lock);
+  while(!MallocTrimmer::is_exit){
+    struct timespec abstime;
+    abstime.tv_sec  = time(NULL) + std::min(static_cast<time_t>(MALLOC_TRIM_CHECK_SEC), MallocTrimmer::interval);
+    abstime.tv_nsec = 0;
+    pthread_cond_timedwait(&MallocTrimmer::trim_cond, &MallocTrimmer::trim_lock, &abstime);
+    if(MallocTrimmer::is_exit){
+      break;
+    }
+
+    size_t rss = MallocTrimmer::GetRss();
+    time_t now = time(NULL);
+    if(!MallocTrimmer::is_requested && (rss < last_rss + MALLOC_TRIM_RSS_GROWTH) && (now < last_trim + MallocTrimmer::interval)){
+      continue;
+    }
+    MallocTrimmer::is_requested = false;
+
+    pthread_mutex_unlock(&MallocTrimmer::trim_lock);
+    S3FS_MALLOCTRIM(0);
+    size_t trimmed_rss = MallocTrimmer::GetRss();
+    pthread_mutex_lock(&MallocTrimmer::trim_lock);
+
+    S3FS_PRN_DBG("malloc_trim: resident size %zu -> %zu bytes", rss, trimmed_rss);
+    last_rss  = trimmed_rss;
+    last_trim = now;
+  }
+  return NULL;
+}
+
+//-------------------------------------------------------------------
+// Class S3fsLog
+//-------------------------------------------------------------------
+pthread_mutex_t       S3fsLog::log_lock      = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t        S3fsLog::log_cond      = PTHREAD_COND_INITIALIZER;
+pthread_cond_t        S3fsLog::written_cond  = PTHREAD_COND_INITIALIZER;
+pthread_t             S3fsLog::thread;
+S3fsLog::log_message* S3fsLog::ring          = NULL;
+size_t                S3fsLog::ring_head     = 0;
+size_t                S3fsLog::ring_count    = 0;
+size_t                S3fsLog::dropped       = 0;
+unsigned long long    S3fsLog::queued_count  = 0;
+unsigned long long    S3fsLog::written_count = 0;
+bool                  S3fsLog::is_async      = true;
+bool                  S3fsLog::is_started    = false;
+bool                  S3fsLog::is_exit       = false;
+
+bool S3fsLog::SetAsync(bool async)
+{
+  bool old = S3fsLog::is_async;
+  S3fsLog::is_async = async;
+  return old;
+}
+
+// [NOTE]
+// This class does not use S3FS_PRN_* macros for its own errors, because
+// they would come back to Write.
+//
+bool S3fsLog::Start(void)
+{
+  pthread_mutex_lock(&S3fsLog::log_lock);
+
+  if(S3fsLog::is_started || !S3fsLog::is_async){
+    pthread_mutex_unlock(&S3fsLog::log_lock);
+    return true;
+  }
+  if(NULL == (S3fsLog::ring = new(std::nothrow) log_message[S3FS_LOG_RING_SIZE])){
+    pthread_mutex_unlock(&S3fsLog::log_lock);
+    syslog(LOG_ERR, "could not allocate log ring buffer.");
+    return false;
+  }
+  S3fsLog::ring_head     = 0;
+  S3fsLog::ring_count    = 0;
+  S3fsLog::dropped       = 0;
+  S3fsLog::queued_count  = 0;
+  S3fsLog::written_count = 0;
+  S3fsLog::is_exit       = false;
+
+  int rc;
+  if(0 != (rc = pthread_create(&S3fsLog::thread, NULL, S3fsLog::Worker, NULL))){
+    delete[] S3fsLog::ring;
+    S3fsLog::ring = NULL;
+    pthread_mutex_unlock(&S3fsLog::log_lock);
+    syslog(LOG_ERR, "failed pthread_create for logging - rc(%d)", rc);
+    return false;
+  }
+  S3fsLog::is_started = true;
+  pthread_mutex_unlock(&S3fsLog::log_lock);
+  return true;
+}
+
+// The messages left in the ring buffer are written before the thread exits.
+bool S3fsLog::Destroy(void)
+{
+  pthread_mutex_lock(&S3fsLog::log_lock);
+  if(!S3fsLog::is_started){
+    pthread_mutex_unlock(&S3fsLog::log_lock);
+    return true;
+  }
+  S3fsLog::is_exit = true;
+  pthread_cond_broadcast(&S3fsLog::log_cond);
+  pthread_mutex_unlock(&S3fsLog::log_lock);
+
+  int rc;
+  if(0 != (rc = pthread_join(S3fsLog::thread, NULL))){
+    syslog(LOG_ERR, "failed pthread_join for logging - rc(%d)", rc);
+    return false;
+  }
+  pthread_mutex_lock(&S3fsLog::log_lock);
+  S3fsLog::is_started = false;
+  delete[] S3fsLog::ring;
+  S3fsLog::ring = NULL;
+  pthread_mutex_unlock(&S3fsLog::log_lock);
+  return true;
+}
+
+void S3fsLog::Write(int priority, const char* format, va_list args)
+{
+  // format without the lock
+  char    text[S3FS_LOG_MSG_SIZE];
+  va_list args_copy;
+  va_copy(args_copy, args);
+  int     length = vsnprintf(text, sizeof(text), format, args_copy);
+  va_end(args_copy);
+  bool    is_long = (static_cast<int>(sizeof(text)) <= length);
+
+  pthread_mutex_lock(&S3fsLog::log_lock);
+  if(S3fsLog::is_started && (LOG_CRIT >= priority || is_long)){
+    // the messages queued before this are written at first
+    unsigned long long target = S3fsLog::queued_count;
+    while(S3fsLog::written_count < target){
+      pthread_cond_wait(&S3fsLog::written_cond, &S3fsLog::log_lock);
+    }
+    pthread_mutex_unlock(&S3fsLog::log_lock);
+
+  }else if(S3fsLog::is_started){
+    if(S3FS_LOG_RING_SIZE <= S3fsLog::ring_count){
+      S3fsLog::dropped++;
+    }else{
+      log_message& message = S3fsLog::ring[(S3fsLog::ring_head + S3fsLog::ring_count) % S3FS_LOG_RING_SIZE];
+      message.priority = priority;
+      memcpy(message.text, text, sizeof(text));
+      S3fsLog::queued_count++;
+      if(0 == S3fsLog::ring_count++){
+        pthread_cond_signal(&S3fsLog::log_cond);
+      }
+    }
+    pthread_mutex_unlock(&S3fsLog::log_lock);
+    return;
+
+  }else{
+    pthread_mutex_unlock(&S3fsLog::log_lock);
+  }
+
+  if(is_long){
+    vsyslog(priority, format, args);
+  }else{
+    syslog(priority, "%s", text);
+  }
+}
+
+void* S3fsLog::Worker(void* arg)
+{
+  log_message message;
+
+  pthread_mutex_lock(&S3fsLog::log_lock);
+  while(true){
+    while(0 == S3fsLog::ring_count && !S3fsLog::is_exit){
+      pthread_cond_wait(&S3fsLog::log_cond, &S3fsLog::log_lock);
+    }
+    if(0 == S3fsLog::ring_count){
+      break;
+    }
+    message              = S3fsLog::ring[S3fsLog::ring_head];
+    S3fsLog::ring_head   = (S3fsLog::ring_head + 1) % S3FS_LOG_RING_SIZE;
+    S3fsLog::ring_count--;
+    size_t lost          = S3fsLog::dropped;
+    S3fsLog::dropped     = 0;
+
+    pthread_mutex_unlock(&S3fsLog::log_lock);
+    if(0 < lost){
+      syslog(LOG_WARNING, "%zu log messages were dropped, because log ring buffer was full.", lost);
+    }
+    syslog(message.priority, "%s", message.text);
+    pthread_mutex_lock(&S3fsLog::log_lock);
+    S3fsLog::written_count++;
+    pthread_cond_broadcast(&S3fsLog::written_cond);
+  }
+  pthread_mutex_unlock(&S3fsLog::log_lock);
+  return NULL;
+}
+
+void s3fs_syslog(int priority, const char* format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  S3fsLog::Write(priority, format, args);
+  va_end(args);
+}
+
 //-------------------------------------------------------------------
 // Utility for UID/GID
 //-------------------------------------------------------------------
@@ -922,6 +1308,12 @@ void show_help (void)
     "\n"
     "   retries (default=\"2\")\n"
     "      - number of times to retry a failed cos transaction\n"
+    "        the wait before each retry is randomized and grows up to\n"
+    "        10 seconds, and retries stop while many requests are failing\n"
+    "\n"
+    "   retry_deadline (default=\"0\" which means no limit)\n"
+    "      - seconds from the first attempt after which a failed cos\n"
+    "        transaction is not retried any more\n"
     "\n"
     "   use_cache (default=\"\" which means disabled)\n"
     "      - local folder to use for local file cache\n"
@@ -973,6 +1365,14 @@ void show_help (void)
     "      You can specify this option for performance, cosfs memorizes \n"
     "      in stat cache that the object(file or directory) does not exist.\n"
     "\n"
+    "   stat_from_list (default is disable)\n"
+    "      - make stat cache entries of files from the size, last modified\n"
+    "      time and ETag in the listing of readdir, instead of sending a\n"
+    "      head request for each file. The mode, uid and gid of those\n"
+    "      entries are the defaults(as for objects without x-cos-meta\n"
+    "      headers), and a head request is sent only when the headers of\n"
+    "      the file are needed(ex. getxattr, chmod).\n"
+    "\n"
     "   no_check_certificate\n"
     "      - server certificate won't be checked against the available \n"
 	"      certificate authorities.\n"
@@ -984,8 +1384,60 @@ void show_help (void)
     "      - cosfs is always using ssl session cache, this option make ssl \n"
     "      session cache disable.\n"
     "\n"
+    "   noasynclog (write syslog directly)\n"
+    "      - cosfs writes log messages to syslog in background thread, so\n"
+    "      that file operations do not wait for syslog. This option makes\n"
+    "      the operations write syslog by themselves.\n"
+    "\n"
     "   multireq_max (default=\"20\")\n"
     "      - maximum number of parallel request for listing objects.\n"
+    "      parallel requests are performed by a pool of worker threads, \n"
+    "      the pool has the larger of multireq_max and parallel_count \n"
+    "      threads.\n"
+    "\n"
+    "   max_curl_handles (default=\"64\")\n"
+    "      - maximum number of curl handles. The handles are pooled with\n"
+    "      their connections kept alive, and a request waits for a handle\n"
+    "      when all handles are used(for up to 1 second, then a temporary\n"
+    "      handle is made).\n"
+    "\n"
+    "   http2 (default is HTTP/1.1)\n"
+    "      - send requests over HTTP/2, and multiplex the concurrent requests\n"
+    "      (e.g. head requests in readdir, parallel range requests) over a\n"
+    "      few connections. HTTP/2 is negotiated by TLS, and HTTP/1.1 is used\n"
+    "      over http or when the server does not support it.\n"
+    "      \"http2=prior_knowledge\" uses HTTP/2 without negotiation, for\n"
+    "      servers over plain http.\n"
+    "      This needs libcurl 7.68.0 or later built with HTTP/2 support.\n"
+    "\n"
+    "   hedge_percentile (default=\"0\" which means disabled)\n"
+    "      - send a head request or a small get request again on another\n"
+    "      connection, when it is not answered within this percentile\n"
+    "      (e.g. 95) of measured latency of its type, and take the one\n"
+    "      answered first. This needs libcurl 7.68.0 or later.\n"
+    "\n"
+    "   hedge_max_size (default=\"1048576\")\n"
+    "      - max size in bytes of get request which is hedged.\n"
+    "\n"
+    "   malloc_trim_interval (default=\"60\" seconds)\n"
+    "      - interval for giving freed memory back to the system by\n"
+    "      malloc_trim in background. It is also done when the resident\n"
+    "      size has grown by 32MB. Specify 0 to disable it.\n"
+    "\n"
+    "   stats_socket (default is disable)\n"
+    "      - path of unix socket which serves the statistics in Prometheus\n"
+    "      text format: latency histograms of FUSE operations, requests,\n"
+    "      cache file I/O and contended locks, and hit counts of the stat\n"
+    "      cache and the file cache. It can be read by\n"
+    "      \"curl --unix-socket <path> http://localhost/metrics\".\n"
+    "      A relative path is from the current directory at mounting.\n"
+    "      The statistics are not served when another running process\n"
+    "      listens on the socket.\n"
+    "\n"
+    "   warmup_connections (default=\"0\")\n"
+    "      - number of connections which are made at mounting, by head\n"
+    "      requests to the bucket in parallel. The first requests after\n"
+    "      mounting reuse them instead of making new connections.\n"
     "\n"
     "   parallel_count (default=\"5\")\n"
     "      - number of parallel request for uploading big objects.\n"
@@ -995,6 +1447,15 @@ void show_help (void)
     "      at once. It is necessary to set this value depending on a CPU \n"
     "      and a network band.\n"
     "\n"
+    "   streamupload (default is disable)\n"
+    "      - upload parts of big objects while writing sequentially.\n"
+    "      When a file is written sequentially from the top, each filled\n"
+    "      multipart_size area is uploaded as a part in background by\n"
+    "      parallel_count threads, then flushing(closing) the file only\n"
+    "      uploads the rest and completes multipart uploading. If the\n"
+    "      uploaded area is rewritten or truncated, the object is uploaded\n"
+    "      entirely at flushing as before.\n"
+    "\n"
     "   multipart_size (default=\"10\")\n"
     "      - part size, in MB, for each multipart request.\n"
     "\n"
@@ -1004,6 +1465,13 @@ void show_help (void)
     "        space is smaller than this value, cosfs do not use diskspace\n"
     "        as possible in exchange for the performance.\n"
     "\n"
+    "   max_cache_size (default=\"0\" which means not limited)\n"
+    "      - sets MB to limit total size of closed files in the cache\n"
+    "        directory(use_cache). When the total size is over this\n"
+    "        value, or the disk free space is smaller than ensure_diskfree,\n"
+    "        least recently used files are removed in background until\n"
+    "        the total size is under 90%% of this value.\n"
+    "\n"
     "   singlepart_copy_limit (default=\"5120\")\n"
     "      - maximum size, in MB, of a single-part copy before trying \n"
     "      multipart copy.\n"
@@ -1064,11 +1532,21 @@ void show_help (void)
     "        (error), warn(warning), info(information) to debug level.\n"
     "        default debug level is critical. If cosfs run with \"-d\" option,\n"
     "        the debug level is set information. When cosfs catch the signal\n"
-    "        SIGUSR2, the debug level is bumpup.\n"
+    "        SIGUSR2, the debug level is bumpup. The messages under the\n"
+    "        level of --with-log-level option of configure are not built in.\n"
     "\n"
     "   max_prefetch_bytes (default=\"100*1024*1024, unit: bytes\")\n"
     "        Set the pretech bytes, when read data from cos, the fetch bytes will decide by\n"
     "        max(size, min(parrellel_count*multipart_size, max_prefetch_bytes))\n"
+    "        Sequential reading is not prefetched this way when readahead_threads\n"
+    "        is enabled, the read ahead window grows up to this size instead.\n"
+    "\n"
+    "   readahead_threads (default=\"4\")\n"
+    "        Number of background threads which load the area ahead of\n"
+    "        sequential readers. The read ahead window starts from\n"
+    "        multipart_size and doubles while reading stays sequential.\n"
+    "        Set 0 to disable, then sequential reading is prefetched\n"
+    "        synchronously by max_prefetch_bytes.\n"
     "\n"
     "   curldbg - put curl debug message\n"
     "        Put the debug message from libcurl when this option is specified.\n"
@@ -20,6 +20,8 @@
 #ifndef S3FS_S3FS_UTIL_H_
 #define S3FS_S3FS_UTIL_H_
 
+#include <stdarg.h>
+
 //-------------------------------------------------------------------
 // Typedef
 //-------------------------------------------------------------------
@@ -31,8 +33,10 @@ struct s3obj_entry{
   std::string orgname;    // original name: if empty, object is original name.
   std::string etag;
   bool        is_dir;
+  off_t       size;       // size in listing: -1 means unknown.
+  time_t      mtime;      // last modified in listing
 
-  s3obj_entry() : is_dir(false) {}
+  s3obj_entry() : is_dir(false), size(-1), mtime(0) {}
 };
 
 typedef std::map<std::string, struct s3obj_entry> s3obj_t;
@@ -64,13 +68,19 @@ class S3ObjList
     bool IsEmpty(void) const {
       return objects.empty();
     }
-    bool insert(const char* name, const char* etag = NULL, bool is_dir = false);
+    bool insert(const char* name, const char* etag = NULL, bool is_dir = false, off_t size = -1, time_t mtime = 0);
+    void swap(S3ObjList& other) {
+      objects.swap(other.objects);
+    }
     std::string GetOrgName(const char* name) const;
     std::string GetNormalizedName(const char* name) const;
     std::string GetETag(const char* name) const;
     bool IsDir(const char* name) const;
+    bool GetListStat(const char* name, off_t& size, time_t& mtime) const;
     bool GetNameList(s3obj_list_t& list, bool OnlyNormalized = true, bool CutSlash = true) const;
     bool GetLastName(std::string& lastname) const;
+    bool MoveTo(S3ObjList& other);
+    bool MoveMergeableTo(S3ObjList& other);
 
     static bool MakeHierarchizedList(s3obj_list_t& list, bool haveSlash);
 };
@@ -103,6 +113,88 @@ class AutoLock
     ~AutoLock();
 };
 
+//-------------------------------------------------------------------
+// class MallocTrimmer
+//-------------------------------------------------------------------
+// Gives freed heap memory back to the kernel by malloc_trim in
+// background thread. It trims when the resident size has grown by
+// MALLOC_TRIM_RSS_GROWTH since the last trimming, when memory has
+// been freed in bulk(Request), or every trim interval seconds.
+//
+#define MALLOC_TRIM_INTERVAL    60                // default interval(sec)
+#define MALLOC_TRIM_RSS_GROWTH  (32 * 1024 * 1024)  // 32MB
+#define MALLOC_TRIM_CHECK_SEC   5
+
+class MallocTrimmer
+{
+  private:
+    static pthread_mutex_t trim_lock;
+    static pthread_cond_t  trim_cond;
+    static pthread_t       thread;
+    static bool            is_started;
+    static bool            is_exit;
+    static bool            is_requested;
+    static time_t          interval;       // 0 means disabled
+
+  private:
+    static void* Worker(void* arg);
+    static size_t GetRss(void);
+
+  public:
+    static time_t SetInterval(time_t sec);
+    static bool Start(void);
+    static bool Destroy(void);
+    static void Request(void);
+};
+
+//-------------------------------------------------------------------
+// class S3fsLog
+//-------------------------------------------------------------------
+// Writes the log messages to syslog in background thread, so that the
+// threads which log(ex. FUSE threads) do not wait for syslog. A message
+// is formatted by the caller into the ring buffer, and it is dropped
+// when the buffer is full(the count of dropped messages is logged later).
+// The messages of LOG_CRIT and the messages longer than S3FS_LOG_MSG_SIZE
+// are written to syslog directly by the caller, after it waits for the
+// messages queued before them. All messages before Start and after
+// Destroy are written directly too. Start must be called after
+// daemonizing, because the thread does not survive fork.
+//
+#define S3FS_LOG_RING_SIZE      2048
+#define S3FS_LOG_MSG_SIZE       1024
+
+class S3fsLog
+{
+  private:
+    struct log_message{
+      int  priority;
+      char text[S3FS_LOG_MSG_SIZE];
+    };
+
+    static pthread_mutex_t    log_lock;
+    static pthread_cond_t     log_cond;
+    static pthread_cond_t     written_cond;
+    static pthread_t          thread;
+    static log_message*       ring;
+    static size_t             ring_head;      // position of the oldest message
+    static size_t             ring_count;
+    static size_t             dropped;
+    static unsigned long long queued_count;   // messages put into the ring
+    static unsigned long long written_count;  // messages written by the thread
+    static bool               is_async;
+    static bool               is_started;
+    static bool               is_exit;
+
+  private:
+    static void* Worker(void* arg);
+
+  public:
+    static bool SetAsync(bool async);
+    static bool Start(void);
+    static bool Destroy(void);
+    static void Write(int priority, const char* format, va_list args);
+};
+
 //-------------------------------------------------------------------
 // Functions
 //-------------------------------------------------------------------
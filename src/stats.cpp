@@ -0,0 +1,425 @@
+/*
+ * s3fs - FUSE-based file system backed by Tencentyun COS
+ *
+ * Copyright 2007-2008 Randy Rizun <rrizun@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string>
+#include <map>
+#include <list>
+#include <vector>
+
+#include "common.h"
+#include "stats.h"
+#include "s3fs_util.h"
+#include "string_util.h"
+
+using namespace std;
+
+//-------------------------------------------------------------------
+// Symbols
+//-------------------------------------------------------------------
+#define STATS_POLL_MSEC         1000
+#define STATS_READ_MSEC         100
+#define STATS_LISTEN_BACKLOG    8
+
+// upper bounds of buckets(usec), and their "le" labels(sec)
+static const long long stats_bucket_usec[STATS_BUCKETS] = {
+  100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+  100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+static const char* stats_bucket_label[STATS_BUCKETS] = {
+  "0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005", "0.01", "0.025", "0.05",
+  "0.1", "0.25", "0.5", "1", "2.5", "5", "10"
+};
+
+//-------------------------------------------------------------------
+// Common statistics
+//-------------------------------------------------------------------
+OpStats stats_lock_wait("cosfs_lock_wait", "Waiting time for contended locks.", "mutex");
+
+//-------------------------------------------------------------------
+// Class OpStats
+//-------------------------------------------------------------------
+// [NOTE]
+// The head is zero-initialized before any constructor is called, so
+// the static objects in other files can be registered at any order.
+//
+OpStats* OpStats::head = NULL;
+
+OpStats::OpStats(const char* family, const char* help, const char* op) :
+  next(NULL), family(family), help(help), op(op), count(0), sum_usec(0), errors(0), bytes(0), retries(0)
+{
+  memset(buckets, 0, sizeof(buckets));
+
+  // keep the order of declaration for the output
+  OpStats** ppstats;
+  for(ppstats = &OpStats::head; *ppstats; ppstats = &((*ppstats)->next));
+  *ppstats = this;
+}
+
+void OpStats::Add(long long usec, bool is_error, off_t size)
+{
+  if(!S3fsStats::IsEnabled()){
+    return;
+  }
+  int pos;
+  for(pos = 0; pos < STATS_BUCKETS && stats_bucket_usec[pos] < usec; pos++);
+
+  __sync_fetch_and_add(&buckets[pos], 1ULL);
+  __sync_fetch_and_add(&count, 1ULL);
+  __sync_fetch_and_add(&sum_usec, static_cast<unsigned long long>(0 < usec ? usec : 0));
+  if(is_error){
+    __sync_fetch_and_add(&errors, 1ULL);
+  }
+  if(0 < size){
+    __sync_fetch_and_add(&bytes, static_cast<unsigned long long>(size));
+  }
+}
+
+void OpStats::AddRetry(void)
+{
+  if(S3fsStats::IsEnabled()){
+    __sync_fetch_and_add(&retries, 1ULL);
+  }
+}
+
+//-------------------------------------------------------------------
+// Class StatsCounter
+//-------------------------------------------------------------------
+StatsCounter* StatsCounter::head = NULL;
+
+StatsCounter::StatsCounter(const char* name, const char* help) : next(NULL), name(name), help(help), value(0)
+{
+  StatsCounter** ppcounter;
+  for(ppcounter = &StatsCounter::head; *ppcounter; ppcounter = &((*ppcounter)->next));
+  *ppcounter = this;
+}
+
+void StatsCounter::Add(unsigned long long count)
+{
+  if(S3fsStats::IsEnabled()){
+    __sync_fetch_and_add(&value, count);
+  }
+}
+
+//-------------------------------------------------------------------
+// Class StatsTimer
+//-------------------------------------------------------------------
+StatsTimer::StatsTimer(OpStats& opstats) : stats(opstats), start(0), is_error(false), size(0)
+{
+  if(S3fsStats::IsEnabled()){
+    start = S3fsStats::GetUsec();
+  }
+}
+
+StatsTimer::~StatsTimer()
+{
+  if(S3fsStats::IsEnabled() && 0 != start){
+    stats.Add(S3fsStats::GetUsec() - start, is_error, size);
+  }
+}
+
+// result is the return value of FUSE operation, which is -errno for error.
+void StatsTimer::SetResult(int result)
+{
+  is_error = (0 > result);
+  if(0 < result){
+    size = result;
+  }
+}
+
+//-------------------------------------------------------------------
+// Class S3fsStats
+//-------------------------------------------------------------------
+bool            S3fsStats::is_enabled  = false;
+std::string     S3fsStats::socket_path;
+pthread_mutex_t S3fsStats::stats_lock  = PTHREAD_MUTEX_INITIALIZER;
+pthread_t       S3fsStats::thread;
+int             S3fsStats::listen_fd   = -1;
+bool            S3fsStats::is_started  = false;
+bool            S3fsStats::is_exit     = false;
+
+long long S3fsStats::GetUsec(void)
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return static_cast<long long>(now.tv_sec) * 1000000 + now.tv_usec;
+}
+
+// [NOTE]
+// The socket is made in s3fs_init after the process changes the current
+// directory to "/" by fuse_main, so a relative path is resolved here.
+//
+bool S3fsStats::SetSocketPath(const char* path)
+{
+  struct sockaddr_un addr;
+  if(!path || '\0' == path[0]){
+    return false;
+  }
+  std::string strpath = path;
+  if('/' != path[0]){
+    char cwd[sizeof(addr.sun_path)];
+    if(!getcwd(cwd, sizeof(cwd))){
+      return false;
+    }
+    strpath = std::string(cwd) + "/" + strpath;
+  }
+  if(sizeof(addr.sun_path) <= strpath.length()){
+    return false;
+  }
+  S3fsStats::socket_path = strpath;
+  S3fsStats::is_enabled  = true;
+  return true;
+}
+
+// Returns true when the socket at the path is accepted by other process.
+static bool is_socket_alive(const struct sockaddr_un& addr)
+{
+  int fd;
+  if(-1 == (fd = socket(AF_UNIX, SOCK_STREAM, 0))){
+    return false;
+  }
+  bool result = (0 == connect(fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr)));
+  close(fd);
+  return result;
+}
+
+bool S3fsStats::Start(void)
+{
+  AutoLock auto_lock(&S3fsStats::stats_lock);
+
+  if(S3fsStats::is_started || S3fsStats::socket_path.empty()){
+    return true;
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, S3fsStats::socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+  int fd;
+  if(-1 == (fd = socket(AF_UNIX, SOCK_STREAM, 0))){
+    S3FS_PRN_ERR("failed to create stats socket - errno(%d)", errno);
+    return false;
+  }
+  // remove the socket which is left by the last mount, but do not take
+  // the socket of other mount which is still running.
+  struct stat st;
+  if(0 == lstat(S3fsStats::socket_path.c_str(), &st) && S_ISSOCK(st.st_mode)){
+    if(is_socket_alive(addr)){
+      S3FS_PRN_ERR("stats socket(%s) is used by other process.", S3fsStats::socket_path.c_str());
+      close(fd);
+      return false;
+    }
+    unlink(S3fsStats::socket_path.c_str());
+  }
+  if(-1 == bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) ||
+     -1 == chmod(S3fsStats::socket_path.c_str(), S_IRUSR | S_IWUSR) ||
+     -1 == listen(fd, STATS_LISTEN_BACKLOG))
+  {
+    S3FS_PRN_ERR("failed to listen stats socket(%s) - errno(%d)", S3fsStats::socket_path.c_str(), errno);
+    close(fd);
+    return false;
+  }
+  S3fsStats::listen_fd = fd;
+  S3fsStats::is_exit   = false;
+
+  int rc;
+  if(0 != (rc = pthread_create(&S3fsStats::thread, NULL, S3fsStats::Worker, NULL))){
+    S3FS_PRN_ERR("failed pthread_create - rc(%d)", rc);
+    close(S3fsStats::listen_fd);
+    S3fsStats::listen_fd = -1;
+    unlink(S3fsStats::socket_path.c_str());
+    return false;
+  }
+  S3fsStats::is_started = true;
+  return true;
+}
+
+bool S3fsStats::Destroy(void)
+{
+  {
+    AutoLock auto_lock(&S3fsStats::stats_lock);
+    if(!S3fsStats::is_started){
+      return true;
+    }
+    S3fsStats::is_exit = true;
+  }
+  int rc;
+  if(0 != (rc = pthread_join(S3fsStats::thread, NULL))){
+    S3FS_PRN_ERR("failed pthread_join - rc(%d)", rc);
+    return false;
+  }
+  close(S3fsStats::listen_fd);
+  S3fsStats::listen_fd = -1;
+  unlink(S3fsStats::socket_path.c_str());
+  S3fsStats::is_started = false;
+  return true;
+}
+
+// [NOTE]
+// The exit flag is checked every STATS_POLL_MSEC, so that the listening
+// socket can be closed by Destroy after this thread is joined.
+//
+void* S3fsStats::Worker(void* arg)
+{
+  while(true){
+    {
+      AutoLock auto_lock(&S3fsStats::stats_lock);
+      if(S3fsStats::is_exit){
+        break;
+      }
+    }
+    struct pollfd pfd;
+    pfd.fd      = S3fsStats::listen_fd;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
+    if(0 >= poll(&pfd, 1, STATS_POLL_MSEC)){
+      continue;
+    }
+    int fd;
+    if(-1 == (fd = accept(S3fsStats::listen_fd, NULL, NULL))){
+      continue;
+    }
+    S3fsStats::Response(fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+// [NOTE]
+// The client may send nothing(ex. "socat - UNIX-CONNECT:<path>"), then
+// only the text is sent. For HTTP request(ex. "curl --unix-socket"), the
+// response header is added.
+//
+void S3fsStats::Response(int fd)
+{
+  char          request[4];
+  ssize_t       length = 0;
+  struct pollfd pfd;
+  pfd.fd      = fd;
+  pfd.events  = POLLIN;
+  pfd.revents = 0;
+  if(0 < poll(&pfd, 1, STATS_READ_MSEC)){
+    length = recv(fd, request, sizeof(request), 0);
+  }
+
+  string body = S3fsStats::Dump();
+  string response;
+  if(static_cast<ssize_t>(sizeof(request)) == length && 0 == memcmp(request, "GET ", sizeof(request))){
+    response  = "HTTP/1.0 200 OK\r\n";
+    response += "Content-Type: text/plain; version=0.0.4\r\n";
+    response += "Content-Length: " + str(body.size()) + "\r\n";
+    response += "Connection: close\r\n\r\n";
+  }
+  response += body;
+
+  for(size_t sent = 0; sent < response.size(); ){
+    ssize_t bytes = send(fd, response.c_str() + sent, response.size() - sent, MSG_NOSIGNAL);
+    if(0 >= bytes){
+      if(-1 == bytes && EINTR == errno){
+        continue;
+      }
+      S3FS_PRN_WARN("failed to send stats - errno(%d)", errno);
+      break;
+    }
+    sent += bytes;
+  }
+}
+
+// Returns all statistics in Prometheus text format.
+std::string S3fsStats::Dump(void)
+{
+  string result;
+  char   buff[256];
+
+  // families in the order of registration
+  vector<const OpStats*> families;
+  for(const OpStats* pstats = OpStats::head; pstats; pstats = pstats->next){
+    vector<const OpStats*>::const_iterator iter;
+    for(iter = families.begin(); iter != families.end() && 0 != strcmp((*iter)->family, pstats->family); ++iter);
+    if(iter == families.end()){
+      families.push_back(pstats);
+    }
+  }
+
+  for(vector<const OpStats*>::const_iterator iter = families.begin(); iter != families.end(); ++iter){
+    const char* family = (*iter)->family;
+
+    snprintf(buff, sizeof(buff), "# HELP %s_seconds %s\n# TYPE %s_seconds histogram\n", family, (*iter)->help, family);
+    result += buff;
+    for(const OpStats* pstats = *iter; pstats; pstats = pstats->next){
+      if(0 != strcmp(family, pstats->family)){
+        continue;
+      }
+      unsigned long long cumulative = 0;
+      for(int pos = 0; pos <= STATS_BUCKETS; pos++){
+        cumulative += pstats->buckets[pos];
+        snprintf(buff, sizeof(buff), "%s_seconds_bucket{op=\"%s\",le=\"%s\"} %llu\n",
+                 family, pstats->op, (pos < STATS_BUCKETS ? stats_bucket_label[pos] : "+Inf"), cumulative);
+        result += buff;
+      }
+      snprintf(buff, sizeof(buff), "%s_seconds_sum{op=\"%s\"} %.6f\n%s_seconds_count{op=\"%s\"} %llu\n",
+               family, pstats->op, static_cast<double>(pstats->sum_usec) / 1000000, family, pstats->op, pstats->count);
+      result += buff;
+    }
+
+    const char* names[] = {"errors", "bytes", "retries"};
+    const char* helps[] = {"Failed operations.", "Transferred bytes.", "Retried operations."};
+    for(int cnt = 0; cnt < 3; cnt++){
+      snprintf(buff, sizeof(buff), "# HELP %s_%s_total %s\n# TYPE %s_%s_total counter\n", family, names[cnt], helps[cnt], family, names[cnt]);
+      result += buff;
+      for(const OpStats* pstats = *iter; pstats; pstats = pstats->next){
+        if(0 != strcmp(family, pstats->family)){
+          continue;
+        }
+        unsigned long long value = (0 == cnt ? pstats->errors : 1 == cnt ? pstats->bytes : pstats->retries);
+        snprintf(buff, sizeof(buff), "%s_%s_total{op=\"%s\"} %llu\n", family, names[cnt], pstats->op, value);
+        result += buff;
+      }
+    }
+  }
+
+  for(const StatsCounter* pcounter = StatsCounter::head; pcounter; pcounter = pcounter->next){
+    snprintf(buff, sizeof(buff), "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+             pcounter->name, pcounter->help, pcounter->name, pcounter->name, pcounter->value);
+    result += buff;
+  }
+  return result;
+}
+
+/*
+* Local variables:
+* tab-width: 4
+* c-basic-offset: 4
+* End:
+* vim600: noet sw=4 ts=4 fdm=marker
+* vim<600: noet sw=4 ts=4
+*/
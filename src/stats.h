@@ -0,0 +1,155 @@
+/*
+ * s3fs - FUSE-based file system backed by Tencentyun COS
+ *
+ * Copyright 2007-2008 Randy Rizun <rrizun@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef S3FS_STATS_H_
+#define S3FS_STATS_H_
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <string>
+
+//-------------------------------------------------------------------
+// Statistics
+//-------------------------------------------------------------------
+// The counters and latency histograms are static objects, which are
+// registered in the list at start up and are updated by atomic adds
+// without any lock. S3fsStats exports them in Prometheus text format
+// through the unix socket of stats_socket option, and nothing is
+// counted while the option is not specified.
+//
+#define STATS_BUCKETS           16    // count of buckets except +Inf
+
+//
+// Latency histogram and counters of one operation.
+// family is the metric name, and op is its "op" label.
+//
+class OpStats
+{
+  friend class S3fsStats;
+
+  private:
+    static OpStats* head;
+
+    OpStats*             next;
+    const char*          family;
+    const char*          help;
+    const char*          op;
+    unsigned long long   buckets[STATS_BUCKETS + 1];
+    unsigned long long   count;
+    unsigned long long   sum_usec;
+    unsigned long long   errors;
+    unsigned long long   bytes;
+    unsigned long long   retries;
+
+  private:
+    OpStats(const OpStats&);
+
+  public:
+    OpStats(const char* family, const char* help, const char* op);
+
+    void Add(long long usec, bool is_error = false, off_t size = 0);
+    void AddRetry(void);
+};
+
+//
+// Counter which does not belong to any operation.
+//
+class StatsCounter
+{
+  friend class S3fsStats;
+
+  private:
+    static StatsCounter* head;
+
+    StatsCounter*        next;
+    const char*          name;
+    const char*          help;
+    unsigned long long   value;
+
+  private:
+    StatsCounter(const StatsCounter&);
+
+  public:
+    StatsCounter(const char* name, const char* help);
+
+    void Add(unsigned long long count = 1);
+};
+
+//
+// Measures the time of the scope, and adds it to OpStats.
+//
+class StatsTimer
+{
+  private:
+    OpStats&    stats;
+    long long   start;
+    bool        is_error;
+    off_t       size;
+
+  private:
+    StatsTimer(const StatsTimer&);
+
+  public:
+    explicit StatsTimer(OpStats& opstats);
+    ~StatsTimer();
+
+    void SetResult(int result);
+    void SetSize(off_t bytes) { size = bytes; }
+};
+
+class S3fsStats
+{
+  private:
+    static bool            is_enabled;
+    static std::string     socket_path;
+    static pthread_mutex_t stats_lock;
+    static pthread_t       thread;
+    static int             listen_fd;
+    static bool            is_started;
+    static bool            is_exit;
+
+  private:
+    static void* Worker(void* arg);
+    static void Response(int fd);
+
+  public:
+    static bool IsEnabled(void) { return S3fsStats::is_enabled; }
+    static long long GetUsec(void);
+    static bool SetSocketPath(const char* path);
+    static void Enable(void) { S3fsStats::is_enabled = true; }
+    static bool Start(void);
+    static bool Destroy(void);
+    static std::string Dump(void);
+};
+
+//
+// Waiting time for the contended lock in AutoLock
+//
+extern OpStats stats_lock_wait;
+
+#endif // S3FS_STATS_H_
+
+/*
+* Local variables:
+* tab-width: 4
+* c-basic-offset: 4
+* End:
+* vim600: noet sw=4 ts=4 fdm=marker
+* vim<600: noet sw=4 ts=4
+*/
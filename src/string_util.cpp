@@ -322,10 +322,10 @@ string get_date_iso8601(time_t tm)
 std::string s3fs_hex(const unsigned char* input, size_t length)
 {
   std::string hex;
+  hex.reserve(length * 2);
   for(size_t pos = 0; pos < length; ++pos){
-    char hexbuf[3];
-    snprintf(hexbuf, 3, "%02x", input[pos]);
-    hex += hexbuf;
+    hex += "0123456789abcdef"[input[pos] >> 4];
+    hex += "0123456789abcdef"[input[pos] & 0x0F];
   }
   return hex;
 }
@@ -1,9 +1,19 @@
 extern void test_get_retry();
 extern void test_put_retry();
+extern void test_readdir_page_boundary();
+extern void test_readdir_one_object();
+extern void test_curl_pool_exhausted();
+extern void test_curl_http2();
+extern void test_curl_multi_hedge();
 
-int TestMain()
+int TestMain(int argc, char* argv[])
 {
   test_get_retry();
   test_put_retry();
+  test_readdir_page_boundary();
+  test_readdir_one_object();
+  test_curl_pool_exhausted();
+  test_curl_http2();
+  test_curl_multi_hedge();
   return 0;
 }
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <curl/curl.h>
+#include <string>
+#include <map>
+#include <list>
+#include <vector>
+#include <set>
+
+#include "common.h"
+#include "curl.h"
+#include "s3fs.h"
+#include "s3fs_util.h"
+#include "test_util.h"
+
+extern void init();
+
+static long elapsed_msec(const struct timeval& start)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start.tv_sec) * 1000 + (now.tv_usec - start.tv_usec) / 1000;
+}
+
+//
+// When all handles in the pool are used, CreateCurlHandle makes an
+// overflow handle without waiting. The overflow handle is destroyed
+// when it is returned, and the pooled handles are kept in the pool.
+//
+void test_curl_pool_exhausted()
+{
+    init();
+
+    int poolsize = S3fsCurl::SetMaxCurlHandles(0);
+    S3fsCurl::SetMaxCurlHandles(poolsize);
+
+    std::vector<S3fsCurl*> curls;
+    std::set<CURL*>        pooled;
+    for(int cnt = 0; cnt < poolsize; cnt++){
+        S3fsCurl* curl = new S3fsCurl();
+        ASSERT_EQUALS(curl->CreateCurlHandle(), true);
+        curls.push_back(curl);
+        pooled.insert(curl->GetCurlHandle());
+    }
+    ASSERT_EQUALS(pooled.size(), static_cast<size_t>(poolsize));
+
+    struct timeval start;
+    gettimeofday(&start, NULL);
+    S3fsCurl overflow;
+    ASSERT_EQUALS(overflow.CreateCurlHandle(), true);
+    ASSERT_EQUALS(elapsed_msec(start) < 100, true);
+    ASSERT_EQUALS(pooled.count(overflow.GetCurlHandle()), static_cast<size_t>(0));
+
+    // return the pooled handles before and after the overflow handle
+    curls[0]->DestroyCurlHandle();
+    overflow.DestroyCurlHandle();
+    for(std::vector<S3fsCurl*>::iterator iter = curls.begin() + 1; iter != curls.end(); ++iter){
+        (*iter)->DestroyCurlHandle();
+    }
+
+    // all pooled handles are kept
+    std::set<CURL*> reused;
+    for(std::vector<S3fsCurl*>::iterator iter = curls.begin(); iter != curls.end(); ++iter){
+        ASSERT_EQUALS((*iter)->CreateCurlHandle(), true);
+        reused.insert((*iter)->GetCurlHandle());
+    }
+    ASSERT_EQUALS(reused == pooled, true);
+
+    for(std::vector<S3fsCurl*>::iterator iter = curls.begin(); iter != curls.end(); ++iter){
+        delete *iter;
+    }
+}
+
+//
+// With COSFS_TEST_HTTP2, requests are sent by HTTP/2 with prior knowledge.
+//
+void test_curl_http2()
+{
+    init();
+    if(!getenv("COSFS_TEST_HTTP2")){
+        return;
+    }
+
+    headers_t meta;
+    {
+        S3fsCurl curl;
+        ASSERT_EQUALS(curl.PutRequest("/http2", meta, -1), 0);
+    }
+    S3fsCurl curl;
+    ASSERT_EQUALS(curl.HeadRequest("/http2", meta), 0);
+
+    long version = CURL_HTTP_VERSION_NONE;
+    ASSERT_EQUALS(curl_easy_getinfo(curl.GetCurlHandle(), CURLINFO_HTTP_VERSION, &version), CURLE_OK);
+    ASSERT_EQUALS(version, static_cast<long>(CURL_HTTP_VERSION_2_0));
+}
+
+static int hedge_head_count = 0;
+
+static bool hedge_head_callback(S3fsCurl* s3fscurl)
+{
+    hedge_head_count++;
+    return true;
+}
+
+//
+// The hedge which is answered first gives its handle to the request,
+// and S3fsMultiCurl must still find the request when it is done.
+// Hedging is enabled at the median latency in this test only. Run
+// mock_cos_server.py with "--stall-rate 0.1 --stall-prefix hedge/", then
+// hedges are sent for the stalled HEAD requests after the first 100
+// requests are measured. The test is killed by SIGALRM if it hangs.
+//
+void test_curl_multi_hedge()
+{
+    init();
+
+    const int count  = 50;
+    const int rounds = 4;
+    char      path[64];
+    for(int cnt = 0; cnt < count; cnt++){
+        S3fsCurl  curl;
+        headers_t meta;
+        snprintf(path, sizeof(path), "/hedge/%d", cnt);
+        ASSERT_EQUALS(curl.PutRequest(path, meta, -1), 0);
+    }
+
+    ASSERT_EQUALS(S3fsCurl::SetHedgePercentile(50), true);
+    alarm(60);
+    for(int round = 0; round < rounds; round++){
+        S3fsMultiCurl curlmulti;
+        curlmulti.SetSuccessCallback(hedge_head_callback);
+        for(int cnt = 0; cnt < count; cnt++){
+            S3fsCurl* s3fscurl = new S3fsCurl();
+            snprintf(path, sizeof(path), "/hedge/%d", cnt);
+            ASSERT_EQUALS(s3fscurl->PreHeadRequest(path), true);
+            ASSERT_EQUALS(curlmulti.SetS3fsCurlObject(s3fscurl), true);
+        }
+        ASSERT_EQUALS(curlmulti.Request(), 0);
+    }
+    alarm(0);
+    S3fsCurl::SetHedgePercentile(0);
+    ASSERT_EQUALS(hedge_head_count, count * rounds);
+}
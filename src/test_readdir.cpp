@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <curl/curl.h>
+#include <string>
+#include <map>
+#include <list>
+#include <vector>
+
+#include "common.h"
+#include "curl.h"
+#include "s3fs.h"
+#include "s3fs_util.h"
+#include "test_util.h"
+
+extern void init();
+extern int test_readdir_pages(const char* path, void* buf, fuse_fill_dir_t filler);
+
+typedef std::map<std::string, int> fill_count_t;
+
+static int count_filler(void* buf, const char* name, const struct stat* stbuf, off_t off)
+{
+    fill_count_t* counts = reinterpret_cast<fill_count_t*>(buf);
+    (*counts)[name]++;
+    return 0;
+}
+
+//
+// "dir", "dir/" and "dir_$folder$" are one directory, even if they are
+// listed in different pages. Run mock_cos_server.py with "--max-keys 2",
+// then the following objects are listed in 3 pages:
+//   "dir" "dir.a" | "dir.b" "dir/" | "dir_$folder$" "file"
+//
+void test_readdir_page_boundary()
+{
+    init();
+
+    const char* paths[] = {"/readdir/dir", "/readdir/dir.a", "/readdir/dir.b", "/readdir/dir/file", "/readdir/dir_$folder$", "/readdir/file", NULL};
+    for(int cnt = 0; paths[cnt]; cnt++){
+        S3fsCurl  curl;
+        headers_t meta;
+        ASSERT_EQUALS(curl.PutRequest(paths[cnt], meta, -1), 0);
+    }
+
+    fill_count_t counts;
+    ASSERT_EQUALS(test_readdir_pages("/readdir", &counts, count_filler), 0);
+    ASSERT_EQUALS(counts.size(), static_cast<size_t>(4));
+    ASSERT_EQUALS(counts["dir"], 1);
+    ASSERT_EQUALS(counts["dir.a"], 1);
+    ASSERT_EQUALS(counts["dir.b"], 1);
+    ASSERT_EQUALS(counts["file"], 1);
+}
+
+//
+// The only object of a directory is held back for the next page, and
+// is filled after the last page.
+//
+void test_readdir_one_object()
+{
+    init();
+
+    {
+        S3fsCurl  curl;
+        headers_t meta;
+        ASSERT_EQUALS(curl.PutRequest("/readdir_one/file", meta, -1), 0);
+    }
+
+    fill_count_t counts;
+    ASSERT_EQUALS(test_readdir_pages("/readdir_one", &counts, count_filler), 0);
+    ASSERT_EQUALS(counts.size(), static_cast<size_t>(1));
+    ASSERT_EQUALS(counts["file"], 1);
+}
@@ -26,11 +26,43 @@ extern std::string appid;
 
 void init()
 {
+    static bool is_init = false;
+    if(is_init){
+        return;
+    }
+    is_init = true;
+
+    // COSFS_TEST_HTTP2 is for HTTP/2 of mock_cos_server.py, which is
+    // "prior_knowledge" for h2c(--h2c-port), or "tls" for h2(--h2-port
+    // with --path-style, and its certificate is only for "localhost").
+    const char* http2 = getenv("COSFS_TEST_HTTP2");
+    if(http2){
+        bool prior_knowledge = (0 == strcmp(http2, "prior_knowledge"));
+        if(!S3fsCurl::SetHttp2(prior_knowledge)){
+            exit(EXIT_FAILURE);
+        }
+        if(!prior_knowledge){
+            S3fsCurl::SetCheckCertificate(false);
+            pathrequeststyle = true;
+        }
+    }
+    // The multiplexer for hedged requests is made only when hedging is
+    // enabled at initializing, so it is disabled after that, and only
+    // test_curl_multi_hedge enables it.
+    S3fsCurl::SetHedgePercentile(50);
     if(!S3fsCurl::InitS3fsCurl("/etc/mime.types")){
         exit(EXIT_FAILURE);
     }
+    S3fsCurl::SetHedgePercentile(0);
     S3fsCurl::SetReadwriteTimeout(1);
-    host = "http://cos.ap-chengdu.myqcloud.com";
+    // COSFS_TEST_URL is set by test/mock-test.sh for mock_cos_server.py,
+    // or is "http://cos.ap-chengdu.myqcloud.com" for the live bucket.
+    const char* url = getenv("COSFS_TEST_URL");
+    if(!url){
+        fprintf(stderr, "COSFS_TEST_URL is not set, run the test by test/mock-test.sh or \"make check\".\n");
+        exit(EXIT_FAILURE);
+    }
+    host = url;
     bucket = "cos-sdk-err-retry";
     appid  = "1253960454";
     S3fsCurl::SetPublicBucket(true);
@@ -43,7 +43,7 @@ template <typename T> void assert_not_equals(const T &x, const T &y, const char
   }
 }
 
-void assert_strequals(const char *x, const char *y, const char *file, int line)
+inline void assert_strequals(const char *x, const char *y, const char *file, int line)
 {
   if(x == NULL && y == NULL){
     return;
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+# -*- coding: UTF-8 -*-
+#
+# Benchmark of the FUSE operations on a mounted cosfs, which is usually
+# mounted on test/mock_cos_server.py by mock-bench.sh.
+#
+# Usage: bench_fuse.py <mount point> [--dir bench] [--threads 4] [--count 1000]
+#                      [--size 65536] [--objects 100] [operation...]
+#
+# operation is getattr, readdir, read or write(all of them by default).
+#
+
+import argparse
+import os
+import sys
+import threading
+import time
+
+READ_SIZE = 128 * 1024
+
+
+class Result(object):
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.latencies = []
+        self.bytes = 0
+        self.errors = 0
+
+    def add(self, msec, size, is_ok):
+        with self.lock:
+            self.latencies.append(msec)
+            if is_ok:
+                self.bytes += size
+            else:
+                self.errors += 1
+
+    def percentile(self, percent):
+        if not self.latencies:
+            return 0
+        index = (len(self.latencies) * percent + 99) // 100
+        return self.latencies[max(index - 1, 0)]
+
+    def report(self, name, elapsed):
+        self.latencies.sort()
+        count = len(self.latencies)
+        print("%-8s n=%-6d err=%-4d %10.1f ops/s %9.2f MB/s  p50=%.2fms p90=%.2fms p99=%.2fms max=%.2fms"
+              % (name, count, self.errors, count / elapsed if elapsed else 0,
+                 self.bytes / elapsed / (1024 * 1024) if elapsed else 0,
+                 self.percentile(50), self.percentile(90), self.percentile(99),
+                 self.latencies[-1] if count else 0))
+
+
+def op_getattr(args, index):
+    os.stat(os.path.join(args.path, str(index % args.objects)))
+    return 0
+
+
+def op_readdir(args, index):
+    os.listdir(args.path)
+    return 0
+
+
+def op_read(args, index):
+    size = 0
+    with open(os.path.join(args.path, str(index % args.objects)), "rb") as f:
+        while True:
+            data = f.read(READ_SIZE)
+            if not data:
+                break
+            size += len(data)
+    return size
+
+
+def op_write(args, index):
+    with open(os.path.join(args.path, "write-%d" % index), "wb") as f:
+        f.write(args.data)
+    return len(args.data)
+
+
+def run(name, func, args):
+    result = Result()
+
+    def worker(start):
+        for index in range(start, args.count, args.threads):
+            begin = time.time()
+            try:
+                size = func(args, index)
+                is_ok = True
+            except (IOError, OSError):
+                size = 0
+                is_ok = False
+            result.add((time.time() - begin) * 1000, size, is_ok)
+
+    threads = [threading.Thread(target=worker, args=(i,)) for i in range(args.threads)]
+    begin = time.time()
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    result.report(name, time.time() - begin)
+
+
+def main():
+    ops = {"getattr": op_getattr, "readdir": op_readdir, "read": op_read, "write": op_write}
+    parser = argparse.ArgumentParser(description="benchmark of FUSE operations on cosfs")
+    parser.add_argument("mountpoint")
+    parser.add_argument("--dir", default="bench", help="directory of populated objects")
+    parser.add_argument("--threads", type=int, default=4)
+    parser.add_argument("--count", type=int, default=1000)
+    parser.add_argument("--size", type=int, default=65536, help="size of written files")
+    parser.add_argument("--objects", type=int, default=100, help="count of populated objects")
+    parser.add_argument("operations", nargs="*", default=["getattr", "readdir", "read", "write"])
+    args = parser.parse_args()
+    args.path = os.path.join(args.mountpoint, args.dir)
+    args.data = os.urandom(args.size)
+
+    print("path=%s threads=%d count=%d size=%d objects=%d"
+          % (args.path, args.threads, args.count, args.size, args.objects))
+    for name in args.operations:
+        if name not in ops:
+            sys.stderr.write("unknown operation: %s\n" % name)
+            continue
+        run(name, ops[name], args)
+
+
+if __name__ == "__main__":
+    main()
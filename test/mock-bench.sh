@@ -0,0 +1,107 @@
+#!/bin/bash
+
+#
+# Offline benchmark of cosfs on the local mock COS server(mock_cos_server.py).
+# It runs ../src/bench_cosfs(make -C ../src bench_cosfs) for the requests and
+# the file cache, then mounts ../src/cosfs and runs bench_fuse.py for the
+# FUSE operations. Mounting needs fuse, and is skipped without /dev/fuse.
+#
+# The following variables change the mock server and the workload:
+#
+# MOCK_PORT=8080          port of the mock server
+# MOCK_OPTS=""            options of mock_cos_server.py(e.g. "--latency 20 --stall-rate 0.01")
+# BENCH_THREADS=4         threads of workload
+# BENCH_COUNT=1000        operations of each workload
+# BENCH_SIZE=65536        size of objects
+# BENCH_OBJECTS=100       count of objects
+# COSFS_OPTS=""           additional mount options(e.g. "-o hedge_percentile=95")
+# HTTP2=""                "tls" runs all over h2(HTTP/2 over TLS) with http2,
+#                         "prior_knowledge" runs all over h2c(HTTP/2 over
+#                         cleartext) with http2=prior_knowledge. Both need
+#                         nghttpx of nghttp2 in front of the mock server(port
+#                         is MOCK_PORT + 1)
+#
+# "-o http2" in COSFS_OPTS does not use HTTP/2 with the mock server over http,
+# because libcurl negotiates HTTP/2 only by TLS ALPN, so use HTTP2 for it.
+# libcurl 7.88 fails the requests on a reused h2c connection, so use "tls"
+# with it.
+#
+# Example:
+#
+# HTTP2=tls MOCK_OPTS="--latency 5 --latency-jitter 5" ./mock-bench.sh
+#
+
+set -o errexit
+
+: ${MOCK_PORT:=8080}
+: ${MOCK_OPTS:=""}
+: ${BENCH_THREADS:=4}
+: ${BENCH_COUNT:=1000}
+: ${BENCH_SIZE:=65536}
+: ${BENCH_OBJECTS:=100}
+: ${COSFS_OPTS:=""}
+: ${HTTP2:=""}
+
+COSFS=../src/cosfs
+BENCH_COSFS=../src/bench_cosfs
+MOCK_URL="http://localhost:${MOCK_PORT}"
+BENCH_OPTS=""
+if [ "${HTTP2}" = "tls" ]; then
+    # the certificate of the mock server is only for "localhost"
+    MOCK_OPTS="${MOCK_OPTS} --h2-port $((MOCK_PORT + 1)) --path-style"
+    MOCK_URL="https://localhost:$((MOCK_PORT + 1))"
+    BENCH_OPTS="-2 -k -P"
+    COSFS_OPTS="${COSFS_OPTS} -o http2 -o no_check_certificate -o use_path_request_style"
+elif [ "${HTTP2}" = "prior_knowledge" ]; then
+    MOCK_OPTS="${MOCK_OPTS} --h2c-port $((MOCK_PORT + 1))"
+    MOCK_URL="http://localhost:$((MOCK_PORT + 1))"
+    BENCH_OPTS="-2"
+    COSFS_OPTS="${COSFS_OPTS} -o http2=prior_knowledge"
+elif [ -n "${HTTP2}" ]; then
+    echo "HTTP2 must be tls or prior_knowledge." 1>&2
+    exit 1
+fi
+MOUNT_POINT=$(mktemp -d /tmp/cosfs-bench.XXXXXX)
+
+function exit_handler {
+    if grep -q "$MOUNT_POINT" /proc/mounts; then
+        fusermount -u "$MOUNT_POINT" || true
+    fi
+    rmdir "$MOUNT_POINT" || true
+    if [ -n "${MOCK_PID}" ]; then
+        kill $MOCK_PID
+    fi
+}
+trap exit_handler EXIT
+
+./mock_cos_server.py --port $MOCK_PORT --populate $BENCH_OBJECTS --object-size $BENCH_SIZE $MOCK_OPTS &
+MOCK_PID=$!
+
+# wait for the mock server to start
+MOCK_URL_PORT=${MOCK_URL##*:}
+for i in $(seq 30); do
+    if exec 3<>"/dev/tcp/127.0.0.1/${MOCK_URL_PORT}"; then
+        exec 3<&-
+        exec 3>&-
+        break
+    fi
+    sleep 1
+done
+
+echo "### requests and file cache"
+$BENCH_COSFS $BENCH_OPTS -u $MOCK_URL -t $BENCH_THREADS -n $BENCH_COUNT -s $BENCH_SIZE -o $BENCH_OBJECTS
+
+if [ ! -c /dev/fuse ]; then
+    echo "### FUSE operations are skipped, because /dev/fuse is not found."
+    exit 0
+fi
+
+echo "### FUSE operations"
+$COSFS bench-1250000000 "$MOUNT_POINT" -o url=$MOCK_URL -o public_bucket=1 $COSFS_OPTS
+for i in $(seq 30); do
+    if grep -q "$MOUNT_POINT" /proc/mounts; then
+        break
+    fi
+    sleep 1
+done
+./bench_fuse.py "$MOUNT_POINT" --threads $BENCH_THREADS --count $BENCH_COUNT --size $BENCH_SIZE --objects $BENCH_OBJECTS
@@ -0,0 +1,86 @@
+#!/bin/bash
+
+#
+# Runs a test program(e.g. ../src/test_cosfs) on the local mock COS server
+# (mock_cos_server.py), which is started on a free port and is passed to the
+# test by COSFS_TEST_URL. "make check" in src runs the tests by this script.
+#
+# The following variables change the server:
+#
+# COSFS_TEST_URL=""       when it is set, the test runs on that server and
+#                         the mock server is not started(e.g. the live bucket
+#                         "http://cos.ap-chengdu.myqcloud.com")
+# COSFS_TEST_HTTP2=""     "tls" runs the test over h2(HTTP/2 over TLS), which
+#                         needs nghttpx of nghttp2 in front of the mock server
+# MOCK_OPTS=""            additional options of mock_cos_server.py
+#
+# The mock server lists 2 keys in a page for test_readdir.cpp, and stalls
+# 10% of requests under "hedge/" for test_curl.cpp.
+#
+# Example:
+#
+# ./mock-test.sh ../src/test_cosfs
+#
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 <test program> [args...]" 1>&2
+    exit 1
+fi
+if [ -n "${COSFS_TEST_URL}" ]; then
+    exec "$@"
+fi
+
+: ${COSFS_TEST_HTTP2:=""}
+: ${MOCK_OPTS:=""}
+
+MOCK_SERVER="$(dirname "$0")/mock_cos_server.py"
+if ! command -v python3 >/dev/null 2>&1; then
+    echo "python3 is not found for mock_cos_server.py, skip $1." 1>&2
+    exit 77
+fi
+
+function free_port {
+    python3 -c 'import socket; s = socket.socket(); s.bind(("127.0.0.1", 0)); print(s.getsockname()[1])'
+}
+
+MOCK_PORT=$(free_port)
+MOCK_OPTS="--port ${MOCK_PORT} --max-keys 2 --stall-rate 0.1 --stall-prefix hedge/ ${MOCK_OPTS}"
+if [ "${COSFS_TEST_HTTP2}" = "tls" ]; then
+    # the certificate of the mock server is only for "localhost"
+    MOCK_URL_PORT=$(free_port)
+    MOCK_OPTS="${MOCK_OPTS} --h2-port ${MOCK_URL_PORT} --path-style"
+    COSFS_TEST_URL="https://localhost:${MOCK_URL_PORT}"
+elif [ -n "${COSFS_TEST_HTTP2}" ]; then
+    echo "COSFS_TEST_HTTP2 must be tls with the mock server." 1>&2
+    exit 1
+else
+    MOCK_URL_PORT=${MOCK_PORT}
+    COSFS_TEST_URL="http://localhost:${MOCK_PORT}"
+fi
+export COSFS_TEST_URL
+
+function exit_handler {
+    if [ -n "${MOCK_PID}" ]; then
+        kill $MOCK_PID
+        wait $MOCK_PID
+    fi
+}
+trap exit_handler EXIT
+
+python3 "$MOCK_SERVER" $MOCK_OPTS &
+MOCK_PID=$!
+
+# wait for the mock server to start
+for i in $(seq 30); do
+    if (exec 3<>"/dev/tcp/127.0.0.1/${MOCK_URL_PORT}") 2>/dev/null; then
+        break
+    fi
+    if ! kill -0 $MOCK_PID 2>/dev/null; then
+        echo "mock_cos_server.py could not start." 1>&2
+        MOCK_PID=""
+        exit 1
+    fi
+    sleep 1
+done
+
+"$@"
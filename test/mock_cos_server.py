@@ -0,0 +1,478 @@
+#!/usr/bin/env python3
+# -*- coding: UTF-8 -*-
+#
+# Local mock of COS for offline tests and benchmarks of cosfs.
+#
+# Objects are kept in memory. The bucket in the host name or the path is
+# ignored, so cosfs can be mounted with any bucket name, e.g.:
+#
+#   ./mock_cos_server.py --port 8080 --populate 1000 --object-size 65536 &
+#   cosfs bucket-1250000000 /mnt/cosfs -o url=http://localhost:8080 -o public_bucket=1
+#
+# The host name of requests is "<bucket>-<appid>.localhost", which libcurl
+# resolves to the loopback address.
+#
+# Fault objects, which are used by test_retry.cpp:
+#   /<code>r    returns the HTTP status code(e.g. /503r)
+#   /shutdown   closes the connection without response
+#   /timeout    does not answer for --timeout-sleep seconds
+#
+# HTTP/2: the server itself speaks HTTP/1.1 only. With --h2c-port or
+# --h2-port, nghttpx(from nghttp2) is started in front of it, and serves
+# h2c(HTTP/2 over cleartext TCP) or h2(HTTP/2 over TLS with a self-signed
+# certificate for "localhost", which openssl makes) on that port, e.g.:
+#
+#   ./mock_cos_server.py --port 8080 --h2c-port 8081 &
+#   cosfs bucket-1250000000 /mnt/cosfs -o url=http://localhost:8081 -o public_bucket=1 -o http2=prior_knowledge
+#
+#   ./mock_cos_server.py --port 8080 --h2-port 8443 --path-style &
+#   cosfs bucket-1250000000 /mnt/cosfs -o url=https://localhost:8443 -o public_bucket=1 -o http2 \
+#       -o no_check_certificate -o use_path_request_style
+#
+# "-o http2" does not use HTTP/2 over http://, because libcurl negotiates
+# HTTP/2 only by TLS ALPN. libcurl 7.88 fails the requests on a reused h2c
+# connection with prior knowledge, so use --h2-port with it.
+#
+
+import argparse
+import hashlib
+import random
+import re
+import signal
+import socket
+import shutil
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+import uuid
+import xml.etree.ElementTree as ET
+from email.utils import formatdate
+from http.server import BaseHTTPRequestHandler, HTTPServer
+from socketserver import ThreadingMixIn
+from urllib.parse import parse_qs, unquote, urlsplit
+
+CHUNK_SIZE = 64 * 1024
+
+args = None
+lock = threading.Lock()
+objects = {}                # key -> CosObject
+uploads = {}                # upload id -> {"key", "meta", "parts": {number: bytes}}
+stats = {"requests": 0, "errors": 0, "stalls": 0}
+
+
+class CosObject(object):
+    def __init__(self, data, meta):
+        self.data = data
+        self.meta = meta
+        self.mtime = time.time()
+        self.etag = hashlib.md5(data).hexdigest()
+
+
+def populate(count, size, prefix):
+    data = bytes(bytearray(random.getrandbits(8) for _ in range(min(size, 4096))))
+    data = (data * (size // max(len(data), 1) + 1))[:size]
+    for i in range(count):
+        objects["/%s%d" % (prefix, i)] = CosObject(data, {"content-type": "application/octet-stream"})
+    # directory object, so that cosfs can see the prefix as a directory.
+    if prefix.endswith("/"):
+        objects["/" + prefix] = CosObject(b"", {"content-type": "application/x-directory"})
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, fmt, *fargs):
+        if args.verbose:
+            sys.stderr.write("mock_cos: " + (fmt % fargs) + "\n")
+
+    # key of the object, without the bucket for path style request
+    def parse_request_path(self):
+        parts = urlsplit(self.path)
+        key = unquote(parts.path)
+        if args.path_style and key != "/":
+            key = re.match(r"^/[^/]*(/.*)?$", key).group(1) or "/"
+        query = parse_qs(parts.query, keep_blank_values=True)
+        return key, query
+
+    def read_body(self):
+        length = int(self.headers.get("Content-Length", 0) or 0)
+        if length:
+            return self.rfile.read(length)
+        if self.headers.get("Transfer-Encoding", "").lower() == "chunked":
+            body = b""
+            while True:
+                size = int(self.rfile.readline().strip().split(b";")[0], 16)
+                if size == 0:
+                    self.rfile.readline()
+                    break
+                body += self.rfile.read(size)
+                self.rfile.readline()
+            return body
+        return b""
+
+    def delay(self, key):
+        wait = args.latency + random.uniform(0, args.latency_jitter)
+        if args.stall_rate and key.startswith("/" + args.stall_prefix) and random.random() < args.stall_rate:
+            with lock:
+                stats["stalls"] += 1
+            wait += args.stall
+        if wait:
+            time.sleep(wait / 1000.0)
+
+    def send_body(self, body):
+        if not args.bandwidth:
+            self.wfile.write(body)
+            return
+        for pos in range(0, len(body), CHUNK_SIZE):
+            chunk = body[pos:pos + CHUNK_SIZE]
+            self.wfile.write(chunk)
+            time.sleep(float(len(chunk)) / args.bandwidth)
+
+    def respond(self, code, body=b"", headers=None, is_head=False):
+        self.send_response(code)
+        for name, value in (headers or {}).items():
+            self.send_header(name, value)
+        # 204 must not have Content-Length, and HTTP/2 clients reject it
+        if "Content-Length" not in (headers or {}) and 204 != code:
+            self.send_header("Content-Length", str(len(body)))
+        self.send_header("x-cos-request-id", uuid.uuid4().hex)
+        self.end_headers()
+        if body and not is_head:
+            self.send_body(body)
+
+    def respond_error(self, code, error, is_head=False):
+        with lock:
+            stats["errors"] += 1
+        body = ("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<Error><Code>%s</Code>"
+                "<Message>%s</Message></Error>" % (error, error)).encode()
+        self.respond(code, body, {"Content-Type": "application/xml"}, is_head)
+
+    # returns True if the request is handled as a fault object or injected error
+    def fault(self, key, is_head=False):
+        m = re.match(r"^/(\d{3})r$", key)
+        if m:
+            code = int(m.group(1))
+            if code < 300:
+                self.respond(code, b"" if code == 204 else b"mock", {}, is_head)
+            else:
+                self.respond_error(code, "MockError", is_head)
+            return True
+        if key == "/shutdown":
+            self.close_connection = True
+            try:
+                self.connection.shutdown(socket.SHUT_RDWR)
+            except socket.error:
+                pass
+            return True
+        if key == "/timeout":
+            time.sleep(args.timeout_sleep)
+            self.close_connection = True
+            return True
+        if args.error_rate and random.random() < args.error_rate:
+            self.respond_error(503, "SlowDown", is_head)
+            return True
+        return False
+
+    def object_headers(self, obj):
+        headers = {
+            "Content-Type": obj.meta.get("content-type", "application/octet-stream"),
+            "ETag": "\"%s\"" % obj.etag,
+            "Last-Modified": formatdate(obj.mtime, usegmt=True),
+        }
+        for name, value in obj.meta.items():
+            if name.startswith("x-cos-meta-"):
+                headers[name] = value
+        return headers
+
+    def begin(self):
+        with lock:
+            stats["requests"] += 1
+        key, query = self.parse_request_path()
+        self.delay(key)
+        return key, query
+
+    def do_HEAD(self):
+        key, query = self.begin()
+        if self.fault(key, True):
+            return
+        with lock:
+            obj = objects.get(key)
+        if obj is None:
+            self.respond_error(404, "NoSuchKey", True)
+            return
+        headers = self.object_headers(obj)
+        headers["Content-Length"] = str(len(obj.data))
+        self.respond(200, b"", headers, True)
+
+    def do_GET(self):
+        key, query = self.begin()
+        if key == "/":
+            if "uploads" in query:
+                self.list_uploads()
+            else:
+                self.list_objects(query)
+            return
+        if self.fault(key):
+            return
+        with lock:
+            obj = objects.get(key)
+        if obj is None:
+            self.respond_error(404, "NoSuchKey")
+            return
+        headers = self.object_headers(obj)
+        m = re.match(r"^bytes=(\d+)-(\d*)$", self.headers.get("Range", ""))
+        if not m:
+            self.respond(200, obj.data, headers)
+            return
+        start = int(m.group(1))
+        end = int(m.group(2)) if m.group(2) else len(obj.data) - 1
+        end = min(end, len(obj.data) - 1)
+        if start >= len(obj.data):
+            self.respond_error(416, "InvalidRange")
+            return
+        headers["Content-Range"] = "bytes %d-%d/%d" % (start, end, len(obj.data))
+        self.respond(206, obj.data[start:end + 1], headers)
+
+    def do_PUT(self):
+        key, query = self.begin()
+        body = self.read_body()
+        if self.fault(key):
+            return
+        meta = dict((k.lower(), v) for k, v in self.headers.items()
+                    if k.lower().startswith("x-cos-meta-") or k.lower() == "content-type")
+        source = self.headers.get("x-cos-copy-source")
+        if source:
+            # "/<bucket>-<appid>/<key>"
+            src_key = "/" + unquote(source).lstrip("/").split("/", 1)[-1]
+            with lock:
+                src = objects.get(src_key)
+            if src is None:
+                self.respond_error(404, "NoSuchKey")
+                return
+            body = src.data
+            m = re.match(r"^bytes=(\d+)-(\d+)$", self.headers.get("x-cos-copy-source-range", ""))
+            if m:
+                body = body[int(m.group(1)):int(m.group(2)) + 1]
+            if not any(k.startswith("x-cos-meta-") for k in meta):
+                meta = dict(src.meta)
+
+        if "uploadId" in query:
+            upload_id = query["uploadId"][0]
+            with lock:
+                upload = uploads.get(upload_id)
+                if upload is not None:
+                    upload["parts"][int(query["partNumber"][0])] = body
+            if upload is None:
+                self.respond_error(404, "NoSuchUpload")
+                return
+            etag = hashlib.md5(body).hexdigest()
+            if source:
+                result = ("<CopyPartResult><ETag>\"%s\"</ETag><LastModified>%s</LastModified>"
+                          "</CopyPartResult>" % (etag, formatdate(usegmt=True))).encode()
+                self.respond(200, result, {"Content-Type": "application/xml", "ETag": "\"%s\"" % etag})
+            else:
+                self.respond(200, b"", {"ETag": "\"%s\"" % etag})
+            return
+
+        obj = CosObject(body, meta)
+        with lock:
+            objects[key] = obj
+        if source:
+            result = ("<CopyObjectResult><ETag>\"%s\"</ETag><LastModified>%s</LastModified>"
+                      "</CopyObjectResult>" % (obj.etag, formatdate(obj.mtime, usegmt=True))).encode()
+            self.respond(200, result, {"Content-Type": "application/xml", "ETag": "\"%s\"" % obj.etag})
+        else:
+            self.respond(200, b"", {"ETag": "\"%s\"" % obj.etag})
+
+    def do_POST(self):
+        key, query = self.begin()
+        body = self.read_body()
+        if self.fault(key):
+            return
+        if "uploads" in query:
+            upload_id = uuid.uuid4().hex
+            meta = dict((k.lower(), v) for k, v in self.headers.items()
+                        if k.lower().startswith("x-cos-meta-") or k.lower() == "content-type")
+            with lock:
+                uploads[upload_id] = {"key": key, "meta": meta, "parts": {}}
+            result = ("<InitiateMultipartUploadResult><Bucket>mock</Bucket><Key>%s</Key>"
+                      "<UploadId>%s</UploadId></InitiateMultipartUploadResult>" % (key[1:], upload_id)).encode()
+            self.respond(200, result, {"Content-Type": "application/xml"})
+            return
+        if "uploadId" in query:
+            upload_id = query["uploadId"][0]
+            with lock:
+                upload = uploads.pop(upload_id, None)
+            if upload is None:
+                self.respond_error(404, "NoSuchUpload")
+                return
+            numbers = [int(e.text) for e in ET.fromstring(body).iter("PartNumber")]
+            data = b"".join(upload["parts"].get(n, b"") for n in numbers)
+            obj = CosObject(data, upload["meta"])
+            with lock:
+                objects[key] = obj
+            result = ("<CompleteMultipartUploadResult><Key>%s</Key><ETag>\"%s\"</ETag>"
+                      "</CompleteMultipartUploadResult>" % (key[1:], obj.etag)).encode()
+            self.respond(200, result, {"Content-Type": "application/xml"})
+            return
+        self.respond_error(400, "InvalidRequest")
+
+    def do_DELETE(self):
+        key, query = self.begin()
+        if self.fault(key):
+            return
+        with lock:
+            if "uploadId" in query:
+                uploads.pop(query["uploadId"][0], None)
+            else:
+                objects.pop(key, None)
+        self.respond(204)
+
+    def list_objects(self, query):
+        prefix = query.get("prefix", [""])[0]
+        delimiter = query.get("delimiter", [""])[0]
+        marker = query.get("marker", [""])[0]
+        max_keys = min(int(query.get("max-keys", ["1000"])[0]), args.max_keys)
+
+        with lock:
+            keys = sorted(k[1:] for k in objects if k[1:].startswith(prefix) and k[1:] > marker)
+        if delimiter and marker.endswith(delimiter):
+            # marker is the common prefix which ended previous page
+            keys = [k for k in keys if not k.startswith(marker)]
+        contents = []
+        prefixes = []
+        next_marker = ""
+        truncated = False
+        for key in keys:
+            if len(contents) + len(prefixes) >= max_keys:
+                truncated = True
+                break
+            if delimiter:
+                pos = key.find(delimiter, len(prefix))
+                if pos >= 0:
+                    common = key[:pos + len(delimiter)]
+                    if not prefixes or prefixes[-1] != common:
+                        prefixes.append(common)
+                        next_marker = common
+                    continue
+            contents.append(key)
+            next_marker = key
+
+        root = ET.Element("ListBucketResult")
+        ET.SubElement(root, "Name").text = "mock"
+        ET.SubElement(root, "Prefix").text = prefix
+        ET.SubElement(root, "Marker").text = marker
+        ET.SubElement(root, "MaxKeys").text = str(max_keys)
+        if delimiter:
+            ET.SubElement(root, "Delimiter").text = delimiter
+        ET.SubElement(root, "IsTruncated").text = "true" if truncated else "false"
+        if truncated:
+            ET.SubElement(root, "NextMarker").text = next_marker
+        for key in contents:
+            with lock:
+                obj = objects.get("/" + key)
+            if obj is None:
+                continue
+            item = ET.SubElement(root, "Contents")
+            ET.SubElement(item, "Key").text = key
+            ET.SubElement(item, "LastModified").text = time.strftime("%Y-%m-%dT%H:%M:%S.000Z", time.gmtime(obj.mtime))
+            ET.SubElement(item, "ETag").text = "\"%s\"" % obj.etag
+            ET.SubElement(item, "Size").text = str(len(obj.data))
+            ET.SubElement(item, "StorageClass").text = "STANDARD"
+        for common in prefixes:
+            ET.SubElement(ET.SubElement(root, "CommonPrefixes"), "Prefix").text = common
+
+        body = b"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n" + ET.tostring(root)
+        self.respond(200, body, {"Content-Type": "application/xml"})
+
+    def list_uploads(self):
+        body = (b"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<ListMultipartUploadsResult>"
+                b"<Bucket>mock</Bucket><IsTruncated>false</IsTruncated></ListMultipartUploadsResult>")
+        self.respond(200, body, {"Content-Type": "application/xml"})
+
+
+class Server(ThreadingMixIn, HTTPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+    request_queue_size = 128
+
+
+def terminate(signum, frame):
+    raise KeyboardInterrupt()
+
+
+# starts nghttpx which serves HTTP/2 in front of this server
+def start_proxy(certdir):
+    frontends = []
+    if args.h2c_port:
+        frontends.append("--frontend=%s,%d;no-tls" % (args.host, args.h2c_port))
+    if args.h2_port:
+        frontends.append("--frontend=%s,%d" % (args.host, args.h2_port))
+    key = certdir + "/key.pem"
+    cert = certdir + "/cert.pem"
+    try:
+        subprocess.check_call(["openssl", "req", "-x509", "-newkey", "rsa:2048", "-nodes", "-days", "1",
+                               "-keyout", key, "-out", cert, "-subj", "/CN=localhost",
+                               "-addext", "subjectAltName=DNS:localhost"], stderr=subprocess.DEVNULL)
+        cmd = [args.nghttpx, "--conf=/dev/null", "--workers=1", "--log-level=WARN", "--no-ocsp",
+               "--backend=%s,%d" % (args.host, args.port)] + frontends + [key, cert]
+        return subprocess.Popen(cmd)
+    except (OSError, subprocess.CalledProcessError) as err:
+        sys.exit("mock_cos: could not start nghttpx for HTTP/2: %s" % err)
+
+
+def main():
+    global args
+    parser = argparse.ArgumentParser(description="local mock COS server")
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--path-style", action="store_true", help="the first path element is the bucket")
+    parser.add_argument("--latency", type=float, default=0, help="latency of each response(msec)")
+    parser.add_argument("--latency-jitter", type=float, default=0, help="random latency added(msec)")
+    parser.add_argument("--stall-rate", type=float, default=0, help="rate of requests which stall")
+    parser.add_argument("--stall", type=float, default=3000, help="latency of stalled requests(msec)")
+    parser.add_argument("--stall-prefix", default="", help="prefix of objects whose requests stall")
+    parser.add_argument("--bandwidth", type=int, default=0, help="bytes per sec of each response body")
+    parser.add_argument("--error-rate", type=float, default=0, help="rate of requests answered by 503")
+    parser.add_argument("--timeout-sleep", type=float, default=10, help="sleep of /timeout(sec)")
+    parser.add_argument("--max-keys", type=int, default=1000, help="max keys in a page of listing")
+    parser.add_argument("--populate", type=int, default=0, help="count of objects made at start")
+    parser.add_argument("--object-size", type=int, default=4096, help="size of populated objects")
+    parser.add_argument("--prefix", default="bench/", help="prefix of populated objects")
+    parser.add_argument("--h2c-port", type=int, default=0, help="port of h2c served by nghttpx in front")
+    parser.add_argument("--h2-port", type=int, default=0, help="port of h2 over TLS served by nghttpx in front")
+    parser.add_argument("--nghttpx", default="nghttpx", help="path of nghttpx for --h2c-port and --h2-port")
+    parser.add_argument("--verbose", action="store_true")
+    args = parser.parse_args()
+
+    random.seed(0)
+    populate(args.populate, args.object_size, args.prefix)
+
+    server = Server((args.host, args.port), Handler)
+    sys.stderr.write("mock_cos: listening on %s:%d, %d objects\n" % (args.host, args.port, len(objects)))
+    proxy = None
+    certdir = None
+    if args.h2c_port or args.h2_port:
+        certdir = tempfile.mkdtemp(prefix="mock_cos.")
+        proxy = start_proxy(certdir)
+        sys.stderr.write("mock_cos: HTTP/2 by nghttpx, h2c port %d, h2 port %d\n" % (args.h2c_port, args.h2_port))
+    sys.stderr.flush()
+    signal.signal(signal.SIGTERM, terminate)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if proxy:
+            proxy.terminate()
+            proxy.wait()
+        if certdir:
+            shutil.rmtree(certdir, ignore_errors=True)
+    sys.stderr.write("mock_cos: %d requests, %d errors, %d stalls\n"
+                     % (stats["requests"], stats["errors"], stats["stalls"]))
+
+
+if __name__ == "__main__":
+    main()